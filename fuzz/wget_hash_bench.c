@@ -0,0 +1,127 @@
+/*
+ * Copyright(c) 2018 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Wget.
+ *
+ * GNU Wget is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GNU Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the hash tables.
+ *
+ * Fills a string hash table with URL-like keys, then looks up every
+ * key, looks up as many missing keys and removes every key, printing
+ * the time per operation and the slowest single insertion (each
+ * insertion is timed, so the insertion times include the timer
+ * overhead).  The arguments are the numbers of keys to run with
+ * (default: 1000, 10000, 100000, 1000000).
+ *
+ * Build with 'make wget_hash_bench' in this directory.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wget.h"
+#include "utils.h"
+#include "ptimer.h"
+#include "hash.h"
+
+static char **
+make_keys (long n, const char *prefix)
+{
+	char **keys = xnew_array(char *, n);
+	long i;
+
+	for (i = 0; i < n; i++)
+		keys[i] = aprintf("https://www.example.com/%s/%ld/index.html", prefix, i);
+
+	return keys;
+}
+
+static void
+free_keys (char **keys, long n)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		xfree(keys[i]);
+	xfree(keys);
+}
+
+static void
+bench (long n)
+{
+	char **keys = make_keys(n, "page"), **missing = make_keys(n, "other");
+	struct hash_table *ht = make_string_hash_table(0);
+	struct ptimer *timer = ptimer_new(), *op_timer = ptimer_new();
+	double insert, hit, miss, removal, worst = 0, t;
+	long i, found = 0;
+
+	for (i = 0; i < n; i++) {
+		ptimer_reset(op_timer);
+		hash_table_put(ht, keys[i], keys[i]);
+		if ((t = ptimer_measure(op_timer)) > worst)
+			worst = t;
+	}
+	insert = ptimer_measure(timer);
+
+	ptimer_reset(timer);
+	for (i = 0; i < n; i++)
+		found += hash_table_get(ht, keys[i]) != NULL;
+	hit = ptimer_measure(timer);
+
+	ptimer_reset(timer);
+	for (i = 0; i < n; i++)
+		found += hash_table_contains(ht, missing[i]);
+	miss = ptimer_measure(timer);
+
+	ptimer_reset(timer);
+	for (i = 0; i < n; i++)
+		hash_table_remove(ht, keys[i]);
+	removal = ptimer_measure(timer);
+
+	if (found != n || hash_table_count(ht) != 0)
+		fprintf(stderr, "%ld: inconsistent table\n", n);
+
+	printf("%9ld keys: insert %6.1f ns, hit %6.1f ns, miss %6.1f ns, remove %6.1f ns,"
+		" slowest insert %8.3f ms\n",
+		n, insert * 1e9 / n, hit * 1e9 / n, miss * 1e9 / n, removal * 1e9 / n,
+		worst * 1e3);
+
+	ptimer_destroy(op_timer);
+	ptimer_destroy(timer);
+	hash_table_destroy(ht);
+	free_keys(missing, n);
+	free_keys(keys, n);
+}
+
+int main(int argc, char **argv)
+{
+	static const long sizes[] = { 1000, 10000, 100000, 1000000 };
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			bench(atol(argv[i]));
+	} else {
+		for (i = 0; i < (int) countof(sizes); i++)
+			bench(sizes[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright(c) 2018 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Wget.
+ *
+ * GNU Wget is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GNU Wget is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Wget.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of the HTML parser.
+ *
+ * Loads the corpus of wget_html_fuzzer (or the files in the directory
+ * given as first argument) into memory and runs map_html_tags() over
+ * it repeatedly (100 times or as often as given by the second argument),
+ * then prints the parsing throughput.
+ *
+ * Build with 'make wget_html_bench' in this directory.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <dirent.h> // opendir, readdir
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wget.h"
+#include "utils.h"
+#include "ptimer.h"
+#include "html-parse.h"
+
+static long ntags;
+
+static void count_tag(struct taginfo *tag _GL_UNUSED, void *arg _GL_UNUSED)
+{
+	ntags++;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dirname = argc > 1 ? argv[1] : SRCDIR "/wget_html_fuzzer.in";
+	int iterations = argc > 2 ? atoi(argv[2]) : 100;
+	struct file_memory **files = NULL;
+	int nfiles = 0, it, i;
+	long long bytes = 0;
+	struct ptimer *timer;
+	double secs;
+	DIR *dirp;
+	struct dirent *dp;
+
+	if (!(dirp = opendir(dirname))) {
+		fprintf(stderr, "Failed to open %s\n", dirname);
+		return 1;
+	}
+
+	while ((dp = readdir(dirp))) {
+		if (*dp->d_name == '.') continue;
+
+		char fname[strlen(dirname) + strlen(dp->d_name) + 2];
+		snprintf(fname, sizeof(fname), "%s/%s", dirname, dp->d_name);
+
+		struct file_memory *fmem;
+		if ((fmem = wget_read_file(fname))) {
+			files = xrealloc(files, (nfiles + 1) * sizeof(*files));
+			files[nfiles++] = fmem;
+		}
+	}
+	closedir(dirp);
+
+	timer = ptimer_new();
+	for (it = 0; it < iterations; it++) {
+		for (i = 0; i < nfiles; i++) {
+			map_html_tags(files[i]->content, (int) files[i]->length,
+				count_tag, NULL, MHT_TRIM_VALUES, NULL, NULL);
+			bytes += files[i]->length;
+		}
+	}
+	secs = ptimer_measure(timer);
+	ptimer_destroy(timer);
+
+	printf("%d files, %lld bytes, %ld tags in %.3f s: %.1f MB/s\n",
+		nfiles, bytes, ntags, secs, secs > 0 ? bytes / secs / 1e6 : 0.0);
+
+	for (i = 0; i < nfiles; i++)
+		wget_read_file_free(files[i]);
+	xfree(files);
+
+	return 0;
+}
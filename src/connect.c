@@ -51,6 +51,7 @@ as that of the covered work.  */
 #endif /* not WINDOWS */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/time.h>
 
@@ -58,6 +59,8 @@ as that of the covered work.  */
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "ptimer.h"
+#include "reactor.h"
 
 #include <stdint.h>
 
@@ -251,48 +254,47 @@ connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
   return ctx.result;
 }
 
-/* Connect via TCP to the specified address and port.
-
-   If PRINT is non-NULL, it is the host name to print that we're
-   connecting to.  */
+/* Print the "Connecting to..." line for connecting to IP and PORT,
+   with PRINT being the host name we're connecting to.  */
 
-int
-connect_to_ip (const ip_address *ip, int port, const char *print)
+static void
+print_connecting (const ip_address *ip, int port, const char *print)
 {
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *)&ss;
-  int sock;
-
-  /* If PRINT is non-NULL, print the "Connecting to..." line, with
-     PRINT being the host name we're connecting to.  */
-  if (print)
+  const char *txt_addr = print_address (ip);
+  if (0 != strcmp (print, txt_addr))
     {
-      const char *txt_addr = print_address (ip);
-      if (0 != strcmp (print, txt_addr))
-        {
-          char *str = NULL, *name;
+      char *str = NULL, *name;
 
-          if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
-            {
-              str = aprintf ("%s (%s)", name, print);
-              xfree (name);
-            }
+      if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
+        {
+          str = aprintf ("%s (%s)", name, print);
+          xfree (name);
+        }
 
-          logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
-                     str ? str : escnonprint_uri (print), txt_addr, port);
+      logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
+                 str ? str : escnonprint_uri (print), txt_addr, port);
 
-          xfree (str);
-        }
-      else
-        {
-           if (ip->family == AF_INET)
-               logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
+      xfree (str);
+    }
+  else
+    {
+       if (ip->family == AF_INET)
+           logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
 #ifdef ENABLE_IPV6
-           else if (ip->family == AF_INET6)
-               logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
+       else if (ip->family == AF_INET6)
+           logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
 #endif
-        }
     }
+}
+
+/* Create a socket for connecting to IP, set up as the options
+   require, and store the address to connect to, with PORT, to SA.
+   Returns the socket, or -1 with errno set in case of error.  */
+
+static int
+socket_for_ip (const ip_address *ip, int port, struct sockaddr *sa)
+{
+  int sock;
 
   /* Store the sockaddr info to SA.  */
   sockaddr_set_data (sa, ip, port);
@@ -300,7 +302,7 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   /* Create the socket of the family appropriate for the address.  */
   sock = socket (sa->sa_family, SOCK_STREAM, 0);
   if (sock < 0)
-    goto err;
+    return -1;
 
 #if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
   if (opt.ipv6_only) {
@@ -341,10 +343,39 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
       if (resolve_bind_address (bind_sa))
         {
           if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
-            goto err;
+            {
+              int save_errno = errno;
+              fd_close (sock);
+              errno = save_errno;
+              return -1;
+            }
         }
     }
 
+  return sock;
+}
+
+/* Connect via TCP to the specified address and port.
+
+   If PRINT is non-NULL, it is the host name to print that we're
+   connecting to.  */
+
+int
+connect_to_ip (const ip_address *ip, int port, const char *print)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock;
+
+  /* If PRINT is non-NULL, print the "Connecting to..." line, with
+     PRINT being the host name we're connecting to.  */
+  if (print)
+    print_connecting (ip, port, print);
+
+  sock = socket_for_ip (ip, port, sa);
+  if (sock < 0)
+    goto err;
+
   /* Connect the socket to the remote endpoint.  */
   if (connect_with_timeout (sock, sa, sockaddr_size (sa),
                             opt.connect_timeout) < 0)
@@ -378,11 +409,290 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+#if defined(ENABLE_IPV6) && !defined(WINDOWS)
+
+/* How long to wait for a connection attempt before starting the next
+   one alongside it, the "Connection Attempt Delay" of RFC 8305.  */
+#define CONNECTION_ATTEMPT_DELAY 0.25
+
+/* Return true if addresses START through END-1 of AL are not all of
+   the same family.  */
+
+static bool
+address_list_mixed_p (const struct address_list *al, int start, int end)
+{
+  int i;
+  for (i = start + 1; i < end; i++)
+    if (address_list_address_at (al, i)->family
+        != address_list_address_at (al, start)->family)
+      return true;
+  return false;
+}
+
+/* Store to ORDER the indices START through END-1 of AL, alternating
+   between the address families and beginning with the family of the
+   first address, which is the preferred one.  Within a family, the
+   order of AL is kept.  */
+
+static void
+interleave_families (const struct address_list *al, int start, int end,
+                     int *order)
+{
+  int first = address_list_address_at (al, start)->family;
+  int i = start, j = start, n = 0;
+
+  while (n < end - start)
+    {
+      /* Advance I to the next address of the first family and J to
+         the next one of the other family.  */
+      while (i < end && address_list_address_at (al, i)->family != first)
+        i++;
+      while (j < end && address_list_address_at (al, j)->family == first)
+        j++;
+      if (i < end)
+        order[n++] = i++;
+      if (j < end)
+        order[n++] = j++;
+    }
+}
+
+struct connect_attempt {
+  int index;                    /* of the address in the list */
+  int sock;                     /* -1 once the attempt is over */
+  int flags;                    /* file status flags before O_NONBLOCK */
+};
+
+struct connect_race {
+  const struct address_list *al;
+  int port;
+  const char *host;
+  bool *failed;
+  struct reactor *reactor;
+  struct connect_attempt *attempts;
+  int started;                  /* number of attempts started */
+  int nactive;                  /* number of those in progress */
+  int winner;                   /* index in ATTEMPTS, or -1 */
+  int error;                    /* errno of the last failure */
+  int shown;                    /* the attempt whose "Connecting to..."
+                                   line awaits its outcome, or -1 */
+};
+
+/* Note that attempt AT of RACE has failed with ERR.  */
+
+static void
+connect_attempt_failed (struct connect_race *race, struct connect_attempt *at,
+                        int err)
+{
+  race->error = err;
+  race->failed[at->index] = true;
+  if (at->sock >= 0)
+    {
+      reactor_remove (race->reactor, at->sock);
+      fd_close (at->sock);
+      at->sock = -1;
+      --race->nactive;
+    }
+  if (race->shown == at->index)
+    {
+      logprintf (LOG_NOTQUIET, _("failed: %s.\n"), strerror (err));
+      race->shown = -1;
+    }
+  else
+    DEBUGP (("Connecting to %s failed: %s.\n",
+             print_address (address_list_address_at (race->al, at->index)),
+             strerror (err)));
+}
+
+/* Called by the reactor when the socket of an attempt has connected,
+   failed to, or timed out.  */
+
+static void
+connect_attempt_callback (int fd, int events, void *arg)
+{
+  struct connect_race *race = arg;
+  struct connect_attempt *at;
+  int err = 0;
+
+  for (at = race->attempts; at->sock != fd; at++)
+    ;
+  if (events & REACTOR_TIMEOUT)
+    err = ETIMEDOUT;
+  else
+    {
+      socklen_t errlen = sizeof (err);
+      if (getsockopt (fd, SOL_SOCKET, SO_ERROR, (void *) &err, &errlen) < 0)
+        err = errno;
+    }
+  if (err)
+    connect_attempt_failed (race, at, err);
+  else if (race->winner < 0)
+    race->winner = at - race->attempts;
+}
+
+/* Start the next attempt of RACE, to the address with index INDEX.  */
+
+static void
+connect_attempt_start (struct connect_race *race, int index)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  struct connect_attempt *at = &race->attempts[race->started++];
+  const ip_address *ip = address_list_address_at (race->al, index);
+
+  at->index = index;
+  if (race->shown >= 0)
+    {
+      logputs (LOG_VERBOSE, _("no response yet.\n"));
+      race->shown = -1;
+    }
+  if (race->host)
+    {
+      print_connecting (ip, race->port, race->host);
+      race->shown = index;
+    }
+
+  at->sock = socket_for_ip (ip, race->port, sa);
+  if (at->sock < 0)
+    {
+      connect_attempt_failed (race, at, errno);
+      return;
+    }
+  ++race->nactive;
+  at->flags = fcntl (at->sock, F_GETFL, 0);
+  if (at->flags < 0
+      || fcntl (at->sock, F_SETFL, at->flags | O_NONBLOCK) < 0)
+    connect_attempt_failed (race, at, errno);
+  else if (connect (at->sock, sa, sockaddr_size (sa)) == 0)
+    race->winner = at - race->attempts;
+  else if (errno != EINPROGRESS)
+    connect_attempt_failed (race, at, errno);
+  else if (!reactor_add (race->reactor, at->sock, WAIT_FOR_WRITE,
+                         opt.connect_timeout, connect_attempt_callback, race))
+    connect_attempt_failed (race, at, errno);
+}
+
+/* Connect to one of the addresses START through END-1 of AL on PORT,
+   the way RFC 8305 ("Happy Eyeballs") recommends: the attempts are
+   made in the order given by interleave_families, and each one gets
+   CONNECTION_ATTEMPT_DELAY seconds before the next is started in
+   parallel, or none if it fails.  The first connection established
+   wins, and the others are abandoned.  This way a broken path in one
+   family costs a fraction of a second rather than a timeout.
+
+   FAILED[I] is set for the addresses found not to work, or slower
+   than the winner.  HOST is printed as in connect_to_ip.  Returns the
+   socket, or -1 with errno set if no connection could be
+   established.  */
+
+static int
+connect_racing (const struct address_list *al, int start, int end,
+                int port, const char *host, bool *failed)
+{
+  int count = end - start;
+  int *order = xnew_array (int, count);
+  struct ptimer *timer = ptimer_new ();
+  struct connect_race race;
+  double last_start = 0;
+  int i, sock = -1;
+
+  xzero (race);
+  race.al = al;
+  race.port = port;
+  race.host = host;
+  race.failed = failed;
+  race.attempts = xnew_array (struct connect_attempt, count);
+  race.winner = -1;
+  race.error = ETIMEDOUT;
+  race.shown = -1;
+  race.reactor = reactor_new ();
+  if (!race.reactor)
+    {
+      race.error = errno;
+      count = 0;
+    }
+
+  interleave_families (al, start, end, order);
+
+  while (race.winner < 0 && (race.started < count || race.nactive > 0))
+    {
+      double now = ptimer_measure (timer), wait = -1;
+
+      if (race.started < count
+          && (race.nactive == 0
+              || now - last_start >= CONNECTION_ATTEMPT_DELAY))
+        {
+          connect_attempt_start (&race, order[race.started]);
+          last_start = now;
+          continue;
+        }
+
+      /* Wait until an attempt completes or the next one is due.  */
+      if (race.started < count)
+        wait = MAX (0, last_start + CONNECTION_ATTEMPT_DELAY - now);
+      if (reactor_run (race.reactor, wait) < 0)
+        {
+          race.error = errno;
+          break;
+        }
+    }
+
+  /* The attempts still in progress have lost the race.  They count
+     as failed, so that the next connection goes straight to the
+     winner.  */
+  for (i = 0; i < race.started; i++)
+    {
+      struct connect_attempt *at = &race.attempts[i];
+      if (at->sock < 0)
+        continue;
+      reactor_remove (race.reactor, at->sock);
+      if (i == race.winner)
+        continue;
+      failed[at->index] = true;
+      fd_close (at->sock);
+    }
+
+  if (race.winner >= 0)
+    {
+      struct connect_attempt *at = &race.attempts[race.winner];
+
+      sock = at->sock;
+      fcntl (sock, F_SETFL, at->flags);
+      if (host)
+        {
+          if (race.shown != at->index)
+            {
+              /* The line shown is that of an attempt being abandoned.  */
+              if (race.shown >= 0)
+                logputs (LOG_VERBOSE, _("abandoned.\n"));
+              print_connecting (address_list_address_at (al, at->index),
+                                port, host);
+            }
+          logprintf (LOG_VERBOSE, _("connected.\n"));
+        }
+      DEBUGP (("Created socket %d.\n", sock));
+    }
+  else if (race.shown >= 0)
+    logprintf (LOG_NOTQUIET, _("failed: %s.\n"), strerror (race.error));
+
+  if (race.reactor)
+    reactor_destroy (race.reactor);
+  xfree (race.attempts);
+  xfree (order);
+  ptimer_destroy (timer);
+  if (sock < 0)
+    errno = race.error;
+  return sock;
+}
+
+#endif /* ENABLE_IPV6 && !WINDOWS */
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
    more than one IP address, they are tried in the order returned by
-   DNS until connecting to one of them succeeds.  */
+   DNS until connecting to one of them succeeds.  If the addresses are
+   of both IPv4 and IPv6, the attempts to connect overlap, so that a
+   family that doesn't work doesn't hold up the other.  */
 
 int
 connect_to_host (const char *host, int port)
@@ -402,6 +712,28 @@ connect_to_host (const char *host, int port)
     }
 
   address_list_get_bounds (al, &start, &end);
+#if defined(ENABLE_IPV6) && !defined(WINDOWS)
+  if (address_list_mixed_p (al, start, end))
+    {
+      bool *failed = xnew0_array (bool, end);
+
+      sock = connect_racing (al, start, end, port, host, failed);
+
+      /* Mark the addresses that failed as faulty, as far as they lead
+         the list; address_list_set_faulty can only skip a prefix.  */
+      for (i = start; i < end && failed[i]; i++)
+        address_list_set_faulty (al, i);
+      xfree (failed);
+
+      if (sock >= 0)
+        {
+          address_list_set_connected (al);
+          address_list_release (al);
+          return sock;
+        }
+    }
+  else
+#endif
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
@@ -911,6 +1243,17 @@ poll_internal (int fd, struct transport_info *info, int wf, double timeout)
   return true;
 }
 
+/* Return true if the transport of FD has data buffered, which can be
+   read without waiting for FD to become readable.  */
+
+bool
+fd_pending_p (int fd)
+{
+  struct transport_info *info;
+  LAZY_RETRIEVE_INFO (info);
+  return info && info->imp->pending && info->imp->pending (fd, info->ctx);
+}
+
 /* Read no more than BUFSIZE bytes of data from FD, storing them to
    BUF.  If TIMEOUT is non-zero, the operation aborts if no data is
    received after that many seconds.  If TIMEOUT is -1, the value of
@@ -1041,3 +1384,30 @@ fd_close (int fd)
       ++transport_map_modified_tick;
     }
 }
+
+/* Close the file descriptor FD without shutting down the transport
+   registered for it, and forget that transport.  This is for
+   descriptors inherited from a parent process that goes on using the
+   connection: a TLS shutdown would end the parent's session as well.
+   The transport's context is left alone for the same reason.  */
+
+void
+fd_forget (int fd)
+{
+  struct transport_info *info;
+  if (fd < 0)
+    return;
+
+  info = NULL;
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+
+  sock_close (fd);
+
+  if (info)
+    {
+      hash_table_remove (transport_map, (void *)(intptr_t) fd);
+      xfree (info);
+      ++transport_map_modified_tick;
+    }
+}
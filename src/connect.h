@@ -68,14 +68,17 @@ struct transport_implementation {
   int (*peeker) (int, char *, int, void *);
   const char *(*errstr) (int, void *);
   void (*closer) (int, void *);
+  bool (*pending) (int, void *);
 };
 
 void fd_register_transport (int, struct transport_implementation *, void *);
 void *fd_transport_context (int);
+bool fd_pending_p (int);
 int fd_read (int, char *, int, double);
 int fd_write (int, char *, int, double);
 int fd_peek (int, char *, int, double);
 const char *fd_errstr (int);
 void fd_close (int);
+void fd_forget (int);
 
 #endif /* CONNECT_H */
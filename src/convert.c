@@ -36,17 +36,24 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/stat.h>
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <sys/wait.h>
+#endif
 #include "convert.h"
+#include "exits.h"
 #include "url.h"
 #include "recur.h"
 #include "utils.h"
 #include "hash.h"
+#include "intern.h"
 #include "ptimer.h"
 #include "res.h"
 #include "html-url.h"
 #include "css-url.h"
 #include "iri.h"
 #include "xstrndup.h"
+#include "xmemdup0.h"
 
 static struct hash_table *dl_file_url_map;
 struct hash_table *dl_url_file_map;
@@ -56,116 +63,278 @@ struct hash_table *dl_url_file_map;
 struct hash_table *downloaded_html_set;
 struct hash_table *downloaded_css_set;
 
+/* Used by write_backup_file to remember which files have been
+   written. */
+static struct hash_table *converted_files;
+
 static void convert_links (const char *, struct urlpos *);
+static bool stored_links (const char *, const char *, bool,
+                          struct urlpos **);
+static void forget_links (const char *);
 
 
-static void
-convert_links_in_hashtable (struct hash_table *downloaded_set,
-                            int is_css,
-                            int *file_count)
+/* Convert the links in FILE, a downloaded HTML file, or CSS file if
+   IS_CSS is true.  Returns false if FILE turned out to be gone.  */
+
+static bool
+convert_file (const char *file, bool is_css)
 {
-  int i;
+  struct urlpos *urls, *cur_url;
+  char *url;
 
-  int cnt;
-  char **file_array;
+  /* Determine the URL of the file.  get_urls_{html,css} will need
+     it.  */
+  url = hash_table_get (dl_file_url_map, file);
+  if (!url)
+    {
+      DEBUGP (("Apparently %s has been removed.\n", file));
+      return false;
+    }
 
-  cnt = 0;
-  if (downloaded_set)
-    cnt = hash_table_count (downloaded_set);
-  if (cnt == 0)
-    return;
-  file_array = alloca_array (char *, cnt);
-  string_set_to_array (downloaded_set, file_array);
+  /* Use the links found when descending into the file, or parse it
+     now.  */
+  if (!stored_links (file, url, is_css, &urls))
+    {
+      DEBUGP (("Scanning %s (from %s)\n", file, url));
+      urls = is_css ? get_urls_css_file (file, url) :
+                      get_urls_html (file, url, NULL, NULL);
+    }
+
+  /* We don't respect meta_disallow_follow here because, even if
+     the file is not followed, we might still want to convert the
+     links that have been followed from other files.  */
 
-  for (i = 0; i < cnt; i++)
+  for (cur_url = urls; cur_url; cur_url = cur_url->next)
     {
-      struct urlpos *urls, *cur_url;
-      char *url;
-      char *file = file_array[i];
-
-      /* Determine the URL of the file.  get_urls_{html,css} will need
-         it.  */
-      url = hash_table_get (dl_file_url_map, file);
-      if (!url)
+      char *local_name;
+      struct url *u;
+      struct iri *pi;
+
+      if (cur_url->link_base_p)
         {
-          DEBUGP (("Apparently %s has been removed.\n", file));
+          /* Base references have been resolved by our parser, so
+             we turn the base URL into an empty string.  (Perhaps
+             we should remove the tag entirely?)  */
+          cur_url->convert = CO_NULLIFY_BASE;
           continue;
         }
 
-      DEBUGP (("Scanning %s (from %s)\n", file, url));
+      /* We decide the direction of conversion according to whether
+         a URL was downloaded.  Downloaded URLs will be converted
+         ABS2REL, whereas non-downloaded will be converted REL2ABS.  */
 
-      /* Parse the file...  */
-      urls = is_css ? get_urls_css_file (file, url) :
-                      get_urls_html (file, url, NULL, NULL);
+      pi = iri_new ();
+      set_uri_encoding (pi, opt.locale, true);
 
-      /* We don't respect meta_disallow_follow here because, even if
-         the file is not followed, we might still want to convert the
-         links that have been followed from other files.  */
+      u = url_parse (cur_url->url->url, NULL, pi, true);
+      if (!u)
+          continue;
+
+      local_name = hash_table_get (dl_url_file_map, u->url);
 
-      for (cur_url = urls; cur_url; cur_url = cur_url->next)
+      /* Decide on the conversion type.  */
+      if (local_name)
+        {
+          /* We've downloaded this URL.  Convert it to relative
+             form.  We do this even if the URL already is in
+             relative form, because our directory structure may
+             not be identical to that on the server (think `-nd',
+             `--cut-dirs', etc.). If --convert-file-only was passed,
+             we only convert the basename portion of the URL.  */
+          cur_url->convert = (opt.convert_file_only ? CO_CONVERT_BASENAME_ONLY : CO_CONVERT_TO_RELATIVE);
+          cur_url->local_name = local_name;
+          DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
+        }
+      else
         {
-          char *local_name;
-          struct url *u;
-          struct iri *pi;
+          /* We haven't downloaded this URL.  If it's not already
+             complete (including a full host name), convert it to
+             that form, so it can be reached while browsing this
+             HTML locally.  */
+          if (!cur_url->link_complete_p)
+            cur_url->convert = CO_CONVERT_TO_COMPLETE;
+          cur_url->local_name = NULL;
+          DEBUGP (("will convert url %s to complete\n", u->url));
+        }
 
-          if (cur_url->link_base_p)
-            {
-              /* Base references have been resolved by our parser, so
-                 we turn the base URL into an empty string.  (Perhaps
-                 we should remove the tag entirely?)  */
-              cur_url->convert = CO_NULLIFY_BASE;
-              continue;
-            }
+      url_free (u);
+      iri_free (pi);
+    }
 
-          /* We decide the direction of conversion according to whether
-             a URL was downloaded.  Downloaded URLs will be converted
-             ABS2REL, whereas non-downloaded will be converted REL2ABS.  */
+  /* Convert the links in the file.  */
+  convert_links (file, urls);
 
-          pi = iri_new ();
-          set_uri_encoding (pi, opt.locale, true);
+  /* Free the data.  */
+  free_urlpos (urls);
+  return true;
+}
 
-          u = url_parse (cur_url->url->url, NULL, pi, true);
-          if (!u)
-              continue;
+#if !defined(WINDOWS) && !defined(MSDOS)
+/* With --max-parallel, the files are converted by as many processes,
+   each of which takes every Nth file of FILES.  The files don't depend
+   on each other, as the decisions on how to convert the links are all
+   based on the download maps, which are only read.  Each process
+   reports back how many files it converted, and, with -K, which of
+   them it backed up, for convert_all_links and write_backup_file.  */
 
-          local_name = hash_table_get (dl_url_file_map, u->url);
+/* Don't start a process for fewer files than this.  */
+#define CONVERT_FILES_MIN 16
 
-          /* Decide on the conversion type.  */
-          if (local_name)
-            {
-              /* We've downloaded this URL.  Convert it to relative
-                 form.  We do this even if the URL already is in
-                 relative form, because our directory structure may
-                 not be identical to that on the server (think `-nd',
-                 `--cut-dirs', etc.). If --convert-file-only was passed,
-                 we only convert the basename portion of the URL.  */
-              cur_url->convert = (opt.convert_file_only ? CO_CONVERT_BASENAME_ONLY : CO_CONVERT_TO_RELATIVE);
-              cur_url->local_name = xstrdup (local_name);
-              DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
-            }
-          else
-            {
-              /* We haven't downloaded this URL.  If it's not already
-                 complete (including a full host name), convert it to
-                 that form, so it can be reached while browsing this
-                 HTML locally.  */
-              if (!cur_url->link_complete_p)
-                cur_url->convert = CO_CONVERT_TO_COMPLETE;
-              cur_url->local_name = NULL;
-              DEBUGP (("will convert url %s to complete\n", u->url));
-            }
+/* Convert every NTH of the COUNT FILES, starting with FIRST, in a
+   process of its own, and return the descriptor from which its report
+   is read.  Returns -1 if the process cannot be started.  */
+
+static int
+convert_files_fork (char **files, int count, bool is_css, int first,
+                    int nth, pid_t *pid)
+{
+  int fds[2];
+  int i, converted = 0;
+
+  if (pipe (fds) < 0)
+    return -1;
+
+  /* Anything still sitting in stdio buffers would otherwise be
+     written out by both processes.  */
+  logflush ();
+  fflush (NULL);
+
+  *pid = fork ();
+  if (*pid < 0)
+    {
+      close (fds[0]);
+      close (fds[1]);
+      return -1;
+    }
+  if (*pid > 0)
+    {
+      close (fds[1]);
+      return fds[0];
+    }
 
-          url_free (u);
-          iri_free (pi);
+  close (fds[0]);
+  for (i = first; i < count; i += nth)
+    if (convert_file (files[i], is_css))
+      ++converted;
+  write_all (fds[1], (char *) &converted, sizeof converted);
+  if (opt.backup_converted && converted_files)
+    for (i = first; i < count; i += nth)
+      if (string_set_contains (converted_files, files[i]))
+        {
+          int len = strlen (files[i]);
+          write_all (fds[1], (char *) &len, sizeof len);
+          write_all (fds[1], files[i], len);
         }
+  logflush ();
+  fflush (NULL);
+  _exit (WGET_EXIT_SUCCESS);
+}
 
-      /* Convert the links in the file.  */
-      convert_links (file, urls);
-      ++*file_count;
+/* Read the report of a process started by convert_files_fork from FD,
+   and wait for the process to exit.  Returns the number of files it
+   converted.  */
 
-      /* Free the data.  */
-      free_urlpos (urls);
+static int
+convert_files_collect (int fd, pid_t pid)
+{
+  int converted = 0, len;
+
+  if (!read_all (fd, (char *) &converted, sizeof converted))
+    {
+      logprintf (LOG_NOTQUIET,
+                 _("Process %d converting links has failed.\n"), (int) pid);
+      converted = 0;
     }
+  else
+    while (read_all (fd, (char *) &len, sizeof len) && len > 0)
+      {
+        char *file = xmalloc (len + 1);
+        if (!read_all (fd, file, len))
+          {
+            xfree (file);
+            break;
+          }
+        file[len] = '\0';
+        if (!converted_files)
+          converted_files = make_string_hash_table (0);
+        string_set_add (converted_files, file);
+        xfree (file);
+      }
+  close (fd);
+  while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+  return converted;
+}
+#endif /* !WINDOWS && !MSDOS */
+
+/* Convert the links in the COUNT FILES, parsed as CSS if IS_CSS is
+   true, and return the number of files converted.  */
+
+static int
+convert_files (char **files, int count, bool is_css)
+{
+  int i, converted = 0;
+#if !defined(WINDOWS) && !defined(MSDOS)
+  int nth = MIN (opt.max_parallel, count / CONVERT_FILES_MIN);
+
+  if (nth > 1)
+    {
+      int *fds = xnew_array (int, nth);
+      pid_t *pids = xnew_array (pid_t, nth);
+
+      DEBUGP (("Converting links in %d files in %d processes.\n",
+               count, nth));
+      for (i = 0; i < nth; i++)
+        fds[i] = convert_files_fork (files, count, is_css, i, nth, &pids[i]);
+
+      /* The shares of the processes that could not be started are
+         converted here, in the meantime.  */
+      for (i = 0; i < nth; i++)
+        if (fds[i] < 0)
+          {
+            int j;
+            for (j = i; j < count; j += nth)
+              if (convert_file (files[j], is_css))
+                ++converted;
+          }
+      for (i = 0; i < nth; i++)
+        if (fds[i] >= 0)
+          converted += convert_files_collect (fds[i], pids[i]);
+
+      xfree (fds);
+      xfree (pids);
+      return converted;
+    }
+#endif
+
+  for (i = 0; i < count; i++)
+    if (convert_file (files[i], is_css))
+      ++converted;
+  return converted;
+}
+
+static void
+convert_links_in_hashtable (struct hash_table *downloaded_set,
+                            int is_css,
+                            int *file_count)
+{
+  int cnt;
+  char **file_array;
+
+  cnt = 0;
+  if (downloaded_set)
+    cnt = hash_table_count (downloaded_set);
+  if (cnt == 0)
+    return;
+
+  /* There is a pointer for every file downloaded, which can be too
+     many for the stack.  */
+  file_array = xnew_array (char *, cnt);
+  string_set_to_array (downloaded_set, file_array);
+
+  *file_count += convert_files (file_array, cnt, is_css);
+
+  xfree (file_array);
 }
 
 /* This function is called when the retrieval is done to convert the
@@ -224,7 +393,10 @@ convert_links (const char *file, struct urlpos *links)
   struct urlpos *link;
   int to_url_count = 0, to_file_count = 0;
 
-  logprintf (LOG_VERBOSE, _("Converting links in %s... "), file);
+  /* The message about FILE is logged in one piece once the file is
+     done, so that it isn't broken up by those of other processes
+     converting files at the same time.  */
+  char *msg;
 
   {
     /* First we do a "dry run": go through the list L and see whether
@@ -237,7 +409,9 @@ convert_links (const char *file, struct urlpos *links)
         ++dry_count;
     if (!dry_count)
       {
-        logputs (LOG_VERBOSE, _("nothing to do.\n"));
+        msg = aprintf (_("Converting links in %s... "), file);
+        logprintf (LOG_VERBOSE, "%s%s", msg, _("nothing to do.\n"));
+        xfree (msg);
         return;
       }
   }
@@ -383,7 +557,9 @@ convert_links (const char *file, struct urlpos *links)
   fclose (fp);
   wget_read_file_free (fm);
 
-  logprintf (LOG_VERBOSE, "%d-%d\n", to_file_count, to_url_count);
+  msg = aprintf (_("Converting links in %s... "), file);
+  logprintf (LOG_VERBOSE, "%s%d-%d\n", msg, to_file_count, to_url_count);
+  xfree (msg);
 }
 
 /* Construct and return a link that points from BASEFILE to LINKFILE.
@@ -524,10 +700,6 @@ convert_basename (const char *p, const struct urlpos *link)
   return result;
 }
 
-/* Used by write_backup_file to remember which files have been
-   written. */
-static struct hash_table *converted_files;
-
 static void
 write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
 {
@@ -837,11 +1009,7 @@ dissociate_urls_from_file_mapper (void *key, void *value, void *arg)
   char *file = (char *)arg;
 
   if (0 == strcmp (mapping_file, file))
-    {
-      hash_table_remove (dl_url_file_map, mapping_url);
-      xfree (mapping_url);
-      xfree (mapping_file);
-    }
+    hash_table_remove (dl_url_file_map, mapping_url);
 
   /* Continue mapping. */
   return 0;
@@ -860,15 +1028,21 @@ dissociate_urls_from_file (const char *file)
 /* Register that URL has been successfully downloaded to FILE.  This
    is used by the link conversion code to convert references to URLs
    to references to local files.  It is also being used to check if a
-   URL has already been downloaded.  */
+   URL has already been downloaded.
+
+   The maps keep interned strings, which recursive retrieval shares
+   with its queue and blacklist, and which are never freed.  */
 
 void
 register_download (const char *url, const char *file)
 {
-  char *old_file, *old_url;
+  const char *old_file, *old_url;
 
   ENSURE_TABLES_EXIST;
 
+  /* Whatever links were found in FILE before, it has changed since.  */
+  forget_links (file);
+
   /* With some forms of retrieval, it is possible, although not likely
      or particularly desirable.  If both are downloaded, the second
      download will override the first one.  When that happens,
@@ -890,8 +1064,6 @@ register_download (const char *url, const char *file)
         goto url_only;
 
       hash_table_remove (dl_file_url_map, file);
-      xfree (old_file);
-      xfree (old_url);
 
       /* Remove all the URLs that point to this file.  Yes, there can
          be more than one such URL, because we store redirections as
@@ -909,7 +1081,7 @@ register_download (const char *url, const char *file)
       dissociate_urls_from_file (file);
     }
 
-  hash_table_put (dl_file_url_map, xstrdup (file), xstrdup (url));
+  hash_table_put (dl_file_url_map, intern_string (file), intern_string (url));
 
  url_only:
   /* A URL->FILE mapping is not possible without a FILE->URL mapping.
@@ -928,14 +1100,7 @@ register_download (const char *url, const char *file)
      "FILE.1".  In that case, FILE.1 will not be found in
      dl_file_url_map, but URL will still point to FILE in
      dl_url_file_map.  */
-  if (hash_table_get_pair (dl_url_file_map, url, &old_url, &old_file))
-    {
-      hash_table_remove (dl_url_file_map, url);
-      xfree (old_url);
-      xfree (old_file);
-    }
-
-  hash_table_put (dl_url_file_map, xstrdup (url), xstrdup (file));
+  hash_table_put (dl_url_file_map, intern_string (url), intern_string (file));
 }
 
 /* Register that FROM has been redirected to "TO".  This assumes that TO
@@ -952,7 +1117,7 @@ register_redirection (const char *from, const char *to)
   file = hash_table_get (dl_url_file_map, to);
   assert (file != NULL);
   if (!hash_table_contains (dl_url_file_map, from))
-    hash_table_put (dl_url_file_map, xstrdup (from), xstrdup (file));
+    hash_table_put (dl_url_file_map, intern_string (from), file);
 }
 
 /* Register that the file has been deleted. */
@@ -960,16 +1125,10 @@ register_redirection (const char *from, const char *to)
 void
 register_delete_file (const char *file)
 {
-  char *old_url, *old_file;
-
   ENSURE_TABLES_EXIST;
 
-  if (!hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
+  if (!hash_table_remove (dl_file_url_map, file))
     return;
-
-  hash_table_remove (dl_file_url_map, file);
-  xfree (old_file);
-  xfree (old_url);
   dissociate_urls_from_file (file);
 }
 
@@ -980,7 +1139,7 @@ register_html (const char *file)
 {
   if (!downloaded_html_set)
     downloaded_html_set = make_string_hash_table (0);
-  string_set_add (downloaded_html_set, file);
+  hash_table_put (downloaded_html_set, intern_string (file), "1");
 }
 
 /* Register that FILE is a CSS file that has been downloaded. */
@@ -990,7 +1149,205 @@ register_css (const char *file)
 {
   if (!downloaded_css_set)
     downloaded_css_set = make_string_hash_table (0);
-  string_set_add (downloaded_css_set, file);
+  hash_table_put (downloaded_css_set, intern_string (file), "1");
+}
+
+/* The links found in the downloaded files while descending into them
+   are kept for convert_all_links, which would otherwise have to parse
+   all of the files again.  As there can be millions of them, they are
+   written out to a temporary file, and only where they are in it is
+   kept in memory.  */
+
+static FILE *links_fp;
+static bool links_store_failed;
+
+struct stored_links {
+  const char *url;              /* the URL the links were resolved against */
+  bool is_css;                  /* whether the file was parsed as CSS */
+  wgint size;                   /* the size and modification time of */
+  time_t mtime;                 /*   the file when it was parsed */
+  off_t offset;                 /* where the links are in links_fp */
+  int bytes;                    /* how much space they take there */
+  int count;                    /* how many of them there are */
+};
+
+/* Mapping between file names and their struct stored_links.  */
+static struct hash_table *links_map;
+
+/* Forget the links stored for FILE, if any.  */
+
+static void
+forget_links (const char *file)
+{
+  struct stored_links *old;
+
+  if (links_map && (old = hash_table_get (links_map, file)) != NULL)
+    {
+      hash_table_remove (links_map, file);
+      xfree (old);
+    }
+}
+
+/* Forget all the links stored.  */
+
+static void
+links_store_close (void)
+{
+  hash_table_iterator iter;
+
+  if (links_map)
+    {
+      for (hash_table_iterate (links_map, &iter);
+           hash_table_iter_next (&iter); )
+        xfree (iter.value);
+      hash_table_destroy (links_map);
+      links_map = NULL;
+    }
+  if (links_fp)
+    {
+      fclose (links_fp);
+      links_fp = NULL;
+    }
+}
+
+/* Store URLS, the links found in FILE, which is at URL, for converting
+   them at the end of the run.  IS_CSS tells whether FILE was parsed
+   as CSS or HTML.  */
+
+void
+register_links (const char *file, const char *url, bool is_css,
+                const struct urlpos *urls)
+{
+  struct stored_links *sl;
+  const struct urlpos *up;
+  struct stat st;
+
+  forget_links (file);
+  if (stat (file, &st) != 0)
+    return;
+
+  if (!links_fp)
+    {
+      if (links_store_failed)
+        return;
+      links_fp = tmpfile ();
+      if (!links_fp)
+        {
+          DEBUGP (("Cannot store links: %s\n", strerror (errno)));
+          links_store_failed = true;
+          return;
+        }
+      links_map = make_string_hash_table (0);
+    }
+
+  sl = xnew0 (struct stored_links);
+  sl->url = intern_string (url);
+  sl->is_css = is_css;
+  sl->size = st.st_size;
+  sl->mtime = st.st_mtime;
+  fseeko (links_fp, 0, SEEK_END);
+  sl->offset = ftello (links_fp);
+
+  /* Each link is stored as its struct urlpos, without the pointers,
+     followed by the length of its URL and the URL.  */
+  for (up = urls; up; up = up->next)
+    {
+      struct urlpos copy = *up;
+      int len = strlen (up->url->url);
+
+      copy.url = NULL;
+      copy.local_name = NULL;
+      copy.next = NULL;
+      fwrite (&copy, sizeof copy, 1, links_fp);
+      fwrite (&len, sizeof len, 1, links_fp);
+      fwrite (up->url->url, 1, len, links_fp);
+      ++sl->count;
+    }
+
+  sl->bytes = ftello (links_fp) - sl->offset;
+  if (sl->offset < 0 || ferror (links_fp))
+    {
+      DEBUGP (("Cannot store links: %s\n", strerror (errno)));
+      xfree (sl);
+      links_store_close ();
+      links_store_failed = true;
+      return;
+    }
+  hash_table_put (links_map, intern_string (file), sl);
+}
+
+/* If the links stored for FILE by register_links are still valid for
+   FILE at URL, parsed as CSS if IS_CSS is true, store them to *URLS
+   and return true.  Only what convert_links needs is restored: the
+   URLs of the links lack everything but the URL string.  */
+
+static bool
+stored_links (const char *file, const char *url, bool is_css,
+              struct urlpos **urls)
+{
+  struct stored_links *sl;
+  struct urlpos *head = NULL, *tail = NULL;
+  struct stat st;
+  char *buf, *p, *end;
+  int i;
+
+  if (!links_fp || !(sl = hash_table_get (links_map, file)))
+    return false;
+  if (sl->is_css != is_css || strcmp (sl->url, url) != 0
+      || stat (file, &st) != 0
+      || st.st_size != sl->size || st.st_mtime != sl->mtime)
+    return false;
+
+  buf = xmalloc (sl->bytes + 1);
+#if !defined(WINDOWS) && !defined(MSDOS)
+  /* Processes converting files in parallel share the file position of
+     links_fp, so leave it alone.  */
+  if (fflush (links_fp) != 0
+      || pread (fileno (links_fp), buf, sl->bytes, sl->offset) != sl->bytes)
+#else
+  if (fseeko (links_fp, sl->offset, SEEK_SET) != 0
+      || fread (buf, 1, sl->bytes, links_fp) != (size_t) sl->bytes)
+#endif
+    goto error;
+
+  p = buf;
+  end = buf + sl->bytes;
+  for (i = 0; i < sl->count; i++)
+    {
+      struct urlpos *up;
+      int len;
+
+      if (end - p < (int) (sizeof *up + sizeof len))
+        goto error;
+      up = xnew (struct urlpos);
+      memcpy (up, p, sizeof *up);
+      p += sizeof *up;
+      memcpy (&len, p, sizeof len);
+      p += sizeof len;
+      up->url = NULL;
+      up->next = NULL;
+      if (!head)
+        head = up;
+      else
+        tail->next = up;
+      tail = up;
+      if (len < 0 || end - p < len)
+        goto error;
+      up->url = xnew0 (struct url);
+      up->url->url = xmemdup0 (p, len);
+      p += len;
+    }
+
+  DEBUGP (("Reusing the %d links found in %s.\n", sl->count, file));
+  xfree (buf);
+  *urls = head;
+  return true;
+
+ error:
+  DEBUGP (("Cannot read the links stored for %s.\n", file));
+  xfree (buf);
+  free_urlpos (head);
+  return false;
 }
 
 static void downloaded_files_free (void);
@@ -1002,18 +1359,25 @@ convert_cleanup (void)
 {
   if (dl_file_url_map)
     {
-      free_keys_and_values (dl_file_url_map);
       hash_table_destroy (dl_file_url_map);
       dl_file_url_map = NULL;
     }
   if (dl_url_file_map)
     {
-      free_keys_and_values (dl_url_file_map);
       hash_table_destroy (dl_url_file_map);
       dl_url_file_map = NULL;
     }
   if (downloaded_html_set)
-    string_set_free (downloaded_html_set);
+    {
+      hash_table_destroy (downloaded_html_set);
+      downloaded_html_set = NULL;
+    }
+  if (downloaded_css_set)
+    {
+      hash_table_destroy (downloaded_css_set);
+      downloaded_css_set = NULL;
+    }
+  links_store_close ();
   downloaded_files_free ();
   if (converted_files)
     string_set_free (converted_files);
@@ -1095,7 +1459,7 @@ downloaded_file (downloaded_file_t mode, const char *file)
     return *ptr;
 
   ptr = downloaded_mode_to_ptr (mode);
-  hash_table_put (downloaded_files_hash, xstrdup (file), ptr);
+  hash_table_put (downloaded_files_hash, intern_string (file), ptr);
 
   return FILE_NOT_ALREADY_DOWNLOADED;
 }
@@ -1105,16 +1469,124 @@ downloaded_files_free (void)
 {
   if (downloaded_files_hash)
     {
-      hash_table_iterator iter;
-      for (hash_table_iterate (downloaded_files_hash, &iter);
-           hash_table_iter_next (&iter);
-           )
-        xfree (iter.key);
       hash_table_destroy (downloaded_files_hash);
       downloaded_files_hash = NULL;
     }
 }
 
+/* Saving the book-keeping of the downloaded files to a checkpoint of
+   a recursive retrieval, and restoring it from there.  */
+
+static void
+table_write (FILE *fp, struct hash_table *ht, bool with_values)
+{
+  hash_table_iterator iter;
+  int count = ht ? hash_table_count (ht) : 0;
+
+  fwrite (&count, sizeof count, 1, fp);
+  if (!ht)
+    return;
+  for (hash_table_iterate (ht, &iter); hash_table_iter_next (&iter); )
+    {
+      write_counted_string (fp, iter.key);
+      if (with_values)
+        write_counted_string (fp, iter.value);
+    }
+}
+
+/* Read the entries written by table_write into *HT, creating it if
+   needed.  Entries already in *HT are kept.  */
+
+static bool
+table_read (FILE *fp, struct hash_table **ht, bool with_values)
+{
+  int count;
+
+  if (fread (&count, sizeof count, 1, fp) != 1 || count < 0)
+    return false;
+  if (!*ht)
+    *ht = make_string_hash_table (count);
+  while (count--)
+    {
+      char *key, *value = NULL;
+
+      if (!read_counted_string (fp, &key) || !key)
+        return false;
+      if (with_values && (!read_counted_string (fp, &value) || !value))
+        {
+          xfree (key);
+          return false;
+        }
+      if (!hash_table_contains (*ht, key))
+        hash_table_put (*ht, intern_string (key),
+                        with_values ? intern_string (value) : "1");
+      xfree (key);
+      xfree (value);
+    }
+  return true;
+}
+
+/* Write what is known about the downloaded files to FP.  */
+
+void
+convert_state_write (FILE *fp)
+{
+  hash_table_iterator iter;
+  int count;
+
+  table_write (fp, dl_file_url_map, true);
+  table_write (fp, dl_url_file_map, true);
+  table_write (fp, downloaded_html_set, false);
+  table_write (fp, downloaded_css_set, false);
+
+  count = downloaded_files_hash ? hash_table_count (downloaded_files_hash) : 0;
+  fwrite (&count, sizeof count, 1, fp);
+  if (downloaded_files_hash)
+    for (hash_table_iterate (downloaded_files_hash, &iter);
+         hash_table_iter_next (&iter); )
+      {
+        int mode = *(downloaded_file_t *) iter.value;
+        write_counted_string (fp, iter.key);
+        fwrite (&mode, sizeof mode, 1, fp);
+      }
+}
+
+/* Read what convert_state_write wrote from FP.  Return false if it
+   cannot be read.  */
+
+bool
+convert_state_read (FILE *fp)
+{
+  int count;
+
+  if (!table_read (fp, &dl_file_url_map, true)
+      || !table_read (fp, &dl_url_file_map, true)
+      || !table_read (fp, &downloaded_html_set, false)
+      || !table_read (fp, &downloaded_css_set, false))
+    return false;
+
+  if (fread (&count, sizeof count, 1, fp) != 1 || count < 0)
+    return false;
+  while (count--)
+    {
+      char *file;
+      int mode;
+
+      if (!read_counted_string (fp, &file) || !file)
+        return false;
+      if (fread (&mode, sizeof mode, 1, fp) != 1
+          || (mode != FILE_DOWNLOADED_NORMALLY
+              && mode != FILE_DOWNLOADED_AND_HTML_EXTENSION_ADDED))
+        {
+          xfree (file);
+          return false;
+        }
+      downloaded_file (mode, file);
+      xfree (file);
+    }
+  return true;
+}
+
 /* The function returns the pointer to the malloc-ed quoted version of
    string s.  It will recognize and quote numeric and special graphic
    entities, as per RFC1866:
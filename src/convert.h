@@ -55,8 +55,9 @@ struct url;
 struct urlpos {
   struct url *url;              /* the URL of the link, after it has
                                    been merged with the base */
-  char *local_name;             /* local file to which it was saved
-                                   (used by convert_links) */
+  const char *local_name;       /* local file to which it was saved
+                                   (used by convert_links); an
+                                   interned string */
 
   /* reserved for special links such as <base href="..."> which are
      used when converting links, but ignored when downloading.  */
@@ -107,9 +108,14 @@ void register_redirection (const char *, const char *);
 void register_html (const char *);
 void register_css (const char *);
 void register_delete_file (const char *);
+void register_links (const char *, const char *, bool,
+                     const struct urlpos *);
 void convert_all_links (void);
 void convert_cleanup (void);
 
+void convert_state_write (FILE *);
+bool convert_state_read (FILE *);
+
 char *html_quote_string (const char *);
 
 #endif /* CONVERT_H */
@@ -0,0 +1,484 @@
+/* Decoding of compressed HTTP responses.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#include "wget.h"
+
+#ifdef HAVE_CONTENT_DECODING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+#ifdef HAVE_BROTLIDEC
+# include <brotli/decode.h>
+#endif
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#include "utils.h"
+#include "retr.h"
+#include "decoder.h"
+
+/* The content codings of HTTP responses that Wget can decode, and the
+   libraries that decode them, are described in DECODERS below.  The
+   code around them feeds the body through the library of the coding
+   at hand, in whatever pieces it arrives, and hands the decoded data
+   to the caller's sink.  */
+
+/* Size of the buffer the decoded data is produced in.  Decompressing
+   makes more data than it takes, so it's larger than the pieces of
+   the body read by fd_read_body.  */
+#define DECODER_BUFSIZE (32 * 1024)
+
+enum decoder_status {
+  DECODER_OK,                   /* decoded what could be decoded */
+  DECODER_END,                  /* the end of the stream was reached */
+  DECODER_ERROR                 /* the data is corrupt; errno is set */
+};
+
+struct decoder;
+
+struct decoder_impl {
+  int flag;                     /* the rb_compressed_* of fd_read_body */
+  const char *name;             /* the content coding */
+
+  /* Set up the library state of DECODER, setting errno and returning
+     false on failure.  */
+  bool (*init) (struct decoder *);
+
+  /* Decode from *IN, which has *INLEN bytes, into *OUT, which has room
+     for *OUTLEN, and advance the four past what was used.  */
+  enum decoder_status (*step) (struct decoder *, const char **, size_t *,
+                               char **, size_t *);
+
+  void (*end) (struct decoder *);
+};
+
+struct decoder {
+  const struct decoder_impl *impl;
+  bool finished;                /* the end of the stream was reached */
+  char *buf;                    /* decoded data, DECODER_BUFSIZE bytes */
+  union {
+#ifdef HAVE_LIBZ
+    struct {
+      z_stream stream;
+      bool raw;                 /* raw deflate, without zlib header */
+    } z;
+#endif
+#ifdef HAVE_BROTLIDEC
+    BrotliDecoderState *brotli;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+    int dummy;
+  } u;
+};
+
+#ifdef HAVE_LIBZ
+static voidpf
+zalloc (voidpf opaque, unsigned int items, unsigned int size)
+{
+  (void) opaque;
+  return (voidpf) xcalloc (items, size);
+}
+
+static void
+zfree (voidpf opaque, voidpf address)
+{
+  (void) opaque;
+  xfree (address);
+}
+
+static bool
+zlib_init_window (struct decoder *dec, int window_bits)
+{
+  z_stream *zs = &dec->u.z.stream;
+  int err;
+
+  xzero (*zs);
+  zs->zalloc = zalloc;
+  zs->zfree = zfree;
+  zs->opaque = Z_NULL;
+  err = inflateInit2 (zs, window_bits);
+  if (err != Z_OK)
+    {
+      errno = (err == Z_MEM_ERROR) ? ENOMEM : EINVAL;
+      return false;
+    }
+  return true;
+}
+
+#define GZIP_DETECT 32 /* gzip format detection */
+#define GZIP_WINDOW 15 /* logarithmic window size (default: 15) */
+
+static bool
+gzip_init (struct decoder *dec)
+{
+  return zlib_init_window (dec, GZIP_DETECT | GZIP_WINDOW);
+}
+
+/* "deflate" is meant to be zlib data, but some servers send a bare
+   deflate stream; zlib_step falls back to that.  */
+
+static bool
+deflate_init (struct decoder *dec)
+{
+  return zlib_init_window (dec, GZIP_WINDOW);
+}
+
+static enum decoder_status
+zlib_step (struct decoder *dec, const char **in, size_t *inlen,
+           char **out, size_t *outlen)
+{
+  z_stream *zs = &dec->u.z.stream;
+  int err;
+
+  zs->next_in = (unsigned char *) *in;
+  zs->avail_in = *inlen;
+  zs->next_out = (unsigned char *) *out;
+  zs->avail_out = *outlen;
+
+  err = inflate (zs, Z_NO_FLUSH);
+
+  if (err == Z_DATA_ERROR && dec->impl->flag == rb_compressed_deflate
+      && !dec->u.z.raw && zs->total_out == 0
+      && zs->total_in == *inlen - zs->avail_in)
+    {
+      /* The start of the stream, which is all in *IN, is no zlib
+         header: start over with raw deflate.  */
+      DEBUGP (("No zlib header, decoding raw deflate data.\n"));
+      inflateEnd (zs);
+      if (!zlib_init_window (dec, -GZIP_WINDOW))
+        return DECODER_ERROR;
+      dec->u.z.raw = true;
+      return zlib_step (dec, in, inlen, out, outlen);
+    }
+
+  *in = (const char *) zs->next_in;
+  *inlen = zs->avail_in;
+  *out = (char *) zs->next_out;
+  *outlen = zs->avail_out;
+
+  switch (err)
+    {
+    case Z_OK:
+    case Z_BUF_ERROR:           /* no progress possible, not an error */
+      return DECODER_OK;
+    case Z_STREAM_END:
+      return DECODER_END;
+    case Z_MEM_ERROR:
+      errno = ENOMEM;
+      return DECODER_ERROR;
+    default:
+      DEBUGP (("zlib error: %s\n", zs->msg ? zs->msg : "?"));
+      errno = EINVAL;
+      return DECODER_ERROR;
+    }
+}
+
+static void
+zlib_end (struct decoder *dec)
+{
+  inflateEnd (&dec->u.z.stream);
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_BROTLIDEC
+static bool
+brotli_init (struct decoder *dec)
+{
+  dec->u.brotli = BrotliDecoderCreateInstance (NULL, NULL, NULL);
+  if (!dec->u.brotli)
+    {
+      errno = ENOMEM;
+      return false;
+    }
+  return true;
+}
+
+static enum decoder_status
+brotli_step (struct decoder *dec, const char **in, size_t *inlen,
+             char **out, size_t *outlen)
+{
+  const uint8_t *next_in = (const uint8_t *) *in;
+  uint8_t *next_out = (uint8_t *) *out;
+  BrotliDecoderResult res;
+
+  res = BrotliDecoderDecompressStream (dec->u.brotli, inlen, &next_in,
+                                       outlen, &next_out, NULL);
+  *in = (const char *) next_in;
+  *out = (char *) next_out;
+
+  switch (res)
+    {
+    case BROTLI_DECODER_RESULT_SUCCESS:
+      return DECODER_END;
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+      return DECODER_OK;
+    default:
+      DEBUGP (("brotli error: %s\n", BrotliDecoderErrorString (
+                 BrotliDecoderGetErrorCode (dec->u.brotli))));
+      errno = EINVAL;
+      return DECODER_ERROR;
+    }
+}
+
+static void
+brotli_end (struct decoder *dec)
+{
+  BrotliDecoderDestroyInstance (dec->u.brotli);
+}
+#endif /* HAVE_BROTLIDEC */
+
+#ifdef HAVE_ZSTD
+static bool
+zstd_init (struct decoder *dec)
+{
+  dec->u.zstd = ZSTD_createDStream ();
+  if (!dec->u.zstd)
+    {
+      errno = ENOMEM;
+      return false;
+    }
+  if (ZSTD_isError (ZSTD_initDStream (dec->u.zstd)))
+    {
+      ZSTD_freeDStream (dec->u.zstd);
+      errno = EINVAL;
+      return false;
+    }
+  return true;
+}
+
+static enum decoder_status
+zstd_step (struct decoder *dec, const char **in, size_t *inlen,
+           char **out, size_t *outlen)
+{
+  ZSTD_inBuffer input = { *in, *inlen, 0 };
+  ZSTD_outBuffer output = { *out, *outlen, 0 };
+  size_t res = ZSTD_decompressStream (dec->u.zstd, &output, &input);
+
+  *in += input.pos;
+  *inlen -= input.pos;
+  *out += output.pos;
+  *outlen -= output.pos;
+
+  if (ZSTD_isError (res))
+    {
+      DEBUGP (("zstd error: %s\n", ZSTD_getErrorName (res)));
+      errno = EINVAL;
+      return DECODER_ERROR;
+    }
+  /* 0 means a frame has been decoded and flushed.  */
+  return res == 0 ? DECODER_END : DECODER_OK;
+}
+
+static void
+zstd_end (struct decoder *dec)
+{
+  ZSTD_freeDStream (dec->u.zstd);
+}
+#endif /* HAVE_ZSTD */
+
+/* The decoders, in the order of preference that Accept-Encoding
+   gives them.  */
+static const struct decoder_impl decoders[] = {
+#ifdef HAVE_BROTLIDEC
+  { rb_compressed_brotli, "br", brotli_init, brotli_step, brotli_end },
+#endif
+#ifdef HAVE_ZSTD
+  { rb_compressed_zstd, "zstd", zstd_init, zstd_step, zstd_end },
+#endif
+#ifdef HAVE_LIBZ
+  { rb_compressed_gzip, "gzip", gzip_init, zlib_step, zlib_end },
+  { rb_compressed_deflate, "deflate", deflate_init, zlib_step, zlib_end },
+#endif
+};
+
+static const struct decoder_impl *
+find_decoder (int flag)
+{
+  size_t i;
+  for (i = 0; i < countof (decoders); i++)
+    if (decoders[i].flag == flag)
+      return &decoders[i];
+  return NULL;
+}
+
+/* Return true if data of the content coding denoted by FLAG, an
+   rb_compressed_* value, can be decoded.  */
+
+bool
+decoder_available_p (int flag)
+{
+  return find_decoder (flag) != NULL;
+}
+
+/* Return the value of the Accept-Encoding request header, according
+   to --compression.  */
+
+const char *
+decoder_accept_encoding (void)
+{
+  static char *all;
+  const char *name = NULL;
+  size_t i;
+
+  switch (opt.compression)
+    {
+    case compression_none:
+      return "identity";
+    case compression_auto:
+      break;
+    case compression_gzip:
+      name = "gzip";
+      break;
+    case compression_deflate:
+      name = "deflate";
+      break;
+    case compression_brotli:
+      name = "br";
+      break;
+    case compression_zstd:
+      name = "zstd";
+      break;
+    }
+  if (name)
+    return name;
+
+  /* All of them, e.g. "br, zstd, gzip, deflate".  */
+  if (!all)
+    {
+      size_t size = 1;
+      for (i = 0; i < countof (decoders); i++)
+        size += strlen (decoders[i].name) + 2;
+      all = xmalloc (size);
+      *all = '\0';
+      for (i = 0; i < countof (decoders); i++)
+        {
+          if (i)
+            strcat (all, ", ");
+          strcat (all, decoders[i].name);
+        }
+    }
+  return all;
+}
+
+/* Create a decoder for the content coding denoted by FLAG, which must
+   be available.  Returns NULL and sets errno on failure.  */
+
+struct decoder *
+decoder_new (int flag)
+{
+  struct decoder *dec = xnew0 (struct decoder);
+
+  dec->impl = find_decoder (flag);
+  if (!dec->impl)
+    {
+      xfree (dec);
+      errno = EINVAL;
+      return NULL;
+    }
+  if (!dec->impl->init (dec))
+    {
+      xfree (dec);
+      return NULL;
+    }
+  dec->buf = xmalloc (DECODER_BUFSIZE);
+  return dec;
+}
+
+/* Decode the LEN bytes at IN, the next piece of the body, and pass the
+   decoded data to SINK with ARG.  Anything after the end of the
+   compressed stream is ignored.
+
+   Returns 0 on success, -1 with errno set if the data can't be
+   decoded, or the negative value returned by SINK.  */
+
+int
+decoder_decode (struct decoder *dec, const char *in, int len,
+                decoder_sink_t sink, void *arg)
+{
+  size_t inlen = len;
+
+  while (!dec->finished)
+    {
+      char *out = dec->buf;
+      size_t outlen = DECODER_BUFSIZE;
+      size_t before = inlen;
+      enum decoder_status status;
+
+      status = dec->impl->step (dec, &in, &inlen, &out, &outlen);
+      if (status == DECODER_ERROR)
+        return -1;
+      if (status == DECODER_END)
+        {
+          dec->finished = true;
+          if (inlen)
+            DEBUGP (("Ignoring %lu bytes after the end of the %s data.\n",
+                     (unsigned long) inlen, dec->impl->name));
+        }
+      if (out > dec->buf)
+        {
+          int res = sink (arg, dec->buf, out - dec->buf);
+          if (res < 0)
+            return res;
+        }
+      /* Go on while there is input, or while output may be pending
+         because the buffer was filled.  */
+      else if (inlen == before)
+        break;
+      if (!inlen && outlen)
+        break;
+    }
+  return 0;
+}
+
+/* Return true if the end of the compressed data has been decoded.  */
+
+bool
+decoder_finished_p (const struct decoder *dec)
+{
+  return dec->finished;
+}
+
+void
+decoder_free (struct decoder *dec)
+{
+  dec->impl->end (dec);
+  xfree (dec->buf);
+  xfree (dec);
+}
+
+#endif /* HAVE_CONTENT_DECODING */
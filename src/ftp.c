@@ -272,7 +272,7 @@ init_control_ssl_connection (int csock, struct url *u, bool *using_control_secur
     logputs (LOG_VERBOSE, "==> AUTH TLS ... ");
   if (opt.ftps_implicit || ftp_auth (csock, SCHEME_FTPS) == FTPOK)
     {
-      if (!ssl_connect_wget (csock, u->host, NULL))
+      if (!ssl_connect_wget (csock, u->host, u->port, NULL))
         {
           fd_close (csock);
           return CONSSLERR;
@@ -1539,11 +1539,11 @@ Error in server response, closing control connection.\n"));
       /* We should try to restore the existing SSL session in the data connection
        * and fall back to establishing a new session if the server doesn't want to restore it.
        */
-      if (!opt.ftps_resume_ssl || !ssl_connect_wget (dtsock, u->host, &csock))
+      if (!opt.ftps_resume_ssl || !ssl_connect_wget (dtsock, u->host, 0, &csock))
         {
           if (opt.ftps_resume_ssl)
             logputs (LOG_NOTQUIET, "Server does not want to resume the SSL session. Trying with a new one.\n");
-          if (!ssl_connect_wget (dtsock, u->host, NULL))
+          if (!ssl_connect_wget (dtsock, u->host, 0, NULL))
             {
               fd_close (csock);
               fd_close (dtsock);
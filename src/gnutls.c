@@ -36,6 +36,7 @@ as that of the covered work.  */
 #include <dirent.h>
 #include <stdlib.h>
 #include <xalloc.h>
+#include <time.h>
 
 #include <gnutls/abstract.h>
 #include <gnutls/gnutls.h>
@@ -229,6 +230,7 @@ struct wgnutls_transport_context
 {
   gnutls_session_t session;       /* GnuTLS session handle */
   gnutls_datum_t *session_data;
+  char *session_key;            /* key in the session cache, or NULL */
   int last_error;               /* last error returned by read/write/... */
 
   /* Since GnuTLS doesn't support the equivalent to recv(...,
@@ -424,11 +426,53 @@ wgnutls_errstr (int fd _GL_UNUSED, void *arg)
   return gnutls_strerror (ctx->last_error);
 }
 
+static bool
+wgnutls_pending (int fd _GL_UNUSED, void *arg)
+{
+  struct wgnutls_transport_context *ctx = arg;
+  return ctx->peeklen || gnutls_record_check_pending (ctx->session);
+}
+
+/* How long to keep sessions when GnuTLS can't tell their lifetime.  */
+#define SESSION_LIFETIME (2 * 60 * 60)
+
+/* Store the state of SESSION in the session cache under KEY.  */
+
+static void
+wgnutls_store_session (gnutls_session_t session, const char *key)
+{
+  gnutls_datum_t data;
+  time_t expires = 0;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+  /* TLS 1.3 sessions can only be resumed with a ticket, which the
+     server sends after the handshake.  */
+  if (gnutls_protocol_get_version (session) == GNUTLS_TLS1_3
+      && !(gnutls_session_get_flags (session) & GNUTLS_SFLAGS_SESSION_TICKET))
+    return;
+#endif
+  if (gnutls_session_get_data2 (session, &data) < 0)
+    return;
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+  expires = gnutls_db_check_entry_expire_time (&data);
+#endif
+  if (!expires)
+    expires = time (NULL) + SESSION_LIFETIME;
+  ssl_session_store (key, data.data, data.size, expires);
+  gnutls_free (data.data);
+}
+
 static void
 wgnutls_close (int fd, void *arg)
 {
   struct wgnutls_transport_context *ctx = arg;
   /*gnutls_bye (ctx->session, GNUTLS_SHUT_RDWR);*/
+  if (ctx->session_key)
+    {
+      /* Under TLS 1.3, the ticket has arrived by now.  */
+      wgnutls_store_session (ctx->session, ctx->session_key);
+      xfree (ctx->session_key);
+    }
   if (ctx->session_data)
     {
       gnutls_free (ctx->session_data->data);
@@ -445,7 +489,7 @@ wgnutls_close (int fd, void *arg)
 static struct transport_implementation wgnutls_transport =
 {
   wgnutls_read, wgnutls_write, wgnutls_poll,
-  wgnutls_peek, wgnutls_errstr, wgnutls_close
+  wgnutls_peek, wgnutls_errstr, wgnutls_close, wgnutls_pending
 };
 
 static int
@@ -739,11 +783,21 @@ set_prio_default (gnutls_session_t session)
   return err;
 }
 
+/* Perform the SSL handshake on file descriptor FD, which is assumed
+   to be connected to an SSL server.
+
+   If CONTINUE_SESSION is non-NULL, the session of that file
+   descriptor is resumed.  Otherwise, if PORT is non-zero, a session
+   with HOSTNAME and PORT is resumed from the session cache if there
+   is one, and the session is stored there.  */
+
 bool
-ssl_connect_wget (int fd, const char *hostname, int *continue_session)
+ssl_connect_wget (int fd, const char *hostname, int port,
+                  int *continue_session)
 {
   struct wgnutls_transport_context *ctx;
   gnutls_session_t session;
+  char *key = NULL;
   int err;
 
 #if GNUTLS_VERSION_NUMBER >= 0x030604
@@ -819,18 +873,40 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
           continue_session = NULL;
         }
     }
+  else if (port)
+    {
+      const void *data;
+      size_t size;
+
+      key = ssl_session_key (hostname, port);
+      data = ssl_session_lookup (key, &size);
+      if (data)
+        {
+          if (gnutls_session_set_data (session, data, size) == 0)
+            DEBUGP (("Trying to resume the TLS session with %s.\n", key));
+        }
+    }
 
   err = _do_handshake (session, fd, opt.connect_timeout);
 
   if (err < 0)
     {
       gnutls_deinit (session);
+      xfree (key);
       return false;
     }
 
+  if (key)
+    {
+      if (gnutls_session_is_resumed (session))
+        DEBUGP (("Resumed the TLS session.\n"));
+      wgnutls_store_session (session, key);
+    }
+
   ctx = xnew0 (struct wgnutls_transport_context);
   ctx->session_data = xnew0 (gnutls_datum_t);
   ctx->session = session;
+  ctx->session_key = key;
   if (gnutls_session_get_data2 (session, ctx->session_data))
     {
       xfree (ctx->session_data);
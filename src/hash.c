@@ -48,6 +48,7 @@ as that of the covered work.  */
 # define xnew(type) (xmalloc (sizeof (type)))
 # define xnew0(type) (xcalloc (1, sizeof (type)))
 # define xnew_array(type, len) (xmalloc ((len) * sizeof (type)))
+# define xnew0_array(type, len) (xcalloc ((len), sizeof (type)))
 # define xfree(p) do { free ((void *) (p)); p = NULL; } while (0)
 
 # ifndef countof
@@ -60,6 +61,10 @@ as that of the covered work.  */
 
 #include "hash.h"
 
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
+
 /* INTERFACE:
 
    Hash tables are a technique used to implement mapping between
@@ -107,15 +112,20 @@ as that of the covered work.  */
 /* IMPLEMENTATION:
 
    The hash table is implemented as an open-addressed table with
-   linear probing collision resolution.
+   linear probing and "Robin Hood" collision resolution.
 
    The above means that all the cells (each cell containing a key and
    a value pointer) are stored in a contiguous array.  Array position
    of each cell is determined by the hash value of its key and the
    size of the table: location := hash(key) % size.  If two different
-   keys end up on the same position (collide), the one that came
-   second is stored in the first unoccupied cell that follows it.
-   This collision resolution technique is called "linear probing".
+   keys end up on the same position (collide), one of them is stored
+   in a cell that follows it.  When inserting, the new entry takes
+   over any cell whose occupant is closer to its own "home" position
+   than the new entry is, and the displaced occupant continues the
+   search in its place.  This "Robin Hood" rule keeps the distances
+   from the home positions short and even, and it allows lookups of
+   missing keys to stop as soon as they reach an entry that is closer
+   to home than the searched key would be.
 
    There are more advanced collision resolution methods (quadratic
    probing, double hashing), but we don't use them because they incur
@@ -124,13 +134,26 @@ as that of the covered work.  */
    count/size ratio (fullness) is kept below 75%.  We make sure to
    grow and rehash the table whenever this threshold is exceeded.
 
+   Each cell also caches the hash value of its key and its distance
+   from the home position.  The cached hash means that the (possibly
+   expensive) test function is only called for keys whose hash
+   matches, and that growing the table doesn't need to call the hash
+   function at all.
+
    Collisions complicate deletion because simply clearing a cell
    followed by previously collided entries would cause those neighbors
    to not be picked up by find_cell later.  One solution is to leave a
    "tombstone" marker instead of clearing the cell, and another is to
-   recalculate the positions of adjacent cells.  We take the latter
-   approach because it results in less bookkeeping garbage and faster
-   retrieval at the (slight) expense of deletion.  */
+   shift the entries that follow it back by one cell until reaching
+   an empty cell or an entry that is already at its home position.
+   We take the latter approach because it results in less bookkeeping
+   garbage and faster retrieval at the (slight) expense of deletion.
+
+   Large tables are grown incrementally: a new array is allocated and
+   the entries are moved over a few at a time with each insertion of
+   a new key, while lookups and removals consult both arrays.  That
+   way no single insertion has to pay for rehashing millions of
+   entries.  */
 
 /* Maximum allowed fullness: when hash table's fullness exceeds this
    value, the table is resized.  */
@@ -141,9 +164,22 @@ as that of the covered work.  */
    resizes.  */
 #define HASH_RESIZE_FACTOR 2
 
+/* Tables smaller than this many cells are rehashed in one go when
+   they grow; larger ones are rehashed incrementally.  */
+#define HASH_INCREMENTAL_SIZE 32768
+
+/* The number of cells of the old array processed with each insertion
+   while a table is being grown incrementally.  Since the new array
+   is at least twice the size of the old one, this ensures that the
+   old array is emptied long before the new one fills up.  */
+#define HASH_MIGRATE_STEPS 8
+
 struct cell {
   void *key;
   void *value;
+  unsigned int hash;            /* hash value of KEY */
+  unsigned int probe;           /* 1 + distance from KEY's home
+                                   position, 0 if the cell is empty */
 };
 
 typedef unsigned long (*hashfun_t) (const void *);
@@ -161,43 +197,37 @@ struct hash_table {
                                    entries, resize the table.  */
   int prime_offset;             /* the offset of the current prime in
                                    the prime table. */
-};
 
-/* We use the all-bits-set constant (INVALID_PTR) marker to mean that
-   a cell is empty.  It is unaligned and therefore illegal as a
-   pointer.  INVALID_PTR_CHAR (0xff) is the single-character constant
-   used to initialize the entire cells array as empty.
+  struct cell *old_cells;       /* while growing incrementally, the
+                                   array the entries are moved from;
+                                   NULL otherwise. */
+  int old_size;                 /* size of the old array. */
+  int old_pos;                  /* cells of the old array below this
+                                   position have been moved. */
+};
 
-   The all-bits-set value is a better choice than NULL because it
-   allows the use of NULL/0 keys.  Since the keys are either integers
-   or pointers, the only key that cannot be used is the integer value
-   -1.  This is acceptable because it still allows the use of
-   nonnegative integer keys.  */
-
-#define INVALID_PTR ((void *) ~(uintptr_t) 0)
-#ifndef UCHAR_MAX
-# define UCHAR_MAX 0xff
-#endif
-#define INVALID_PTR_CHAR UCHAR_MAX
+/* A cell is empty when its probe count is zero.  Marking empty cells
+   in the probe count rather than in the key allows any value to be
+   used as key, and it means that a zero-filled array is empty, so
+   that large arrays can be allocated with calloc without having to
+   touch every page up front.  */
 
 /* Whether the cell C is occupied (non-empty). */
-#define CELL_OCCUPIED(c) ((c)->key != INVALID_PTR)
+#define CELL_OCCUPIED(c) ((c)->probe != 0)
 
 /* Clear the cell C, i.e. mark it as empty (unoccupied). */
-#define CLEAR_CELL(c) ((c)->key = INVALID_PTR)
+#define CLEAR_CELL(c) ((c)->probe = 0)
 
 /* "Next" cell is the cell following C, but wrapping back to CELLS
    when C would reach CELLS+SIZE.  */
 #define NEXT_CELL(c, cells, size) (c != cells + (size - 1) ? c + 1 : cells)
 
-/* Loop over occupied cells starting at C, terminating the loop when
-   an empty cell is encountered.  */
-#define FOREACH_OCCUPIED_ADJACENT(c, cells, size)                               \
-  for (; CELL_OCCUPIED (c); c = NEXT_CELL (c, cells, size))
+/* Return the hash value of KEY as cached in the cells.  */
+#define HASH_KEY(ht, key) ((unsigned int) (ht)->hash_function (key))
 
-/* Return the position of KEY in hash table SIZE large, hash function
-   being HASHFUN.  */
-#define HASH_POSITION(key, hashfun, size) ((hashfun) (key) % size)
+/* Return the home position of hash value HASH in an array SIZE
+   large.  */
+#define HASH_POSITION(hash, size) ((hash) % (unsigned int) (size))
 
 /* Find a prime near, but greater than or equal to SIZE.  The primes
    are looked up from a table with a selection of primes convenient
@@ -288,14 +318,12 @@ hash_table_new (int items,
   ht->resize_threshold = (int) (size * HASH_MAX_FULLNESS);
   /*assert (ht->resize_threshold >= items);*/
 
-  ht->cells = xnew_array (struct cell, ht->size);
-
-  /* Mark cells as empty.  We use 0xff rather than 0 to mark empty
-     keys because it allows us to use NULL/0 as keys.  */
-  memset (ht->cells, INVALID_PTR_CHAR, size * sizeof (struct cell));
-
+  ht->cells = xnew0_array (struct cell, ht->size);
   ht->count = 0;
 
+  ht->old_cells = NULL;
+  ht->old_size = ht->old_pos = 0;
+
   return ht;
 }
 
@@ -305,27 +333,115 @@ void
 hash_table_destroy (struct hash_table *ht)
 {
   xfree (ht->cells);
+  xfree (ht->old_cells);
   xfree (ht);
 }
 
+/* Find the cell whose key is equal to KEY, HASH being its hash
+   value, in the array CELLS of SIZE cells.  Returns the matching
+   cell, or NULL if none matches.  */
+
+static inline struct cell *
+lookup_cell (struct cell *cells, int size, const void *key,
+             unsigned int hash, testfun_t equals)
+{
+  struct cell *c = cells + HASH_POSITION (hash, size);
+  unsigned int probe = 1;
+
+  /* An entry closer to its home position than KEY would be (or an
+     empty cell) means that KEY would have displaced it, had it been
+     inserted.  */
+  for (; c->probe >= probe; c = NEXT_CELL (c, cells, size), probe++)
+    if (c->hash == hash && equals (key, c->key))
+      return c;
+  return NULL;
+}
+
 /* The heart of most functions in this file -- find the cell whose
-   KEY is equal to key, using linear probing.  Returns the cell
-   that matches KEY, or the first empty cell if none matches.  */
+   KEY is equal to key, looking in the old array too if HT is being
+   grown.  Returns the cell that matches KEY, or NULL if none
+   matches.  */
 
 static inline struct cell *
 find_cell (const struct hash_table *ht, const void *key)
 {
-  struct cell *cells = ht->cells;
-  int size = ht->size;
-  struct cell *c = cells + HASH_POSITION (key, ht->hash_function, size);
-  testfun_t equals = ht->test_function;
-
-  FOREACH_OCCUPIED_ADJACENT (c, cells, size)
-    if (equals (key, c->key))
-      break;
+  unsigned int hash = HASH_KEY (ht, key);
+  struct cell *c = lookup_cell (ht->cells, ht->size, key, hash,
+                                ht->test_function);
+  if (!c && ht->old_cells)
+    c = lookup_cell (ht->old_cells, ht->old_size, key, hash,
+                     ht->test_function);
   return c;
 }
 
+/* Store KEY->VALUE with hash value HASH in the array CELLS of SIZE
+   cells, which must not already contain KEY.  */
+
+static void
+insert_cell (struct cell *cells, int size, void *key, void *value,
+             unsigned int hash)
+{
+  struct cell new_c, *c = cells + HASH_POSITION (hash, size);
+
+  new_c.key = key;
+  new_c.value = value;
+  new_c.hash = hash;
+  new_c.probe = 1;
+
+  for (; CELL_OCCUPIED (c); c = NEXT_CELL (c, cells, size), new_c.probe++)
+    if (c->probe < new_c.probe)
+      {
+        /* Take the place of the entry that is closer to home, and
+           continue looking for a place for it instead.  */
+        struct cell tmp = *c;
+        *c = new_c;
+        new_c = tmp;
+      }
+  *c = new_c;
+}
+
+/* Remove the cell C from the array CELLS of SIZE cells, shifting the
+   entries that follow it back towards their home positions.  */
+
+static void
+delete_cell (struct cell *cells, int size, struct cell *c)
+{
+  struct cell *next = NEXT_CELL (c, cells, size);
+
+  for (; next->probe > 1; c = next, next = NEXT_CELL (next, cells, size))
+    {
+      *c = *next;
+      c->probe--;
+    }
+  CLEAR_CELL (c);
+}
+
+/* Move up to STEPS cells from the old array of HT to the current
+   one, freeing the old array once it is empty.  */
+
+static void
+migrate_cells (struct hash_table *ht, int steps)
+{
+  while (ht->old_cells && steps-- > 0)
+    {
+      struct cell *c = ht->old_cells + ht->old_pos;
+      if (CELL_OCCUPIED (c))
+        {
+          /* Deleting C shifts the entries that follow it back, so the
+             next one may end up at the same position.  Cells below
+             OLD_POS stay empty, which keeps the lookups in the old
+             array working.  */
+          insert_cell (ht->cells, ht->size, c->key, c->value, c->hash);
+          delete_cell (ht->old_cells, ht->old_size, c);
+        }
+      else if (++ht->old_pos == ht->old_size)
+        {
+          xfree (ht->old_cells);
+          ht->old_size = ht->old_pos = 0;
+        }
+    }
+}
+
 /* Get the value that corresponds to the key KEY in the hash table HT.
    If no value is found, return NULL.  Note that NULL is a legal value
    for value; if you are storing NULLs in your hash table, you can use
@@ -337,7 +453,7 @@ void *
 hash_table_get (const struct hash_table *ht, const void *key)
 {
   struct cell *c = find_cell (ht, key);
-  if (CELL_OCCUPIED (c))
+  if (c)
     return c->value;
   else
     return NULL;
@@ -351,7 +467,7 @@ hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
                      void *orig_key, void *value)
 {
   struct cell *c = find_cell (ht, lookup_key);
-  if (CELL_OCCUPIED (c))
+  if (c)
     {
       if (orig_key)
         *(void **)orig_key = c->key;
@@ -368,22 +484,21 @@ hash_table_get_pair (const struct hash_table *ht, const void *lookup_key,
 int
 hash_table_contains (const struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
-  return CELL_OCCUPIED (c);
+  return find_cell (ht, key) != NULL;
 }
 
 /* Grow hash table HT as necessary, and rehash all the key-value
-   mappings.  */
+   mappings, or start doing so for large tables.  */
 
 static void
 grow_hash_table (struct hash_table *ht)
 {
-  hashfun_t hasher = ht->hash_function;
-  struct cell *old_cells = ht->cells;
-  struct cell *old_end   = ht->cells + ht->size;
-  struct cell *c, *cells;
+  struct cell *old_cells, *old_end, *c;
   int newsize;
 
+  /* Finish the previous resize first, if still in progress. */
+  migrate_cells (ht, INT_MAX);
+
   newsize = prime_size (ht->size * HASH_RESIZE_FACTOR, &ht->prime_offset);
 #if 0
   printf ("growing from %d to %d; fullness %.2f%% to %.2f%%\n",
@@ -392,27 +507,31 @@ grow_hash_table (struct hash_table *ht)
           100.0 * ht->count / newsize);
 #endif
 
-  ht->size = newsize;
-  ht->resize_threshold = (int) (newsize * HASH_MAX_FULLNESS);
+  old_cells = ht->cells;
+  old_end = ht->cells + ht->size;
 
-  cells = xnew_array (struct cell, newsize);
-  memset (cells, INVALID_PTR_CHAR, newsize * sizeof (struct cell));
-  ht->cells = cells;
+  if (ht->size >= HASH_INCREMENTAL_SIZE)
+    {
+      ht->old_cells = old_cells;
+      ht->old_size = ht->size;
+      ht->old_pos = 0;
+      old_cells = NULL;
+    }
 
-  for (c = old_cells; c < old_end; c++)
-    if (CELL_OCCUPIED (c))
-      {
-        struct cell *new_c;
-        /* We don't need to test for uniqueness of keys because they
-           come from the hash table and are therefore known to be
-           unique.  */
-        new_c = cells + HASH_POSITION (c->key, hasher, newsize);
-        FOREACH_OCCUPIED_ADJACENT (new_c, cells, newsize)
-          ;
-        *new_c = *c;
-      }
+  ht->size = newsize;
+  ht->resize_threshold = (int) (newsize * HASH_MAX_FULLNESS);
+  ht->cells = xnew0_array (struct cell, newsize);
 
-  xfree (old_cells);
+  if (old_cells)
+    {
+      /* We don't need to test for uniqueness of keys because they
+         come from the hash table and are therefore known to be
+         unique.  */
+      for (c = old_cells; c < old_end; c++)
+        if (CELL_OCCUPIED (c))
+          insert_cell (ht->cells, newsize, c->key, c->value, c->hash);
+      xfree (old_cells);
+    }
 }
 
 /* Put VALUE in the hash table HT under the key KEY.  This regrows the
@@ -422,7 +541,7 @@ void
 hash_table_put (struct hash_table *ht, const void *key, const void *value)
 {
   struct cell *c = find_cell (ht, key);
-  if (CELL_OCCUPIED (c))
+  if (c)
     {
       /* update existing item */
       c->key   = (void *)key; /* const? */
@@ -433,15 +552,14 @@ hash_table_put (struct hash_table *ht, const void *key, const void *value)
   /* If adding the item would make the table exceed max. fullness,
      grow the table first.  */
   if (ht->count >= ht->resize_threshold)
-    {
-      grow_hash_table (ht);
-      c = find_cell (ht, key);
-    }
+    grow_hash_table (ht);
+  else
+    migrate_cells (ht, HASH_MIGRATE_STEPS);
 
   /* add new item */
   ++ht->count;
-  c->key   = (void *)key;       /* const? */
-  c->value = (void *)value;
+  insert_cell (ht->cells, ht->size, (void *)key, (void *)value, /* const? */
+               HASH_KEY (ht, key));
 }
 
 /* Remove KEY->value mapping from HT.  Return 0 if there was no such
@@ -450,45 +568,20 @@ hash_table_put (struct hash_table *ht, const void *key, const void *value)
 int
 hash_table_remove (struct hash_table *ht, const void *key)
 {
-  struct cell *c = find_cell (ht, key);
-  if (!CELL_OCCUPIED (c))
-    return 0;
+  unsigned int hash = HASH_KEY (ht, key);
+  struct cell *c = lookup_cell (ht->cells, ht->size, key, hash,
+                                ht->test_function);
+  if (c)
+    delete_cell (ht->cells, ht->size, c);
+  else if (ht->old_cells
+           && (c = lookup_cell (ht->old_cells, ht->old_size, key, hash,
+                                ht->test_function)) != NULL)
+    delete_cell (ht->old_cells, ht->old_size, c);
   else
-    {
-      int size = ht->size;
-      struct cell *cells = ht->cells;
-      hashfun_t hasher = ht->hash_function;
-
-      CLEAR_CELL (c);
-      --ht->count;
-
-      /* Rehash all the entries following C.  The alternative
-         approach is to mark the entry as deleted, i.e. create a
-         "tombstone".  That speeds up removal, but leaves a lot of
-         garbage and slows down hash_table_get and hash_table_put.  */
+    return 0;
 
-      c = NEXT_CELL (c, cells, size);
-      FOREACH_OCCUPIED_ADJACENT (c, cells, size)
-        {
-          const void *key2 = c->key;
-          struct cell *c_new;
-
-          /* Find the new location for the key. */
-          c_new = cells + HASH_POSITION (key2, hasher, size);
-          FOREACH_OCCUPIED_ADJACENT (c_new, cells, size)
-            if (key2 == c_new->key)
-              /* The cell C (key2) is already where we want it (in
-                 C_NEW's "chain" of keys.)  */
-              goto next_rehash;
-
-          *c_new = *c;
-          CLEAR_CELL (c);
-
-        next_rehash:
-          ;
-        }
-      return 1;
-    }
+  --ht->count;
+  return 1;
 }
 
 /* Clear HT of all entries.  After calling this function, the count
@@ -498,10 +591,38 @@ hash_table_remove (struct hash_table *ht, const void *key)
 void
 hash_table_clear (struct hash_table *ht)
 {
-  memset (ht->cells, INVALID_PTR_CHAR, ht->size * sizeof (struct cell));
+  memset (ht->cells, 0, ht->size * sizeof (struct cell));
+  xfree (ht->old_cells);
+  ht->old_size = ht->old_pos = 0;
   ht->count = 0;
 }
 
+/* Call FN for each occupied cell of the array CELLS of SIZE cells, as
+   described at hash_table_for_each.  Return non-zero if FN asked to
+   stop the mapping.  */
+
+static int
+for_each_cell (struct cell *cells, int size,
+               int (*fn) (void *, void *, void *), void *arg)
+{
+  struct cell *c = cells;
+  struct cell *end = cells + size;
+
+  for (; c < end; c++)
+    if (CELL_OCCUPIED (c))
+      {
+        void *key;
+      repeat:
+        key = c->key;
+        if (fn (key, c->value, arg))
+          return 1;
+        /* hash_table_remove might have moved the adjacent cells. */
+        if (c->key != key && CELL_OCCUPIED (c))
+          goto repeat;
+      }
+  return 0;
+}
+
 /* Call FN for each entry in HT.  FN is called with three arguments:
    the key, the value, and ARG.  When FN returns a non-zero value, the
    mapping stops.
@@ -517,21 +638,10 @@ void
 hash_table_for_each (struct hash_table *ht,
                      int (*fn) (void *, void *, void *), void *arg)
 {
-  struct cell *c = ht->cells;
-  struct cell *end = ht->cells + ht->size;
-
-  for (; c < end; c++)
-    if (CELL_OCCUPIED (c))
-      {
-        void *key;
-      repeat:
-        key = c->key;
-        if (fn (key, c->value, arg))
-          return;
-        /* hash_table_remove might have moved the adjacent cells. */
-        if (c->key != key && CELL_OCCUPIED (c))
-          goto repeat;
-      }
+  if (for_each_cell (ht->cells, ht->size, fn, arg))
+    return;
+  if (ht->old_cells)
+    for_each_cell (ht->old_cells, ht->old_size, fn, arg);
 }
 
 /* Initiate iteration over HT.  Entries are obtained with
@@ -549,6 +659,13 @@ hash_table_iterate (struct hash_table *ht, hash_table_iterator *iter)
 {
   iter->pos = ht->cells;
   iter->end = ht->cells + ht->size;
+  if (ht->old_cells)
+    {
+      iter->next_pos = ht->old_cells + ht->old_pos;
+      iter->next_end = ht->old_cells + ht->old_size;
+    }
+  else
+    iter->next_pos = iter->next_end = NULL;
 }
 
 /* Get the next hash table entry.  ITER is an iterator object
@@ -563,17 +680,25 @@ hash_table_iterate (struct hash_table *ht, hash_table_iterator *iter)
 int
 hash_table_iter_next (hash_table_iterator *iter)
 {
-  struct cell *c = iter->pos;
-  struct cell *end = iter->end;
-  for (; c < end; c++)
-    if (CELL_OCCUPIED (c))
-      {
-        iter->key = c->key;
-        iter->value = c->value;
-        iter->pos = c + 1;
-        return 1;
-      }
-  return 0;
+  for (;;)
+    {
+      struct cell *c = iter->pos;
+      struct cell *end = iter->end;
+      for (; c < end; c++)
+        if (CELL_OCCUPIED (c))
+          {
+            iter->key = c->key;
+            iter->value = c->value;
+            iter->pos = c + 1;
+            return 1;
+          }
+      if (!iter->next_pos)
+        return 0;
+      /* Continue with the old array of a table being grown. */
+      iter->pos = iter->next_pos;
+      iter->end = iter->next_end;
+      iter->next_pos = iter->next_end = NULL;
+    }
 }
 
 /* Return the number of elements in the hash table.  This is not the
@@ -750,6 +875,71 @@ cmp_pointer (const void *ptr1, const void *ptr2)
   return ptr1 == ptr2;
 }
 
+#ifdef TESTING
+
+static int
+remove_odd_mapper (void *key, void *value, void *arg)
+{
+  if ((uintptr_t) key & 1)
+    hash_table_remove (arg, key);
+  return 0;
+}
+
+const char *
+test_hash_table (void)
+{
+  struct hash_table *ht = hash_table_new (0, NULL, NULL);
+  hash_table_iterator iter;
+  uintptr_t i, n;
+  int count;
+
+  /* Enough keys to grow the table incrementally more than once, with
+     removals while the entries are being moved, stopping while they
+     still are.  */
+  for (i = 0; i < 100000 || !ht->old_cells; i++)
+    {
+      hash_table_put (ht, (void *) i, (void *) (i + 1));
+      if (i % 4 == 0)
+        hash_table_remove (ht, (void *) (i / 2));
+    }
+  n = i;
+
+  for (i = 0, count = 0; i < n; i++)
+    {
+      void *value = hash_table_get (ht, (void *) i);
+      /* I was removed when 2*I was inserted, if it was a multiple
+         of 4.  */
+      bool removed = i % 2 == 0 && 2 * i < n;
+      if (removed)
+        mu_assert ("removed key found", value == NULL);
+      else
+        {
+          mu_assert ("key not found", value == (void *) (i + 1));
+          count++;
+        }
+    }
+  mu_assert ("wrong count", hash_table_count (ht) == count);
+
+  hash_table_for_each (ht, remove_odd_mapper, ht);
+  count = 0;
+  for (hash_table_iterate (ht, &iter); hash_table_iter_next (&iter); count++)
+    mu_assert ("odd key left", !((uintptr_t) iter.key & 1));
+  mu_assert ("iteration missed keys", count == hash_table_count (ht));
+  for (i = 0; i < n; i += 2)
+    if (hash_table_contains (ht, (void *) i))
+      count--;
+  mu_assert ("even keys lost", count == 0);
+
+  hash_table_clear (ht);
+  mu_assert ("table not empty", hash_table_count (ht) == 0
+             && !hash_table_contains (ht, (void *) 2));
+  hash_table_destroy (ht);
+
+  return NULL;
+}
+
+#endif /* TESTING */
+
 #ifdef TEST
 
 #include <stdio.h>
@@ -52,6 +52,7 @@ void hash_table_for_each (struct hash_table *,
 typedef struct {
   void *key, *value;    /* public members */
   void *pos, *end;      /* private members */
+  void *next_pos, *next_end;
 } hash_table_iterator;
 void hash_table_iterate (struct hash_table *, hash_table_iterator *);
 int hash_table_iter_next (hash_table_iterator *);
@@ -32,6 +32,7 @@ as that of the covered work.  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 #ifndef WINDOWS
@@ -54,6 +55,9 @@ as that of the covered work.  */
 #endif /* WINDOWS */
 
 #include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 #include "utils.h"
 #include "host.h"
@@ -61,6 +65,10 @@ as that of the covered work.  */
 #include "hash.h"
 #include "ptimer.h"
 
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
+
 #ifndef NO_ADDRESS
 # define NO_ADDRESS NO_DATA
 #endif
@@ -84,6 +92,8 @@ struct address_list {
 
   int refcount;                 /* reference count; when it drops to
                                    0, the entry is freed. */
+
+  time_t expires;               /* when the DNS cache entry expires */
 };
 
 /* Get the bounds of the address list.  */
@@ -260,6 +270,19 @@ cmp_prefer_ipv6 (const void *addr1, const void *addr2)
   return !IS_IPV6 (addr1) - !IS_IPV6 (addr2);
 }
 
+/* Reorder the addresses of AL so that IPv4 ones (or IPv6 ones, as per
+   --prefer-family) come first.  Sorting is stable so the order of the
+   addresses with the same family is undisturbed.  */
+
+static void
+address_list_sort (struct address_list *al)
+{
+  if (al->count > 1 && opt.prefer_family != prefer_none)
+    stable_sort (al->addresses, al->count, sizeof (ip_address),
+                 opt.prefer_family == prefer_ipv4
+                 ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+}
+
 #else  /* not ENABLE_IPV6 */
 
 /* Create an address_list from a NULL-terminated vector of IPv4
@@ -575,17 +598,45 @@ is_valid_ipv6_address (const char *str, const char *end)
   return true;
 }
 
-/* Simple host cache, used by lookup_host to speed up resolving.  The
-   cache doesn't handle TTL because Wget is a fairly short-lived
-   application.  Refreshing is attempted when connect fails, though --
-   see connect_to_host.  */
+/* Simple host cache, used by lookup_host to speed up resolving.
+   Entries expire after the TTL the resolver gave, or after
+   --dns-cache-ttl if it gave none, which is always the case with
+   getaddrinfo.  Failed lookups are cached too, as entries without
+   addresses, for --dns-negative-ttl.  Refreshing is attempted when
+   connect fails, though -- see connect_to_host.  */
 
 /* Mapping between known hosts and to lists of their addresses. */
 static struct hash_table *host_name_addresses_map;
 
+/* Return the time at which an entry cached now expires, given the
+   TTL of the lookup, which is negative if unknown.  */
 
-/* Return the host's resolved addresses from the cache, if
-   available.  */
+static time_t
+cache_expiry (double ttl)
+{
+  return time (NULL) + (time_t) (ttl < 0 ? opt.dns_cache_ttl : ttl);
+}
+
+/* Remove HOST from the DNS cache.  Does nothing is HOST is not in
+   the cache.  */
+
+static void
+cache_remove (const char *host)
+{
+  char *key;
+  struct address_list *al;
+  if (!host_name_addresses_map)
+    return;
+  if (hash_table_get_pair (host_name_addresses_map, host, &key, &al))
+    {
+      hash_table_remove (host_name_addresses_map, host);
+      address_list_release (al);
+      xfree (key);
+    }
+}
+
+/* Return the host's resolved addresses from the cache, if available
+   and not expired.  If the lookup failed, the list has no addresses.  */
 
 static struct address_list *
 cache_query (const char *host)
@@ -594,6 +645,12 @@ cache_query (const char *host)
   if (!host_name_addresses_map)
     return NULL;
   al = hash_table_get (host_name_addresses_map, host);
+  if (al && al->expires < time (NULL))
+    {
+      DEBUGP (("%s expired from host_name_addresses_map\n", host));
+      cache_remove (host);
+      return NULL;
+    }
   if (al)
     {
       DEBUGP (("Found %s in host_name_addresses_map (%p)\n", host, (void *) al));
@@ -603,15 +660,32 @@ cache_query (const char *host)
   return NULL;
 }
 
-/* Cache the DNS lookup of HOST.  Subsequent invocations of
-   lookup_host will return the cached value.  */
+#ifdef HAVE_LIBCARES
+/* Return true if HOST is in the cache.  Unlike cache_query, this
+   doesn't take a reference.  */
+
+static bool
+cached_p (const char *host)
+{
+  struct address_list *al;
+  if (!host_name_addresses_map)
+    return false;
+  al = hash_table_get (host_name_addresses_map, host);
+  return al && al->expires >= time (NULL);
+}
+#endif
+
+/* Cache the DNS lookup of HOST until EXPIRES.  Subsequent invocations
+   of lookup_host will return the cached value.  */
 
 static void
-cache_store (const char *host, struct address_list *al)
+cache_store (const char *host, struct address_list *al, time_t expires)
 {
   if (!host_name_addresses_map)
     host_name_addresses_map = make_nocase_string_hash_table (0);
 
+  cache_remove (host);
+  al->expires = expires;
   ++al->refcount;
   hash_table_put (host_name_addresses_map, xstrdup_lower (host), al);
 
@@ -621,25 +695,23 @@ cache_store (const char *host, struct address_list *al)
       debug_logprintf ("Caching %s =>", host);
       for (i = 0; i < al->count; i++)
         debug_logprintf (" %s", print_address (al->addresses + i));
-      debug_logprintf ("\n");
+      if (!al->count)
+        debug_logprintf (" (failed)");
+      debug_logprintf (" for %ld seconds\n", (long) (expires - time (NULL)));
     }
 }
 
-/* Remove HOST from the DNS cache.  Does nothing is HOST is not in
-   the cache.  */
+/* Cache the failure to look up HOST, unless failures are not to be
+   cached.  With --retry-on-host-error they are not, so that the
+   retries do look HOST up again.  */
 
 static void
-cache_remove (const char *host)
+cache_store_failure (const char *host)
 {
-  struct address_list *al;
-  if (!host_name_addresses_map)
+  if (opt.dns_negative_ttl <= 0 || opt.retry_on_host_error)
     return;
-  al = hash_table_get (host_name_addresses_map, host);
-  if (al)
-    {
-      address_list_release (al);
-      hash_table_remove (host_name_addresses_map, host);
-    }
+  cache_store (host, xnew0 (struct address_list),
+               cache_expiry (opt.dns_negative_ttl));
 }
 
 #ifdef HAVE_LIBCARES
@@ -694,15 +766,20 @@ address_list_from_hostent (struct hostent *host)
 #undef select
 #endif
 
-static void
-wait_ares (ares_channel channel)
+/* Process the queries on CHANNEL until *PENDING drops to zero, and
+   return true, or false if --dns-timeout passed first.  Other queries
+   on the channel, such as prefetches, make progress meanwhile, but
+   aren't waited for, and a timeout leaves them alone.  */
+
+static bool
+wait_ares (ares_channel channel, int *pending)
 {
   struct ptimer *timer = NULL;
 
   if (opt.dns_timeout)
     timer = ptimer_new ();
 
-  for (;;)
+  while (*pending > 0)
     {
       struct timeval *tvp, tv;
       fd_set read_fds, write_fds;
@@ -727,28 +804,248 @@ wait_ares (ares_channel channel)
 
       rc = select (nfds, &read_fds, &write_fds, NULL, tvp);
       if (rc == 0 && timer && ptimer_measure (timer) >= opt.dns_timeout)
-        ares_cancel (channel);
-      else
-        ares_process (channel, &read_fds, &write_fds);
+        break;
+      ares_process (channel, &read_fds, &write_fds);
     }
   if (timer)
     ptimer_destroy (timer);
+  return *pending == 0;
+}
+
+/* A lookup of a host with c-ares, made of a query per address
+   family.  */
+
+struct ares_lookup {
+  char *host;                   /* the host, if this is a prefetch */
+  struct address_list *al4;     /* the IPv4 addresses found */
+  struct address_list *al6;     /* the IPv6 addresses found */
+  int ttl;                      /* lowest TTL of the answers, or -1 */
+  int failure;                  /* ARES_ENOTFOUND, ARES_ETIMEOUT or
+                                   ARES_ECANCELLED if a query failed
+                                   that way, or 0 */
+  int pending;                  /* queries not answered yet */
+  bool claimed;                 /* lookup_host is waiting for it */
+  bool abandoned;               /* lookup_host gave up waiting for it */
+};
+
+/* DNS record types and class, for ares_search.  */
+#define DNS_CLASS_IN 1
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+
+/* Most addresses a single answer is parsed for.  */
+#define ANSWER_MAX 32
+
+/* Prefetches in progress, indexed by host name.  */
+static struct hash_table *prefetch_map;
+
+/* Don't have more than this many prefetches going on at once.  */
+#define PREFETCH_MAX 32
+
+static void prefetch_done (struct ares_lookup *);
+static void ares_lookup_free (struct ares_lookup *);
+
+/* Record the answer HOST of a query of LOOKUP, with the query's
+   STATUS, and TTL if known.  */
+
+static void
+ares_lookup_answer (struct ares_lookup *lookup, int status,
+                    struct hostent *host, int ttl)
+{
+  if (host && status == ARES_SUCCESS && host->h_addr_list[0])
+    {
+      if (host->h_addrtype == AF_INET)
+        lookup->al4 = address_list_from_hostent (host);
+      else
+        lookup->al6 = address_list_from_hostent (host);
+      if (ttl >= 0 && (lookup->ttl < 0 || ttl < lookup->ttl))
+        lookup->ttl = ttl;
+    }
+  else if (status == ARES_ENOTFOUND
+           || ((status == ARES_ETIMEOUT || status == ARES_ECANCELLED)
+               && !lookup->failure))
+    lookup->failure = status;
+
+  if (--lookup->pending == 0)
+    {
+      if (lookup->abandoned)
+        ares_lookup_free (lookup);
+      else if (lookup->host && !lookup->claimed)
+        prefetch_done (lookup);
+    }
 }
 
 static void
 callback (void *arg, int status, int timeouts _GL_UNUSED, struct hostent *host)
 {
-  struct address_list **al = (struct address_list **) arg;
+  ares_lookup_answer (arg, status, host, -1);
+}
+
+/* Parse the answer ABUF of an A or AAAA query, taking its TTL from
+   the records.  */
+
+static void
+search_callback (void *arg, int status, int timeouts _GL_UNUSED,
+                 unsigned char *abuf, int alen, int family)
+{
+  struct hostent *host = NULL;
+  int i, count = ANSWER_MAX, ttl = -1;
 
-  if (!host || status != ARES_SUCCESS)
+  if (status == ARES_SUCCESS)
     {
-      *al = NULL;
-      return;
+      if (family == AF_INET)
+        {
+          struct ares_addrttl ttls[ANSWER_MAX];
+          status = ares_parse_a_reply (abuf, alen, &host, ttls, &count);
+          for (i = 0; status == ARES_SUCCESS && i < count; i++)
+            if (ttl < 0 || ttls[i].ttl < ttl)
+              ttl = ttls[i].ttl;
+        }
+      else
+        {
+          struct ares_addr6ttl ttls[ANSWER_MAX];
+          status = ares_parse_aaaa_reply (abuf, alen, &host, ttls, &count);
+          for (i = 0; status == ARES_SUCCESS && i < count; i++)
+            if (ttl < 0 || ttls[i].ttl < ttl)
+              ttl = ttls[i].ttl;
+        }
     }
 
-  *al = address_list_from_hostent (host);
+  ares_lookup_answer (arg, status, host, ttl);
+  if (host)
+    ares_free_hostent (host);
+}
+
+static void
+search_callback_a (void *arg, int status, int timeouts,
+                   unsigned char *abuf, int alen)
+{
+  search_callback (arg, status, timeouts, abuf, alen, AF_INET);
 }
+
+static void
+search_callback_aaaa (void *arg, int status, int timeouts,
+                      unsigned char *abuf, int alen)
+{
+  search_callback (arg, status, timeouts, abuf, alen, AF_INET6);
+}
+
+/* Send the query for the FAMILY addresses of HOST.  ares_gethostbyname
+   would do, but it doesn't tell the TTL, so the DNS is queried
+   directly once the hosts file has been looked at.  */
+
+static void
+ares_lookup_query (struct ares_lookup *lookup, const char *host, int family)
+{
+  struct hostent *hostent;
+
+  if (is_valid_ip_address (host))
+    ares_gethostbyname (ares, host, family, callback, lookup);
+  else if (ares_gethostbyname_file (ares, host, family, &hostent)
+           == ARES_SUCCESS)
+    {
+      ares_lookup_answer (lookup, ARES_SUCCESS, hostent, -1);
+      ares_free_hostent (hostent);
+    }
+  else
+    ares_search (ares, host, DNS_CLASS_IN,
+                 family == AF_INET ? DNS_TYPE_A : DNS_TYPE_AAAA,
+                 family == AF_INET ? search_callback_a : search_callback_aaaa,
+                 lookup);
+}
+
+/* Send the queries for HOST on behalf of LOOKUP.  The callbacks may
+   be invoked, and a prefetch finished, before this returns.  */
+
+static void
+ares_lookup_start (struct ares_lookup *lookup, const char *host)
+{
+#ifdef ENABLE_IPV6
+  bool ipv4 = opt.ipv4_only || !opt.ipv6_only;
+  bool ipv6 = opt.ipv6_only || !opt.ipv4_only;
+
+  lookup->ttl = -1;
+  lookup->pending = ipv4 + ipv6;
+  if (ipv4)
+    ares_lookup_query (lookup, host, AF_INET);
+  if (ipv6)
+    ares_lookup_query (lookup, host, AF_INET6);
+#else
+  lookup->ttl = -1;
+  lookup->pending = 1;
+  ares_lookup_query (lookup, host, AF_INET);
 #endif
+}
+
+/* Return the addresses found by the finished LOOKUP, or NULL if
+   there are none.  */
+
+static struct address_list *
+ares_lookup_result (struct ares_lookup *lookup)
+{
+  if (lookup->al4 && lookup->al6)
+    return merge_address_lists (lookup->al4, lookup->al6);
+  return lookup->al4 ? lookup->al4 : lookup->al6;
+}
+
+/* Free LOOKUP along with the addresses it found.  */
+
+static void
+ares_lookup_free (struct ares_lookup *lookup)
+{
+  if (lookup->al4)
+    address_list_delete (lookup->al4);
+  if (lookup->al6)
+    address_list_delete (lookup->al6);
+  xfree (lookup->host);
+  xfree (lookup);
+}
+
+/* Resolve HOST with c-ares, taking over the prefetch of HOST if
+   there is one.  The lowest TTL of the answers is stored to *TTL, or
+   -1 if there was none.  *NEGATIVE is set if the lookup failed in a
+   way worth caching: HOST doesn't exist, or the lookup timed out.  */
+
+static struct address_list *
+ares_lookup_host (const char *host, int *ttl, bool *negative)
+{
+  struct ares_lookup *lookup = NULL;
+  struct address_list *al;
+
+  if (prefetch_map)
+    lookup = hash_table_get (prefetch_map, host);
+  if (lookup)
+    {
+      DEBUGP (("Waiting for the prefetch of %s.\n", host));
+      hash_table_remove (prefetch_map, host);
+      lookup->claimed = true;
+    }
+  else
+    {
+      lookup = xnew0 (struct ares_lookup);
+      ares_lookup_start (lookup, host);
+    }
+
+  if (!wait_ares (ares, &lookup->pending))
+    {
+      /* Timed out.  The queries of LOOKUP can't be cancelled without
+         cancelling the prefetches too, so let them run their course
+         and discard their answers.  */
+      DEBUGP (("Lookup of %s timed out.\n", host));
+      lookup->abandoned = true;
+      *ttl = -1;
+      *negative = true;
+      return NULL;
+    }
+  al = ares_lookup_result (lookup);
+  *ttl = lookup->ttl;
+  *negative = !al && lookup->failure;
+
+  xfree (lookup->host);
+  xfree (lookup);
+  return al;
+}
+#endif /* HAVE_LIBCARES */
 
 /* Look up HOST in DNS and return a list of IP addresses.
 
@@ -780,6 +1077,8 @@ lookup_host (const char *host, int flags)
   bool use_cache;
   bool numeric_address = false;
   double timeout = opt.dns_timeout;
+  int ttl = -1;
+  bool negative = false;
 
 #ifndef ENABLE_IPV6
   /* If we're not using getaddrinfo, first check if HOST specifies a
@@ -827,8 +1126,22 @@ lookup_host (const char *host, int flags)
       if (!(flags & LH_REFRESH))
         {
           al = cache_query (host);
-          if (al)
+          if (al && al->count)
             return al;
+          if (al)
+            {
+              /* HOST failed to resolve not long ago.  */
+              address_list_release (al);
+              if (!opt.retry_on_host_error)
+                {
+                  if (!silent)
+                    logprintf (LOG_VERBOSE,
+                               _("Resolving %s... failed: cached.\n"),
+                               quotearg_style (escape_quoting_style, host));
+                  return NULL;
+                }
+              cache_remove (host);
+            }
         }
       else
         cache_remove (host);
@@ -855,24 +1168,7 @@ lookup_host (const char *host, int flags)
 #ifdef ENABLE_IPV6
 #ifdef HAVE_LIBCARES
   if (ares)
-    {
-      struct address_list *al4;
-      struct address_list *al6;
-
-      if (opt.ipv4_only || !opt.ipv6_only)
-        ares_gethostbyname (ares, host, AF_INET, callback, &al4);
-      if (opt.ipv6_only || !opt.ipv4_only)
-        ares_gethostbyname (ares, host, AF_INET6, callback, &al6);
-
-      wait_ares (ares);
-
-      if (al4 && al6)
-        al = merge_address_lists (al4, al6);
-      else if (al4)
-        al = al4;
-      else
-        al = al6;
-    }
+    al = ares_lookup_host (host, &ttl, &negative);
   else
 #endif
     {
@@ -913,6 +1209,13 @@ lookup_host (const char *host, int flags)
           if (!silent)
             logprintf (LOG_VERBOSE, _ ("failed: %s.\n"),
                        err != EAI_SYSTEM ? gai_strerror (err) : strerror (errno));
+          if (use_cache
+              && (err == EAI_NONAME || err == EAI_AGAIN
+#ifdef EAI_NODATA
+                  || err == EAI_NODATA
+#endif
+                  || (err == EAI_SYSTEM && errno == ETIMEDOUT)))
+            cache_store_failure (host);
           return NULL;
         }
       al = address_list_from_addrinfo (res);
@@ -923,22 +1226,26 @@ lookup_host (const char *host, int flags)
     {
       logprintf (LOG_VERBOSE,
                  _ ("failed: No IPv4/IPv6 addresses for host.\n"));
+      if (use_cache && negative)
+        cache_store_failure (host);
       return NULL;
     }
 
-  /* Reorder addresses so that IPv4 ones (or IPv6 ones, as per
-     --prefer-family) come first.  Sorting is stable so the order of
-     the addresses with the same family is undisturbed.  */
-  if (al->count > 1 && opt.prefer_family != prefer_none)
-    stable_sort (al->addresses, al->count, sizeof (ip_address),
-                 opt.prefer_family == prefer_ipv4
-                 ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+  address_list_sort (al);
 #else  /* not ENABLE_IPV6 */
 #ifdef HAVE_LIBCARES
   if (ares)
     {
-      ares_gethostbyname (ares, host, AF_INET, callback, &al);
-      wait_ares (ares);
+      al = ares_lookup_host (host, &ttl, &negative);
+      if (!al)
+        {
+          if (!silent)
+            logputs (LOG_VERBOSE,
+                     _ ("failed: No IPv4/IPv6 addresses for host.\n"));
+          if (use_cache && negative)
+            cache_store_failure (host);
+          return NULL;
+        }
     }
   else
 #endif
@@ -954,6 +1261,9 @@ lookup_host (const char *host, int flags)
               else
                 logputs (LOG_VERBOSE, _ ("failed: timed out.\n"));
             }
+          if (use_cache && (errno == ETIMEDOUT || h_errno == HOST_NOT_FOUND
+                            || h_errno == TRY_AGAIN))
+            cache_store_failure (host);
           return NULL;
         }
       /* Do older systems have h_addr_list?  */
@@ -984,11 +1294,311 @@ lookup_host (const char *host, int flags)
 
   /* Cache the lookup information. */
   if (use_cache)
-    cache_store (host, al);
+    cache_store (host, al, cache_expiry (ttl));
 
   return al;
 }
 
+#ifdef HAVE_LIBCARES
+/* Finish the prefetch LOOKUP: cache the addresses it found, if any,
+   and free it.  */
+
+static void
+prefetch_done (struct ares_lookup *lookup)
+{
+  struct address_list *al = ares_lookup_result (lookup);
+
+  hash_table_remove (prefetch_map, lookup->host);
+  if (al)
+    {
+#ifdef ENABLE_IPV6
+      address_list_sort (al);
+#endif
+      cache_store (lookup->host, al, cache_expiry (lookup->ttl));
+      address_list_release (al);
+    }
+  else
+    {
+      DEBUGP (("Prefetch of %s failed.\n", lookup->host));
+      /* Cancelled prefetches didn't fail.  */
+      if (lookup->failure == ARES_ENOTFOUND
+          || lookup->failure == ARES_ETIMEOUT)
+        cache_store_failure (lookup->host);
+    }
+  xfree (lookup->host);
+  xfree (lookup);
+}
+#endif /* HAVE_LIBCARES */
+
+/* Start resolving HOST in the background, so that its addresses are
+   in the cache by the time lookup_host is asked for them.  This is
+   only done with the c-ares resolver, and only if the DNS cache is
+   on; otherwise nothing happens.  The queries make progress whenever
+   another lookup is waited for and when host_prefetch_process is
+   called.  */
+
+void
+host_prefetch (const char *host)
+{
+#ifdef HAVE_LIBCARES
+  struct ares_lookup *lookup;
+
+  if (!ares || !opt.dns_cache || is_valid_ip_address (host)
+      || cached_p (host))
+    return;
+  if (prefetch_map
+      && (hash_table_contains (prefetch_map, host)
+          || hash_table_count (prefetch_map) >= PREFETCH_MAX))
+    return;
+
+  if (!prefetch_map)
+    prefetch_map = make_nocase_string_hash_table (0);
+
+  DEBUGP (("Prefetching the addresses of %s.\n", host));
+  lookup = xnew0 (struct ares_lookup);
+  lookup->host = xstrdup_lower (host);
+  hash_table_put (prefetch_map, lookup->host, lookup);
+  ares_lookup_start (lookup, lookup->host);
+#else
+  (void) host;
+#endif
+}
+
+/* Let the prefetches in progress make progress, without blocking.  */
+
+void
+host_prefetch_process (void)
+{
+#ifdef HAVE_LIBCARES
+  fd_set read_fds, write_fds;
+  struct timeval tv;
+  int nfds;
+
+  if (!ares || !prefetch_map || !hash_table_count (prefetch_map))
+    return;
+
+  FD_ZERO (&read_fds);
+  FD_ZERO (&write_fds);
+  nfds = ares_fds (ares, &read_fds, &write_fds);
+  tv.tv_sec = tv.tv_usec = 0;
+  if (nfds == 0 || select (nfds, &read_fds, &write_fds, NULL, &tv) < 0)
+    return;
+  /* Called even if nothing is ready, to handle the timeouts.  */
+  ares_process (ares, &read_fds, &write_fds);
+#endif
+}
+
+/* Add the numeric address ADDR to AL.  Returns false if ADDR isn't
+   an address Wget can use.  */
+
+static bool
+address_list_append (struct address_list *al, const char *addr)
+{
+  ip_address *ip;
+#ifdef ENABLE_IPV6
+  struct address_list *parsed;
+  struct addrinfo hints, *res;
+
+  xzero (hints);
+  hints.ai_socktype = SOCK_STREAM;
+#ifdef AI_NUMERICHOST
+  hints.ai_flags = AI_NUMERICHOST;
+#endif
+  if (getaddrinfo (addr, NULL, &hints, &res) != 0)
+    return false;
+  parsed = address_list_from_addrinfo (res);
+  freeaddrinfo (res);
+  if (!parsed)
+    return false;
+  al->addresses = xrealloc (al->addresses,
+                            (al->count + 1) * sizeof (ip_address));
+  ip = &al->addresses[al->count++];
+  *ip = parsed->addresses[0];
+  address_list_delete (parsed);
+#else
+  uint32_t addr_ipv4 = (uint32_t) inet_addr (addr);
+
+  if (addr_ipv4 == (uint32_t) -1)
+    return false;
+  al->addresses = xrealloc (al->addresses,
+                            (al->count + 1) * sizeof (ip_address));
+  ip = &al->addresses[al->count++];
+  ip->family = AF_INET;
+  memcpy (IP_INADDR_DATA (ip), &addr_ipv4, 4);
+#endif
+  return true;
+}
+
+/* Read the DNS cache file FP into the cache, skipping the expired
+   entries and, if MERGE is set, the hosts that are cached already.
+   Each line of the file holds a host name, the time its entry
+   expires, and its addresses, if it resolved.  */
+
+static void
+cache_read (FILE *fp, bool merge)
+{
+  char *line = NULL;
+  size_t len = 0;
+  time_t now = time (NULL);
+
+  if (!host_name_addresses_map)
+    host_name_addresses_map = make_nocase_string_hash_table (0);
+
+  while (getline (&line, &len, fp) > 0)
+    {
+      struct address_list *al;
+      char host[256], addr[64];
+      unsigned long expires;
+      bool bad = false;
+      char *p;
+      int n;
+
+      for (p = line; c_isspace (*p); p++)
+        ;
+      if (*p == '#' || sscanf (p, "%255s %lu%n", host, &expires, &n) != 2)
+        continue;
+      if ((time_t) expires < now
+          || (merge && hash_table_contains (host_name_addresses_map, host)))
+        continue;
+
+      al = xnew0 (struct address_list);
+      for (p += n; sscanf (p, "%63s%n", addr, &n) == 1; p += n)
+        if (!address_list_append (al, addr))
+          bad = true;
+      /* Don't turn a list of addresses we can't use into a failure.  */
+      if (bad && !al->count)
+        address_list_delete (al);
+      else
+        cache_store (host, al, (time_t) expires);
+    }
+  xfree (line);
+}
+
+/* Write the entries of the cache that haven't expired to FP.  */
+
+static bool
+cache_dump (FILE *fp)
+{
+  hash_table_iterator iter;
+  time_t now = time (NULL);
+
+  fputs ("# DNS cache of GNU Wget.\n", fp);
+  fputs ("# <hostname>\t<expires>\t<address>... "
+         "(no address: the lookup failed)\n", fp);
+
+  for (hash_table_iterate (host_name_addresses_map, &iter);
+       hash_table_iter_next (&iter); )
+    {
+      const char *host = iter.key;
+      struct address_list *al = iter.value;
+      int i;
+
+      if (al->expires < now)
+        continue;
+      fprintf (fp, "%s\t%lu", host, (unsigned long) al->expires);
+      for (i = 0; i < al->count; i++)
+        fprintf (fp, "\t%s", print_address (al->addresses + i));
+      if (fputc ('\n', fp) == EOF)
+        return false;
+    }
+  return true;
+}
+
+/* Return true if FILE can be trusted with the DNS cache: it is a
+   regular file, and not world-writable.  */
+
+static bool
+cache_file_access_valid (const char *file)
+{
+  struct stat st;
+
+  if (stat (file, &st) == -1)
+    return false;
+  return
+#ifndef WINDOWS
+    !(st.st_mode & S_IWOTH) &&
+#endif
+    S_ISREG (st.st_mode);
+}
+
+/* The modification time of the DNS cache file when it was loaded.  */
+static time_t cache_file_mtime;
+
+/* Load the DNS cache from FILE, if it exists.  */
+
+void
+dns_cache_load (const char *file)
+{
+  struct stat st;
+  FILE *fp;
+
+  if (!file_exists_p (file, NULL))
+    return;
+  if (!cache_file_access_valid (file))
+    {
+      logprintf (LOG_NOTQUIET, _("Not using the DNS cache file %s, which "
+                                 "must be a regular and non-world-writable "
+                                 "file.\n"), quote (file));
+      return;
+    }
+  fp = fopen (file, "r");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return;
+    }
+  cache_read (fp, false);
+  if (fstat (fileno (fp), &st) == 0)
+    cache_file_mtime = st.st_mtime;
+  fclose (fp);
+  DEBUGP (("Loaded %d entries from the DNS cache file %s.\n",
+           hash_table_count (host_name_addresses_map), file));
+}
+
+/* Save the DNS cache to FILE.  Entries written there by other Wget
+   processes since it was loaded are kept.  */
+
+void
+dns_cache_save (const char *file)
+{
+  struct stat st;
+  FILE *fp;
+  int fd;
+
+  if (!host_name_addresses_map)
+    return;
+  if (file_exists_p (file, NULL) && !cache_file_access_valid (file))
+    return;
+
+  fp = fopen (file, "a+");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return;
+    }
+
+  /* Lock the file, so that concurrent runs don't overwrite each
+     other's entries.  */
+  fd = fileno (fp);
+  flock (fd, LOCK_EX);
+
+  if (fstat (fd, &st) == 0 && st.st_mtime != cache_file_mtime)
+    {
+      fseeko (fp, 0, SEEK_SET);
+      cache_read (fp, true);
+    }
+
+  fseeko (fp, 0, SEEK_SET);
+  if (ftruncate (fd, 0) < 0 || !cache_dump (fp))
+    logprintf (LOG_NOTQUIET, _("Could not write the DNS cache file %s: %s\n"),
+               quote (file), strerror (errno));
+
+  /* fclose is expected to unlock the file for us */
+  if (fclose (fp) == EOF)
+    logprintf (LOG_NOTQUIET, _("Could not write the DNS cache file %s: %s\n"),
+               quote (file), strerror (errno));
+}
+
 /* Determine whether a URL is acceptable to be followed, according to
    a list of domains to accept.  */
 bool
@@ -1045,6 +1655,17 @@ sufmatch (const char **list, const char *what)
 void
 host_cleanup (void)
 {
+#ifdef HAVE_LIBCARES
+  /* The callbacks of the cancelled queries free the prefetches and
+     the lookups that timed out.  */
+  if (ares)
+    ares_cancel (ares);
+  if (prefetch_map)
+    {
+      hash_table_destroy (prefetch_map);
+      prefetch_map = NULL;
+    }
+#endif
   if (host_name_addresses_map)
     {
       hash_table_iterator iter;
@@ -1077,3 +1698,54 @@ is_valid_ip_address (const char *name)
 #endif
   return false;
 }
+
+#ifdef TESTING
+
+const char *
+test_dns_negative_cache (void)
+{
+  static const char host[] = "no-such-host.invalid";
+  struct address_list *al;
+  double old_ttl = opt.dns_negative_ttl;
+  bool old_retry = opt.retry_on_host_error;
+  time_t now = time (NULL);
+
+  opt.dns_negative_ttl = 30;
+  opt.retry_on_host_error = false;
+
+  /* The failure is cached for --dns-negative-ttl seconds, as an entry
+     without addresses.  */
+  cache_store_failure (host);
+  al = cache_query (host);
+  mu_assert ("test_dns_negative_cache: failure not cached", al != NULL);
+  mu_assert ("test_dns_negative_cache: negative entry has addresses",
+             al->count == 0);
+  mu_assert ("test_dns_negative_cache: wrong expiry",
+             al->expires >= now + 30 && al->expires <= time (NULL) + 30);
+
+  /* Once that time has passed, the entry is dropped.  */
+  al->expires = time (NULL) - 1;
+  address_list_release (al);
+  mu_assert ("test_dns_negative_cache: entry didn't expire",
+             cache_query (host) == NULL);
+  mu_assert ("test_dns_negative_cache: expired entry kept",
+             !hash_table_contains (host_name_addresses_map, host));
+
+  /* Failures are not cached without a TTL, nor when they are to be
+     retried.  */
+  opt.dns_negative_ttl = 0;
+  cache_store_failure (host);
+  mu_assert ("test_dns_negative_cache: cached with a zero TTL",
+             cache_query (host) == NULL);
+  opt.dns_negative_ttl = 30;
+  opt.retry_on_host_error = true;
+  cache_store_failure (host);
+  mu_assert ("test_dns_negative_cache: cached despite --retry-on-host-error",
+             cache_query (host) == NULL);
+
+  opt.dns_negative_ttl = old_ttl;
+  opt.retry_on_host_error = old_retry;
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -82,6 +82,10 @@ enum {
   LH_REFRESH = 4
 };
 struct address_list *lookup_host (const char *, int);
+void host_prefetch (const char *);
+void host_prefetch_process (void);
+void dns_cache_load (const char *);
+void dns_cache_save (const char *);
 
 void address_list_get_bounds (const struct address_list *, int *, int *);
 const ip_address *address_list_address_at (const struct address_list *, int);
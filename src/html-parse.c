@@ -126,16 +126,6 @@ as that of the covered work.  */
 # define c_tolower(x) tolower (x)
 # define c_toupper(x) toupper (x)
 
-struct hash_table {
-  int dummy;
-};
-static void *
-hash_table_get (const struct hash_table *ht, void *ptr)
-{
-  return ptr;
-}
-#else  /* not STANDALONE */
-# include "hash.h"
 #endif
 
 /* Pool support.  A pool is a resizable chunk of memory.  It is first
@@ -271,10 +261,13 @@ struct pool {
    to "<foo", but "&lt,foo" to "<,foo".  */
 #define SKIP_SEMI(p, inc) (p += inc, p < end && *p == ';' ? ++p : p)
 
+/* The open tags.  The positions are offsets into the text rather than
+   pointers, because map_html_tags_partial keeps the stack across calls
+   and the text may move in between.  */
 struct tagstack_item {
-  const char *tagname_begin;
-  const char *tagname_end;
-  const char *contents_begin;
+  int tagname_begin;
+  int tagname_end;
+  int contents_begin;           /* -1 if unknown */
   struct tagstack_item *prev;
   struct tagstack_item *next;
 };
@@ -343,15 +336,16 @@ tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
 }
 
 static struct tagstack_item *
-tagstack_find (struct tagstack_item *tail, const char *tagname_begin,
-               const char *tagname_end)
+tagstack_find (struct tagstack_item *tail, const char *text,
+               const char *tagname_begin, const char *tagname_end)
 {
   int len = tagname_end - tagname_begin;
   while (tail)
     {
       if (len == (tail->tagname_end - tail->tagname_begin))
         {
-          if (0 == strncasecmp (tail->tagname_begin, tagname_begin, len))
+          if (0 == strncasecmp (text + tail->tagname_begin, tagname_begin,
+                                len))
             return tail;
         }
       tail = tail->prev;
@@ -557,10 +551,13 @@ static int comment_backout_count;
 
    Whitespace is allowed between and after the comments, but not
    before the first comment.  Additionally, this function attempts to
-   handle double quotes in SGML declarations correctly.  */
+   handle double quotes in SGML declarations correctly.
+
+   If END is reached before the declaration ends, *TRUNCATED is set
+   to true; more text could have changed the outcome.  */
 
 static const char *
-advance_declaration (const char *beg, const char *end)
+advance_declaration (const char *beg, const char *end, bool *truncated)
 {
   const char *p = beg;
   char quote_char = '\0';       /* shut up, gcc! */
@@ -582,8 +579,12 @@ advance_declaration (const char *beg, const char *end)
     AC_S_QUOTE2
   } state = AC_S_BANG;
 
+  *truncated = false;
   if (beg == end)
-    return beg;
+    {
+      *truncated = true;
+      return beg;
+    }
   ch = *p++;
 
   /* It looked like a good idea to write this as a state machine, but
@@ -592,7 +593,10 @@ advance_declaration (const char *beg, const char *end)
   while (state != AC_S_DONE && state != AC_S_BACKOUT)
     {
       if (p == end)
-        state = AC_S_BACKOUT;
+        {
+          state = AC_S_BACKOUT;
+          *truncated = true;
+        }
       switch (state)
         {
         case AC_S_DONE:
@@ -721,6 +725,60 @@ advance_declaration (const char *beg, const char *end)
   return p;
 }
 
+/* Vector primitives for the scanning loops below, which look at
+   VEC_SIZE characters at a time when the compiler targets SSE2 or
+   AVX2.  VEC_MASK returns a bit mask with one bit per character,
+   lowest bit first.  Without them, the scalar loops do all the work.
+   Skipping the text between tags is left to memchr, which the C
+   library already vectorizes.  */
+
+#if defined __GNUC__ && defined __AVX2__
+# include <immintrin.h>
+# define VEC_SIZE 32
+typedef __m256i vec_t;
+# define VEC_LOAD(p) _mm256_loadu_si256 ((const __m256i *) (p))
+# define VEC_SPLAT(c) _mm256_set1_epi8 (c)
+# define VEC_EQ(a, b) _mm256_cmpeq_epi8 (a, b)
+# define VEC_OR(a, b) _mm256_or_si256 (a, b)
+# define VEC_AND(a, b) _mm256_and_si256 (a, b)
+# define VEC_MASK(v) ((unsigned int) _mm256_movemask_epi8 (v))
+#elif defined __GNUC__ && defined __SSE2__
+# include <emmintrin.h>
+# define VEC_SIZE 16
+typedef __m128i vec_t;
+# define VEC_LOAD(p) _mm_loadu_si128 ((const __m128i *) (p))
+# define VEC_SPLAT(c) _mm_set1_epi8 (c)
+# define VEC_EQ(a, b) _mm_cmpeq_epi8 (a, b)
+# define VEC_OR(a, b) _mm_or_si128 (a, b)
+# define VEC_AND(a, b) _mm_and_si128 (a, b)
+# define VEC_MASK(v) ((unsigned int) _mm_movemask_epi8 (v))
+#endif
+
+/* Return the pointer to the first occurrence of any of the characters
+   A, B and C in [P, END), or END if there is none.  */
+
+static const char *
+find_any_of (const char *p, const char *end, char a, char b, char c)
+{
+#ifdef VEC_SIZE
+  vec_t va = VEC_SPLAT (a), vb = VEC_SPLAT (b), vc = VEC_SPLAT (c);
+
+  for (; end - p >= VEC_SIZE; p += VEC_SIZE)
+    {
+      vec_t v = VEC_LOAD (p);
+      unsigned int mask = VEC_MASK (VEC_OR (VEC_EQ (v, va),
+                                            VEC_OR (VEC_EQ (v, vb),
+                                                    VEC_EQ (v, vc))));
+      if (mask)
+        return p + __builtin_ctz (mask);
+    }
+#endif
+  for (; p < end; p++)
+    if (*p == a || *p == b || *p == c)
+      return p;
+  return end;
+}
+
 /* Find the first occurrence of the substring "-->" in [BEG, END) and
    return the pointer to the character after the substring.  If the
    substring is not found, return NULL.  */
@@ -728,11 +786,31 @@ advance_declaration (const char *beg, const char *end)
 static const char *
 find_comment_end (const char *beg, const char *end)
 {
+  const char *p;
+
+#ifdef VEC_SIZE
+  /* Look for '>' at VEC_SIZE positions at a time, together with the
+     two dashes that must precede it.  The scalar search below picks
+     up the positions that don't fill a whole vector.  */
+  vec_t gt = VEC_SPLAT ('>'), dash = VEC_SPLAT ('-');
+
+  for (p = beg + 2; end - p >= VEC_SIZE; p += VEC_SIZE)
+    {
+      vec_t v = VEC_AND (VEC_EQ (VEC_LOAD (p), gt),
+                         VEC_AND (VEC_EQ (VEC_LOAD (p - 1), dash),
+                                  VEC_EQ (VEC_LOAD (p - 2), dash)));
+      unsigned int mask = VEC_MASK (v);
+      if (mask)
+        return p + __builtin_ctz (mask) + 1;
+    }
+  beg = p - 2;
+#endif
+
   /* Open-coded Boyer-Moore search for "-->".  Examine the third char;
      if it's not '>' or '-', advance by three characters.  Otherwise,
      look at the preceding characters and try to find a match.  */
 
-  const char *p = beg - 1;
+  p = beg - 1;
 
   while ((p += 3) < end)
     switch (p[0])
@@ -770,17 +848,13 @@ find_comment_end (const char *beg, const char *end)
   return NULL;
 }
 
-/* Return true if the string containing of characters inside [b, e) is
-   present in hash table HT.  */
+/* Return true if the name consisting of characters inside [b, e) is
+   accepted by FILTER, or if there is no FILTER.  */
 
 static bool
-name_allowed (const struct hash_table *ht, const char *b, const char *e)
+name_allowed (html_name_filter_t filter, const char *b, const char *e)
 {
-  char *copy;
-  if (!ht)
-    return true;
-  BOUNDED_TO_ALLOCA (b, e, copy);
-  return hash_table_get (ht, copy) != NULL;
+  return !filter || filter (b, e - b);
 }
 
 /* Advance P (a char pointer), with the explicit intent of being able
@@ -808,10 +882,10 @@ static int tag_backout_count;
    MAPFUN will be called with two arguments: pointer to an initialized
    struct taginfo, and MAPARG.
 
-   ALLOWED_TAGS and ALLOWED_ATTRIBUTES are hash tables the keys of
-   which are the tags and attribute names that this function should
-   use.  If ALLOWED_TAGS is NULL, all tags are processed; if
-   ALLOWED_ATTRIBUTES is NULL, all attributes are returned.
+   ALLOWED_TAGS and ALLOWED_ATTRIBUTES are functions that tell which
+   tags and attribute names this function should use.  If ALLOWED_TAGS
+   is NULL, all tags are processed; if ALLOWED_ATTRIBUTES is NULL, all
+   attributes are returned.
 
    (Obviously, the caller can filter out unwanted tags and attributes
    just as well, but this is just an optimization designed to avoid
@@ -822,15 +896,42 @@ void
 map_html_tags (const char *text, int size,
                void (*mapfun) (struct taginfo *, void *), void *maparg,
                int flags,
-               const struct hash_table *allowed_tags,
-               const struct hash_table *allowed_attributes)
+               html_name_filter_t allowed_tags,
+               html_name_filter_t allowed_attributes)
+{
+  struct html_scan scan;
+
+  xzero (scan);
+  map_html_tags_partial (text, size, true, &scan, mapfun, maparg, flags,
+                         allowed_tags, allowed_attributes);
+}
+
+/* Like map_html_tags, but for a document that arrives in pieces.
+   TEXT is the part of the document received so far, SIZE characters
+   long; it may have been moved or grown since the previous call.
+   The scan resumes where the previous call with SCAN stopped, and
+   stops before a tag or comment that cannot be told apart yet from
+   what follows it, which is scanned again in the next call.
+
+   When FINAL is true, TEXT is the whole document: the rest of it is
+   mapped exactly as map_html_tags would, and SCAN is released.  The
+   tags mapped over all the calls are the same ones map_html_tags
+   would map over the whole document.  */
+
+void
+map_html_tags_partial (const char *text, int size, bool final,
+                       struct html_scan *scan,
+                       void (*mapfun) (struct taginfo *, void *),
+                       void *maparg, int flags,
+                       html_name_filter_t allowed_tags,
+                       html_name_filter_t allowed_attributes)
 {
   /* storage for strings passed to MAPFUN callback; if 256 bytes is
      too little, POOL_APPEND allocates more with malloc. */
   char pool_initial_storage[256];
   struct pool pool;
 
-  const char *p = text;
+  const char *p = text + scan->offset;
   const char *end = text + size;
 
   struct attr_pair attr_pair_initial_storage[8];
@@ -838,11 +939,15 @@ map_html_tags (const char *text, int size,
   bool attr_pair_resized = false;
   struct attr_pair *pairs = attr_pair_initial_storage;
 
-  struct tagstack_item *head = NULL;
-  struct tagstack_item *tail = NULL;
+  struct tagstack_item *head = scan->head;
+  struct tagstack_item *tail = scan->tail;
 
-  if (!size)
-    return;
+  /* The tag the text ran out in, and its entry on the tag stack.  */
+  const char *unfinished = NULL;
+  struct tagstack_item *pushed = NULL;
+
+  if (p == end)
+    goto done;
 
   POOL_INIT (&pool, pool_initial_storage, countof (pool_initial_storage));
 
@@ -857,6 +962,8 @@ map_html_tags (const char *text, int size,
 
     nattrs = 0;
     end_tag = 0;
+    unfinished = NULL;
+    pushed = NULL;
 
     /* Find beginning of tag.  We use memchr() instead of the usual
        looping with ADVANCE() for speed. */
@@ -864,13 +971,18 @@ map_html_tags (const char *text, int size,
     if (!p)
       goto finish;
 
-    tag_start_position = p;
+    tag_start_position = unfinished = p;
     ADVANCE (p);
 
     /* Establish the type of the tag (start-tag, end-tag or
        declaration).  */
     if (*p == '!')
       {
+        bool truncated = false;
+
+        if (!final && !(flags & MHT_STRICT_COMMENTS) && p + 3 >= end)
+          /* Too short to tell whether this is a comment.  */
+          goto finish;
         if (!(flags & MHT_STRICT_COMMENTS)
             && p + 3 < end && p[1] == '-' && p[2] == '-')
           {
@@ -882,6 +994,8 @@ map_html_tags (const char *text, int size,
             const char *comment_end = find_comment_end (p + 3, end);
             if (comment_end)
               p = comment_end;
+            else
+              truncated = true;
           }
         else
           {
@@ -889,8 +1003,11 @@ map_html_tags (const char *text, int size,
                declaration.  Real declarations are much less likely to
                be misused the way comments are, so advance over them
                properly regardless of strictness.  */
-            p = advance_declaration (p, end);
+            p = advance_declaration (p, end, &truncated);
           }
+        if (truncated && !final)
+          goto finish;
+        unfinished = NULL;
         if (p == end)
           goto finish;
         goto look_for_tag;
@@ -913,9 +1030,10 @@ map_html_tags (const char *text, int size,
         struct tagstack_item *ts = tagstack_push (&head, &tail);
         if (ts)
           {
-            ts->tagname_begin  = tag_name_begin;
-            ts->tagname_end    = tag_name_end;
-            ts->contents_begin = NULL;
+            ts->tagname_begin  = tag_name_begin - text;
+            ts->tagname_end    = tag_name_end - text;
+            ts->contents_begin = -1;
+            pushed = ts;
           }
       }
 
@@ -988,31 +1106,22 @@ map_html_tags (const char *text, int size,
             SKIP_WS (p);
             if (*p == '\"' || *p == '\'')
               {
-                bool newline_seen = false;
                 char quote_char = *p;
                 attr_raw_value_begin = p;
                 ADVANCE (p);
                 attr_value_begin = p; /* <foo bar="baz"> */
                                       /*           ^     */
-                while (*p != quote_char)
-                  {
-                    if (!newline_seen && *p == '\n')
-                      {
-                        /* If a newline is seen within the quotes, it
-                           is most likely that someone forgot to close
-                           the quote.  In that case, we back out to
-                           the value beginning, and terminate the tag
-                           at either `>' or the delimiter, whichever
-                           comes first.  Such a tag terminated at `>'
-                           is discarded.  */
-                        p = attr_value_begin;
-                        newline_seen = true;
-                        continue;
-                      }
-                    else if (newline_seen && (*p == '<' || *p == '>'))
-                      break;
-                    ADVANCE (p);
-                  }
+                p = find_any_of (p, end, quote_char, '\n', '\n');
+                if (p < end && *p == '\n')
+                  /* If a newline is seen within the quotes, it is
+                     most likely that someone forgot to close the
+                     quote.  In that case, we back out to the value
+                     beginning, and terminate the tag at either `>' or
+                     the delimiter, whichever comes first.  Such a tag
+                     terminated at `>' is discarded.  */
+                  p = find_any_of (attr_value_begin, end, quote_char, '<', '>');
+                if (p == end)
+                  goto finish;
                 attr_value_end = p; /* <foo bar="baz"> */
                                     /*              ^  */
                 if (*p == quote_char)
@@ -1081,13 +1190,14 @@ map_html_tags (const char *text, int size,
         ++nattrs;
       }
 
-    if (!end_tag && tail && (tail->tagname_begin == tag_name_begin))
+    if (!end_tag && tail && (tail->tagname_begin == tag_name_begin - text))
       {
-        tail->contents_begin = p+1;
+        tail->contents_begin = p + 1 - text;
       }
 
     if (uninteresting_tag)
       {
+        unfinished = NULL;
         ADVANCE (p);
         goto look_for_tag;
       }
@@ -1119,12 +1229,12 @@ map_html_tags (const char *text, int size,
 
       if (end_tag)
         {
-          ts = tagstack_find (tail, tag_name_begin, tag_name_end);
+          ts = tagstack_find (tail, text, tag_name_begin, tag_name_end);
           if (ts)
             {
-              if (ts->contents_begin)
+              if (ts->contents_begin != -1)
                 {
-                  taginfo.contents_begin = ts->contents_begin;
+                  taginfo.contents_begin = text + ts->contents_begin;
                   taginfo.contents_end   = tag_start_position;
                 }
               tagstack_pop (&head, &tail, ts);
@@ -1132,6 +1242,7 @@ map_html_tags (const char *text, int size,
         }
 
       mapfun (&taginfo, maparg);
+      unfinished = NULL;
       if (*p != '<')
         ADVANCE (p);
     }
@@ -1151,8 +1262,38 @@ map_html_tags (const char *text, int size,
   POOL_FREE (&pool);
   if (attr_pair_resized)
     xfree (pairs);
-  /* pop any tag stack that's left */
-  tagstack_pop (&head, &tail, head);
+
+ done:
+  if (final)
+    {
+      /* pop any tag stack that's left */
+      tagstack_pop (&head, &tail, head);
+      xzero (*scan);
+      return;
+    }
+
+  /* Leave the unfinished tag for the next call, which will see it
+     whole, and push it again.  */
+  if (unfinished)
+    {
+      if (pushed)
+        tagstack_pop (&head, &tail, pushed);
+      scan->offset = unfinished - text;
+    }
+  else
+    scan->offset = size;
+  scan->head = head;
+  scan->tail = tail;
+}
+
+/* Release what SCAN holds, when a document mapped with
+   map_html_tags_partial is given up on before its final call.  */
+
+void
+html_scan_free (struct html_scan *scan)
+{
+  tagstack_pop (&scan->head, &scan->tail, scan->head);
+  xzero (*scan);
 }
 
 #undef ADVANCE
@@ -56,15 +56,32 @@ struct taginfo {
   const char *contents_end;     /* only valid if end_tag_p */
 };
 
-struct hash_table;              /* forward declaration */
+struct tagstack_item;           /* forward declaration */
+
+/* The state of the scan of a document whose tags are mapped while it
+   arrives, with map_html_tags_partial.  Initialize it to all zeros
+   before the first call.  */
+struct html_scan {
+  int offset;                   /* where the next call starts */
+  struct tagstack_item *head;   /* the tags that are still open */
+  struct tagstack_item *tail;
+};
 
 /* Flags for map_html_tags: */
 #define MHT_STRICT_COMMENTS  1  /* use strict comment interpretation */
 #define MHT_TRIM_VALUES      2  /* trim attribute values, e.g. interpret
                                    <a href=" foo "> as "foo" */
 
+/* Tells whether the tag or attribute name of the given length, which
+   is not NUL-terminated, is of interest.  */
+typedef bool (*html_name_filter_t) (const char *, int);
+
 void map_html_tags (const char *, int,
                     void (*) (struct taginfo *, void *), void *, int,
-                    const struct hash_table *, const struct hash_table *);
+                    html_name_filter_t, html_name_filter_t);
+void map_html_tags_partial (const char *, int, bool, struct html_scan *,
+                            void (*) (struct taginfo *, void *), void *, int,
+                            html_name_filter_t, html_name_filter_t);
+void html_scan_free (struct html_scan *);
 
 #endif /* HTML_PARSE_H */
@@ -34,18 +34,22 @@ as that of the covered work.  */
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "exits.h"
 #include "html-parse.h"
 #include "url.h"
 #include "utils.h"
-#include "hash.h"
 #include "convert.h"
 #include "recur.h"
 #include "html-url.h"
 #include "css-url.h"
 #include "c-strcase.h"
 
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
+
 typedef void (*tag_handler_t) (int, struct taginfo *, struct map_context *);
 
 #define DECLARE_TAG_HANDLER(fun)                                \
@@ -172,80 +176,186 @@ static struct {
   { TAG_SOURCE,         "src",          ATTR_INLINE }
 };
 
-/* The lists of interesting tags and attributes are built dynamically,
-   from the information above.  However, some places in the code refer
-   to the attributes not mentioned here.  We add them manually.  */
-static const char *additional_attributes[] = {
-  "rel",                        /* used by tag_handle_link  */
-  "type",                       /* used by tag_handle_link  */
-  "http-equiv",                 /* used by tag_handle_meta  */
-  "name",                       /* used by tag_handle_meta  */
-  "content",                    /* used by tag_handle_meta  */
-  "action",                     /* used by tag_handle_form  */
-  "style",                      /* used by check_style_attr */
-  "srcset",                     /* used by tag_handle_img */
-};
-
-static struct hash_table *interesting_tags;
-static struct hash_table *interesting_attributes;
+/* Whether the tags of known_tags, in the order of their ids, are to
+   be followed, according to --ignore-tags and --follow-tags.  */
+static bool followed_tags[countof (known_tags)];
+static bool followed_tags_initialized;
 
 /* Will contains the (last) charset found in 'http-equiv=content-type'
    meta tags  */
 static char *meta_charset;
 
+/* Return the id of the known tag NAME, LEN characters long and not
+   necessarily NUL-terminated, or -1 if NAME is not in known_tags.
+   This runs for every tag of every document, so instead of hashing
+   NAME, it switches on the length and the first characters to the
+   only tag that NAME can be, and compares NAME with that one.  It
+   must be kept in sync with known_tags.  */
+
+static int
+known_tag_id (const char *name, int len)
+{
+  int id;
+
+  switch (len)
+    {
+    case 1:
+      id = TAG_A;
+      break;
+    case 2:
+      id = c_tolower (name[1]) == 'd' ? TAG_TD : TAG_TH;
+      break;
+    case 3:
+      id = c_tolower (name[0]) == 'f' ? TAG_FIG : TAG_IMG;
+      break;
+    case 4:
+      switch (c_tolower (name[0]))
+        {
+        case 'a': id = TAG_AREA; break;
+        case 'b':
+          id = c_tolower (name[1]) == 'a' ? TAG_BASE : TAG_BODY;
+          break;
+        case 'f': id = TAG_FORM; break;
+        case 'l': id = TAG_LINK; break;
+        case 'm': id = TAG_META; break;
+        default: return -1;
+        }
+      break;
+    case 5:
+      switch (c_tolower (name[0]))
+        {
+        case 'a': id = TAG_AUDIO; break;
+        case 'e': id = TAG_EMBED; break;
+        case 'f': id = TAG_FRAME; break;
+        case 'i': id = TAG_INPUT; break;
+        case 'l': id = TAG_LAYER; break;
+        case 't': id = TAG_TABLE; break;
+        case 'v': id = TAG_VIDEO; break;
+        default: return -1;
+        }
+      break;
+    case 6:
+      switch (c_tolower (name[0]))
+        {
+        case 'a': id = TAG_APPLET; break;
+        case 'i': id = TAG_IFRAME; break;
+        case 'o': id = TAG_OBJECT; break;
+        case 's':
+          id = c_tolower (name[1]) == 'c' ? TAG_SCRIPT : TAG_SOURCE;
+          break;
+        default: return -1;
+        }
+      break;
+    case 7:
+      id = c_tolower (name[0]) == 'b' ? TAG_BGSOUND : TAG_OVERLAY;
+      break;
+    default:
+      return -1;
+    }
+  if (known_tags[id].name[len] != '\0'
+      || c_strncasecmp (name, known_tags[id].name, len) != 0)
+    return -1;
+  return id;
+}
+
+/* Return true if NAME, LEN characters long and not necessarily
+   NUL-terminated, is the name of an attribute we care about: one of
+   the attributes in tag_url_attributes, or one that the tag handlers
+   look at.  The HTML parser calls this for every attribute, so it
+   works like known_tag_id.  */
+
+static bool
+interesting_attribute (const char *name, int len)
+{
+  const char *attr;
+
+  switch (len)
+    {
+    case 3:
+      /* "rel" is used by tag_handle_link */
+      attr = c_tolower (name[0]) == 'r' ? "rel" : "src";
+      break;
+    case 4:
+      switch (c_tolower (name[0]))
+        {
+        case 'c': attr = "code"; break;
+        case 'd': attr = "data"; break;
+        case 'h': attr = "href"; break;
+        case 'n': attr = "name"; break; /* used by tag_handle_meta */
+        case 't': attr = "type"; break; /* used by tag_handle_link */
+        default: return false;
+        }
+      break;
+    case 5:
+      attr = "style";           /* used by check_style_attr */
+      break;
+    case 6:
+      switch (c_tolower (name[0]))
+        {
+        case 'a': attr = "action"; break; /* used by tag_handle_form */
+        case 'l': attr = "lowsrc"; break;
+        case 'p': attr = "poster"; break;
+        case 's': attr = "srcset"; break; /* used by tag_handle_img */
+        default: return false;
+        }
+      break;
+    case 7:
+      attr = "content";         /* used by tag_handle_meta */
+      break;
+    case 10:
+      /* "http-equiv" is used by tag_handle_meta */
+      attr = c_tolower (name[0]) == 'h' ? "http-equiv" : "background";
+      break;
+    default:
+      return false;
+    }
+  return c_strncasecmp (name, attr, len) == 0;
+}
+
 static void
 init_interesting (void)
 {
-  /* Init the variables interesting_tags and interesting_attributes
-     that are used by the HTML parser to know which tags and
-     attributes we're interested in.  We initialize this only once,
-     for performance reasons.
-
-     Here we also make sure that what we put in interesting_tags
-     matches the user's preferences as specified through --ignore-tags
-     and --follow-tags.  */
+  /* Init followed_tags, which tells collect_tags_mapper which of the
+     tags we know it should handle, according to the user's
+     preferences as specified through --ignore-tags and
+     --follow-tags.  We initialize this only once, for performance
+     reasons.  */
 
   size_t i;
-  interesting_tags = make_nocase_string_hash_table (countof (known_tags));
 
-  /* First, add all the tags we know hot to handle, mapped to their
-     respective entries in known_tags.  */
+  /* First, enable all the tags we know how to handle.  */
   for (i = 0; i < countof (known_tags); i++)
-    hash_table_put (interesting_tags, known_tags[i].name, known_tags + i);
+    followed_tags[i] = true;
 
-  /* Then remove the tags ignored through --ignore-tags.  */
+  /* Then disable the tags ignored through --ignore-tags.  */
   if (opt.ignore_tags)
     {
       char **ignored;
       for (ignored = opt.ignore_tags; *ignored; ignored++)
-        hash_table_remove (interesting_tags, *ignored);
+        {
+          int id = known_tag_id (*ignored, strlen (*ignored));
+          if (id != -1)
+            followed_tags[id] = false;
+        }
     }
 
   /* If --follow-tags is specified, use only those tags.  */
   if (opt.follow_tags)
     {
-      /* Create a new table intersecting --follow-tags and known_tags,
-         and use it as interesting_tags.  */
-      struct hash_table *intersect = make_nocase_string_hash_table (0);
+      /* Keep the tags both in --follow-tags and still enabled.  */
+      bool intersect[countof (known_tags)] = { false };
       char **followed;
       for (followed = opt.follow_tags; *followed; followed++)
         {
-          struct known_tag *t = hash_table_get (interesting_tags, *followed);
-          if (!t)
+          int id = known_tag_id (*followed, strlen (*followed));
+          if (id == -1)
             continue;           /* ignore unknown --follow-tags entries. */
-          hash_table_put (intersect, *followed, t);
+          intersect[id] = followed_tags[id];
         }
-      hash_table_destroy (interesting_tags);
-      interesting_tags = intersect;
+      memcpy (followed_tags, intersect, sizeof (followed_tags));
     }
 
-  /* Add the attributes we care about. */
-  interesting_attributes = make_nocase_string_hash_table (10);
-  for (i = 0; i < countof (additional_attributes); i++)
-    hash_table_put (interesting_attributes, additional_attributes[i], "1");
-  for (i = 0; i < countof (tag_url_attributes); i++)
-    hash_table_put (interesting_attributes,
-                    tag_url_attributes[i].attr_name, "1");
+  followed_tags_initialized = true;
 }
 
 /* Find the value of attribute named NAME in the taginfo TAG.  If the
@@ -767,17 +877,13 @@ collect_tags_mapper (struct taginfo *tag, void *arg)
 {
   struct map_context *ctx = (struct map_context *)arg;
 
-  /* Find the tag in our table of tags.  This must not fail because
-     map_html_tags only returns tags found in interesting_tags.
+  /* Find the tag in our table of tags.  map_html_tags returns all
+     tags, not only the ones we know, so that we can check all tags
+     for a style attribute.  */
+  int id = known_tag_id (tag->name, strlen (tag->name));
 
-     I've changed this for now, I'm passing NULL as interesting_tags
-     to map_html_tags.  This way we can check all tags for a style
-     attribute.
-  */
-  struct known_tag *t = hash_table_get (interesting_tags, tag->name);
-
-  if (t != NULL)
-    t->handler (t->tagid, tag, ctx);
+  if (id != -1 && followed_tags[id])
+    known_tags[id].handler (id, tag, ctx);
 
   check_style_attr (tag, ctx);
 
@@ -791,28 +897,29 @@ collect_tags_mapper (struct taginfo *tag, void *arg)
   }
 }
 
-/* Analyze HTML tags FILE and construct a list of URLs referenced from
-   it.  It merges relative links in FILE with URL.  It is aware of
-   <base href=...> and does the right thing.  */
+/* Set up CTX for collecting the links in the HTML text TEXT, the
+   contents of FILE, which is at URL.  */
 
-struct urlpos *
-get_urls_html_fm (const char *file, const struct file_memory *fm,
-                    const char *url, bool *meta_disallow_follow,
-                    struct iri *iri)
+static void
+map_context_init (struct map_context *ctx, char *text, const char *file,
+                  const char *url)
 {
-  struct map_context ctx;
-  int flags;
-
-  ctx.text = fm->content;
-  ctx.head = NULL;
-  ctx.base = NULL;
-  ctx.parent_base = url ? url : opt.base_href;
-  ctx.document_file = file;
-  ctx.nofollow = false;
-
-  if (!interesting_tags)
+  ctx->text = text;
+  ctx->head = NULL;
+  ctx->base = NULL;
+  ctx->parent_base = url ? url : opt.base_href;
+  ctx->document_file = file;
+  ctx->nofollow = false;
+
+  if (!followed_tags_initialized)
     init_interesting ();
+}
+
+/* The flags with which map_html_tags looks for links.  */
 
+static int
+map_context_flags (void)
+{
   /* Specify MHT_TRIM_VALUES because of buggy HTML generators that
      generate <a href=" foo"> instead of <a href="foo"> (browsers
      ignore spaces as well.)  If you really mean space, use &32; or
@@ -820,28 +927,249 @@ get_urls_html_fm (const char *file, const struct file_memory *fm,
      e.g. in <img src="foo.[newline]html">.  Such newlines are also
      ignored by IE and Mozilla and are presumably introduced by
      writing HTML with editors that force word wrap.  */
-  flags = MHT_TRIM_VALUES;
+  int flags = MHT_TRIM_VALUES;
   if (opt.strict_comments)
     flags |= MHT_STRICT_COMMENTS;
+  return flags;
+}
 
-  /* the NULL here used to be interesting_tags */
-  map_html_tags (fm->content, fm->length, collect_tags_mapper, &ctx, flags,
-                 NULL, interesting_attributes);
+/* Finish collecting links with CTX, and return them.  */
 
+static struct urlpos *
+map_context_finish (struct map_context *ctx, bool *meta_disallow_follow,
+                    struct iri *iri)
+{
 #ifdef ENABLE_IRI
   /* Meta charset is only valid if there was no HTTP header Content-Type charset. */
   /* This is true for HTTP 1.0 and 1.1. */
   if (iri && !iri->content_encoding && meta_charset)
     set_content_encoding (iri, meta_charset);
+#else
+  (void) iri;
 #endif
   xfree (meta_charset);
 
-  DEBUGP (("no-follow in %s: %d\n", file, ctx.nofollow));
+  DEBUGP (("no-follow in %s: %d\n", ctx->document_file, ctx->nofollow));
   if (meta_disallow_follow)
-    *meta_disallow_follow = ctx.nofollow;
+    *meta_disallow_follow = ctx->nofollow;
+
+  xfree (ctx->base);
+  return ctx->head;
+}
+
+/* Analyze HTML tags FILE and construct a list of URLs referenced from
+   it.  It merges relative links in FILE with URL.  It is aware of
+   <base href=...> and does the right thing.  */
+
+struct urlpos *
+get_urls_html_fm (const char *file, const struct file_memory *fm,
+                    const char *url, bool *meta_disallow_follow,
+                    struct iri *iri)
+{
+  struct map_context ctx;
+
+  map_context_init (&ctx, fm->content, file, url);
+
+  map_html_tags (fm->content, fm->length, collect_tags_mapper, &ctx,
+                 map_context_flags (), NULL, interesting_attribute);
+
+  return map_context_finish (&ctx, meta_disallow_follow, iri);
+}
+
+/* Links are looked for in an HTML page already while it is being
+   downloaded: fd_read_body hands what it writes to the file to
+   html_stream_feed, which scans the text as it grows.  The links are
+   reported as they are found, so that the hosts they are on can be
+   looked up while the rest of the page arrives, and get_urls_html
+   then finishes the scan in memory instead of reading the file back.
+   There is one such page at a time, set up by html_stream_begin.  */
+
+struct html_stream {
+  char *url;                    /* the URL the links are relative to */
+  char *file;                   /* the file the page is written to */
+  char *text;                   /* what has arrived so far */
+  int size, alloc;
+  int scanned;                  /* SIZE when the text was last scanned */
+  bool broken;                  /* some of the page went elsewhere */
+  struct map_context ctx;
+  struct html_scan scan;
+
+  /* Called with the links as they are found, and its argument.  */
+  void (*link_found) (const struct urlpos *, void *);
+  void *arg;
+  struct urlpos *last_found;    /* the last link it was called with */
+};
+
+static struct html_stream *stream;
+
+/* The text is scanned again once at least this much of it is new.  If
+   the last scan stopped at a tag it couldn't finish, the new text must
+   also be as long as what follows the beginning of that tag, so that
+   a long comment isn't scanned over and over.  */
+#define STREAM_SCAN_MIN (16 * 1024)
 
-  xfree (ctx.base);
-  return ctx.head;
+/* Forget the links found in the page so far.  */
+
+static void
+html_stream_drop_links (void)
+{
+  if (!stream->scanned)
+    return;
+  html_scan_free (&stream->scan);
+  xfree (meta_charset);
+  xfree (stream->ctx.base);
+  free_urlpos (stream->ctx.head);
+  stream->scanned = 0;
+  stream->last_found = NULL;
+}
+
+/* Forget what has arrived of the page so far.  */
+
+static void
+html_stream_reset (void)
+{
+  html_stream_drop_links ();
+  xfree (stream->file);
+  xfree (stream->text);
+  stream->size = stream->alloc = 0;
+}
+
+/* Scan the page for links, in the text that hasn't been scanned yet,
+   and report the new ones.  */
+
+static void
+html_stream_scan (void)
+{
+  struct urlpos *up;
+  int offset = stream->scan.offset;
+
+  if (!stream->scanned)
+    map_context_init (&stream->ctx, stream->text, stream->file, stream->url);
+  stream->ctx.text = stream->text;
+  stream->ctx.document_file = stream->file;
+  stream->scanned = stream->size;
+
+  map_html_tags_partial (stream->text, stream->size, false, &stream->scan,
+                         collect_tags_mapper, &stream->ctx,
+                         map_context_flags (), NULL, interesting_attribute);
+
+  if (!stream->link_found)
+    return;
+
+  /* The list is ordered by position; the links found after the last
+     one reported are new.  (The links in <style> contents come
+     before that point, and aren't reported.)  */
+  up = stream->last_found ? stream->last_found->next : stream->ctx.head;
+  for (; up; up = up->next)
+    if (up->pos >= offset)
+      {
+        stream->link_found (up, stream->arg);
+        stream->last_found = up;
+      }
+}
+
+/* Start looking for links in the HTML page to be downloaded from URL
+   next.  LINK_FOUND, if non-NULL, is called with each link found
+   while the page arrives, and with ARG.  */
+
+void
+html_stream_begin (const char *url,
+                   void (*link_found) (const struct urlpos *, void *),
+                   void *arg)
+{
+  html_stream_end ();
+  stream = xnew0 (struct html_stream);
+  stream->url = xstrdup (url);
+  stream->link_found = link_found;
+  stream->arg = arg;
+}
+
+/* Stop looking for links in the page set up with html_stream_begin.  */
+
+void
+html_stream_end (void)
+{
+  if (!stream)
+    return;
+  html_stream_reset ();
+  xfree (stream->url);
+  xfree (stream);
+}
+
+/* Add the SIZE bytes at BUF, which were just written to FILE at
+   offset POS, to the page being downloaded.  */
+
+void
+html_stream_feed (const char *file, wgint pos, const char *buf, int size)
+{
+  if (!stream || stream->broken || !size)
+    return;
+
+  /* A download of the page starting over.  */
+  if (pos == 0 && stream->size)
+    html_stream_reset ();
+
+  if (!stream->file)
+    stream->file = xstrdup (file);
+  if (pos != stream->size || strcmp (file, stream->file) != 0
+      || size > INT_MAX / 2 - stream->size)
+    {
+      DEBUGP (("Not scanning %s while it is downloaded.\n", file));
+      html_stream_reset ();
+      stream->broken = true;
+      return;
+    }
+
+  if (stream->size + size > stream->alloc)
+    {
+      stream->alloc = MAX (stream->alloc * 2, stream->size + size);
+      stream->alloc = MAX (stream->alloc, STREAM_SCAN_MIN);
+      stream->text = xrealloc (stream->text, stream->alloc);
+    }
+  memcpy (stream->text + stream->size, buf, size);
+  stream->size += size;
+
+  if (stream->size - stream->scanned >= MAX (STREAM_SCAN_MIN,
+                                             stream->scanned
+                                             - stream->scan.offset))
+    html_stream_scan ();
+}
+
+/* If the page set up with html_stream_begin was downloaded to FILE in
+   its entirety, return the links in it, as get_urls_html would, and
+   store true to *HANDLED.  */
+
+static struct urlpos *
+html_stream_finish (const char *file, const char *url,
+                    bool *meta_disallow_follow, struct iri *iri,
+                    bool *handled)
+{
+  struct urlpos *urls;
+
+  *handled = false;
+  if (!stream || stream->broken || !stream->file
+      || strcmp (file, stream->file) != 0
+      || file_size (file) != stream->size)
+    return NULL;
+
+  DEBUGP (("Scanned %s (size %s) while it was downloaded.\n", file,
+           number_to_static_string (stream->size)));
+  *handled = true;
+
+  /* After a redirection, the relative links are relative to where the
+     page turned out to be; scan it again from the start.  */
+  if (!url || strcmp (url, stream->url) != 0)
+    html_stream_drop_links ();
+
+  if (!stream->scanned)
+    map_context_init (&stream->ctx, stream->text, file, url);
+  stream->ctx.text = stream->text;
+  map_html_tags_partial (stream->text, stream->size, true, &stream->scan,
+                         collect_tags_mapper, &stream->ctx,
+                         map_context_flags (), NULL, interesting_attribute);
+  urls = map_context_finish (&stream->ctx, meta_disallow_follow, iri);
+  stream->scanned = 0;
+  return urls;
 }
 
 struct urlpos *
@@ -850,6 +1178,11 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 {
   struct urlpos *urls;
   struct file_memory *fm;
+  bool handled;
+
+  urls = html_stream_finish (file, url, meta_disallow_follow, iri, &handled);
+  if (handled)
+    return urls;
 
   fm = wget_read_file (file);
   if (!fm)
@@ -958,13 +1291,51 @@ get_urls_file (const char *file)
   return head;
 }
 
-void
-cleanup_html_url (void)
+#ifdef TESTING
+
+const char *
+test_known_names (void)
 {
-  /* Destroy the hash tables.  The hash table keys and values are not
-     allocated by this code, so we don't need to free them here.  */
-  if (interesting_tags)
-    hash_table_destroy (interesting_tags);
-  if (interesting_attributes)
-    hash_table_destroy (interesting_attributes);
+  unsigned i;
+  static const char *not_known[] = {
+    "", "b", "tr", "ab", "fog", "imgs", "bass", "stile", "SOURCES",
+    "overlaz", "http-equiw", "backgrounds"
+  };
+
+  for (i = 0; i < countof (known_tags); i++)
+    {
+      char *upper = xstrdup (known_tags[i].name);
+      char *p;
+
+      for (p = upper; *p; p++)
+        *p = c_toupper (*p);
+      mu_assert ("test_known_names: known tag ids out of order",
+                 known_tags[i].tagid == (int) i);
+      mu_assert ("test_known_names: known tag not found",
+                 known_tag_id (known_tags[i].name,
+                               strlen (known_tags[i].name)) == (int) i);
+      mu_assert ("test_known_names: known tag not found ignoring case",
+                 known_tag_id (upper, strlen (upper)) == (int) i);
+      xfree (upper);
+    }
+
+  for (i = 0; i < countof (tag_url_attributes); i++)
+    mu_assert ("test_known_names: URL attribute not found",
+               interesting_attribute (tag_url_attributes[i].attr_name,
+                                      strlen (tag_url_attributes[i].attr_name)));
+
+  for (i = 0; i < countof (not_known); i++)
+    mu_assert ("test_known_names: unknown name found",
+               known_tag_id (not_known[i], strlen (not_known[i])) == -1
+               && !interesting_attribute (not_known[i],
+                                          strlen (not_known[i])));
+
+  /* Only the prefix of the name counts.  */
+  mu_assert ("test_known_names: prefix not found",
+             known_tag_id ("imgx", 3) == TAG_IMG
+             && interesting_attribute ("srcset", 3));
+
+  return NULL;
 }
+
+#endif /* TESTING */
@@ -52,7 +52,10 @@ struct urlpos *get_urls_file (const char *);
 struct urlpos *get_urls_html (const char *, const char *, bool *, struct iri *);
 struct urlpos *get_urls_html_fm (const char *, const struct file_memory *, const char *, bool *, struct iri *);
 struct urlpos *append_url (const char *, int, int, struct map_context *);
+void html_stream_begin (const char *,
+                        void (*) (const struct urlpos *, void *), void *);
+void html_stream_feed (const char *, wgint, const char *, int);
+void html_stream_end (void);
 void free_urlpos (struct urlpos *);
-void cleanup_html_url (void);
 
 #endif /* HTML_URL_H */
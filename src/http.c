@@ -58,10 +58,12 @@ as that of the covered work.  */
 #include "cookies.h"
 #include "md5.h"
 #include "convert.h"
+#include "decoder.h"
 #include "spider.h"
 #include "warc.h"
 #include "c-strcase.h"
 #include "version.h"
+#include "segments.h"
 #ifdef HAVE_METALINK
 # include "metalink.h"
 # include "xstrndup.h"
@@ -320,33 +322,32 @@ request_remove_header (struct request *req, const char *name)
   p += A_len;                                   \
 } while (0)
 
-/* Construct the request and write it to FD using fd_write.
-   If warc_tmp is set to a file pointer, the request string will
-   also be written to that file. */
+/* Construct the request and return it as a string.  Its length,
+   including the terminating zero, is stored to *SIZE.  */
 
-static int
-request_send (const struct request *req, int fd, FILE *warc_tmp)
+static char *
+request_format (const struct request *req, int *size)
 {
   char *request_string, *p;
-  int i, size, write_error;
+  int i;
 
   /* Count the request size. */
-  size = 0;
+  *size = 0;
 
   /* METHOD " " ARG " " "HTTP/1.0" "\r\n" */
-  size += strlen (req->method) + 1 + strlen (req->arg) + 1 + 8 + 2;
+  *size += strlen (req->method) + 1 + strlen (req->arg) + 1 + 8 + 2;
 
   for (i = 0; i < req->hcount; i++)
     {
       struct request_header *hdr = &req->headers[i];
       /* NAME ": " VALUE "\r\n" */
-      size += strlen (hdr->name) + 2 + strlen (hdr->value) + 2;
+      *size += strlen (hdr->name) + 2 + strlen (hdr->value) + 2;
     }
 
   /* "\r\n\0" */
-  size += 3;
+  *size += 3;
 
-  p = request_string = xmalloc (size);
+  p = request_string = xmalloc (*size);
 
   /* Generate the request. */
 
@@ -364,10 +365,25 @@ request_send (const struct request *req, int fd, FILE *warc_tmp)
     }
 
   *p++ = '\r', *p++ = '\n', *p++ = '\0';
-  assert (p - request_string == size);
+  assert (p - request_string == *size);
 
 #undef APPEND
 
+  return request_string;
+}
+
+/* Construct the request and write it to FD using fd_write.
+   If warc_tmp is set to a file pointer, the request string will
+   also be written to that file. */
+
+static int
+request_send (const struct request *req, int fd, FILE *warc_tmp)
+{
+  char *request_string;
+  int size, write_error;
+
+  request_string = request_format (req, &size);
+
   DEBUGP (("\n---request begin---\n%s---request end---\n", request_string));
 
   /* Send the request to the server. */
@@ -961,7 +977,7 @@ skip_short_body (int fd, wgint contlen, bool chunked)
     SKIP_SIZE = 512,                /* size of the download buffer */
     SKIP_THRESHOLD = 4096        /* the largest size we read */
   };
-  wgint remaining_chunk_size = 0;
+  struct chunk_decoder cd;
   char dlbuf[SKIP_SIZE + 1];
   dlbuf[SKIP_SIZE] = '\0';        /* so DEBUGP can safely print it */
 
@@ -970,38 +986,24 @@ skip_short_body (int fd, wgint contlen, bool chunked)
   if (contlen > SKIP_THRESHOLD)
     return false;
 
+  if (chunked)
+    chunk_decoder_init (&cd);
+
   while (contlen > 0 || chunked)
     {
-      int ret;
+      int ret, len;
+
       if (chunked)
         {
-          if (remaining_chunk_size == 0)
-            {
-              char *line = fd_read_line (fd);
-              char *endl;
-              if (line == NULL)
-                break;
-
-              remaining_chunk_size = strtol (line, &endl, 16);
-              xfree (line);
-
-              if (remaining_chunk_size < 0)
-                return false;
-
-              if (remaining_chunk_size == 0)
-                {
-                  line = fd_read_line (fd);
-                  xfree (line);
-                  break;
-                }
-            }
-
-          contlen = MIN (remaining_chunk_size, SKIP_SIZE);
+          DEBUGP (("Skipping chunked body: ["));
+          ret = fd_read_chunked (fd, &cd, dlbuf, SKIP_SIZE, -1);
+        }
+      else
+        {
+          DEBUGP (("Skipping %s bytes of body: [",
+                   number_to_static_string (contlen)));
+          ret = fd_read (fd, dlbuf, MIN (contlen, SKIP_SIZE), -1);
         }
-
-      DEBUGP (("Skipping %s bytes of body: [", number_to_static_string (contlen)));
-
-      ret = fd_read (fd, dlbuf, MIN (contlen, SKIP_SIZE), -1);
       if (ret <= 0)
         {
           /* Don't normally report the error since this is an
@@ -1010,24 +1012,25 @@ skip_short_body (int fd, wgint contlen, bool chunked)
                    ret < 0 ? fd_errstr (fd) : "EOF received"));
           return false;
         }
-      contlen -= ret;
 
+      len = ret;
       if (chunked)
         {
-          remaining_chunk_size -= ret;
-          if (remaining_chunk_size == 0)
+          if (chunk_decode (&cd, dlbuf, ret, dlbuf, &len) < 0)
             {
-              char *line = fd_read_line (fd);
-              if (line == NULL)
-                return false;
-              else
-                xfree (line);
+              DEBUGP (("] aborting (malformed chunk).\n"));
+              return false;
             }
         }
+      else
+        contlen -= ret;
 
       /* Safe even if %.*s bogusly expects terminating \0 because
          we've zero-terminated dlbuf above.  */
-      DEBUGP (("%.*s", ret, dlbuf));
+      DEBUGP (("%.*s", len, dlbuf));
+
+      if (chunked && cd.state == CHUNK_DONE)
+        break;
     }
 
   DEBUGP (("] done.\n"));
@@ -1338,26 +1341,38 @@ parse_strict_transport_security (const char *header, time_t *max_age, bool *incl
 }
 #endif
 
-/* Persistent connections.  Currently, we cache the most recently used
-   connection as persistent, provided that the HTTP server agrees to
-   make it such.  The persistence data is stored in the variables
-   below.  Ideally, it should be possible to cache an arbitrary fixed
-   number of these connections.  */
+/* Persistent connections.  We cache up to MAX_PERSISTENT_CONNECTIONS
+   connections as persistent, provided that the HTTP servers agree to
+   make them such, so that a crawl alternating between several hosts
+   (say, a site and the host serving its images) doesn't have to
+   reconnect on each switch.  When all the slots are taken, the least
+   recently used connection is closed to make room for a new one.  */
+
+#define MAX_PERSISTENT_CONNECTIONS 8
 
-/* Whether a persistent connection is active. */
-static bool pconn_active;
+/* Connections left idle for longer than this many seconds are closed
+   rather than reused, as the server has most likely given up on them
+   by then.  */
+#define PERSISTENT_IDLE_TIMEOUT 60
+
+struct pconn {
+  /* Whether this slot holds a persistent connection.  */
+  bool active;
 
-static struct {
   /* The socket of the connection.  */
   int socket;
 
-  /* Host and port of the currently active persistent connection. */
+  /* Host and port the connection is to.  When a proxy is used for
+     plain HTTP, these are the host and port of the proxy.  */
   char *host;
   int port;
 
   /* Whether a ssl handshake has occurred on this connection.  */
   bool ssl;
 
+  /* When the connection was last registered or reused.  */
+  time_t last_used;
+
   /* Whether the connection was authorized.  This is only done by
      NTLM, which authorizes *connections* rather than individual
      requests.  (That practice is peculiar for HTTP, but it is a
@@ -1368,20 +1383,71 @@ static struct {
   /* NTLM data of the current connection.  */
   struct ntlmdata ntlm;
 #endif
-} pconn;
 
-/* Mark the persistent connection as invalid and free the resources it
-   uses.  This is used by the CLOSE_* macros after they forcefully
-   close a registered persistent connection.  */
+  /* Requests sent ahead on this connection whose responses have not
+     been read yet, oldest first (see pipeline_requests).  */
+  char *pipeline[HTTP_PIPELINE_DEPTH];
+  int pipeline_count;
+};
+
+static struct pconn pconn_slots[MAX_PERSISTENT_CONNECTIONS];
+
+/* The connection used by the current request.  This is the slot the
+   connection is registered in, or PCONN_NEW for a fresh connection
+   that hasn't been registered (yet).  */
+static struct pconn pconn_new;
+static struct pconn *pconn = &pconn_new;
+
+/* Return the slot FD is registered in, or NULL if it isn't.  */
+
+static struct pconn *
+persistent_lookup (int fd)
+{
+  int i;
+  for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+    if (pconn_slots[i].active && pconn_slots[i].socket == fd)
+      return &pconn_slots[i];
+  return NULL;
+}
+
+static void pipeline_drop (struct pconn *);
+
+/* Forget the persistent connections inherited from the parent process
+   without shutting them down, so that the parent can go on using
+   them.  Called in newly forked worker processes.  */
+
+void
+http_forget_connections (void)
+{
+  int i;
+
+  for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+    if (pconn_slots[i].active)
+      {
+        fd_forget (pconn_slots[i].socket);
+        pipeline_drop (&pconn_slots[i]);
+        xfree (pconn_slots[i].host);
+        xzero (pconn_slots[i]);
+      }
+  pconn = &pconn_new;
+}
+
+/* Mark the persistent connection in slot PC as invalid and free the
+   resources it uses.  This is used by the CLOSE_* macros after they
+   forcefully close a registered persistent connection.  */
 
 static void
-invalidate_persistent (void)
+invalidate_persistent (struct pconn *pc)
 {
-  DEBUGP (("Disabling further reuse of socket %d.\n", pconn.socket));
-  pconn_active = false;
-  fd_close (pconn.socket);
-  xfree (pconn.host);
-  xzero (pconn);
+  DEBUGP (("Disabling further reuse of socket %d.\n", pc->socket));
+  /* The requests sent ahead, if any, will be sent again on another
+     connection.  */
+  pipeline_drop (pc);
+  fd_close (pc->socket);
+  xfree (pc->host);
+  xzero (*pc);
+  if (pconn == pc)
+    pconn = &pconn_new;
 }
 
 /* Register FD, which should be a TCP/IP connection to HOST:PORT, as
@@ -1390,65 +1456,92 @@ invalidate_persistent (void)
    response has been received and the server has promised that the
    connection will remain alive.
 
-   If a previous connection was persistent, it is closed. */
+   If all the slots are in use, the least recently used connection is
+   closed. */
 
 static void
 register_persistent (const char *host, int port, int fd, bool ssl)
 {
-  if (pconn_active)
+  struct pconn *pc = persistent_lookup (fd);
+  int i;
+
+  if (pc)
     {
-      if (pconn.socket == fd)
-        {
-          /* The connection FD is already registered. */
-          return;
-        }
-      else
-        {
-          /* The old persistent connection is still active; close it
-             first.  This situation arises whenever a persistent
-             connection exists, but we then connect to a different
-             host, and try to register a persistent connection to that
-             one.  */
-          invalidate_persistent ();
-        }
+      /* The connection FD is already registered. */
+      pc->last_used = time (NULL);
+      return;
     }
 
-  pconn_active = true;
-  pconn.socket = fd;
-  pconn.host = xstrdup (host);
-  pconn.port = port;
-  pconn.ssl = ssl;
-  pconn.authorized = false;
+  for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+    if (!pconn_slots[i].active)
+      {
+        pc = &pconn_slots[i];
+        break;
+      }
+  if (!pc)
+    {
+      /* All the slots are taken; close the connection that has been
+         idle the longest.  */
+      pc = &pconn_slots[0];
+      for (i = 1; i < MAX_PERSISTENT_CONNECTIONS; i++)
+        if (pconn_slots[i].last_used < pc->last_used)
+          pc = &pconn_slots[i];
+      invalidate_persistent (pc);
+    }
+
+  /* Carry over the state gathered on the connection so far.  */
+  if (pconn == &pconn_new)
+    {
+      *pc = pconn_new;
+      xzero (pconn_new);
+    }
+  pconn = pc;
+
+  pc->active = true;
+  pc->socket = fd;
+  pc->host = xstrdup (host);
+  pc->port = port;
+  pc->ssl = ssl;
+  pc->last_used = time (NULL);
+  pc->authorized = false;
 
   DEBUGP (("Registered socket %d for persistent reuse.\n", fd));
 }
 
-/* Return true if a persistent connection is available for connecting
-   to HOST:PORT.  */
+/* Forget about the state of the previous connection before making a
+   new one, which is not (yet) registered as persistent.  */
 
-static bool
-persistent_available_p (const char *host, int port, bool ssl,
-                        bool *host_lookup_failed)
+static void
+persistent_new_connection (void)
 {
-  /* First, check whether a persistent connection is active at all.  */
-  if (!pconn_active)
-    return false;
+  xzero (pconn_new);
+  pconn = &pconn_new;
+}
+
+/* Return true if the persistent connection in slot PC can be used for
+   sending REQUEST to HOST:PORT.  AL holds the addresses HOST resolves
+   to, looked up on demand.  */
 
-  /* If we want SSL and the last connection wasn't or vice versa,
-     don't use it.  Checking for host and port is not enough because
-     HTTP and HTTPS can apparently coexist on the same port.  */
-  if (ssl != pconn.ssl)
+static bool
+persistent_matches_p (struct pconn *pc, const char *host, int port, bool ssl,
+                      const char *request, struct address_list **al,
+                      bool *host_lookup_failed)
+{
+  /* If we want SSL and the connection isn't or vice versa, don't use
+     it.  Checking for host and port is not enough because HTTP and
+     HTTPS can apparently coexist on the same port.  */
+  if (ssl != pc->ssl)
     return false;
 
   /* If we're not connecting to the same port, we're not interested. */
-  if (port != pconn.port)
+  if (port != pc->port)
     return false;
 
   /* If the host is the same, we're in business.  If not, there is
      still hope -- read below.  */
-  if (0 != strcasecmp (host, pconn.host))
+  if (0 != strcasecmp (host, pc->host))
     {
-      /* Check if pconn.socket is talking to HOST under another name.
+      /* Check if pc->socket is talking to HOST under another name.
          This happens often when both sites are virtual hosts
          distinguished only by name and served by the same network
          interface, and hence the same web server (possibly set up by
@@ -1456,9 +1549,7 @@ persistent_available_p (const char *host, int port, bool ssl,
          admittedly unconventional optimization does not contradict
          HTTP and works well with popular server software.  */
 
-      bool found;
       ip_address ip;
-      struct address_list *al;
 
       if (ssl)
         /* Don't try to talk to two different SSL sites over the same
@@ -1466,35 +1557,52 @@ persistent_available_p (const char *host, int port, bool ssl,
            name-based virtual hosting is even possible with SSL.)  */
         return false;
 
-      /* If pconn.socket's peer is one of the IP addresses HOST
-         resolves to, pconn.socket is for all intents and purposes
+      /* If pc->socket's peer is one of the IP addresses HOST
+         resolves to, pc->socket is for all intents and purposes
          already talking to HOST.  */
 
-      if (!socket_ip_address (pconn.socket, &ip, ENDPOINT_PEER))
+      if (!socket_ip_address (pc->socket, &ip, ENDPOINT_PEER))
         {
           /* Can't get the peer's address -- something must be very
              wrong with the connection.  */
-          invalidate_persistent ();
+          invalidate_persistent (pc);
           return false;
         }
-      al = lookup_host (host, 0);
-      if (!al)
+      if (!*al)
         {
-          *host_lookup_failed = true;
-          return false;
+          *al = lookup_host (host, 0);
+          if (!*al)
+            {
+              *host_lookup_failed = true;
+              return false;
+            }
         }
 
-      found = address_list_contains (al, &ip);
-      address_list_release (al);
-
-      if (!found)
+      if (!address_list_contains (*al, &ip))
         return false;
 
       /* The persistent connection's peer address was found among the
-         addresses HOST resolved to; therefore, pconn.sock is in fact
+         addresses HOST resolved to; therefore, pc->socket is in fact
          already talking to HOST -- no need to reconnect.  */
     }
 
+  if (pc->pipeline_count)
+    {
+      /* Responses to the requests sent ahead are on their way, so
+         the connection can only be used for the first of those.  */
+      if (request && 0 == strcmp (request, pc->pipeline[0]))
+        return true;
+      if (0 == strcasecmp (host, pc->host))
+        {
+          /* We're not going to ask for that document after all, so
+             the connection is of no further use.  */
+          DEBUGP (("Request does not match the one sent ahead on "
+                   "socket %d.\n", pc->socket));
+          invalidate_persistent (pc);
+        }
+      return false;
+    }
+
   /* Finally, check whether the connection is still open.  This is
      important because most servers implement liberal (short) timeout
      on persistent connections.  Wget can of course always reconnect
@@ -1508,18 +1616,169 @@ persistent_available_p (const char *host, int port, bool ssl,
      body in response to HEAD, or if it sends more than conent-length
      data, we won't reuse the corrupted connection.)  */
 
-  if (!test_socket_open (pconn.socket))
+  if (!test_socket_open (pc->socket))
     {
       /* Oops, the socket is no longer open.  Now that we know that,
          let's invalidate the persistent connection before returning
          0.  */
-      invalidate_persistent ();
+      invalidate_persistent (pc);
       return false;
     }
 
   return true;
 }
 
+/* Return true if a persistent connection is available for sending
+   REQUEST, which may be NULL, to HOST:PORT.  If so, it becomes the
+   connection of the current request, and *REQUEST_SENT tells whether
+   REQUEST has already been sent on it.  */
+
+static bool
+persistent_available_p (const char *host, int port, bool ssl,
+                        const char *request, bool *request_sent,
+                        bool *host_lookup_failed)
+{
+  struct address_list *al = NULL;
+  struct pconn *found = NULL;
+  time_t now = time (NULL);
+  int i, pass;
+
+  /* Close the connections that have been idle for too long.  */
+  for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+    if (pconn_slots[i].active
+        && now - pconn_slots[i].last_used > PERSISTENT_IDLE_TIMEOUT)
+      invalidate_persistent (&pconn_slots[i]);
+
+  /* Prefer a connection to HOST itself over one that merely talks to
+     the same address; only the latter requires looking HOST up.  */
+  for (pass = 0; pass < 2 && !found && !*host_lookup_failed; pass++)
+    for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+      {
+        struct pconn *pc = &pconn_slots[i];
+        if (!pc->active
+            || (pass == 0) != (0 == strcasecmp (host, pc->host)))
+          continue;
+        if (persistent_matches_p (pc, host, port, ssl, request, &al,
+                                  host_lookup_failed))
+          {
+            found = pc;
+            break;
+          }
+        if (*host_lookup_failed)
+          break;
+      }
+
+  if (al)
+    address_list_release (al);
+
+  if (!found)
+    return false;
+
+  found->last_used = now;
+  pconn = found;
+  *request_sent = found->pipeline_count > 0;
+  return true;
+}
+
+/* HTTP/1.1 pipelining.  With --http-pipelining, the requests for the
+   documents the caller expects to retrieve next (see
+   http_pipeline_hints) are sent ahead on a persistent connection
+   while the response to the current request is still on its way.
+   Each connection remembers the exact requests sent ahead on it, and
+   a later request is only served from the connection if it matches
+   the oldest of those byte for byte; otherwise the connection is
+   dropped and the request is sent on a fresh one.  */
+
+/* The URLs expected to be retrieved after the current one, and their
+   referrers.  */
+static char *pipeline_hint_urls[HTTP_PIPELINE_DEPTH];
+static char *pipeline_hint_referers[HTTP_PIPELINE_DEPTH];
+static int pipeline_hint_count;
+
+/* Set of "HOST:PORT" strings of the servers that lost responses to
+   pipelined requests.  */
+static struct hash_table *pipeline_refused;
+
+/* Set the URLs to be retrieved after the current one to the COUNT
+   elements of URLS, requested with the respective REFERERS.  */
+
+void
+http_pipeline_hints (const char **urls, const char **referers, int count)
+{
+  int i;
+
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      xfree (pipeline_hint_urls[i]);
+      xfree (pipeline_hint_referers[i]);
+    }
+  pipeline_hint_count = MIN (count, HTTP_PIPELINE_DEPTH);
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      pipeline_hint_urls[i] = xstrdup (urls[i]);
+      pipeline_hint_referers[i] = referers[i] ? xstrdup (referers[i]) : NULL;
+    }
+}
+
+/* Forget about the requests sent ahead on the connection in PC.  */
+
+static void
+pipeline_drop (struct pconn *pc)
+{
+  int i;
+  for (i = 0; i < pc->pipeline_count; i++)
+    xfree (pc->pipeline[i]);
+  pc->pipeline_count = 0;
+}
+
+/* Called when the response to the oldest request sent ahead on FD has
+   arrived.  */
+
+static void
+pipeline_pop (int fd)
+{
+  struct pconn *pc = persistent_lookup (fd);
+
+  if (!pc || !pc->pipeline_count)
+    return;
+  xfree (pc->pipeline[0]);
+  --pc->pipeline_count;
+  memmove (pc->pipeline, pc->pipeline + 1,
+           pc->pipeline_count * sizeof (pc->pipeline[0]));
+}
+
+/* Stop pipelining requests to HOST:PORT.  */
+
+static void
+pipeline_refuse (const char *host, int port)
+{
+  char *hostport = aprintf ("%s:%d", host, port);
+
+  if (!pipeline_refused)
+    pipeline_refused = make_nocase_string_hash_table (0);
+  if (!string_set_contains (pipeline_refused, hostport))
+    {
+      logprintf (LOG_VERBOSE, _("Disabling pipelining for %s.\n"),
+                 quotearg_style (escape_quoting_style, hostport));
+      string_set_add (pipeline_refused, hostport);
+    }
+  xfree (hostport);
+}
+
+static bool
+pipeline_refused_p (const char *host, int port)
+{
+  char *hostport;
+  bool refused;
+
+  if (!pipeline_refused)
+    return false;
+  hostport = aprintf ("%s:%d", host, port);
+  refused = string_set_contains (pipeline_refused, hostport);
+  xfree (hostport);
+  return refused;
+}
+
 /* The idea behind these two CLOSE macros is to distinguish between
    two cases: one when the job we've been doing is finished, and we
    want to close the connection and leave, and two when something is
@@ -1532,14 +1791,15 @@ persistent_available_p (const char *host, int port, bool ssl,
    Note that the semantics of the flag `keep_alive' is "this
    connection *will* be reused (the server has promised not to close
    the connection once we're done)", while the semantics of
-   `pc_active_p && (fd) == pc_last_fd' is "we're *now* using an
-   active, registered connection".  */
+   `persistent_lookup (fd) != NULL' is "we're *now* using an active,
+   registered connection".  */
 
 #define CLOSE_FINISH(fd) do {                   \
   if (!keep_alive)                              \
     {                                           \
-      if (pconn_active && (fd) == pconn.socket) \
-        invalidate_persistent ();               \
+      struct pconn *pc_ = persistent_lookup (fd); \
+      if (pc_)                                  \
+        invalidate_persistent (pc_);            \
       else                                      \
           fd_close (fd);                        \
       fd = -1;                                  \
@@ -1547,8 +1807,9 @@ persistent_available_p (const char *host, int port, bool ssl,
 } while (0)
 
 #define CLOSE_INVALIDATE(fd) do {               \
-  if (pconn_active && (fd) == pconn.socket)     \
-    invalidate_persistent ();                   \
+  struct pconn *pc_ = persistent_lookup (fd);   \
+  if (pc_)                                      \
+    invalidate_persistent (pc_);                \
   else                                          \
     fd_close (fd);                              \
   fd = -1;                                      \
@@ -1561,7 +1822,8 @@ typedef enum
   ENC_GZIP,                     /* gzip compression */
   ENC_DEFLATE,                  /* deflate compression */
   ENC_COMPRESS,                 /* compress compression */
-  ENC_BROTLI                    /* brotli compression */
+  ENC_BROTLI,                   /* brotli compression */
+  ENC_ZSTD                      /* zstd compression */
 } encoding_t;
 
 struct http_stat
@@ -1631,6 +1893,100 @@ File %s already there; not retrieving.\n\n"), quote (filename));
     *dt |= TEXTHTML;
 }
 
+/* Whether a document of content type TYPE is HTML.  If content-type
+   is not given, assume text/html.  This is because of the multitude of
+   broken CGI's that "forget" to generate the content-type.  */
+static bool
+html_type_p (const char *type)
+{
+  return (!type ||
+          0 == c_strcasecmp (type, TEXTHTML_S) ||
+          0 == c_strcasecmp (type, TEXTXHTML_S));
+}
+
+#ifdef HAVE_CONTENT_DECODING
+/* Return the rb_compressed_* flag of fd_read_body that decodes
+   ENCODING, or 0 if it can't be decoded.  */
+
+static int
+encoding_decoder (encoding_t encoding)
+{
+  int flag;
+
+  switch (encoding)
+    {
+    case ENC_GZIP:
+      flag = rb_compressed_gzip;
+      break;
+    case ENC_DEFLATE:
+      flag = rb_compressed_deflate;
+      break;
+    case ENC_BROTLI:
+      flag = rb_compressed_brotli;
+      break;
+    case ENC_ZSTD:
+      flag = rb_compressed_zstd;
+      break;
+    default:
+      return 0;
+    }
+  return decoder_available_p (flag) ? flag : 0;
+}
+
+/* Files in the compressed formats, which broken servers serve with a
+   Content-Encoding of their own format.  */
+static const struct {
+  encoding_t encoding;
+  const char *subtype;          /* of the Content-Type */
+  const char *suffixes[2];
+} compressed_formats[] = {
+  { ENC_GZIP, "gzip", { ".gz", ".tgz" } },
+  { ENC_BROTLI, NULL, { ".br", NULL } },
+  { ENC_ZSTD, "zstd", { ".zst", NULL } },
+};
+
+/* Return true if the Content-Type TYPE says that the response is a
+   file compressed with ENCODING, such as application/x-gzip.  */
+
+static bool
+compressed_type_p (encoding_t encoding, const char *type)
+{
+  const char *p;
+  size_t i;
+
+  if (!type || (p = strchr (type, '/')) == NULL)
+    return false;
+  p++;
+  if (c_tolower(p[0]) == 'x' && p[1] == '-')
+    p += 2;
+  for (i = 0; i < countof (compressed_formats); i++)
+    if (compressed_formats[i].encoding == encoding)
+      return compressed_formats[i].subtype
+        && 0 == c_strcasecmp (p, compressed_formats[i].subtype);
+  return false;
+}
+
+/* Return true if FILE has the suffix of files compressed with
+   ENCODING, such as '.gz' or '.tgz'.  */
+
+static bool
+compressed_file_p (encoding_t encoding, const char *file)
+{
+  const char *p = strrchr (file, '.');
+  size_t i, j;
+
+  if (!p)
+    return false;
+  for (i = 0; i < countof (compressed_formats); i++)
+    if (compressed_formats[i].encoding == encoding)
+      for (j = 0; j < countof (compressed_formats[i].suffixes); j++)
+        if (compressed_formats[i].suffixes[j]
+            && 0 == c_strcasecmp (p, compressed_formats[i].suffixes[j]))
+          return true;
+  return false;
+}
+#endif /* HAVE_CONTENT_DECODING */
+
 /* Download the response body from the socket and writes it to
    an output file.  The headers have already been read from the
    socket.  If WARC is enabled, the response body will also be
@@ -1708,9 +2064,12 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     flags |= rb_skip_startpos;
   if (chunked_transfer_encoding)
     flags |= rb_chunked_transfer_encoding;
+  if (fp != NULL && html_type_p (type))
+    flags |= rb_html;
 
-  if (hs->remote_encoding == ENC_GZIP)
-    flags |= rb_compressed_gzip;
+#ifdef HAVE_CONTENT_DECODING
+  flags |= encoding_decoder (hs->remote_encoding);
+#endif
 
   hs->len = hs->restval;
   hs->rd_size = 0;
@@ -1905,12 +2264,12 @@ initialize_request (const struct url *u, struct http_stat *hs, int *dt, struct u
                         rel_value);
   SET_USER_AGENT (req);
   request_set_header (req, "Accept", "*/*", rel_none);
-#ifdef HAVE_LIBZ
-  if (opt.compression != compression_none)
-    request_set_header (req, "Accept-Encoding", "gzip", rel_none);
-  else
+#ifdef HAVE_CONTENT_DECODING
+  request_set_header (req, "Accept-Encoding", decoder_accept_encoding (),
+                      rel_none);
+#else
+  request_set_header (req, "Accept-Encoding", "identity", rel_none);
 #endif
-    request_set_header (req, "Accept-Encoding", "identity", rel_none);
 
   /* Find the username with priority */
   if (u->user)
@@ -2014,6 +2373,118 @@ initialize_request (const struct url *u, struct http_stat *hs, int *dt, struct u
   return req;
 }
 
+/* Add the cookies to be sent to U and the user-specified headers to
+   REQ.  */
+
+static void
+add_cookie_and_user_headers (const struct url *u, struct request *req)
+{
+  if (opt.cookies)
+    request_set_header (req, "Cookie",
+                        cookie_header (wget_cookie_jar,
+                                       u->host, u->port, u->path,
+#ifdef HAVE_SSL
+                                       u->scheme == SCHEME_HTTPS
+#else
+                                       0
+#endif
+                                       ),
+                        rel_value);
+
+  /* Add the user headers. */
+  if (opt.user_headers)
+    {
+      int i;
+      for (i = 0; opt.user_headers[i]; i++)
+        request_set_user_header (req, opt.user_headers[i]);
+    }
+}
+
+/* Send the requests for the hinted URLs on the same server as U ahead
+   on the persistent connection SOCK, as far as they haven't been sent
+   already.  */
+
+static void
+pipeline_requests (const struct url *u, int sock)
+{
+  struct pconn *pc = persistent_lookup (sock);
+  int i;
+
+  if (!pc || pc->authorized || pipeline_refused_p (pc->host, pc->port))
+    return;
+
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      struct http_stat hs;
+      struct request *req;
+      struct url *hu;
+      char *user, *passwd, *request;
+      bool basic_auth_finished = false;
+      wgint body_data_size = 0;
+      uerr_t ret;
+      int dt, size, j;
+
+      if (pc->pipeline_count >= HTTP_PIPELINE_DEPTH)
+        break;
+
+      hu = url_parse (pipeline_hint_urls[i], NULL, NULL, true);
+      if (!hu)
+        continue;
+      if (hu->scheme != u->scheme || hu->port != u->port
+          || 0 != strcasecmp (hu->host, u->host))
+        {
+          url_free (hu);
+          continue;
+        }
+
+      /* Build the request just like gethttp will for the first
+         attempt at retrieving HU.  */
+      xzero (hs);
+      hs.referer = pipeline_hint_referers[i];
+      dt = opt.allow_cache ? 0 : SEND_NOCACHE;
+      req = initialize_request (hu, &hs, &dt, NULL, false,
+                                &basic_auth_finished, &body_data_size,
+                                &user, &passwd, &ret);
+      if (!req)
+        {
+          url_free (hu);
+          continue;
+        }
+      if (user || passwd)
+        {
+          /* Leave authentication to the serial code.  */
+          request_free (&req);
+          url_free (hu);
+          continue;
+        }
+      add_cookie_and_user_headers (hu, req);
+      request = request_format (req, &size);
+      request_free (&req);
+      url_free (hu);
+
+      for (j = 0; j < pc->pipeline_count; j++)
+        if (0 == strcmp (request, pc->pipeline[j]))
+          break;
+      if (j < pc->pipeline_count)
+        {
+          /* Already sent.  */
+          xfree (request);
+          continue;
+        }
+
+      DEBUGP (("\n---request begin (pipelined)---\n%s---request end---\n",
+               request));
+      if (fd_write (sock, request, size - 1, -1) < 0)
+        {
+          /* The connection is broken; the serial code will find out
+             about it soon enough.  */
+          xfree (request);
+          break;
+        }
+      pc->pipeline[pc->pipeline_count++] = request;
+    }
+}
+
 static void
 initialize_proxy_configuration (const struct url *u, struct request *req,
                                 struct url *proxy, char **proxyauth)
@@ -2051,7 +2522,7 @@ establish_connection (const struct url *u, const struct url **conn_ref,
                       struct http_stat *hs, struct url *proxy,
                       char **proxyauth,
                       struct request **req_ref, bool *using_ssl,
-                      bool inhibit_keep_alive,
+                      bool inhibit_keep_alive, bool *request_sent,
                       int *sock_ref)
 {
   bool host_lookup_failed = false;
@@ -2069,34 +2540,45 @@ establish_connection (const struct url *u, const struct url **conn_ref,
          case the proxy is nothing but a passthrough to the target
          host, registered as a connection to the latter.  */
       const struct url *relevant = conn;
+      char *request = NULL;
+      bool available;
 #ifdef HAVE_SSL
       if (u->scheme == SCHEME_HTTPS)
         relevant = u;
 #endif
 
-      if (persistent_available_p (relevant->host, relevant->port,
+      if (opt.http_pipelining)
+        {
+          int size;
+          request = request_format (req, &size);
+        }
+      available = persistent_available_p (relevant->host, relevant->port,
 #ifdef HAVE_SSL
-                                  relevant->scheme == SCHEME_HTTPS,
+                                          relevant->scheme == SCHEME_HTTPS,
 #else
-                                  0,
+                                          0,
 #endif
-                                  &host_lookup_failed))
+                                          request, request_sent,
+                                          &host_lookup_failed);
+      xfree (request);
+
+      if (available)
         {
-          int family = socket_family (pconn.socket, ENDPOINT_PEER);
-          sock = pconn.socket;
-          *using_ssl = pconn.ssl;
+          int family = socket_family (pconn->socket, ENDPOINT_PEER);
+          sock = pconn->socket;
+          *using_ssl = pconn->ssl;
 #if ENABLE_IPV6
           if (family == AF_INET6)
              logprintf (LOG_VERBOSE, _("Reusing existing connection to [%s]:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                         pconn.port);
+                        quotearg_style (escape_quoting_style, pconn->host),
+                         pconn->port);
           else
 #endif
              logprintf (LOG_VERBOSE, _("Reusing existing connection to %s:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                        pconn.port);
+                        quotearg_style (escape_quoting_style, pconn->host),
+                        pconn->port);
           DEBUGP (("Reusing fd %d.\n", sock));
-          if (pconn.authorized)
+          if (pconn->authorized)
             /* If the connection is already authorized, the "Basic"
                authorization added by code above is unnecessary and
                only hurts us.  */
@@ -2117,6 +2599,7 @@ establish_connection (const struct url *u, const struct url **conn_ref,
 
   if (sock < 0)
     {
+      persistent_new_connection ();
       sock = connect_to_host (conn->host, conn->port);
       if (sock == E_HOST)
         return HOSTERR;
@@ -2205,7 +2688,7 @@ establish_connection (const struct url *u, const struct url **conn_ref,
 
       if (conn->scheme == SCHEME_HTTPS)
         {
-          if (!ssl_connect_wget (sock, u->host, NULL))
+          if (!ssl_connect_wget (sock, u->host, u->port, NULL))
             {
               CLOSE_INVALIDATE (sock);
               return CONSSLERR;
@@ -2585,12 +3068,7 @@ open_output_stream (struct http_stat *hs, int count, FILE **fp)
 static void
 set_content_type (int *dt, const char *type)
 {
-  /* If content-type is not given, assume text/html.  This is because
-     of the multitude of broken CGI's that "forget" to generate the
-     content-type.  */
-  if (!type ||
-      0 == c_strcasecmp (type, TEXTHTML_S) ||
-      0 == c_strcasecmp (type, TEXTXHTML_S))
+  if (html_type_p (type))
     *dt |= TEXTHTML;
   else
     *dt &= ~TEXTHTML;
@@ -3107,6 +3585,324 @@ fail:
 }
 #endif /* HAVE_METALINK */
 
+/* Return true if the requests for the documents hinted at by
+   http_pipeline_hints may be sent ahead while retrieving a document
+   with the flags in DT through PROXY.  Only plain GET requests whose
+   outcome doesn't depend on the local files are sent ahead.  */
+
+static bool
+http_pipelining_possible (const struct url *proxy, const int *dt)
+{
+  return opt.http_pipelining && pipeline_hint_count > 0
+    && opt.http_keep_alive && !opt.ignore_length
+    && !proxy && !(*dt & (HEAD_ONLY | IF_MODIFIED_SINCE))
+    && !opt.method && !opt.spider && !opt.timestamping && !opt.always_rest
+    && opt.start_pos < 0 && !opt.wait && !opt.warc_filename
+#ifdef HAVE_METALINK
+    && !opt.metalink_over_http
+#endif
+    ;
+}
+
+/* Set when the server didn't honor the range requests of a segmented
+   download, so that http_loop doesn't try that again.  */
+static bool segments_refused;
+
+/* Retrieve bytes START through END of the document at U into FP,
+   through PROXY unless it is NULL, and store the number of bytes
+   written to *WRITTEN.  If the server redirects, the new location is
+   stored to *NEWLOC and NEWLOCATION is returned.  */
+
+static uerr_t
+fetch_range (const struct url *u, struct url *proxy, const char *referer,
+             FILE *fp, wgint start, wgint end, wgint *written, char **newloc)
+{
+  const struct url *conn = u;
+  struct http_stat hs;
+  struct request *req;
+  struct response *resp = NULL;
+  char *head = NULL, *message = NULL;
+  char *user, *passwd, *proxyauth = NULL;
+  char hdrval[256];
+  bool basic_auth_finished = false, using_ssl = false, request_sent = false;
+  bool inhibit_keep_alive = !opt.http_keep_alive;
+  bool keep_alive = !inhibit_keep_alive;
+  wgint body_data_size = 0, first, last, entity;
+  wgint rd_size = 0;
+  int dt = 0, sock = -1, statcode, res;
+  uerr_t err;
+
+  *written = 0;
+  xzero (hs);
+  hs.referer = referer;
+
+  req = initialize_request (u, &hs, &dt, proxy, inhibit_keep_alive,
+                            &basic_auth_finished, &body_data_size,
+                            &user, &passwd, &err);
+  if (!req)
+    return err;
+  request_set_header (req, "Range",
+                      aprintf ("bytes=%s-%s", number_to_static_string (start),
+                               number_to_static_string (end)),
+                      rel_value);
+  request_set_header (req, "Accept-Encoding", "identity", rel_none);
+  add_cookie_and_user_headers (u, req);
+  if (proxy)
+    {
+      conn = proxy;
+      initialize_proxy_configuration (u, req, proxy, &proxyauth);
+    }
+
+  err = establish_connection (u, &conn, &hs, proxy, &proxyauth, &req,
+                              &using_ssl, inhibit_keep_alive, &request_sent,
+                              &sock);
+  if (err != RETROK)
+    goto cleanup;
+
+  if (request_send (req, sock, NULL) < 0)
+    {
+      CLOSE_INVALIDATE (sock);
+      err = WRITEFAILED;
+      goto cleanup;
+    }
+
+  do
+    {
+      xfree (head);
+      resp_free (&resp);
+      xfree (message);
+      head = read_http_response_head (sock);
+      if (!head)
+        {
+          CLOSE_INVALIDATE (sock);
+          err = errno == 0 ? HEOF : HERR;
+          goto cleanup;
+        }
+      resp = resp_new (head);
+      statcode = resp_status (resp, &message);
+    }
+  while (H_10X (statcode));
+
+  if (H_REDIRECTED (statcode)
+      && (*newloc = resp_header_strdup (resp, "Location")) != NULL)
+    {
+      CLOSE_INVALIDATE (sock);
+      err = NEWLOCATION;
+      goto cleanup;
+    }
+
+  if (statcode != HTTP_STATUS_PARTIAL_CONTENTS
+      || !resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval))
+      || !parse_content_range (hdrval, &first, &last, &entity)
+      || first != start || last != end)
+    {
+      logprintf (LOG_NOTQUIET, _("%s: unexpected response to range request: "
+                                 "%d %s\n"),
+                 u->url, statcode, message ? message : "");
+      CLOSE_INVALIDATE (sock);
+      /* Errors other than the server disregarding the range are
+         worth retrying.  */
+      err = (statcode == HTTP_STATUS_OK || H_PARTIAL (statcode)
+             ? RANGEERR : HERR);
+      goto cleanup;
+    }
+
+  if (!inhibit_keep_alive
+      && resp_header_copy (resp, "Connection", hdrval, sizeof (hdrval))
+      && 0 == c_strcasecmp (hdrval, "Close"))
+    keep_alive = false;
+  if (keep_alive)
+    register_persistent (conn->host, conn->port, sock, using_ssl);
+
+  res = fd_read_body (u->url, sock, fp, end - start + 1, 0, &rd_size,
+                      written, NULL, rb_read_exactly, NULL);
+  if (res >= 0)
+    {
+      CLOSE_FINISH (sock);
+      err = RETRFINISHED;
+    }
+  else
+    {
+      CLOSE_INVALIDATE (sock);
+      err = res == -2 ? FWRITEERR : READERR;
+    }
+
+ cleanup:
+  xfree (head);
+  xfree (message);
+  resp_free (&resp);
+  request_free (&req);
+  free_hstat (&hs);
+  return err;
+}
+
+/* Retrieve bytes START through END of the document at U into FP, as a
+   piece of a segmented download, following redirections.  PROXY and
+   REFERER are as for the retrieval of U as a whole.  Authorization
+   other than Basic isn't attempted.  */
+
+uerr_t
+http_fetch_range (const struct url *u, struct url *proxy, const char *referer,
+                  FILE *fp, wgint start, wgint end, wgint *written)
+{
+  struct url *redirected = NULL;
+  int redirections = 0;
+  uerr_t err;
+
+  /* The pieces of a Metalink file may be requested before anything
+     went through http_loop.  */
+  if (opt.cookies)
+    load_cookies ();
+
+  for (;;)
+    {
+      char *newloc = NULL, *merged;
+      struct url *newurl;
+      int up_error_code;
+
+      err = fetch_range (redirected ? redirected : u, proxy, referer, fp,
+                         start, end, written, &newloc);
+      if (err != NEWLOCATION)
+        break;
+
+      merged = uri_merge ((redirected ? redirected : u)->url, newloc);
+      xfree (newloc);
+      newurl = url_parse (merged, &up_error_code, NULL, true);
+      xfree (merged);
+      if (!newurl || ++redirections > opt.max_redirect
+          || (newurl->scheme != SCHEME_HTTP
+#ifdef HAVE_SSL
+              && newurl->scheme != SCHEME_HTTPS
+#endif
+              ))
+        {
+          url_free (newurl);
+          err = WRONGCODE;
+          break;
+        }
+      url_free (redirected);
+      redirected = newurl;
+    }
+  url_free (redirected);
+  return err;
+}
+
+/* What the worker processes of a segmented download need to know to
+   request the pieces.  */
+struct segment_closure {
+  const struct url *u;
+  struct url *proxy;
+  const char *referer;
+};
+
+/* The fetch callback of the segmented downloads started by
+   http_loop.  */
+
+static uerr_t
+http_fetch_segment (void *closure, int source, FILE *fp, wgint start,
+                    wgint end, wgint *written)
+{
+  struct segment_closure *sc = closure;
+
+  (void) source;
+  return http_fetch_range (sc->u, sc->proxy, sc->referer, fp, start, end,
+                           written);
+}
+
+/* Return true if the document about to be retrieved into HS, CONTLEN
+   bytes long, should be retrieved by a segmented download.  */
+
+static bool
+segmented_download_p (const struct http_stat *hs, const struct response *resp,
+                      int statcode, wgint contlen, wgint contrange,
+                      bool chunked_transfer_encoding)
+{
+#if !defined(WINDOWS) && !defined(MSDOS)
+  char hdrval[32];
+
+  return opt.segments > 1 && !segments_refused
+    && statcode == HTTP_STATUS_OK && contrange == 0 && hs->restval == 0
+    && contlen >= SEGMENTS_MIN_LENGTH && !chunked_transfer_encoding
+    && hs->local_encoding == ENC_NONE && hs->remote_encoding == ENC_NONE
+    && !output_stream && !opt.warc_filename && !opt.spider
+    && !opt.save_headers && !opt.method
+    && resp_header_copy (resp, "Accept-Ranges", hdrval, sizeof (hdrval))
+    && 0 == c_strcasecmp (hdrval, "bytes");
+#else
+  /* Segmented downloads need fork.  */
+  return false;
+#endif
+}
+
+/* Retrieve U, CONTLEN bytes long, into HS->local_file by a segmented
+   download.  The local file is created at its full size first, unless
+   an earlier segmented download of the same document is resumed.  */
+
+static uerr_t
+http_segmented_download (const struct url *u, struct url *original_url,
+                         struct url *proxy, struct http_stat *hs,
+                         wgint contlen, int count)
+{
+  struct segment_closure sc;
+  struct segment_params sp;
+  uerr_t err;
+
+  if (segments_resume_p (hs->local_file, u->url, contlen))
+    logprintf (LOG_VERBOSE, _("Resuming segmented download of %s\n"),
+               quote (hs->local_file));
+  else
+    {
+      FILE *fp;
+      int fd;
+
+      err = open_output_stream (hs, count, &fp);
+      if (err != RETROK)
+        return err;
+#ifdef ENABLE_XATTR
+      if (opt.enable_xattr)
+        set_file_metadata (u, original_url != u ? original_url : NULL, fp);
+#else
+      (void) original_url;
+#endif
+      fd = fileno (fp);
+      if (ftruncate (fd, contlen) < 0)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", hs->local_file,
+                     strerror (errno));
+          fclose (fp);
+          return FWRITEERR;
+        }
+      fclose (fp);
+    }
+
+  sc.u = u;
+  sc.proxy = proxy;
+  sc.referer = hs->referer;
+  xzero (sp);
+  sp.id = u->url;
+  sp.length = contlen;
+  sp.connections = opt.segments;
+  sp.sources = 1;
+  sp.fetch = http_fetch_segment;
+  sp.closure = &sc;
+  err = segmented_download (hs->local_file, &sp,
+                            &hs->rd_size, &hs->len, &hs->dltime);
+  hs->res = 0;
+  if (err == RANGEERR)
+    {
+      /* Keep what has been retrieved without a gap, and continue the
+         usual way.  */
+      logputs (LOG_VERBOSE, _("Server does not honor range requests; "
+                              "disabling segmented download.\n"));
+      segments_refused = true;
+      segments_abandon (hs->local_file);
+      hs->len = file_size (hs->local_file);
+      if (hs->len < 0)
+        hs->len = 0;
+    }
+  return err;
+}
+
 /* Retrieve a document through HTTP protocol.  It recognizes status
    code, and correctly handles redirections.  It closes the network
    socket.  If it receives an error from the functions below it, it
@@ -3201,6 +3997,13 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   /* Headers sent when using POST. */
   wgint body_data_size = 0;
 
+  /* Whether the request has been sent ahead on a persistent
+     connection.  */
+  bool request_sent = false;
+
+  /* Whether the requests for the next documents may be sent ahead.  */
+  bool pipelining = http_pipelining_possible (proxy, dt);
+
 #ifdef HAVE_SSL
   if (u->scheme == SCHEME_HTTPS)
     {
@@ -3247,25 +4050,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
      without authorization header fails.  (Expected to happen at least
      for the Digest authorization scheme.)  */
 
-  if (opt.cookies)
-    request_set_header (req, "Cookie",
-                        cookie_header (wget_cookie_jar,
-                                       u->host, u->port, u->path,
-#ifdef HAVE_SSL
-                                       u->scheme == SCHEME_HTTPS
-#else
-                                       0
-#endif
-                                       ),
-                        rel_value);
-
-  /* Add the user headers. */
-  if (opt.user_headers)
-    {
-      int i;
-      for (i = 0; opt.user_headers[i]; i++)
-        request_set_user_header (req, opt.user_headers[i]);
-    }
+  add_cookie_and_user_headers (u, req);
 
   proxyauth = NULL;
   if (proxy)
@@ -3281,7 +4066,8 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
 
   {
     uerr_t conn_err = establish_connection (u, &conn, hs, proxy, &proxyauth, &req,
-                                            &using_ssl, inhibit_keep_alive, &sock);
+                                            &using_ssl, inhibit_keep_alive,
+                                            &request_sent, &sock);
     if (conn_err != RETROK)
       {
         retval = conn_err;
@@ -3307,8 +4093,20 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         }
     }
 
-  /* Send the request to server.  */
-  write_error = request_send (req, sock, warc_tmp);
+  /* Send the request to server, unless that has been done ahead.  */
+  if (request_sent)
+    {
+      DEBUGP (("\n---request begin---\n(sent ahead on fd %d)\n"
+               "---request end---\n", sock));
+      write_error = 0;
+    }
+  else
+    write_error = request_send (req, sock, warc_tmp);
+
+  /* Send the requests for the documents that come next, so that their
+     responses are on the way while we're reading this one.  */
+  if (write_error >= 0 && pipelining)
+    pipeline_requests (u, sock);
 
   if (write_error >= 0)
     {
@@ -3390,19 +4188,24 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         head = read_http_response_head (sock);
         if (!head)
           {
+            struct pconn *pc = persistent_lookup (sock);
+
             if (errno == 0)
               {
                 logputs (LOG_NOTQUIET, _("No data received.\n"));
-                CLOSE_INVALIDATE (sock);
                 retval = HEOF;
               }
             else
               {
                 logprintf (LOG_NOTQUIET, _("Read error (%s) in headers.\n"),
                            fd_errstr (sock));
-                CLOSE_INVALIDATE (sock);
                 retval = HERR;
               }
+            /* The server has lost the response to a request sent
+               ahead; don't try that with it again.  */
+            if (request_sent && pc)
+              pipeline_refuse (pc->host, pc->port);
+            CLOSE_INVALIDATE (sock);
             goto cleanup;
           }
         DEBUGP (("\n---response begin---\n%s---response end---\n", head));
@@ -3439,6 +4242,9 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     while (_repeat);
   }
 
+  if (request_sent)
+    pipeline_pop (sock);
+
   xfree (hs->message);
   hs->message = xstrdup (message);
   if (!opt.server_response)
@@ -3566,7 +4372,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
             CLOSE_INVALIDATE (sock);
         }
 
-      pconn.authorized = false;
+      pconn->authorized = false;
 
       {
         auth_err = check_auth (u, user, passwd, resp, req,
@@ -3592,7 +4398,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     {
       /* Kludge: if NTLM is used, mark the TCP connection as authorized. */
       if (ntlm_seen)
-        pconn.authorized = true;
+        pconn->authorized = true;
     }
 
   {
@@ -3710,6 +4516,10 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
           else if (0 == c_strcasecmp(hdrval, "x-gzip"))
             hs->local_encoding = ENC_GZIP;
           break;
+        case 'z': case 'Z':
+          if (0 == c_strcasecmp(hdrval, "zstd"))
+            hs->local_encoding = ENC_ZSTD;
+          break;
         case '\0':
           hs->local_encoding = ENC_NONE;
         }
@@ -3719,47 +4529,19 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
           DEBUGP (("Unrecognized Content-Encoding: %s\n", hdrval));
           hs->local_encoding = ENC_NONE;
         }
-#ifdef HAVE_LIBZ
-      else if (hs->local_encoding == ENC_GZIP
-               && opt.compression != compression_none)
+#ifdef HAVE_CONTENT_DECODING
+      else if (opt.compression != compression_none
+               && encoding_decoder (hs->local_encoding)
+               && !compressed_type_p (hs->local_encoding, type))
         {
-          const char *p;
-
-          /* Make sure the Content-Type is not gzip before decompressing */
-          if (type)
-            {
-              p = strchr (type, '/');
-              if (p == NULL)
-                {
-                  hs->remote_encoding = ENC_GZIP;
-                  hs->local_encoding = ENC_NONE;
-                }
-              else
-                {
-                  p++;
-                  if (c_tolower(p[0]) == 'x' && p[1] == '-')
-                    p += 2;
-                  if (0 != c_strcasecmp (p, "gzip"))
-                    {
-                      hs->remote_encoding = ENC_GZIP;
-                      hs->local_encoding = ENC_NONE;
-                    }
-                }
-            }
+          /* don't uncompress if a file ends with '.gz', '.tgz' etc. */
+          if (compressed_file_p (hs->local_encoding, u->file))
+            DEBUGP (("Enabling broken server workaround. "
+                     "Will not decompress this %s file.\n",
+                     strrchr (u->file, '.')));
           else
-            {
-               hs->remote_encoding = ENC_GZIP;
-               hs->local_encoding = ENC_NONE;
-            }
-
-          /* don't uncompress if a file ends with '.gz' or '.tgz' */
-          if (hs->remote_encoding == ENC_GZIP
-              && (p = strrchr(u->file, '.'))
-              && (c_strcasecmp(p, ".gz") == 0 || c_strcasecmp(p, ".tgz") == 0))
-            {
-               DEBUGP (("Enabling broken server workaround. Will not decompress this GZip file.\n"));
-               hs->remote_encoding = ENC_NONE;
-            }
+            hs->remote_encoding = hs->local_encoding;
+          hs->local_encoding = ENC_NONE;
         }
 #endif
     }
@@ -3911,6 +4693,9 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         case ENC_GZIP:
           encoding_ext = ".gz";
           break;
+        case ENC_ZSTD:
+          encoding_ext = ".zst";
+          break;
         default:
           DEBUGP (("No extension found for encoding %d\n",
                    hs->local_encoding));
@@ -4004,8 +4789,8 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
   if (contlen == -1)
     hs->contlen = -1;
-  /* If the response is gzipped, the uncompressed size is unknown. */
-  else if (hs->remote_encoding == ENC_GZIP)
+  /* If the response is compressed, the uncompressed size is unknown. */
+  else if (hs->remote_encoding != ENC_NONE)
     hs->contlen = -1;
   else
     hs->contlen = contlen + contrange;
@@ -4101,6 +4886,22 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
       goto cleanup;
     }
 
+  if (segmented_download_p (hs, resp, statcode, contlen, contrange,
+                            chunked_transfer_encoding))
+    {
+      /* The pieces are requested over connections of their own.  */
+      CLOSE_INVALIDATE (sock);
+      retval = http_segmented_download (u, original_url, proxy, hs, contlen,
+                                        count);
+      goto cleanup;
+    }
+
+  /* Whatever an unfinished segmented download left in the local file
+     is about to be overwritten.  */
+  if (opt.segments > 1 && hs->restval == 0 && !output_stream
+      && segments_state_p (hs->local_file))
+    segments_abandon (hs->local_file);
+
   err = open_output_stream (hs, count, &fp);
   if (err != RETROK)
     {
@@ -4211,6 +5012,8 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
   xzero (hstat);
   hstat.referer = referer;
 
+  segments_refused = false;
+
   if (opt.output_document)
     {
       hstat.local_file = xstrdup (opt.output_document);
@@ -4321,11 +5124,22 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
       else
         *dt &= ~HEAD_ONLY;
 
+      /* Without --segments, what an unfinished segmented download
+         has retrieved without a gap can be continued with -c.  */
+      if (opt.always_rest && opt.segments <= 1 && got_name
+          && segments_state_p (hstat.local_file))
+        segments_abandon (hstat.local_file);
+
       /* Decide whether or not to restart.  */
       if (force_full_retrieve)
         hstat.restval = hstat.len;
       else if (opt.start_pos >= 0)
         hstat.restval = opt.start_pos;
+      else if (opt.segments > 1 && (opt.always_rest || count > 1)
+               && got_name && segments_state_p (hstat.local_file))
+        /* The segmented download finds out for itself which pieces
+           are missing.  */
+        hstat.restval = 0;
       else if (opt.always_rest
           && got_name
           && stat (hstat.local_file, &st) == 0
@@ -5224,12 +6038,12 @@ create_authorization_line (const char *au, const char *user,
 #endif
 #ifdef ENABLE_NTLM
     case 'N':                   /* NTLM */
-      if (!ntlm_input (&pconn.ntlm, au))
+      if (!ntlm_input (&pconn->ntlm, au))
         {
           *finished = true;
           return NULL;
         }
-      return ntlm_output (&pconn.ntlm, user, passwd, finished);
+      return ntlm_output (&pconn->ntlm, user, passwd, finished);
 #endif
     default:
       /* We shouldn't get here -- this function should be only called
@@ -5260,7 +6074,16 @@ save_cookies (void)
 void
 http_cleanup (void)
 {
-  xfree (pconn.host);
+  int i;
+
+  for (i = 0; i < MAX_PERSISTENT_CONNECTIONS; i++)
+    {
+      pipeline_drop (&pconn_slots[i]);
+      xfree (pconn_slots[i].host);
+    }
+  http_pipeline_hints (NULL, NULL, 0);
+  if (pipeline_refused)
+    string_set_free (pipeline_refused);
   if (wget_cookie_jar)
     cookie_jar_delete (wget_cookie_jar);
 }
@@ -36,6 +36,14 @@ struct url;
 
 uerr_t http_loop (const struct url *, struct url *, char **, char **, const char *,
                   int *, struct url *, struct iri *);
+
+/* How many requests may be sent ahead on a persistent connection.  */
+#define HTTP_PIPELINE_DEPTH 8
+
+void http_pipeline_hints (const char **, const char **, int);
+void http_forget_connections (void);
+uerr_t http_fetch_range (const struct url *, struct url *, const char *,
+                         FILE *, wgint, wgint, wgint *);
 void save_cookies (void);
 void http_cleanup (void);
 time_t http_atotm (const char *);
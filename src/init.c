@@ -65,8 +65,8 @@ as that of the covered work.  */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
 #include "spider.h"             /* for spider_cleanup */
-#include "html-url.h"           /* for cleanup_html_url */
 #include "ptimer.h"             /* for ptimer_destroy */
+#include "intern.h"             /* for intern_cleanup */
 #include "c-strcase.h"
 
 #ifdef TESTING
@@ -96,7 +96,7 @@ CMD_DECLARE (cmd_vector);
 
 CMD_DECLARE (cmd_use_askpass);
 
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
 CMD_DECLARE (cmd_spec_compression);
 #endif
 CMD_DECLARE (cmd_spec_dirstruct);
@@ -160,11 +160,12 @@ static const struct {
   { "certificatetype",  &opt.cert_type,         cmd_cert_type },
   { "checkcertificate", &opt.check_cert,        cmd_check_cert },
 #endif
+  { "checkpoint",       &opt.checkpoint,        cmd_file },
   { "chooseconfig",     &opt.choose_config,     cmd_file },
 #ifdef HAVE_SSL
   { "ciphers",          &opt.tls_ciphers_string, cmd_string },
 #endif
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
   { "compression",      &opt.compression,       cmd_spec_compression },
 #endif
   { "connecttimeout",   &opt.connect_timeout,   cmd_time },
@@ -184,7 +185,11 @@ static const struct {
   { "dirprefix",        &opt.dir_prefix,        cmd_directory },
   { "dirstruct",        NULL,                   cmd_spec_dirstruct },
   { "dnscache",         &opt.dns_cache,         cmd_boolean },
+  { "dnscachefile",     &opt.dns_cache_file,    cmd_file },
+  { "dnscachettl",      &opt.dns_cache_ttl,     cmd_time },
+  { "dnsnegativettl",   &opt.dns_negative_ttl,  cmd_time },
 #ifdef HAVE_LIBCARES
+  { "dnsprefetch",      &opt.dns_prefetch,      cmd_boolean },
   { "dnsservers",       &opt.dns_servers,       cmd_string },
 #endif
   { "dnstimeout",       &opt.dns_timeout,       cmd_time },
@@ -225,6 +230,7 @@ static const struct {
   { "httpkeepalive",    &opt.http_keep_alive,   cmd_boolean },
   { "httppasswd",       &opt.http_passwd,       cmd_string }, /* deprecated */
   { "httppassword",     &opt.http_passwd,       cmd_string },
+  { "httppipelining",   &opt.http_pipelining,   cmd_boolean },
   { "httpproxy",        &opt.http_proxy,        cmd_string },
 #ifdef HAVE_SSL
   { "httpsonly",        &opt.https_only,        cmd_boolean },
@@ -252,6 +258,8 @@ static const struct {
   { "localencoding",    &opt.locale,            cmd_string },
   { "logfile",          &opt.lfilename,         cmd_file },
   { "login",            &opt.ftp_user,          cmd_string },/* deprecated*/
+  { "maxparallel",      &opt.max_parallel,      cmd_number },
+  { "maxparallelperhost", &opt.max_parallel_per_host, cmd_number },
   { "maxredirect",      &opt.max_redirect,      cmd_number },
 #ifdef HAVE_METALINK
   { "metalinkindex",    &opt.metalink_index,     cmd_number_inf },
@@ -308,6 +316,7 @@ static const struct {
   { "removelisting",    &opt.remove_listing,    cmd_boolean },
   { "reportspeed",             &opt.report_bps, cmd_spec_report_speed},
   { "restrictfilenames", NULL,                  cmd_spec_restrict_file_names },
+  { "resumecrawl",      &opt.resume_crawl,      cmd_boolean },
   { "retrsymlinks",     &opt.retr_symlinks,     cmd_boolean },
   { "retryconnrefused", &opt.retry_connrefused, cmd_boolean },
   { "retryonhosterror", &opt.retry_on_host_error, cmd_boolean },
@@ -318,6 +327,7 @@ static const struct {
 #ifdef HAVE_SSL
   { "secureprotocol",   &opt.secure_protocol,   cmd_spec_secure_protocol },
 #endif
+  { "segments",         &opt.segments,          cmd_number },
   { "serverresponse",   &opt.server_response,   cmd_boolean },
   { "showalldnsentries", &opt.show_all_dns_entries, cmd_boolean },
   { "showprogress",     &opt.show_progress,     cmd_spec_progressdisp },
@@ -327,9 +337,13 @@ static const struct {
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
+#ifdef HAVE_SSL
+  { "tlssessionfile",   &opt.tls_session_file,  cmd_file },
+#endif
   { "tries",            &opt.ntry,              cmd_number_inf },
   { "trustservernames", &opt.trustservernames,  cmd_boolean },
   { "unlink",           &opt.unlink_requested,  cmd_boolean },
+  { "urlfingerprints",  &opt.url_fingerprints,  cmd_boolean },
   { "useaskpass" ,      &opt.use_askpass,       cmd_use_askpass },
   { "useproxy",         &opt.use_proxy,         cmd_boolean },
   { "user",             &opt.user,              cmd_string },
@@ -426,6 +440,8 @@ defaults (void)
   opt.dots_in_line = 50;
 
   opt.dns_cache = true;
+  opt.dns_cache_ttl = 3600;
+  opt.dns_negative_ttl = 60;
   opt.ftp_pasv = true;
   /* 2014-09-07  Darshit Shah  <darnir@gmail.com>
    * opt.retr_symlinks is set to true by default. Creating symbolic links on the
@@ -452,7 +468,7 @@ defaults (void)
   opt.ftps_clear_data_connection = false;
 #endif
 
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
   opt.compression = compression_none;
 #endif
 
@@ -1460,13 +1476,22 @@ cmd_cert_type (const char *com, const char *val, void *place)
 
 static bool check_user_specified_header (const char *);
 
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
 static bool
 cmd_spec_compression (const char *com, const char *val, void *place)
 {
   static const struct decode_item choices[] = {
     { "auto", compression_auto },
+#ifdef HAVE_LIBZ
     { "gzip", compression_gzip },
+    { "deflate", compression_deflate },
+#endif
+#ifdef HAVE_BROTLIDEC
+    { "br", compression_brotli },
+#endif
+#ifdef HAVE_ZSTD
+    { "zstd", compression_zstd },
+#endif
     { "none", compression_none },
   };
   int ok = decode_string (val, choices, countof (choices), place);
@@ -1924,11 +1949,11 @@ cleanup (void)
   convert_cleanup ();
   res_cleanup ();
   http_cleanup ();
-  cleanup_html_url ();
   spider_cleanup ();
   host_cleanup ();
   log_cleanup ();
   netrc_cleanup ();
+  intern_cleanup ();
 
   xfree (opt.choose_config);
   xfree (opt.lfilename);
@@ -1987,6 +2012,7 @@ cleanup (void)
   xfree (opt.pinnedpubkey);
   xfree (opt.random_file);
   xfree (opt.egd_file);
+  xfree (opt.tls_session_file);
 # endif
   xfree (opt.bind_address);
   xfree (opt.cookies_input);
@@ -2000,8 +2026,10 @@ cleanup (void)
   xfree (opt.body_data);
   xfree (opt.body_file);
   xfree (opt.rejected_log);
+  xfree (opt.checkpoint);
   xfree (opt.use_askpass);
   xfree (opt.retry_on_http_error);
+  xfree (opt.dns_cache_file);
 
   xfree (opt.encoding_remote);
   xfree (opt.locale);
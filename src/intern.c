@@ -0,0 +1,151 @@
+/* Interning of the URLs and file names kept by recursive retrieval.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+
+/* Recursive retrieval keeps the same URL in several maps that live
+   until the end of the run: the blacklist and the maps of the
+   downloaded files, which also keep the file names.  Rather than each
+   of them keeping a copy of its own, they keep the interned string
+   returned by intern_string, which is the same for all equal strings.
+
+   Interned strings are never freed before the end of the run, so they
+   are simply stored back to back in large blocks, which saves the
+   overhead of allocating each of them separately.  Strings that don't
+   live that long, such as those of the URL queue, must not be
+   interned.  */
+
+#include "wget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "intern.h"
+
+/* The size of the blocks the strings are stored in.  Strings longer
+   than a quarter of this get a block of their own.  */
+#define INTERN_BLOCK_SIZE 65536
+
+struct intern_block {
+  struct intern_block *next;    /* the next older block */
+  /* the strings follow */
+};
+
+/* The interned strings, as both keys and values.  */
+static struct hash_table *interned;
+
+static struct intern_block *blocks;
+static char *block_pos;         /* the free space of the newest block */
+static size_t block_left;
+
+/* Return space for SIZE bytes, which lasts until intern_cleanup.  */
+
+static char *
+intern_alloc (size_t size)
+{
+  struct intern_block *b;
+  char *p;
+
+  if (size > INTERN_BLOCK_SIZE / 4)
+    {
+      /* Put the block behind the newest one, whose free space can
+         still be used.  */
+      b = xmalloc (sizeof *b + size);
+      if (blocks)
+        {
+          b->next = blocks->next;
+          blocks->next = b;
+        }
+      else
+        {
+          b->next = NULL;
+          blocks = b;
+        }
+      return (char *) (b + 1);
+    }
+
+  if (size > block_left)
+    {
+      b = xmalloc (sizeof *b + INTERN_BLOCK_SIZE);
+      b->next = blocks;
+      blocks = b;
+      block_pos = (char *) (b + 1);
+      block_left = INTERN_BLOCK_SIZE;
+    }
+  p = block_pos;
+  block_pos += size;
+  block_left -= size;
+  return p;
+}
+
+/* Return the interned copy of S, a string equal to S that stays valid
+   until intern_cleanup is called.  Equal strings yield the same
+   pointer.  A NULL S yields NULL.  */
+
+const char *
+intern_string (const char *s)
+{
+  char *copy;
+  size_t size;
+
+  if (!s)
+    return NULL;
+  if (!interned)
+    interned = make_string_hash_table (0);
+  else if ((copy = hash_table_get (interned, s)) != NULL)
+    return copy;
+
+  size = strlen (s) + 1;
+  copy = intern_alloc (size);
+  memcpy (copy, s, size);
+  hash_table_put (interned, copy, copy);
+  return copy;
+}
+
+/* Free all the interned strings.  */
+
+void
+intern_cleanup (void)
+{
+  while (blocks)
+    {
+      struct intern_block *b = blocks;
+      blocks = b->next;
+      xfree (b);
+    }
+  block_pos = NULL;
+  block_left = 0;
+  if (interned)
+    {
+      hash_table_destroy (interned);
+      interned = NULL;
+    }
+}
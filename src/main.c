@@ -54,6 +54,7 @@ as that of the covered work.  */
 #include "spider.h"
 #include "http.h"               /* for save_cookies */
 #include "hsts.h"               /* for initializing hsts_store to NULL */
+#include "ssl.h"                /* for ssl_sessions_load */
 #include "ptimer.h"
 #include "warc.h"
 #include "version.h"
@@ -285,8 +286,9 @@ static struct cmdline_option option_data[] =
     { IF_SSL ("certificate"), 0, OPT_VALUE, "certificate", -1 },
     { IF_SSL ("certificate-type"), 0, OPT_VALUE, "certificatetype", -1 },
     { IF_SSL ("check-certificate"), 0, OPT_BOOLEAN, "checkcertificate", -1 },
+    { "checkpoint", 0, OPT_VALUE, "checkpoint", -1 },
     { "clobber", 0, OPT__CLOBBER, NULL, optional_argument },
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
     { "compression", 0, OPT_VALUE, "compression", -1 },
 #endif
     { "config", 0, OPT_VALUE, "chooseconfig", -1 },
@@ -305,7 +307,11 @@ static struct cmdline_option option_data[] =
     { "directories", 0, OPT_BOOLEAN, "dirstruct", -1 },
     { "directory-prefix", 'P', OPT_VALUE, "dirprefix", -1 },
     { "dns-cache", 0, OPT_BOOLEAN, "dnscache", -1 },
+    { "dns-cache-file", 0, OPT_VALUE, "dnscachefile", -1 },
+    { "dns-cache-ttl", 0, OPT_VALUE, "dnscachettl", -1 },
+    { "dns-negative-ttl", 0, OPT_VALUE, "dnsnegativettl", -1 },
 #ifdef HAVE_LIBCARES
+    { "dns-prefetch", 0, OPT_BOOLEAN, "dnsprefetch", -1 },
     { "dns-servers", 0, OPT_VALUE, "dnsservers", -1 },
 #endif
     { "dns-timeout", 0, OPT_VALUE, "dnstimeout", -1 },
@@ -344,6 +350,7 @@ static struct cmdline_option option_data[] =
     { "http-keep-alive", 0, OPT_BOOLEAN, "httpkeepalive", -1 },
     { "http-passwd", 0, OPT_VALUE, "httppassword", -1 }, /* deprecated */
     { "http-password", 0, OPT_VALUE, "httppassword", -1 },
+    { "http-pipelining", 0, OPT_BOOLEAN, "httppipelining", -1 },
     { "http-user", 0, OPT_VALUE, "httpuser", -1 },
     { IF_SSL ("https-only"), 0, OPT_BOOLEAN, "httpsonly", -1 },
     { "ignore-case", 0, OPT_BOOLEAN, "ignorecase", -1 },
@@ -366,6 +373,8 @@ static struct cmdline_option option_data[] =
     { "load-cookies", 0, OPT_VALUE, "loadcookies", -1 },
     { "local-encoding", 0, OPT_VALUE, "localencoding", -1 },
     { "rejected-log", 0, OPT_VALUE, "rejectedlog", -1 },
+    { "max-parallel", 0, OPT_VALUE, "maxparallel", -1 },
+    { "max-parallel-per-host", 0, OPT_VALUE, "maxparallelperhost", -1 },
     { "max-redirect", 0, OPT_VALUE, "maxredirect", -1 },
 #ifdef HAVE_METALINK
     { "metalink-index", 0, OPT_VALUE, "metalinkindex", -1 },
@@ -418,6 +427,7 @@ static struct cmdline_option option_data[] =
     { "remove-listing", 0, OPT_BOOLEAN, "removelisting", -1 },
     { "report-speed", 0, OPT_BOOLEAN, "reportspeed", -1 },
     { "restrict-file-names", 0, OPT_BOOLEAN, "restrictfilenames", -1 },
+    { "resume-crawl", 0, OPT_BOOLEAN, "resumecrawl", -1 },
     { "retr-symlinks", 0, OPT_BOOLEAN, "retrsymlinks", -1 },
     { "retry-connrefused", 0, OPT_BOOLEAN, "retryconnrefused", -1 },
     { "retry-on-host-error", 0, OPT_BOOLEAN, "retryonhosterror", -1 },
@@ -425,6 +435,7 @@ static struct cmdline_option option_data[] =
     { "save-cookies", 0, OPT_VALUE, "savecookies", -1 },
     { "save-headers", 0, OPT_BOOLEAN, "saveheaders", -1 },
     { IF_SSL ("secure-protocol"), 0, OPT_VALUE, "secureprotocol", -1 },
+    { "segments", 0, OPT_VALUE, "segments", -1 },
     { "server-response", 'S', OPT_BOOLEAN, "serverresponse", -1 },
     { "span-hosts", 'H', OPT_BOOLEAN, "spanhosts", -1 },
     { "spider", 0, OPT_BOOLEAN, "spider", -1 },
@@ -432,10 +443,12 @@ static struct cmdline_option option_data[] =
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
+    { IF_SSL ("tls-session-file"), 0, OPT_VALUE, "tlssessionfile", -1 },
     { "if-modified-since", 0, OPT_BOOLEAN, "ifmodifiedsince", -1 },
     { "tries", 't', OPT_VALUE, "tries", -1 },
     { "unlink", 0, OPT_BOOLEAN, "unlink", -1 },
     { "trust-server-names", 0, OPT_BOOLEAN, "trustservernames", -1 },
+    { "url-fingerprints", 0, OPT_BOOLEAN, "urlfingerprints", -1 },
     { "use-askpass", 0, OPT_VALUE, "useaskpass", -1},
     { "use-server-timestamps", 0, OPT_BOOLEAN, "useservertimestamps", -1 },
     { "user", 0, OPT_VALUE, "user", -1 },
@@ -664,6 +677,8 @@ Download:\n"),
   -c,  --continue                  resume getting a partially-downloaded file\n"),
     N_("\
        --start-pos=OFFSET          start downloading from zero-based position OFFSET\n"),
+    N_("\
+       --segments=NUMBER           retrieve large files over NUMBER connections\n"),
     N_("\
        --progress=TYPE             select progress gauge type\n"),
     N_("\
@@ -711,6 +726,16 @@ Download:\n"),
        --limit-rate=RATE           limit download rate to RATE\n"),
     N_("\
        --no-dns-cache              disable caching DNS lookups\n"),
+    N_("\
+       --dns-cache-file=FILE       keep the DNS cache in FILE across runs\n"),
+    N_("\
+       --dns-cache-ttl=SECS        cache addresses without a TTL for SECS\n"),
+    N_("\
+       --dns-negative-ttl=SECS     cache failed DNS lookups for SECS\n"),
+#ifdef HAVE_LIBCARES
+    N_("\
+       --dns-prefetch              look up the hosts of links ahead with -r -H\n"),
+#endif
     N_("\
        --restrict-file-names=OS    restrict chars in file names to ones OS allows\n"),
     N_("\
@@ -792,9 +817,10 @@ HTTP options:\n"),
        --ignore-length             ignore 'Content-Length' header field\n"),
     N_("\
        --header=STRING             insert STRING among the headers\n"),
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
     N_("\
-       --compression=TYPE          choose compression, one of auto, gzip and none. (default: none)\n"),
+       --compression=TYPE          choose compression, one of auto, gzip, deflate,\n\
+                                     br, zstd and none. (default: none)\n"),
 #endif
     N_("\
        --max-redirect              maximum redirections allowed per page\n"),
@@ -810,6 +836,8 @@ HTTP options:\n"),
   -U,  --user-agent=AGENT          identify as AGENT instead of Wget/VERSION\n"),
     N_("\
        --no-http-keep-alive        disable HTTP keep-alive (persistent connections)\n"),
+    N_("\
+       --http-pipelining           send requests ahead on persistent connections\n"),
     N_("\
        --no-cookies                don't use cookies\n"),
     N_("\
@@ -863,6 +891,8 @@ HTTPS (SSL/TLS) options:\n"),
        --ca-directory=DIR          directory where hash list of CAs is stored\n"),
     N_("\
        --crl-file=FILE             file with bundle of CRLs\n"),
+    N_("\
+       --tls-session-file=FILE     keep TLS sessions in FILE across runs\n"),
     N_("\
        --pinnedpubkey=FILE/HASHES  Public key (PEM/DER) file, or any number\n\
                                    of base64 encoded sha256 hashes preceded by\n\
@@ -960,6 +990,16 @@ Recursive download:\n"),
   -r,  --recursive                 specify recursive download\n"),
     N_("\
   -l,  --level=NUMBER              maximum recursion depth (inf or 0 for infinite)\n"),
+    N_("\
+       --max-parallel=NUMBER       retrieve up to NUMBER files concurrently\n"),
+    N_("\
+       --max-parallel-per-host=NUMBER  retrieve up to NUMBER files per host\n"),
+    N_("\
+       --url-fingerprints          remember the URLs seen by their fingerprints\n"),
+    N_("\
+       --checkpoint=FILE           save the state of the retrieval to FILE\n"),
+    N_("\
+       --resume-crawl              continue from the state saved by --checkpoint\n"),
     N_("\
        --delete-after              delete files locally after downloading them\n"),
     N_("\
@@ -1641,6 +1681,12 @@ Can't timestamp and not clobber old files at the same time.\n"));
       print_usage (1);
       exit (WGET_EXIT_GENERIC_ERROR);
     }
+  if (opt.resume_crawl && !opt.checkpoint)
+    {
+      fprintf (stderr, _("--resume-crawl requires --checkpoint.\n"));
+      print_usage (1);
+      exit (WGET_EXIT_GENERIC_ERROR);
+    }
 #ifdef ENABLE_IPV6
   if (opt.ipv4_only && opt.ipv6_only)
     {
@@ -1727,7 +1773,7 @@ for details.\n\n"));
         }
     }
 
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
   if (opt.always_rest || opt.start_pos >= 0)
     {
       if (opt.compression == compression_auto)
@@ -2016,7 +2062,10 @@ only if outputting to a regular file.\n"));
     }
 
 #ifdef HAVE_LIBCARES
-  if (opt.bind_dns_address || opt.dns_servers)
+  /* With --dns-prefetch, recursive retrieval resolves the hosts of the
+     links ahead of time when spanning hosts, which needs c-ares.  */
+  if (opt.bind_dns_address || opt.dns_servers
+      || (opt.dns_prefetch && opt.recursive && opt.spanhost && opt.dns_cache))
     {
       if (ares_library_init (ARES_LIB_INIT_ALL))
         {
@@ -2111,6 +2160,14 @@ only if outputting to a regular file.\n"));
     load_hsts ();
 #endif
 
+  if (opt.dns_cache && opt.dns_cache_file)
+    dns_cache_load (opt.dns_cache_file);
+
+#ifdef HAVE_SSL
+  if (opt.tls_session_file)
+    ssl_sessions_load (opt.tls_session_file);
+#endif
+
   /* Retrieve the URLs from argument list.  */
   for (t = url; *t; t++)
     {
@@ -2287,6 +2344,14 @@ only if outputting to a regular file.\n"));
     save_hsts ();
 #endif
 
+  if (opt.dns_cache && opt.dns_cache_file)
+    dns_cache_save (opt.dns_cache_file);
+
+#ifdef HAVE_SSL
+  if (opt.tls_session_file)
+    ssl_sessions_save (opt.tls_session_file);
+#endif
+
   if ((opt.convert_links || opt.convert_file_only) && !opt.delete_after)
     convert_all_links ();
 
@@ -44,6 +44,9 @@ as that of the covered work.  */
 #include "xmemdup0.h"
 #include "xstrndup.h"
 #include "c-strcase.h"
+#include "http.h"
+#include "segments.h"
+#include "convert.h"
 #include <errno.h>
 #include <unistd.h> /* For unlink.  */
 #include <metalink/metalink_parser.h>
@@ -56,6 +59,256 @@ as that of the covered work.  */
 #include "../tests/unit-tests.h"
 #endif
 
+/* The mirrors a Metalink file is retrieved from in parallel, and the
+   piece hashes its pieces are checked against (see
+   retrieve_metalink_pieces).  */
+struct metalink_pieces {
+  struct url **urls;
+  int count;
+  const struct piece_hash *algorithm; /* NULL if pieces aren't checked */
+  char **hashes;                /* the piece hashes, by piece number */
+  int hash_count;
+};
+
+/* Hash algorithms supported for Metalink piece hashes.  */
+static const struct piece_hash {
+  const char *name;
+  int size;
+  void *(*buffer) (const char *, size_t, void *);
+} piece_hashes[] = {
+  { "md5", MD5_DIGEST_SIZE, md5_buffer },
+  { "sha1", SHA1_DIGEST_SIZE, sha1_buffer },
+  { "sha256", SHA256_DIGEST_SIZE, sha256_buffer },
+  { "sha512", SHA512_DIGEST_SIZE, sha512_buffer },
+};
+
+/* Return the algorithm named TYPE, such as "sha-1" or "sha1", or NULL
+   if it isn't supported.  */
+
+static const struct piece_hash *
+find_piece_hash (const char *type)
+{
+  char name[16];
+  size_t i, j;
+
+  for (i = j = 0; type[i] && j < sizeof (name) - 1; i++)
+    if (type[i] != '-')
+      name[j++] = type[i];
+  name[j] = '\0';
+  for (i = 0; i < countof (piece_hashes); i++)
+    if (!c_strcasecmp (name, piece_hashes[i].name))
+      return &piece_hashes[i];
+  return NULL;
+}
+
+/* The fetch callback of retrieve_metalink_pieces.  */
+
+static uerr_t
+metalink_fetch_piece (void *closure, int source, FILE *fp,
+                      wgint start, wgint end, wgint *written)
+{
+  struct metalink_pieces *mp = closure;
+  return http_fetch_range (mp->urls[source], NULL, NULL, fp, start, end,
+                           written);
+}
+
+/* The verify callback of retrieve_metalink_pieces: compare the hash
+   of piece PIECE with the one from the Metalink file.  */
+
+static bool
+metalink_verify_piece (void *closure, int piece, FILE *fp,
+                       wgint start, wgint end)
+{
+  struct metalink_pieces *mp = closure;
+  char digest[SHA512_DIGEST_SIZE];
+  char digest_txt[2 * SHA512_DIGEST_SIZE + 1];
+  size_t len = end - start + 1;
+  char *buf;
+  bool ok;
+
+  if (!mp->algorithm || piece >= mp->hash_count)
+    return true;
+
+  buf = xmalloc (len);
+  ok = fseeko (fp, start, SEEK_SET) == 0 && fread (buf, 1, len, fp) == len;
+  if (ok)
+    {
+      mp->algorithm->buffer (buf, len, digest);
+      wg_hex_to_string (digest_txt, digest, mp->algorithm->size);
+      ok = !c_strcasecmp (digest_txt, mp->hashes[piece]);
+      if (!ok)
+        DEBUGP (("Piece %d: declared hash %s, computed hash %s\n",
+                 piece, mp->hashes[piece], digest_txt));
+    }
+  xfree (buf);
+  return ok;
+}
+
+/* Collect the mirrors of MFILE that pieces can be requested from,
+   and its piece hashes, into MP.  Returns false if MFILE can't be
+   retrieved in pieces.  */
+
+static bool
+metalink_pieces_init (metalink_file_t *mfile, struct metalink_pieces *mp)
+{
+  metalink_resource_t **mres_ptr;
+  metalink_chunk_checksum_t *chunks = mfile->chunk_checksum;
+  int size = 0;
+
+  xzero (*mp);
+  for (mres_ptr = mfile->resources; *mres_ptr; mres_ptr++)
+    {
+      metalink_resource_t *mres = *mres_ptr;
+      struct url *url;
+      int url_err;
+
+      clean_metalink_string (&mres->url);
+      if (!RES_TYPE_SUPPORTED (mres->type))
+        continue;
+      url = url_parse (mres->url, &url_err, NULL, false);
+      if (!url)
+        continue;
+      /* Only HTTP servers are asked for ranges, and only directly.  */
+      if ((url->scheme != SCHEME_HTTP
+#ifdef HAVE_SSL
+           && url->scheme != SCHEME_HTTPS
+#endif
+           ) || url_uses_proxy (url))
+        {
+          url_free (url);
+          continue;
+        }
+      DO_REALLOC (mp->urls, size, mp->count + 1, struct url *);
+      mp->urls[mp->count++] = url;
+    }
+
+  if (!mp->count
+      || (mp->count < 2 && mfile->size < SEGMENTS_MIN_LENGTH))
+    return false;
+
+  /* Use the piece hashes only if there is one for every piece.  */
+  if (chunks && chunks->length > 0 && chunks->piece_hashes
+      && (mp->algorithm = find_piece_hash (chunks->type)) != NULL)
+    {
+      metalink_piece_hash_t **ph_ptr;
+      int i;
+
+      mp->hash_count = (mfile->size + chunks->length - 1) / chunks->length;
+      mp->hashes = xnew0_array (char *, mp->hash_count);
+      for (ph_ptr = chunks->piece_hashes; *ph_ptr; ph_ptr++)
+        if ((*ph_ptr)->piece >= 0 && (*ph_ptr)->piece < mp->hash_count)
+          mp->hashes[(*ph_ptr)->piece] = (*ph_ptr)->hash;
+      for (i = 0; i < mp->hash_count; i++)
+        if (!mp->hashes[i])
+          {
+            DEBUGP (("Piece hash %d is missing; not checking pieces.\n", i));
+            xfree (mp->hashes);
+            mp->hash_count = 0;
+            mp->algorithm = NULL;
+            break;
+          }
+    }
+  else
+    mp->algorithm = NULL;
+  return true;
+}
+
+static void
+metalink_pieces_free (struct metalink_pieces *mp)
+{
+  int i;
+  for (i = 0; i < mp->count; i++)
+    url_free (mp->urls[i]);
+  xfree (mp->urls);
+  xfree (mp->hashes);
+}
+
+/* With --segments, retrieve MFILE into DESTNAME, the file open as
+   OUTPUT_STREAM, by requesting pieces of it from several of its HTTP
+   mirrors at the same time.  Each piece is checked against its piece
+   hash as soon as it has arrived, and fetched again from another
+   mirror if it is corrupt.
+
+   Returns RETROK if the whole file was retrieved.  Otherwise the
+   caller falls back to retrieving from one mirror after another, and
+   DESTNAME is emptied for that, unless -c is in effect: then the
+   pieces are kept for a later run and *GIVE_UP is set.  */
+
+static uerr_t
+retrieve_metalink_pieces (metalink_file_t *mfile, const char *destname,
+                          bool *give_up)
+{
+  struct metalink_pieces mp;
+  struct segment_params sp;
+  wgint rd_size, len;
+  double dltime;
+  uerr_t err;
+
+  if (opt.segments <= 1 || mfile->size <= 0)
+    return METALINK_RETR_ERROR;
+  if (!metalink_pieces_init (mfile, &mp))
+    {
+      metalink_pieces_free (&mp);
+      return METALINK_RETR_ERROR;
+    }
+
+  if (segments_resume_p (destname, mfile->name, mfile->size))
+    logprintf (LOG_VERBOSE, _("Resuming segmented download of %s\n"),
+               quote (destname));
+  else if (file_size (destname) != 0
+           || ftruncate (fileno (output_stream), mfile->size) < 0)
+    {
+      /* Leave a partial file from an earlier run to -c.  */
+      metalink_pieces_free (&mp);
+      return METALINK_RETR_ERROR;
+    }
+
+  logprintf (LOG_VERBOSE,
+             _("Retrieving %s from %d mirrors%s.\n"), quote (destname),
+             mp.count, mp.algorithm ? _(", checking piece hashes") : "");
+
+  xzero (sp);
+  sp.id = mfile->name;
+  sp.length = mfile->size;
+  sp.connections = opt.segments;
+  sp.piece_size = mp.algorithm ? mfile->chunk_checksum->length : 0;
+  sp.sources = mp.count;
+  sp.fetch = metalink_fetch_piece;
+  sp.verify = metalink_verify_piece;
+  sp.closure = &mp;
+  err = segmented_download (destname, &sp, &rd_size, &len, &dltime);
+  metalink_pieces_free (&mp);
+
+  total_downloaded_bytes += rd_size;
+  total_download_time += dltime;
+
+  if (err == RETRFINISHED && len == mfile->size)
+    {
+      logprintf (LOG_VERBOSE, _("%s (%s) - %s saved [%s/%s]\n\n"),
+                 datetime_str (time (NULL)), retr_rate (rd_size, dltime),
+                 quote (destname), number_to_static_string (len),
+                 number_to_static_string (mfile->size));
+      ++numurls;
+      downloaded_file (FILE_DOWNLOADED_NORMALLY, destname);
+      return RETROK;
+    }
+
+  if (opt.always_rest)
+    {
+      *give_up = true;
+      return err == RETRFINISHED ? METALINK_RETR_ERROR : err;
+    }
+
+  logputs (LOG_VERBOSE, _("Retrieving from one mirror after another.\n"));
+  segments_abandon (destname);
+  if (ftruncate (fileno (output_stream), 0) < 0)
+    {
+      *give_up = true;
+      return FWRITEERR;
+    }
+  return METALINK_RETR_ERROR;
+}
+
 /* Loop through all files in metalink structure and retrieve them.
    Returns RETROK if all files were downloaded.
    Returns last retrieval error (from retrieve_url) if some files
@@ -115,6 +368,10 @@ retrieve_from_metalink (const metalink_t* metalink)
 
       bool skip_mfile = false;
 
+      /* Whether retrieving in pieces from several mirrors has been
+         tried.  */
+      bool pieces_tried = false;
+
       output_stream = NULL;
 
       mfc++;
@@ -481,8 +738,15 @@ retrieve_from_metalink (const metalink_t* metalink)
 
               opt.metalink_over_http = false;
               DEBUGP (("Storing to %s\n", destname));
-              retr_err = retrieve_url (url, mres->url, NULL, NULL,
-                                       NULL, NULL, opt.recursive, iri, false);
+              if (!pieces_tried && output_stream)
+                {
+                  pieces_tried = true;
+                  retr_err = retrieve_metalink_pieces (mfile, destname,
+                                                       &skip_mfile);
+                }
+              if (retr_err != RETROK && !skip_mfile)
+                retr_err = retrieve_url (url, mres->url, NULL, NULL,
+                                         NULL, NULL, opt.recursive, iri, false);
               opt.metalink_over_http = _metalink_http;
 
               /*
@@ -152,6 +152,38 @@ key_type_to_ssl_type (enum keyfile_type type)
     }
 }
 
+/* Called by OpenSSL when the server issues session SESS on CONN, to
+   store it in the session cache under the key in the app data of
+   CONN.  TLS 1.3 servers issue sessions after the handshake, while
+   data is being read.  */
+
+static int
+new_session_callback (SSL *conn, SSL_SESSION *sess)
+{
+  const char *key = SSL_get_app_data (conn);
+  unsigned char *data, *p;
+  int size;
+
+  if (!key)
+    return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  if (!SSL_SESSION_is_resumable (sess))
+    return 0;
+#endif
+  size = i2d_SSL_SESSION (sess, NULL);
+  if (size <= 0)
+    return 0;
+  data = p = xmalloc (size);
+  i2d_SSL_SESSION (sess, &p);
+  ssl_session_store (key, data, size,
+                     SSL_SESSION_get_time (sess)
+                     + SSL_SESSION_get_timeout (sess));
+  xfree (data);
+
+  /* We haven't kept a reference to SESS.  */
+  return 0;
+}
+
 /* SSL has been initialized */
 static int ssl_true_initialized = 0;
 
@@ -378,6 +410,12 @@ ssl_init (void)
      tell it to do so.  */
   SSL_CTX_set_mode (ssl_ctx, SSL_MODE_AUTO_RETRY);
 
+  /* Have the sessions the servers issue passed to
+     new_session_callback, which keeps them in Wget's cache.  */
+  SSL_CTX_set_session_cache_mode (ssl_ctx, SSL_SESS_CACHE_CLIENT
+                                  | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb (ssl_ctx, new_session_callback);
+
   return true;
 
  error:
@@ -525,14 +563,23 @@ openssl_errstr (int fd _GL_UNUSED, void *arg)
   return errmsg;
 }
 
+static bool
+openssl_pending (int fd _GL_UNUSED, void *arg)
+{
+  struct openssl_transport_context *ctx = arg;
+  return SSL_pending (ctx->conn) > 0;
+}
+
 static void
 openssl_close (int fd, void *arg)
 {
   struct openssl_transport_context *ctx = arg;
   SSL *conn = ctx->conn;
+  char *key = SSL_get_app_data (conn);
 
   SSL_shutdown (conn);
   SSL_free (conn);
+  xfree (key);
   xfree (ctx->last_error);
   xfree (ctx);
 
@@ -546,7 +593,7 @@ openssl_close (int fd, void *arg)
 
 static struct transport_implementation openssl_transport = {
   openssl_read, openssl_write, openssl_poll,
-  openssl_peek, openssl_errstr, openssl_close
+  openssl_peek, openssl_errstr, openssl_close, openssl_pending
 };
 
 struct scwt_context
@@ -584,14 +631,21 @@ _sni_hostname(const char *hostname)
    fd_register_transport, so that subsequent calls to fd_read,
    fd_write, etc., will use the corresponding SSL functions.
 
+   If CONTINUE_SESSION is non-NULL, the session of that file
+   descriptor is resumed.  Otherwise, if PORT is non-zero, a session
+   with HOSTNAME and PORT is resumed from the session cache if there
+   is one, and the sessions the server issues are stored there.
+
    Returns true on success, false on failure.  */
 
 bool
-ssl_connect_wget (int fd, const char *hostname, int *continue_session)
+ssl_connect_wget (int fd, const char *hostname, int port,
+                  int *continue_session)
 {
   SSL *conn;
   struct scwt_context scwt_ctx;
   struct openssl_transport_context *ctx;
+  char *key = NULL;
 
   DEBUGP (("Initiating SSL handshake.\n"));
 
@@ -624,6 +678,29 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
       if (!ctx || !ctx->sess || !SSL_set_session (conn, ctx->sess))
         goto error;
     }
+  else if (port)
+    {
+      const void *data;
+      size_t size;
+
+      /* new_session_callback finds the key to store the sessions
+         under in the app data.  */
+      key = ssl_session_key (hostname, port);
+      SSL_set_app_data (conn, key);
+
+      data = ssl_session_lookup (key, &size);
+      if (data)
+        {
+          const unsigned char *p = data;
+          SSL_SESSION *sess = d2i_SSL_SESSION (NULL, &p, (long) size);
+          if (sess)
+            {
+              if (SSL_set_session (conn, sess))
+                DEBUGP (("Trying to resume the TLS session with %s.\n", key));
+              SSL_SESSION_free (sess);
+            }
+        }
+    }
 
 #ifndef FD_TO_SOCKET
 # define FD_TO_SOCKET(X) (X)
@@ -661,6 +738,8 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
   fd_register_transport (fd, &openssl_transport, ctx);
   DEBUGP (("Handshake successful; connected socket %d to SSL handle 0x%0*lx\n",
            fd, PTR_FORMAT (conn)));
+  if (SSL_session_reused (conn))
+    DEBUGP (("Resumed the TLS session.\n"));
   return true;
 
  error:
@@ -669,6 +748,7 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
  timeout:
   if (conn)
     SSL_free (conn);
+  xfree (key);
   return false;
 }
 
@@ -54,6 +54,15 @@ struct options
   bool no_parent;               /* Restrict access to the parent
                                    directory.  */
   int reclevel;                 /* Maximum level of recursion */
+  int max_parallel;             /* Maximum number of retrievals done
+                                   concurrently in recursive mode. */
+  int max_parallel_per_host;    /* The same, for each host. */
+  bool url_fingerprints;        /* Remember the URLs seen in recursive
+                                   mode by their fingerprints only. */
+  char *checkpoint;             /* The file to save the state of the
+                                   recursive retrieval to. */
+  bool resume_crawl;            /* Continue from the state saved to
+                                   opt.checkpoint? */
   bool dirstruct;               /* Do we build the directory structure
                                    as we go along? */
   bool no_dirstruct;            /* Do we hate dirstruct? */
@@ -108,6 +117,12 @@ struct options
   char **domains;               /* See host.c */
   char **exclude_domains;
   bool dns_cache;               /* whether we cache DNS lookups. */
+  char *dns_cache_file;         /* file the DNS cache is kept in */
+  double dns_cache_ttl;         /* how long to cache addresses the
+                                   resolver gives no TTL for */
+  double dns_negative_ttl;      /* how long to cache failed lookups */
+  bool dns_prefetch;            /* look up the hosts of links ahead
+                                   with -r -H */
 
   char **follow_tags;           /* List of HTML tags to recursively follow. */
   char **ignore_tags;           /* List of HTML tags to ignore if recursing. */
@@ -137,6 +152,8 @@ struct options
 
   bool always_rest;             /* Always use REST. */
   wgint start_pos;              /* Start position of a download. */
+  int segments;                 /* Number of connections a large file
+                                   is retrieved over. */
   char *ftp_user;               /* FTP username */
   char *ftp_passwd;             /* FTP password */
   bool netrc;                   /* Whether to read .netrc. */
@@ -147,6 +164,8 @@ struct options
   char *http_passwd;            /* HTTP password. */
   char **user_headers;          /* User-defined header(s). */
   bool http_keep_alive;         /* whether we use keep-alive */
+  bool http_pipelining;         /* whether requests are sent ahead on
+                                   persistent connections */
 
   bool use_proxy;               /* Do we use proxy? */
   bool allow_cache;             /* Do we allow server-side caching? */
@@ -260,6 +279,7 @@ struct options
   bool ftps_clear_data_connection;
 
   char *tls_ciphers_string;
+  char *tls_session_file;       /* file to keep TLS sessions in */
 #endif /* HAVE_SSL */
 
   bool cookies;                 /* whether cookies are used. */
@@ -328,10 +348,13 @@ struct options
                                    name. */
   bool report_bps;              /*Output bandwidth in bits format*/
 
-#ifdef HAVE_LIBZ
+#ifdef HAVE_CONTENT_DECODING
   enum compression_options {
     compression_auto,
     compression_gzip,
+    compression_deflate,
+    compression_brotli,
+    compression_zstd,
     compression_none
   } compression;                /* type of HTTP compression to use */
 #endif
@@ -0,0 +1,415 @@
+/* Waiting for many file descriptors at once.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* select_fd waits for a single file descriptor, building a new
+   descriptor set on each call.  A reactor instead keeps a set of file
+   descriptors, each with what it is waited for, an optional timeout
+   and a callback, and reactor_run waits for all of them at once and
+   calls the callbacks of those that are ready or have timed out.
+
+   The file descriptors are kept registered with epoll where it is
+   available, so that waiting costs a single system call however many
+   there are; elsewhere select is used.  Descriptors with a transport
+   registered with fd_register_transport, such as TLS connections, are
+   also ready for reading when the transport has buffered data.  */
+
+#include "wget.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#else
+# include <sys/select.h>
+#endif
+#include <unistd.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "ptimer.h"
+#include "connect.h"
+#include "reactor.h"
+
+struct reactor_entry {
+  int fd;
+  int wait_for;                 /* WAIT_FOR_READ and/or WAIT_FOR_WRITE */
+  double deadline;              /* on the reactor's timer, 0 if none */
+  reactor_callback_t callback;
+  void *arg;
+  int ready;                    /* what FD was found ready for */
+  unsigned int run;             /* last run that called CALLBACK */
+};
+
+struct reactor {
+  struct hash_table *entries;   /* file descriptor -> reactor_entry */
+  struct ptimer *timer;
+  unsigned int run;             /* number of calls to reactor_run */
+#ifdef HAVE_SYS_EPOLL_H
+  int epfd;
+  struct epoll_event *events;
+#endif
+  int *fds;                     /* the file descriptors, taken at the
+                                   start of reactor_run */
+  int size;                     /* allocated size of the above */
+};
+
+#define FD_KEY(fd) ((void *)(intptr_t) (fd))
+
+/* Create an empty reactor.  Returns NULL with errno set on error.  */
+
+struct reactor *
+reactor_new (void)
+{
+  struct reactor *r = xnew0 (struct reactor);
+
+#ifdef HAVE_SYS_EPOLL_H
+  r->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (r->epfd < 0)
+    {
+      xfree (r);
+      return NULL;
+    }
+#endif
+  r->entries = hash_table_new (0, NULL, NULL);
+  r->timer = ptimer_new ();
+  return r;
+}
+
+/* Destroy reactor R.  The file descriptors in it are left open.  */
+
+void
+reactor_destroy (struct reactor *r)
+{
+  hash_table_iterator iter;
+
+  for (hash_table_iterate (r->entries, &iter); hash_table_iter_next (&iter); )
+    xfree (iter.value);
+  hash_table_destroy (r->entries);
+  ptimer_destroy (r->timer);
+#ifdef HAVE_SYS_EPOLL_H
+  close (r->epfd);
+  xfree (r->events);
+#endif
+  xfree (r->fds);
+  xfree (r);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static bool
+epoll_update (struct reactor *r, int op, int fd, int wait_for)
+{
+  struct epoll_event ev;
+
+  xzero (ev);
+  if (wait_for & WAIT_FOR_READ)
+    ev.events |= EPOLLIN;
+  if (wait_for & WAIT_FOR_WRITE)
+    ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  return epoll_ctl (r->epfd, op, fd, &ev) == 0;
+}
+#endif
+
+/* Wait for FD to become ready for WAIT_FOR, a combination of
+   WAIT_FOR_READ and WAIT_FOR_WRITE, and then call CALLBACK with it.
+   If TIMEOUT is non-zero and FD isn't ready within that many seconds,
+   CALLBACK is called with REACTOR_TIMEOUT instead.  FD stays in R
+   until it is removed with reactor_remove, which must be done before
+   closing it.
+
+   Returns false with errno set if FD can't be waited for.  */
+
+bool
+reactor_add (struct reactor *r, int fd, int wait_for, double timeout,
+             reactor_callback_t callback, void *arg)
+{
+  struct reactor_entry *entry;
+
+  assert (fd >= 0);
+  assert (!hash_table_contains (r->entries, FD_KEY (fd)));
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (!epoll_update (r, EPOLL_CTL_ADD, fd, wait_for))
+    return false;
+#else
+  if (fd >= FD_SETSIZE)
+    {
+      errno = EMFILE;
+      return false;
+    }
+#endif
+
+  entry = xnew0 (struct reactor_entry);
+  entry->fd = fd;
+  entry->wait_for = wait_for;
+  entry->deadline = timeout ? ptimer_measure (r->timer) + timeout : 0;
+  entry->callback = callback;
+  entry->arg = arg;
+  hash_table_put (r->entries, FD_KEY (fd), entry);
+  return true;
+}
+
+/* Change what FD in R is waited for to WAIT_FOR, and restart its
+   timeout with TIMEOUT, as in reactor_add.  */
+
+bool
+reactor_modify (struct reactor *r, int fd, int wait_for, double timeout)
+{
+  struct reactor_entry *entry = hash_table_get (r->entries, FD_KEY (fd));
+
+  assert (entry != NULL);
+#ifdef HAVE_SYS_EPOLL_H
+  if (entry->wait_for != wait_for
+      && !epoll_update (r, EPOLL_CTL_MOD, fd, wait_for))
+    return false;
+#endif
+  entry->wait_for = wait_for;
+  entry->deadline = timeout ? ptimer_measure (r->timer) + timeout : 0;
+  return true;
+}
+
+/* Stop waiting for FD.  This may be called from the callbacks.  */
+
+void
+reactor_remove (struct reactor *r, int fd)
+{
+  struct reactor_entry *entry = hash_table_get (r->entries, FD_KEY (fd));
+
+  if (!entry)
+    return;
+#ifdef HAVE_SYS_EPOLL_H
+  epoll_ctl (r->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+  hash_table_remove (r->entries, FD_KEY (fd));
+  xfree (entry);
+}
+
+/* Return the number of file descriptors in R.  */
+
+int
+reactor_count (const struct reactor *r)
+{
+  return hash_table_count (r->entries);
+}
+
+/* Wait until file descriptors in R are ready or their timeouts pass,
+   but no longer than MAXTIME seconds, or indefinitely if MAXTIME is
+   negative, and call the callbacks.
+
+   Returns the number of callbacks called, which is 0 if MAXTIME
+   passed first, or -1 with errno set on error.  */
+
+int
+reactor_run (struct reactor *r, double maxtime)
+{
+  hash_table_iterator iter;
+  double now, wait = maxtime;
+  int count = hash_table_count (r->entries);
+  int i, n = 0, calls = 0;
+#ifndef HAVE_SYS_EPOLL_H
+  fd_set rdset, wrset;
+  struct timeval tmout;
+  int maxfd = -1;
+#endif
+
+  ++r->run;
+  if (count > r->size)
+    {
+      r->size = MAX (count, 2 * r->size);
+      r->fds = xrealloc (r->fds, r->size * sizeof *r->fds);
+#ifdef HAVE_SYS_EPOLL_H
+      r->events = xrealloc (r->events, r->size * sizeof *r->events);
+#endif
+    }
+
+  /* Take the file descriptors, as the callbacks may change the table,
+     and find out how long we may wait.  */
+  now = ptimer_measure (r->timer);
+#ifndef HAVE_SYS_EPOLL_H
+  FD_ZERO (&rdset);
+  FD_ZERO (&wrset);
+#endif
+  for (hash_table_iterate (r->entries, &iter); hash_table_iter_next (&iter); )
+    {
+      struct reactor_entry *entry = iter.value;
+
+      r->fds[n] = entry->fd;
+      entry->ready = 0;
+      if ((entry->wait_for & WAIT_FOR_READ) && fd_pending_p (entry->fd))
+        {
+          /* The data is already there.  */
+          entry->ready = WAIT_FOR_READ;
+          wait = 0;
+        }
+      if (entry->deadline
+          && (wait < 0 || entry->deadline - now < wait))
+        wait = MAX (0, entry->deadline - now);
+#ifndef HAVE_SYS_EPOLL_H
+      if (entry->wait_for & WAIT_FOR_READ)
+        FD_SET (entry->fd, &rdset);
+      if (entry->wait_for & WAIT_FOR_WRITE)
+        FD_SET (entry->fd, &wrset);
+      maxfd = MAX (maxfd, entry->fd);
+#endif
+      n++;
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+  {
+    /* Round up, so as not to wake up just before a deadline.  A day
+       is as good as forever, and doesn't overflow.  */
+    int ms = wait < 0 ? -1 : (int) (MIN (wait, 86400) * 1000 + 0.999);
+    int nev = epoll_wait (r->epfd, r->events, MAX (count, 1), ms);
+
+    if (nev < 0)
+      return errno == EINTR ? 0 : -1;
+    for (i = 0; i < nev; i++)
+      {
+        struct epoll_event *ev = &r->events[i];
+        struct reactor_entry *entry;
+
+        entry = hash_table_get (r->entries, FD_KEY (ev->data.fd));
+        if (ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          entry->ready |= WAIT_FOR_READ;
+        if (ev->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+          entry->ready |= WAIT_FOR_WRITE;
+      }
+  }
+#else /* not HAVE_SYS_EPOLL_H */
+  {
+    int res;
+
+    if (wait >= 0)
+      {
+        tmout.tv_sec = (long) wait;
+        tmout.tv_usec = 1000000 * (wait - (long) wait);
+      }
+    res = select (maxfd + 1, &rdset, &wrset, NULL, wait < 0 ? NULL : &tmout);
+    if (res < 0)
+      return errno == EINTR ? 0 : -1;
+    for (i = 0; i < n; i++)
+      {
+        struct reactor_entry *entry;
+
+        entry = hash_table_get (r->entries, FD_KEY (r->fds[i]));
+        if (FD_ISSET (r->fds[i], &rdset))
+          entry->ready |= WAIT_FOR_READ;
+        if (FD_ISSET (r->fds[i], &wrset))
+          entry->ready |= WAIT_FOR_WRITE;
+      }
+  }
+#endif /* not HAVE_SYS_EPOLL_H */
+
+  /* Call the callbacks of the ready file descriptors, and then of
+     those whose time is up.  Callbacks may remove file descriptors,
+     so they are looked up again each time.  */
+  for (i = 0; i < n; i++)
+    {
+      struct reactor_entry *entry;
+      int ready;
+
+      entry = hash_table_get (r->entries, FD_KEY (r->fds[i]));
+      if (!entry || !(ready = entry->ready & entry->wait_for))
+        continue;
+      entry->run = r->run;
+      entry->callback (entry->fd, ready, entry->arg);
+      ++calls;
+    }
+
+  now = ptimer_measure (r->timer);
+  for (i = 0; i < n; i++)
+    {
+      struct reactor_entry *entry;
+
+      entry = hash_table_get (r->entries, FD_KEY (r->fds[i]));
+      if (!entry || entry->run == r->run
+          || !entry->deadline || now < entry->deadline)
+        continue;
+      entry->run = r->run;
+      entry->deadline = 0;
+      entry->callback (entry->fd, REACTOR_TIMEOUT, entry->arg);
+      ++calls;
+    }
+
+  return calls;
+}
+
+#ifdef TESTING
+
+#include "../tests/unit-tests.h"
+
+static void
+test_reactor_callback (int fd _GL_UNUSED, int events, void *arg)
+{
+  int *seen = arg;
+  *seen = events;
+}
+
+const char *
+test_reactor (void)
+{
+  struct reactor *r = reactor_new ();
+  int fds[2], seen = 0;
+  char c;
+
+  mu_assert ("reactor_new failed", r != NULL);
+  mu_assert ("pipe failed", pipe (fds) == 0);
+  mu_assert ("reactor_add failed",
+             reactor_add (r, fds[0], WAIT_FOR_READ, 0,
+                          test_reactor_callback, &seen));
+
+  /* Nothing to read yet.  */
+  mu_assert ("empty pipe reported ready", reactor_run (r, 0) == 0);
+  mu_assert ("callback called for empty pipe", seen == 0);
+
+  mu_assert ("write failed", write (fds[1], "x", 1) == 1);
+  mu_assert ("pipe not reported ready", reactor_run (r, 1) == 1);
+  mu_assert ("wrong events for readable pipe", seen == WAIT_FOR_READ);
+  mu_assert ("read failed", read (fds[0], &c, 1) == 1);
+
+  /* With the pipe drained, the timeout fires.  */
+  seen = 0;
+  mu_assert ("reactor_modify failed",
+             reactor_modify (r, fds[0], WAIT_FOR_READ, 0.01));
+  mu_assert ("timeout not reported", reactor_run (r, -1) == 1);
+  mu_assert ("wrong events for timeout", seen == REACTOR_TIMEOUT);
+
+  reactor_remove (r, fds[0]);
+  mu_assert ("reactor_remove failed", reactor_count (r) == 0);
+
+  reactor_destroy (r);
+  close (fds[0]);
+  close (fds[1]);
+  return NULL;
+}
+
+#endif /* TESTING */
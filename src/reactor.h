@@ -0,0 +1,57 @@
+/* Declarations for reactor.c.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+struct reactor;                 /* forward declaration; all struct
+                                   members are private */
+
+/* Passed to the callbacks, besides WAIT_FOR_READ and WAIT_FOR_WRITE,
+   when the timeout of a file descriptor has passed.  */
+enum {
+  REACTOR_TIMEOUT = 4
+};
+
+/* Called with the file descriptor, what it is ready for, and the
+   argument given to reactor_add.  */
+typedef void (*reactor_callback_t) (int, int, void *);
+
+struct reactor *reactor_new (void);
+void reactor_destroy (struct reactor *);
+
+bool reactor_add (struct reactor *, int, int, double,
+                  reactor_callback_t, void *);
+bool reactor_modify (struct reactor *, int, int, double);
+void reactor_remove (struct reactor *, int);
+int reactor_count (const struct reactor *);
+
+int reactor_run (struct reactor *, double);
+
+#endif /* REACTOR_H */
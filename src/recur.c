@@ -33,6 +33,7 @@ as that of the covered work.  */
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -48,7 +49,15 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "spider.h"
+#include "http.h"
 #include "exits.h"
+#include "workers.h"
+#include "url-set.h"
+#include "ptimer.h"
+
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
 
 /* Functions for maintaining the URL queue.  */
 
@@ -61,15 +70,55 @@ struct queue_element {
   struct iri *iri;                /* sXXXav */
   bool css_allowed;             /* whether the document is allowed to
                                    be treated as CSS. */
+  struct host_slot *host;       /* the host of the URL, once looked up
+                                   by host_slot_get */
   struct queue_element *next;   /* next element in queue */
 };
 
+/* The queue keeps up to QUEUE_WINDOW_SIZE elements at its head in
+   memory.  Once that many are queued, the newer elements are gathered
+   at its tail and appended QUEUE_SEGMENT_SIZE at a time to a temporary
+   file, in segments that are read back in order as the head drains.
+   This way broad crawls don't need memory for all the URLs waiting to
+   be retrieved.  The file is emptied whenever all its segments have
+   been read, and where possible, the space of each segment is released
+   as soon as it has been read.  */
+
+#define QUEUE_WINDOW_SIZE 65536
+#define QUEUE_SEGMENT_SIZE 16384
+
+struct queue_segment {
+  off_t offset;                 /* where the segment is in the file */
+  off_t size;                   /* its size in bytes */
+  int count;                    /* how many elements it holds */
+  struct queue_segment *next;   /* the next newer segment */
+};
+
 struct url_queue {
-  struct queue_element *head;
+  struct queue_element *head;   /* the elements in memory at the head */
   struct queue_element *tail;
+  int head_count;
+
+  FILE *spill_fp;               /* the file of the segments */
+  struct queue_segment *first_segment; /* the elements in SPILL_FP */
+  struct queue_segment *last_segment;
+
+  struct queue_element *spill_head; /* the newest elements, to be */
+  struct queue_element *spill_tail; /* written to the next segment */
+  int spill_count;
+  bool spill_failed;            /* whether writing a segment failed */
+
   int count, maxcount;
 };
 
+/* Flags of the elements written to the segments.  */
+enum {
+  QEL_HTML_ALLOWED = 1,
+  QEL_CSS_ALLOWED  = 2,
+  QEL_IRI          = 4,
+  QEL_UTF8_ENCODE  = 8
+};
+
 /* Create a URL queue. */
 
 static struct url_queue *
@@ -79,17 +128,251 @@ url_queue_new (void)
   return queue;
 }
 
-/* Delete a URL queue. */
+static void
+queue_element_free (struct queue_element *qel)
+{
+  iri_free (qel->iri);
+  xfree (qel->url);
+  xfree (qel->referer);
+  xfree (qel);
+}
+
+static void
+queue_elements_free (struct queue_element *qel)
+{
+  while (qel)
+    {
+      struct queue_element *next = qel->next;
+      queue_element_free (qel);
+      qel = next;
+    }
+}
+
+/* Delete a URL queue, along with the elements left in it. */
 
 static void
 url_queue_delete (struct url_queue *queue)
 {
+  queue_elements_free (queue->head);
+  queue_elements_free (queue->spill_head);
+  while (queue->first_segment)
+    {
+      struct queue_segment *seg = queue->first_segment;
+      queue->first_segment = seg->next;
+      xfree (seg);
+    }
+  if (queue->spill_fp)
+    fclose (queue->spill_fp);
   xfree (queue);
 }
 
+/* Write QEL to FP, in the format of the segments.  */
+
+static void
+queue_element_write (FILE *fp, const struct queue_element *qel)
+{
+  struct iri *i = qel->iri;
+  unsigned char flags = ((qel->html_allowed ? QEL_HTML_ALLOWED : 0)
+                         | (qel->css_allowed ? QEL_CSS_ALLOWED : 0)
+                         | (i ? QEL_IRI : 0)
+                         | (i && i->utf8_encode ? QEL_UTF8_ENCODE : 0));
+
+  fwrite (&qel->depth, sizeof qel->depth, 1, fp);
+  fwrite (&flags, 1, 1, fp);
+  write_counted_string (fp, qel->url);
+  write_counted_string (fp, qel->referer);
+#ifdef ENABLE_IRI
+  if (i)
+    {
+      write_counted_string (fp, i->uri_encoding);
+      write_counted_string (fp, i->content_encoding);
+      write_counted_string (fp, i->orig_url);
+    }
+#endif
+}
+
+/* Read an element written by queue_element_write from FP.  Return
+   NULL if it cannot be read.  */
+
+static struct queue_element *
+queue_element_read (FILE *fp)
+{
+  struct queue_element *qel = xnew0 (struct queue_element);
+  unsigned char flags;
+  char *url, *referer;
+
+  if (fread (&qel->depth, sizeof qel->depth, 1, fp) != 1
+      || fread (&flags, 1, 1, fp) != 1
+      || !read_counted_string (fp, &url) || !url)
+    {
+      xfree (qel);
+      return NULL;
+    }
+  qel->url = url;
+  if (!read_counted_string (fp, &referer))
+    {
+      queue_element_free (qel);
+      return NULL;
+    }
+  qel->referer = referer;
+  qel->html_allowed = !!(flags & QEL_HTML_ALLOWED);
+  qel->css_allowed = !!(flags & QEL_CSS_ALLOWED);
+  if (flags & QEL_IRI)
+    {
+#ifdef ENABLE_IRI
+      struct iri *i = xnew0 (struct iri);
+      qel->iri = i;
+      if (!read_counted_string (fp, &i->uri_encoding)
+          || !read_counted_string (fp, &i->content_encoding)
+          || !read_counted_string (fp, &i->orig_url))
+        {
+          queue_element_free (qel);
+          return NULL;
+        }
+      i->utf8_encode = !!(flags & QEL_UTF8_ENCODE);
+#else
+      qel->iri = iri_new ();
+#endif
+    }
+  return qel;
+}
+
+/* Write the elements gathered at the tail of QUEUE to a new segment.
+   If that fails, they are kept in memory, and so are all the elements
+   queued from then on.  */
+
+static void
+url_queue_spill (struct url_queue *queue)
+{
+  struct queue_element *qel;
+  struct queue_segment *seg;
+  FILE *fp;
+  off_t offset;
+
+  if (!queue->spill_fp)
+    queue->spill_fp = tmpfile ();
+  fp = queue->spill_fp;
+  if (!fp || fseeko (fp, 0, SEEK_END) != 0 || (offset = ftello (fp)) < 0)
+    goto fail;
+
+  for (qel = queue->spill_head; qel; qel = qel->next)
+    queue_element_write (fp, qel);
+  if (fflush (fp) != 0 || ferror (fp))
+    goto fail;
+
+  seg = xnew0 (struct queue_segment);
+  seg->offset = offset;
+  seg->size = ftello (fp) - offset;
+  seg->count = queue->spill_count;
+  if (queue->last_segment)
+    queue->last_segment->next = seg;
+  else
+    queue->first_segment = seg;
+  queue->last_segment = seg;
+
+  queue_elements_free (queue->spill_head);
+  queue->spill_head = queue->spill_tail = NULL;
+  queue->spill_count = 0;
+
+  DEBUGP (("Wrote %d queued URLs to a temporary file.\n", seg->count));
+  return;
+
+ fail:
+  logprintf (LOG_NOTQUIET,
+             _("Cannot write the URL queue to a temporary file: %s\n"),
+             strerror (errno));
+  queue->spill_failed = true;
+}
+
+/* Read the elements of SEG, appending them to the head of QUEUE.
+   Return false if they cannot all be read.  */
+
+static bool
+segment_read (struct queue_segment *seg, struct url_queue *queue)
+{
+  FILE *fp = queue->spill_fp;
+  int n;
+
+  if (fseeko (fp, seg->offset, SEEK_SET) != 0)
+    return false;
+
+  for (n = 0; n < seg->count; n++)
+    {
+      struct queue_element *qel = queue_element_read (fp);
+
+      if (!qel)
+        return false;
+      if (queue->tail)
+        queue->tail->next = qel;
+      else
+        queue->head = qel;
+      queue->tail = qel;
+      ++queue->head_count;
+    }
+  return true;
+}
+
+/* Move the oldest elements that aren't at the head of QUEUE there:
+   those of the oldest segment, or else those gathered at the tail.
+   Return false if there are none.  */
+
+static bool
+url_queue_refill (struct url_queue *queue)
+{
+  struct queue_segment *seg = queue->first_segment;
+  int head_count = queue->head_count;
+
+  if (!seg)
+    {
+      if (!queue->spill_head)
+        return false;
+      if (queue->tail)
+        queue->tail->next = queue->spill_head;
+      else
+        queue->head = queue->spill_head;
+      queue->tail = queue->spill_tail;
+      queue->head_count += queue->spill_count;
+      queue->spill_head = queue->spill_tail = NULL;
+      queue->spill_count = 0;
+      return true;
+    }
+
+  queue->first_segment = seg->next;
+  if (!queue->first_segment)
+    queue->last_segment = NULL;
+
+  if (!segment_read (seg, queue))
+    {
+      int lost = seg->count - (queue->head_count - head_count);
+
+      logprintf (LOG_NOTQUIET, _("Cannot read %d queued URLs back from "
+                                 "a temporary file.\n"), lost);
+      queue->count -= lost;
+    }
+  DEBUGP (("Read %d queued URLs from a temporary file.\n",
+           queue->head_count - head_count));
+
+  /* Release the disk space of what has been read.  */
+  if (!queue->first_segment)
+    {
+      if (ftruncate (fileno (queue->spill_fp), 0) != 0)
+        DEBUGP (("Cannot truncate the URL queue file: %s\n",
+                 strerror (errno)));
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+  else
+    fallocate (fileno (queue->spill_fp),
+               FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+               seg->offset, seg->size);
+#endif
+  xfree (seg);
+  return true;
+}
+
 /* Enqueue a URL in the queue.  The queue is FIFO: the items will be
    retrieved ("dequeued") from the queue in the order they were placed
-   into it.  */
+   into it, except that url_dequeue may pass over the URLs of the same
+   depth whose hosts are not ready.  */
 
 static void
 url_enqueue (struct url_queue *queue, struct iri *i,
@@ -103,6 +386,7 @@ url_enqueue (struct url_queue *queue, struct iri *i,
   qel->depth = depth;
   qel->html_allowed = html_allowed;
   qel->css_allowed = css_allowed;
+  qel->host = NULL;
   qel->next = NULL;
 
   ++queue->count;
@@ -117,64 +401,188 @@ url_enqueue (struct url_queue *queue, struct iri *i,
     DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, url),
              i->uri_encoding ? quote_n (1, i->uri_encoding) : "None"));
 
-  if (queue->tail)
-    queue->tail->next = qel;
-  queue->tail = qel;
+  /* Elements go to the head only as long as nothing older waits
+     elsewhere, which keeps the queue in order.  */
+  if (queue->head_count < QUEUE_WINDOW_SIZE
+      && !queue->first_segment && !queue->spill_head)
+    {
+      if (queue->tail)
+        queue->tail->next = qel;
+      queue->tail = qel;
+
+      if (!queue->head)
+        queue->head = queue->tail;
+      ++queue->head_count;
+      return;
+    }
 
-  if (!queue->head)
-    queue->head = queue->tail;
+  if (queue->spill_tail)
+    queue->spill_tail->next = qel;
+  else
+    queue->spill_head = qel;
+  queue->spill_tail = qel;
+  if (++queue->spill_count == QUEUE_SEGMENT_SIZE && !queue->spill_failed)
+    url_queue_spill (queue);
 }
 
-/* Take a URL out of the queue.  Return true if this operation
-   succeeded, or false if the queue is empty.  */
+/* Take a URL out of the queue.  If ELIGIBLE is NULL, this is the URL
+   at the head.  Otherwise it is the first one for which ELIGIBLE,
+   called with the element and ARG, returns true, looking no further
+   than the elements at the head of the same depth as the first one,
+   so that the queue is still traversed breadth-first.  Return the
+   element, or NULL if the queue is empty or no element is eligible.  */
 
-static bool
-url_dequeue (struct url_queue *queue, struct iri **i,
-             const char **url, const char **referer, int *depth,
-             bool *html_allowed, bool *css_allowed)
+static struct queue_element *
+url_dequeue (struct url_queue *queue,
+             bool (*eligible) (struct queue_element *, void *), void *arg)
 {
-  struct queue_element *qel = queue->head;
+  struct queue_element *qel, *prev = NULL;
 
-  if (!qel)
-    return false;
+  /* Keep the head filled, so that the elements at the head can be
+     requested ahead of time.  */
+  while (queue->head_count + QUEUE_SEGMENT_SIZE <= QUEUE_WINDOW_SIZE
+         && url_queue_refill (queue))
+    ;
 
-  queue->head = queue->head->next;
-  if (!queue->head)
-    queue->tail = NULL;
+  qel = queue->head;
+  if (!qel)
+    return NULL;
 
-  *i = qel->iri;
-  *url = qel->url;
-  *referer = qel->referer;
-  *depth = qel->depth;
-  *html_allowed = qel->html_allowed;
-  *css_allowed = qel->css_allowed;
+  if (eligible)
+    {
+      int depth = qel->depth;
+      while (qel && qel->depth == depth && !eligible (qel, arg))
+        {
+          prev = qel;
+          qel = qel->next;
+        }
+      if (!qel || qel->depth != depth)
+        return NULL;
+    }
 
+  if (prev)
+    prev->next = qel->next;
+  else
+    queue->head = qel->next;
+  if (queue->tail == qel)
+    queue->tail = prev;
+  --queue->head_count;
   --queue->count;
+  qel->next = NULL;
 
   DEBUGP (("Dequeuing %s at depth %d\n",
            quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
   DEBUGP (("Queue count %d, maxcount %d.\n", queue->count, queue->maxcount));
 
-  xfree (qel);
+  return qel;
+}
+
+/* Tell the HTTP code which of the URLs at the head of QUEUE are going
+   to be retrieved next, so that it can request them ahead of time.  */
+
+static void
+url_queue_pipeline_hints (const struct url_queue *queue)
+{
+  const char *urls[HTTP_PIPELINE_DEPTH], *referers[HTTP_PIPELINE_DEPTH];
+  struct queue_element *qel;
+  int count = 0;
+
+  for (qel = queue->head; qel && count < HTTP_PIPELINE_DEPTH; qel = qel->next)
+    {
+      /* These are not going to be downloaded again.  */
+      if (dl_url_file_map && hash_table_contains (dl_url_file_map, qel->url))
+        continue;
+      urls[count] = qel->url;
+      referers[count] = qel->referer;
+      ++count;
+    }
+  http_pipeline_hints (urls, referers, count);
+}
+
+/* Write the elements of QUEUE to FP, after those of EXTRA, a list of
+   elements taken out of it whose retrieval is not done yet.  Return
+   false if that fails.  */
+
+static bool
+url_queue_write (struct url_queue *queue, struct queue_element *extra,
+                 FILE *fp)
+{
+  struct queue_element *qel;
+  struct queue_segment *seg;
+  int count = queue->count;
+
+  for (qel = extra; qel; qel = qel->next)
+    ++count;
+  fwrite (&count, sizeof count, 1, fp);
+
+  for (qel = extra; qel; qel = qel->next)
+    queue_element_write (fp, qel);
+  for (qel = queue->head; qel; qel = qel->next)
+    queue_element_write (fp, qel);
+
+  /* The segments are in the same format, so copy them as they are.  */
+  for (seg = queue->first_segment; seg; seg = seg->next)
+    {
+      char buf[8192];
+      off_t left = seg->size;
+
+      if (fseeko (queue->spill_fp, seg->offset, SEEK_SET) != 0)
+        return false;
+      while (left > 0)
+        {
+          size_t n = fread (buf, 1, MIN (left, (off_t) sizeof buf),
+                            queue->spill_fp);
+          if (n == 0)
+            return false;
+          fwrite (buf, 1, n, fp);
+          left -= n;
+        }
+    }
+
+  for (qel = queue->spill_head; qel; qel = qel->next)
+    queue_element_write (fp, qel);
+  return !ferror (fp);
+}
+
+/* Append the elements written by url_queue_write to FP to QUEUE.
+   Return false if they cannot all be read.  */
+
+static bool
+url_queue_read (struct url_queue *queue, FILE *fp)
+{
+  int count;
+
+  if (fread (&count, sizeof count, 1, fp) != 1 || count < 0)
+    return false;
+  while (count--)
+    {
+      struct queue_element *qel = queue_element_read (fp);
+
+      if (!qel)
+        return false;
+      url_enqueue (queue, qel->iri, qel->url, qel->referer, qel->depth,
+                   qel->html_allowed, qel->css_allowed);
+      xfree (qel);
+    }
   return true;
 }
 
-static void blacklist_add (struct hash_table *blacklist, const char *url)
+static void blacklist_add (struct url_set *blacklist, const char *url)
 {
   char *url_unescaped = xstrdup (url);
 
   url_unescape (url_unescaped);
-  string_set_add (blacklist, url_unescaped);
+  url_set_add (blacklist, url_unescaped);
   xfree (url_unescaped);
 }
 
-static int blacklist_contains (struct hash_table *blacklist, const char *url)
+static int blacklist_contains (struct url_set *blacklist, const char *url)
 {
   char *url_unescaped = xstrdup(url);
   int ret;
 
   url_unescape (url_unescaped);
-  ret = string_set_contains (blacklist, url_unescaped);
+  ret = url_set_contains (blacklist, url_unescaped);
   xfree (url_unescaped);
 
   return ret;
@@ -188,13 +596,435 @@ typedef enum
 } reject_reason;
 
 static reject_reason download_child (const struct urlpos *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
+                              struct url *, struct url_set *, struct iri *);
 static reject_reason descend_redirect (const char *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
+                              struct url *, struct url_set *, struct iri *);
 static void write_reject_log_header (FILE *);
 static void write_reject_log_reason (FILE *, reject_reason,
                               const struct url *, const struct url *);
 
+/* State shared by retrieve_tree and the functions that process the
+   URLs it retrieves.  */
+
+struct recur_state {
+  struct url_queue *queue;      /* the URLs we need to load */
+  struct url_set *blacklist;    /* the URLs we do not wish to enqueue,
+                                   because they are already in the
+                                   queue, but haven't been downloaded
+                                   yet */
+  struct url *start_url_parsed;
+  FILE *rejectedlog;            /* where rejected URLs are logged, or
+                                   NULL */
+  bool dns_prefetch;            /* resolve the hosts of the enqueued
+                                   URLs ahead of time */
+  struct queue_element *in_progress; /* the URLs being retrieved by
+                                   the workers */
+  double next_checkpoint;       /* when to write the next checkpoint,
+                                   on the clock of the schedule */
+  struct hash_table *hosts;     /* the host_slot of each host */
+  struct ptimer *clock;         /* the clock of the host schedule */
+  double next_ready;            /* when the next host the last call to
+                                   url_dequeue found too early becomes
+                                   ready, or -1 */
+};
+
+static void retrieved_url (struct recur_state *, struct queue_element *,
+                           struct url *, uerr_t, int, char *, char *);
+static void descend_url (struct recur_state *, struct queue_element *,
+                         char *, bool, bool);
+
+/* Start looking up the host of LINK, found in a page while it is
+   being downloaded, the way descend_url does once it is complete.  */
+
+static void
+prefetch_link (const struct urlpos *link, void *arg)
+{
+  (void) arg;
+  if (!link->ignore_when_downloading
+      && accept_domain (link->url)
+      && !url_uses_proxy (link->url))
+    host_prefetch (link->url->host);
+}
+
+/* Scheduling of the retrievals from each host.  With --wait, or once
+   the robots.txt of a host asks for a Crawl-delay, a host is sent one
+   request at a time, and only after the given time has passed since
+   the previous one was done.  The URLs of the other hosts are taken out
+   of the queue in the meantime, which keeps a crawl spanning many hosts
+   from spending most of its time sleeping.  Otherwise, with
+   --max-parallel, up to --max-parallel-per-host URLs of a host are
+   retrieved at a time.  */
+
+struct host_slot {
+  double ready;                 /* when the host may be sent the next
+                                   request, on the clock of the
+                                   schedule */
+  double crawl_delay;           /* the Crawl-delay of the host */
+  int active;                   /* retrievals from the host in
+                                   progress */
+};
+
+/* Return the slot of the host of the URL in QEL.  The hosts are told
+   apart by the scheme and the host and port part of the URLs, which
+   are in canonical form.  */
+
+static struct host_slot *
+host_slot_get (struct recur_state *rs, struct queue_element *qel)
+{
+  const char *url = qel->url;
+  const char *host, *end, *p;
+  size_t scheme_len;
+  struct host_slot *slot;
+  char *key;
+
+  if (qel->host)
+    return qel->host;
+
+  p = strstr (url, "://");
+  scheme_len = p ? p + 3 - url : 0;
+  host = url + scheme_len;
+  end = host + strcspn (host, "/?#");
+  for (p = end; p > host; p--)
+    if (p[-1] == '@')
+      {
+        /* Leave out the user name and password.  */
+        host = p;
+        break;
+      }
+
+  key = xmalloc (scheme_len + (end - host) + 1);
+  memcpy (key, url, scheme_len);
+  memcpy (key + scheme_len, host, end - host);
+  key[scheme_len + (end - host)] = '\0';
+
+  slot = hash_table_get (rs->hosts, key);
+  if (slot)
+    xfree (key);
+  else
+    {
+      slot = xnew0 (struct host_slot);
+      hash_table_put (rs->hosts, key, slot);
+    }
+  qel->host = slot;
+  return slot;
+}
+
+/* Return the number of retrievals from the host of SLOT that may be
+   in progress at the same time, or 0 if there is no limit.  */
+
+static int
+host_slot_limit (const struct host_slot *slot)
+{
+  if (opt.wait || slot->crawl_delay)
+    return 1;
+  return opt.max_parallel_per_host;
+}
+
+/* Whether the URL in QEL may be retrieved now, as far as its host is
+   concerned.  Called by url_dequeue.  */
+
+static bool
+host_ready (struct queue_element *qel, void *arg)
+{
+  struct recur_state *rs = arg;
+  struct host_slot *slot;
+  int limit;
+
+  /* These are not going to be downloaded again.  */
+  if (dl_url_file_map && hash_table_contains (dl_url_file_map, qel->url))
+    return true;
+
+  slot = host_slot_get (rs, qel);
+  limit = host_slot_limit (slot);
+  if (limit && slot->active >= limit)
+    return false;
+  if (slot->ready > ptimer_measure (rs->clock))
+    {
+      if (rs->next_ready < 0 || slot->ready < rs->next_ready)
+        rs->next_ready = slot->ready;
+      return false;
+    }
+  return true;
+}
+
+/* Note that the URL in QEL, whose parsed form is U, is being
+   retrieved.  */
+
+static void
+host_slot_start (struct recur_state *rs, struct queue_element *qel,
+                 const struct url *u)
+{
+  struct host_slot *slot = host_slot_get (rs, qel);
+  struct robot_specs *specs = NULL;
+
+  if (opt.use_robots)
+    specs = res_get_specs (u->host, u->port);
+  slot->crawl_delay = specs ? res_crawl_delay (specs) : 0;
+  ++slot->active;
+}
+
+/* Note that the retrieval of the URL in QEL is done, and when its host
+   may be sent the next request.  */
+
+static void
+host_slot_done (struct recur_state *rs, struct queue_element *qel)
+{
+  struct host_slot *slot = qel->host;
+  double wait = opt.wait;
+
+  if (opt.random_wait)
+    wait *= 0.5 + random_float ();
+  --slot->active;
+  slot->ready = ptimer_measure (rs->clock) + MAX (wait, slot->crawl_delay);
+}
+
+/* Checkpoints.  With --checkpoint, the state of the retrieval is
+   written to a file every now and then: the queue, including the URLs
+   being retrieved, the blacklist, the book-keeping of convert.c and the
+   totals of the downloads.  With --resume-crawl, retrieve_tree starts
+   from there, without retrieving or parsing again the documents whose
+   links have already been enqueued.
+
+   A checkpoint is written to a temporary file that is then renamed
+   over the previous one, so whenever Wget is killed, the file holds
+   the last complete checkpoint.  The numbers are written in the byte
+   order of the machine, and the format may change between versions of
+   Wget, so checkpoints are only good for continuing with the same
+   build.  */
+
+#define CHECKPOINT_MAGIC "Wget checkpoint 2\n"
+
+/* The least number of seconds between checkpoints.  The interval grows
+   with the time it takes to write them, to at most a tenth of the
+   time spent.  */
+#define CHECKPOINT_INTERVAL 60
+
+/* The start URLs of the retrievals that have been completed, each of
+   which is named by the checkpoints so that --resume-crawl skips it.  */
+static char **finished_urls;
+
+/* Whether URL is among the start URLs in the NULL-terminated vector
+   URLS.  */
+
+static bool
+start_url_listed (char **urls, const char *url)
+{
+  for (; urls && *urls; urls++)
+    if (!strcmp (*urls, url))
+      return true;
+  return false;
+}
+
+/* Write a checkpoint.  It begins with the start URLs of the completed
+   retrievals and of the retrieval of RS, unless that is complete as
+   well, so that --resume-crawl can tell which retrievals it knows
+   about before restoring anything.  The totals and the book-keeping
+   of convert.c, which are shared by all the retrievals, follow, and
+   then the state of RS if it isn't complete.  */
+
+static void
+checkpoint_write (struct recur_state *rs, bool complete)
+{
+  char *tmp = concat_strings (opt.checkpoint, ".tmp", (char *) 0);
+  FILE *fp = fopen (tmp, "wb");
+  double start = ptimer_measure (rs->clock), elapsed;
+  bool ok = false;
+
+  if (fp)
+    {
+      int count = 0;
+      char **url;
+
+      for (url = finished_urls; url && *url; url++)
+        ++count;
+      fputs (CHECKPOINT_MAGIC, fp);
+      fwrite (&count, sizeof count, 1, fp);
+      for (url = finished_urls; url && *url; url++)
+        write_counted_string (fp, *url);
+      write_counted_string (fp, complete ? NULL : rs->start_url_parsed->url);
+      fwrite (&numurls, sizeof numurls, 1, fp);
+      fwrite (&total_downloaded_bytes, sizeof total_downloaded_bytes, 1, fp);
+      fwrite (&total_download_time, sizeof total_download_time, 1, fp);
+      convert_state_write (fp);
+      if (complete)
+        ok = true;
+      else
+        {
+          url_set_write (rs->blacklist, fp);
+          ok = url_queue_write (rs->queue, rs->in_progress, fp);
+        }
+      ok = ok && fflush (fp) == 0;
+#if !defined(WINDOWS) && !defined(MSDOS)
+      ok = ok && fsync (fileno (fp)) == 0;
+#endif
+      if (fclose (fp) != 0)
+        ok = false;
+    }
+  if (ok && rename (tmp, opt.checkpoint) == 0)
+    DEBUGP (("Wrote checkpoint %s.\n", quote (opt.checkpoint)));
+  else
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write checkpoint %s: %s\n"),
+                 quote (opt.checkpoint), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+
+  elapsed = ptimer_measure (rs->clock) - start;
+  rs->next_checkpoint = ptimer_measure (rs->clock)
+    + MAX (CHECKPOINT_INTERVAL, 10 * elapsed);
+}
+
+/* What --resume-crawl has read of the checkpoint so far.  The start
+   URLs are read by the first retrieval, and the rest of the file by
+   the first retrieval that the checkpoint knows about.  */
+static struct {
+  bool started;                 /* the start URLs have been read */
+  FILE *fp;                     /* the checkpoint, until it is read
+                                   completely */
+  char **finished;              /* the completed retrievals */
+  char *current;                /* the start URL of the incomplete
+                                   retrieval, or NULL */
+  struct url_set *blacklist;    /* its blacklist and queue, once read */
+  struct url_queue *queue;
+} resume;
+
+/* What checkpoint_read did with the retrieval it was given.  */
+enum checkpoint_result {
+  CHECKPOINT_UNKNOWN,           /* not in the checkpoint, start anew */
+  CHECKPOINT_RESUMED,           /* its queue and blacklist are restored */
+  CHECKPOINT_COMPLETE           /* complete already, nothing to do */
+};
+
+/* Report that the checkpoint cannot be read, and exit.  */
+
+_Noreturn static void
+checkpoint_error (void)
+{
+  logprintf (LOG_NOTQUIET, _("Cannot read checkpoint %s: %s\n"),
+             quote (opt.checkpoint),
+             resume.fp && !ferror (resume.fp)
+             ? _("invalid or truncated file") : strerror (errno));
+  exit (WGET_EXIT_GENERIC_ERROR);
+}
+
+/* Read the start URLs at the beginning of the checkpoint.  */
+
+static void
+checkpoint_read_urls (void)
+{
+  char magic[sizeof CHECKPOINT_MAGIC - 1];
+  int count;
+
+  resume.started = true;
+  resume.fp = fopen (opt.checkpoint, "rb");
+  if (!resume.fp)
+    {
+      if (errno != ENOENT)
+        checkpoint_error ();
+      logprintf (LOG_VERBOSE, _("No checkpoint in %s, starting anew.\n"),
+                 quote (opt.checkpoint));
+      return;
+    }
+
+  if (fread (magic, 1, sizeof magic, resume.fp) != sizeof magic
+      || memcmp (magic, CHECKPOINT_MAGIC, sizeof magic) != 0
+      || fread (&count, sizeof count, 1, resume.fp) != 1 || count < 0)
+    checkpoint_error ();
+  while (count-- > 0)
+    {
+      char *url;
+      if (!read_counted_string (resume.fp, &url) || !url)
+        checkpoint_error ();
+      resume.finished = vec_append (resume.finished, url);
+      xfree (url);
+    }
+  if (!read_counted_string (resume.fp, &resume.current))
+    checkpoint_error ();
+}
+
+/* Read the rest of the checkpoint, restoring the totals, the
+   book-keeping of convert.c and the list of completed retrievals, and
+   reading the state of the incomplete retrieval, if any.  */
+
+static void
+checkpoint_read_state (void)
+{
+  char **url;
+
+  if (fread (&numurls, sizeof numurls, 1, resume.fp) != 1
+      || fread (&total_downloaded_bytes, sizeof total_downloaded_bytes, 1,
+                resume.fp) != 1
+      || fread (&total_download_time, sizeof total_download_time, 1,
+                resume.fp) != 1
+      || !convert_state_read (resume.fp))
+    checkpoint_error ();
+
+  if (resume.current)
+    {
+      resume.blacklist = url_set_read (resume.fp);
+      resume.queue = url_queue_new ();
+      if (!resume.blacklist || !url_queue_read (resume.queue, resume.fp))
+        checkpoint_error ();
+    }
+  fclose (resume.fp);
+  resume.fp = NULL;
+
+  /* The next checkpoints name the completed retrievals as well, also
+     those that haven't come along yet.  */
+  for (url = resume.finished; url && *url; url++)
+    if (!start_url_listed (finished_urls, *url))
+      finished_urls = vec_append (finished_urls, *url);
+}
+
+/* Look up the retrieval of RS in the checkpoint.  The first time a
+   retrieval the checkpoint knows about comes along, the state shared
+   by all the retrievals is restored; the queue and the blacklist of
+   RS are restored if it is the retrieval that was interrupted.  The
+   retrievals the checkpoint doesn't know about, for example those of
+   a checkpoint of another command line, don't restore anything.  */
+
+static enum checkpoint_result
+checkpoint_read (struct recur_state *rs)
+{
+  const char *url = rs->start_url_parsed->url;
+  bool complete, current;
+
+  if (!resume.started)
+    checkpoint_read_urls ();
+
+  complete = start_url_listed (resume.finished, url);
+  current = resume.current && !strcmp (resume.current, url);
+  if (!complete && !current)
+    {
+      if (resume.finished || resume.current)
+        logprintf (LOG_NOTQUIET, _("\
+The checkpoint in %s has no retrieval of %s; retrieving it from the start.\n"),
+                   quote_n (0, opt.checkpoint), quote_n (1, url));
+      return CHECKPOINT_UNKNOWN;
+    }
+
+  if (resume.fp)
+    checkpoint_read_state ();
+
+  if (complete)
+    {
+      logprintf (LOG_NOTQUIET, _("\
+The retrieval of %s is complete according to %s.\n"),
+                 quote_n (0, url), quote_n (1, opt.checkpoint));
+      return CHECKPOINT_COMPLETE;
+    }
+
+  rs->blacklist = resume.blacklist;
+  rs->queue = resume.queue;
+  resume.blacklist = NULL;
+  resume.queue = NULL;
+  xfree (resume.current);
+  logprintf (LOG_NOTQUIET, _("Resuming from %s, with %d URLs queued.\n"),
+             quote (opt.checkpoint), rs->queue->count);
+  return CHECKPOINT_RESUMED;
+}
+
 /* Retrieve a part of the web beginning with START_URL.  This used to
    be called "recursive retrieval", because the old function was
    recursive and implemented depth-first search.  retrieve_tree on the
@@ -214,23 +1044,30 @@ static void write_reject_log_reason (FILE *, reject_reason,
 
        7. if the URL is not one of those downloaded before, and if it
           satisfies the criteria specified by the various command-line
-          options, add it to the queue. */
+          options, add it to the queue.
+
+   With --max-parallel, step 4 is handed to a pool of worker processes
+   and the loop keeps dequeuing URLs while there are idle workers.
+   Steps 5-7 are still done here, as each download completes, so the
+   blacklist and the download maps see exactly the same updates as in
+   the serial case.
+
+   In step 3, the URLs whose hosts need to be waited for are passed
+   over in favor of those of other hosts at the same depth; see
+   host_ready.  */
 
 uerr_t
 retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 {
   uerr_t status = RETROK;
-
-  /* The queue of URLs we need to load. */
-  struct url_queue *queue;
-
-  /* The URLs we do not wish to enqueue, because they are already in
-     the queue, but haven't been downloaded yet.  */
-  struct hash_table *blacklist;
+  struct recur_state rs;
+  struct worker_pool *pool = NULL;
+  enum checkpoint_result resumed = CHECKPOINT_UNKNOWN;
 
   struct iri *i = iri_new ();
 
-  FILE *rejectedlog = NULL; /* Don't write a rejected log. */
+  xzero (rs);
+  rs.start_url_parsed = start_url_parsed;
 
   /* Duplicate pi struct if not NULL */
   if (pi)
@@ -246,43 +1083,125 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
     set_uri_encoding (i, opt.locale, true);
 #endif
 
-  queue = url_queue_new ();
-  blacklist = make_string_hash_table (0);
+  rs.hosts = make_string_hash_table (0);
+  rs.clock = ptimer_new ();
+  rs.next_checkpoint = CHECKPOINT_INTERVAL;
+
+  if (opt.resume_crawl)
+    resumed = checkpoint_read (&rs);
 
-  /* Enqueue the starting URL.  Use start_url_parsed->url rather than
-     just URL so we enqueue the canonical form of the URL.  */
-  url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
-               false);
-  blacklist_add (blacklist, start_url_parsed->url);
+  if (resumed == CHECKPOINT_COMPLETE)
+    {
+      iri_free (i);
+      hash_table_destroy (rs.hosts);
+      ptimer_destroy (rs.clock);
+      return RETROK;
+    }
+  if (resumed == CHECKPOINT_RESUMED)
+    iri_free (i);
+  else
+    {
+      rs.queue = url_queue_new ();
+      rs.blacklist = url_set_new (opt.url_fingerprints);
+
+      /* Enqueue the starting URL.  Use start_url_parsed->url rather
+         than just URL so we enqueue the canonical form of the URL.  */
+      url_enqueue (rs.queue, i, xstrdup (start_url_parsed->url), NULL, 0,
+                   true, false);
+      blacklist_add (rs.blacklist, start_url_parsed->url);
+    }
 
   if (opt.rejected_log)
     {
-      rejectedlog = fopen (opt.rejected_log, "w");
-      write_reject_log_header (rejectedlog);
-      if (!rejectedlog)
+      rs.rejectedlog = fopen (opt.rejected_log, "w");
+      write_reject_log_header (rs.rejectedlog);
+      if (!rs.rejectedlog)
         logprintf (LOG_NOTQUIET, "%s: %s\n", opt.rejected_log, strerror (errno));
     }
 
+  if (opt.max_parallel > 1)
+    {
+      /* Workers cannot share a single output document, WARC file or
+         cookie jar, so don't try.  */
+      if (opt.output_document || opt.warc_filename || opt.cookies_output)
+        logputs (LOG_VERBOSE, _("Ignoring --max-parallel, which cannot be "
+                                "combined with -O, --warc-file or "
+                                "--save-cookies.\n"));
+      else
+        pool = worker_pool_new (opt.max_parallel);
+    }
+
+  /* Workers resolve the hosts themselves, in their own caches.  */
+  rs.dns_prefetch = opt.dns_prefetch && opt.spanhost && !pool;
+
   while (1)
     {
-      bool descend = false;
-      char *url, *referer, *file = NULL;
-      int depth;
-      bool html_allowed, css_allowed;
-      bool is_css = false;
-      bool dash_p_leaf_HTML = false;
+      struct queue_element *qel;
+      char *file = NULL;
 
-      if (opt.quota && total_downloaded_bytes > opt.quota)
-        break;
-      if (status == FWRITEERR)
-        break;
+      if ((opt.quota && total_downloaded_bytes > opt.quota)
+          || status == FWRITEERR)
+        {
+          /* Let the downloads in progress finish, so that they get
+             registered, but don't start any new ones.  */
+          if (pool && worker_pool_busy (pool))
+            goto collect;
+          break;
+        }
+
+      if (opt.checkpoint && ptimer_measure (rs.clock) >= rs.next_checkpoint)
+        checkpoint_write (&rs, false);
+
+      if (pool && !worker_pool_size (pool))
+        {
+          /* The jobs of the workers that went away are back in the
+             queue, so nothing is lost by doing without them.  */
+          logputs (LOG_NOTQUIET, _("No worker process is left; "
+                                   "continuing without them.\n"));
+          worker_pool_delete (pool);
+          pool = NULL;
+        }
+
+      if (pool && !worker_pool_idle (pool))
+        goto collect;
+
+      if (rs.dns_prefetch)
+        host_prefetch_process ();
 
       /* Get the next URL from the queue... */
 
-      if (!url_dequeue (queue, (struct iri **) &i,
-                        (const char **)&url, (const char **)&referer,
-                        &depth, &html_allowed, &css_allowed))
-        break;
+      rs.next_ready = -1;
+      qel = url_dequeue (rs.queue, host_ready, &rs);
+      if (!qel && rs.queue->count)
+        {
+          /* All the URLs that may come next are of hosts that are busy
+             or need a rest.  Wait for a download to finish or for the
+             first of those hosts to become ready, whichever comes
+             first.  */
+          double delay = -1;
+
+          if (rs.next_ready >= 0)
+            delay = MAX (0, rs.next_ready - ptimer_measure (rs.clock));
+          if (pool && worker_pool_busy (pool))
+            {
+              if (delay < 0 || worker_pool_wait (pool, delay))
+                goto collect;
+            }
+          else
+            {
+              /* Only hosts with downloads in progress can be busy.  */
+              assert (delay >= 0);
+              DEBUGP (("Waiting %.2f seconds for the next host.\n", delay));
+              xsleep (delay);
+            }
+          continue;
+        }
+      if (!qel)
+        {
+          if (pool && worker_pool_busy (pool))
+            goto collect;
+          break;
+        }
 
       /* ...and download it.  Note that this download is in most cases
          unconditional, as download_child already makes sure a file
@@ -292,268 +1211,424 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
          and again under URL2, but at a different (possibly smaller)
          depth, we want the URL's children to be taken into account
          the second time.  */
-      if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
+      if (dl_url_file_map && hash_table_contains (dl_url_file_map, qel->url))
         {
+          bool descend = false, is_css = false;
           bool is_css_bool;
 
-          file = xstrdup (hash_table_get (dl_url_file_map, url));
+          file = xstrdup (hash_table_get (dl_url_file_map, qel->url));
 
           DEBUGP (("Already downloaded \"%s\", reusing it from \"%s\".\n",
-                   url, file));
+                   qel->url, file));
 
-          if ((is_css_bool = (css_allowed
+          if ((is_css_bool = (qel->css_allowed
                   && downloaded_css_set
                   && string_set_contains (downloaded_css_set, file)))
-              || (html_allowed
+              || (qel->html_allowed
                 && downloaded_html_set
                 && string_set_contains (downloaded_html_set, file)))
             {
               descend = true;
               is_css = is_css_bool;
             }
+          descend_url (&rs, qel, file, descend, is_css);
         }
       else
         {
           int dt = 0, url_err;
           char *redirected = NULL;
-          struct url *url_parsed = url_parse (url, &url_err, i, true);
+          struct url *url_parsed = url_parse (qel->url, &url_err, qel->iri,
+                                              true);
 
           if (!url_parsed)
             {
-              char *error = url_error (url, url_err);
-              logprintf (LOG_NOTQUIET, "%s: %s.\n",url, error);
+              char *error = url_error (qel->url, url_err);
+              logprintf (LOG_NOTQUIET, "%s: %s.\n", qel->url, error);
               xfree (error);
               inform_exit_status (URLERROR);
+              descend_url (&rs, qel, NULL, false, false);
             }
           else
             {
-
-              status = retrieve_url (url_parsed, url, &file, &redirected, referer,
-                                     &dt, false, i, true);
-
-              if (html_allowed && file && status == RETROK
-                  && (dt & RETROKF) && (dt & TEXTHTML))
+              host_slot_start (&rs, qel, url_parsed);
+              if (pool && worker_pool_submit (pool, qel->url, qel->referer,
+                                              qel->iri, qel))
                 {
-                  descend = true;
-                  is_css = false;
+                  struct queue_element **link = &rs.in_progress;
+
+                  /* The worker now has it; we'll get back to it once
+                     the download is done.  */
+                  while (*link)
+                    link = &(*link)->next;
+                  *link = qel;
+                  url_free (url_parsed);
+                  continue;
                 }
 
-              /* a little different, css_allowed can override content type
-                 lots of web servers serve css with an incorrect content type
-              */
-              if (file && status == RETROK
-                  && (dt & RETROKF) &&
-                  ((dt & TEXTCSS) || css_allowed))
-                {
-                  descend = true;
-                  is_css = true;
-                }
-
-              if (redirected)
-                {
-                  /* We have been redirected, possibly to another host, or
-                     different path, or wherever.  Check whether we really
-                     want to follow it.  */
-                  if (descend)
-                    {
-                      reject_reason r = descend_redirect (redirected, url_parsed,
-                                        depth, start_url_parsed, blacklist, i);
-                      if (r == WG_RR_SUCCESS)
-                        {
-                          /* Make sure that the old pre-redirect form gets
-                             blacklisted. */
-                          blacklist_add (blacklist, url);
-                        }
-                      else
-                        {
-                          write_reject_log_reason (rejectedlog, r, url_parsed, start_url_parsed);
-                          descend = false;
-                        }
-                    }
-
-                  xfree (url);
-                  url = redirected;
-                }
-              else
-                {
-                  xfree (url);
-                  url = xstrdup (url_parsed->url);
-                }
+              if (opt.http_pipelining)
+                url_queue_pipeline_hints (rs.queue);
+              /* If this is a page to be descended into, look for its
+                 links while it arrives.  */
+              if (qel->html_allowed && !opt.output_document
+                  && (qel->depth < opt.reclevel || opt.page_requisites
+                      || opt.reclevel == INFINITE_RECURSION))
+                html_stream_begin (url_parsed->url,
+                                   rs.dns_prefetch ? prefetch_link : NULL,
+                                   NULL);
+              wait_scheduled = true;
+              status = retrieve_url (url_parsed, qel->url, &file, &redirected,
+                                     qel->referer, &dt, false, qel->iri, true);
+              wait_scheduled = false;
+              host_slot_done (&rs, qel);
+              retrieved_url (&rs, qel, url_parsed, status, dt, file,
+                             redirected);
+              html_stream_end ();
               url_free (url_parsed);
             }
         }
+      continue;
 
-      if (opt.spider)
-        {
-          visited_url (url, referer);
-        }
+    collect:
+      {
+        struct worker_result res;
+        struct url *url_parsed;
+        struct queue_element **link;
+        int url_err;
+
+        if (!worker_pool_collect (pool, &res))
+          break;
+        qel = res.cookie;
+        host_slot_done (&rs, qel);
+        for (link = &rs.in_progress; *link != qel; link = &(*link)->next)
+          ;
+        *link = qel->next;
+
+        if (res.lost)
+          {
+            /* Retrieve it again, with another worker or without.  */
+            url_enqueue (rs.queue, qel->iri, qel->url, qel->referer,
+                         qel->depth, qel->html_allowed, qel->css_allowed);
+            xfree (qel);
+            continue;
+          }
+        status = res.status;
+
+        /* Pick up the encoding the worker found in the document.  */
+        if (res.iri)
+          {
+            iri_free (qel->iri);
+            qel->iri = res.iri;
+          }
+
+        /* retrieve_url has updated the exit status of the worker; do
+           the same here.  */
+        inform_exit_status (status);
+
+        /* The worker registered the download in its own copy of the
+           maps; do the same here.  */
+        register_retrieval (qel->url, res.redirected,
+                            res.redirected ? res.redirected : qel->url,
+                            res.file, res.dt);
+        if (res.file && (res.dt & RETROKF))
+          downloaded_file ((res.dt & ADDED_HTML_EXTENSION)
+                           ? FILE_DOWNLOADED_AND_HTML_EXTENSION_ADDED
+                           : FILE_DOWNLOADED_NORMALLY, res.file);
+
+        /* The encoding the worker found may keep the URL from being
+           parsed again.  */
+        url_parsed = url_parse (qel->url, &url_err, qel->iri, true);
+        if (!url_parsed)
+          {
+            char *error = url_error (qel->url, url_err);
+            logprintf (LOG_NOTQUIET, "%s: %s.\n", qel->url, error);
+            xfree (error);
+            inform_exit_status (URLERROR);
+            xfree (res.redirected);
+            descend_url (&rs, qel, res.file, false, false);
+            continue;
+          }
+        retrieved_url (&rs, qel, url_parsed, status, res.dt, res.file,
+                       res.redirected);
+        url_free (url_parsed);
+      }
+    }
+
+  if (pool)
+    worker_pool_delete (pool);
+
+  /* Record where the retrieval has ended, so that it isn't done again,
+     or so that it can be continued after a premature exit.  */
+  if (opt.checkpoint)
+    {
+      bool complete = rs.queue->count == 0;
+      if (complete)
+        finished_urls = vec_append (finished_urls, start_url_parsed->url);
+      checkpoint_write (&rs, complete);
+    }
+
+  if (rs.rejectedlog)
+    {
+      fclose (rs.rejectedlog);
+      rs.rejectedlog = NULL;
+    }
+
+  /* If anything is left of the queue due to a premature exit, it is
+     freed along with the queue.  */
+  url_queue_delete (rs.queue);
+
+  url_set_free (rs.blacklist);
+
+  free_keys_and_values (rs.hosts);
+  hash_table_destroy (rs.hosts);
+  ptimer_destroy (rs.clock);
+
+  if (opt.quota && total_downloaded_bytes > opt.quota)
+    return QUOTEXC;
+  else if (status == FWRITEERR)
+    return FWRITEERR;
+  else
+    return RETROK;
+}
+
+/* Process the outcome of retrieving the URL in QEL, whose parsed form
+   is URL_PARSED.  STATUS, DT, FILE and REDIRECTED are what
+   retrieve_url returned; FILE and REDIRECTED are taken over.  Decides
+   whether the document is to be descended into and hands it over to
+   descend_url.  QEL is freed.  */
+
+static void
+retrieved_url (struct recur_state *rs, struct queue_element *qel,
+               struct url *url_parsed, uerr_t status, int dt,
+               char *file, char *redirected)
+{
+  bool descend = false, is_css = false;
+
+  if (qel->html_allowed && file && status == RETROK
+      && (dt & RETROKF) && (dt & TEXTHTML))
+    {
+      descend = true;
+      is_css = false;
+    }
 
-      if (descend
-          && depth >= opt.reclevel && opt.reclevel != INFINITE_RECURSION)
+  /* a little different, css_allowed can override content type
+     lots of web servers serve css with an incorrect content type
+  */
+  if (file && status == RETROK
+      && (dt & RETROKF) &&
+      ((dt & TEXTCSS) || qel->css_allowed))
+    {
+      descend = true;
+      is_css = true;
+    }
+
+  if (redirected)
+    {
+      /* We have been redirected, possibly to another host, or
+         different path, or wherever.  Check whether we really
+         want to follow it.  */
+      if (descend)
         {
-          if (opt.page_requisites
-              && (depth == opt.reclevel || depth == opt.reclevel + 1))
+          reject_reason r = descend_redirect (redirected, url_parsed,
+                            qel->depth, rs->start_url_parsed, rs->blacklist,
+                            qel->iri);
+          if (r == WG_RR_SUCCESS)
             {
-              /* When -p is specified, we are allowed to exceed the
-                 maximum depth, but only for the "inline" links,
-                 i.e. those that are needed to display the page.
-                 Originally this could exceed the depth at most by
-                 one, but we allow one more level so that the leaf
-                 pages that contain frames can be loaded
-                 correctly.  */
-              dash_p_leaf_HTML = true;
+              /* Make sure that the old pre-redirect form gets
+                 blacklisted. */
+              blacklist_add (rs->blacklist, qel->url);
             }
           else
             {
-              /* Either -p wasn't specified or it was and we've
-                 already spent the two extra (pseudo-)levels that it
-                 affords us, so we need to bail out. */
-              DEBUGP (("Not descending further; at depth %d, max. %d.\n",
-                       depth, opt.reclevel));
+              write_reject_log_reason (rs->rejectedlog, r, url_parsed,
+                                       rs->start_url_parsed);
               descend = false;
             }
         }
 
-      /* If the downloaded document was HTML or CSS, parse it and enqueue the
-         links it contains. */
+      xfree (qel->url);
+      qel->url = redirected;
+    }
+  else
+    {
+      xfree (qel->url);
+      qel->url = xstrdup (url_parsed->url);
+    }
+
+  descend_url (rs, qel, file, descend, is_css);
+}
 
-      if (descend)
+/* If DESCEND is true, parse FILE, the local copy of the URL in QEL,
+   and enqueue the links it contains, as CSS if IS_CSS is true.  Then
+   get rid of FILE if it was only needed for its links.  QEL and FILE
+   are freed.  */
+
+static void
+descend_url (struct recur_state *rs, struct queue_element *qel, char *file,
+             bool descend, bool is_css)
+{
+  char *url = (char *) qel->url;
+  char *referer = (char *) qel->referer;
+  struct iri *i = qel->iri;
+  int depth = qel->depth;
+  bool dash_p_leaf_HTML = false;
+
+  if (opt.spider)
+    {
+      visited_url (url, referer);
+    }
+
+  if (descend
+      && depth >= opt.reclevel && opt.reclevel != INFINITE_RECURSION)
+    {
+      if (opt.page_requisites
+          && (depth == opt.reclevel || depth == opt.reclevel + 1))
+        {
+          /* When -p is specified, we are allowed to exceed the
+             maximum depth, but only for the "inline" links,
+             i.e. those that are needed to display the page.
+             Originally this could exceed the depth at most by
+             one, but we allow one more level so that the leaf
+             pages that contain frames can be loaded
+             correctly.  */
+          dash_p_leaf_HTML = true;
+        }
+      else
         {
-          bool meta_disallow_follow = false;
-          struct urlpos *children
-            = is_css ? get_urls_css_file (file, url) :
-                       get_urls_html (file, url, &meta_disallow_follow, i);
+          /* Either -p wasn't specified or it was and we've
+             already spent the two extra (pseudo-)levels that it
+             affords us, so we need to bail out. */
+          DEBUGP (("Not descending further; at depth %d, max. %d.\n",
+                   depth, opt.reclevel));
+          descend = false;
+        }
+    }
 
-          if (opt.use_robots && meta_disallow_follow)
-            {
-              free_urlpos (children);
-              children = NULL;
-            }
+  /* If the downloaded document was HTML or CSS, parse it and enqueue the
+     links it contains. */
 
-          if (children)
-            {
-              struct urlpos *child = children;
-              struct url *url_parsed = url_parse (url, NULL, i, true);
-              struct iri *ci;
-              char *referer_url = url;
-              bool strip_auth;
+  if (descend)
+    {
+      bool meta_disallow_follow = false;
+      struct urlpos *children
+        = is_css ? get_urls_css_file (file, url) :
+                   get_urls_html (file, url, &meta_disallow_follow, i);
 
-              assert (url_parsed != NULL);
+      /* Keep the links for converting them at the end, even if they
+         aren't followed.  */
+      if ((opt.convert_links || opt.convert_file_only) && !opt.delete_after)
+        register_links (file, url, is_css, children);
 
-              if (!url_parsed)
-                continue;
+      if (opt.use_robots && meta_disallow_follow)
+        {
+          free_urlpos (children);
+          children = NULL;
+        }
 
-              strip_auth = (url_parsed && url_parsed->user);
+      if (children)
+        {
+          struct urlpos *child = children;
+          struct url *url_parsed = url_parse (url, NULL, i, true);
+          struct iri *ci;
+          char *referer_url = url;
+          bool strip_auth;
+
+          assert (url_parsed != NULL);
+
+          if (!url_parsed)
+            goto out;
+
+          strip_auth = (url_parsed && url_parsed->user);
+
+          /* Strip auth info if present */
+          if (strip_auth)
+            referer_url = url_string (url_parsed, URL_AUTH_HIDE);
+
+          /* Start looking up the hosts we haven't seen yet, so that
+             their addresses are ready by the time they are needed,
+             be it for robots.txt or for the download.  */
+          if (rs->dns_prefetch)
+            for (; child; child = child->next)
+              if (!child->ignore_when_downloading
+                  && (!dash_p_leaf_HTML || child->link_inline_p)
+                  && accept_domain (child->url)
+                  && !url_uses_proxy (child->url))
+                host_prefetch (child->url->host);
+
+          for (child = children; child; child = child->next)
+            {
+              reject_reason r;
 
-              /* Strip auth info if present */
-              if (strip_auth)
-                referer_url = url_string (url_parsed, URL_AUTH_HIDE);
+              if (child->ignore_when_downloading)
+                {
+                  DEBUGP (("Not following due to 'ignore' flag: %s\n", child->url->url));
+                  continue;
+                }
 
-              for (; child; child = child->next)
+              if (dash_p_leaf_HTML && !child->link_inline_p)
                 {
-                  reject_reason r;
-
-                  if (child->ignore_when_downloading)
-                    {
-                      DEBUGP (("Not following due to 'ignore' flag: %s\n", child->url->url));
-                      continue;
-                    }
-
-                  if (dash_p_leaf_HTML && !child->link_inline_p)
-                    {
-                      DEBUGP (("Not following due to 'link inline' flag: %s\n", child->url->url));
-                      continue;
-                    }
-
-                  r = download_child (child, url_parsed, depth,
-                                      start_url_parsed, blacklist, i);
-                  if (r == WG_RR_SUCCESS)
-                    {
-                      ci = iri_new ();
-                      set_uri_encoding (ci, i->content_encoding, false);
-                      url_enqueue (queue, ci, xstrdup (child->url->url),
-                                   xstrdup (referer_url), depth + 1,
-                                   child->link_expect_html,
-                                   child->link_expect_css);
-                      /* We blacklist the URL we have enqueued, because we
-                         don't want to enqueue (and hence download) the
-                         same URL twice.  */
-                      blacklist_add (blacklist, child->url->url);
-                    }
-                  else
-                    {
-                      write_reject_log_reason (rejectedlog, r, child->url, url_parsed);
-                    }
+                  DEBUGP (("Not following due to 'link inline' flag: %s\n", child->url->url));
+                  continue;
                 }
 
-              if (strip_auth)
-                xfree (referer_url);
-              url_free (url_parsed);
-              free_urlpos (children);
+              r = download_child (child, url_parsed, depth,
+                                  rs->start_url_parsed, rs->blacklist, i);
+              if (r == WG_RR_SUCCESS)
+                {
+                  ci = iri_new ();
+                  set_uri_encoding (ci, i->content_encoding, false);
+                  url_enqueue (rs->queue, ci, xstrdup (child->url->url),
+                               xstrdup (referer_url), depth + 1,
+                               child->link_expect_html,
+                               child->link_expect_css);
+                  /* We blacklist the URL we have enqueued, because we
+                     don't want to enqueue (and hence download) the
+                     same URL twice.  */
+                  blacklist_add (rs->blacklist, child->url->url);
+                }
+              else
+                {
+                  write_reject_log_reason (rs->rejectedlog, r, child->url,
+                                           url_parsed);
+                }
             }
-        }
 
-      if (file
-          && (opt.delete_after
-              || opt.spider /* opt.recursive is implicitly true */
-              || !acceptable (file)))
-        {
-          /* Either --delete-after was specified, or we loaded this
-             (otherwise unneeded because of --spider or rejected by -R)
-             HTML file just to harvest its hyperlinks -- in either case,
-             delete the local file. */
-          DEBUGP (("Removing file due to %s in recursive_retrieve():\n",
-                   opt.delete_after ? "--delete-after" :
-                   (opt.spider ? "--spider" :
-                    "recursive rejection criteria")));
-          logprintf (LOG_VERBOSE,
-                     (opt.delete_after || opt.spider
-                      ? _("Removing %s.\n")
-                      : _("Removing %s since it should be rejected.\n")),
-                     file);
-          if (unlink (file))
-            logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
-          logputs (LOG_VERBOSE, "\n");
-          register_delete_file (file);
+          if (strip_auth)
+            xfree (referer_url);
+          url_free (url_parsed);
+          free_urlpos (children);
         }
-
-      xfree (url);
-      xfree (referer);
-      xfree (file);
-      iri_free (i);
     }
 
-  if (rejectedlog)
+  if (file
+      && (opt.delete_after
+          || opt.spider /* opt.recursive is implicitly true */
+          || !acceptable (file)))
     {
-      fclose (rejectedlog);
-      rejectedlog = NULL;
+      /* Either --delete-after was specified, or we loaded this
+         (otherwise unneeded because of --spider or rejected by -R)
+         HTML file just to harvest its hyperlinks -- in either case,
+         delete the local file. */
+      DEBUGP (("Removing file due to %s in recursive_retrieve():\n",
+               opt.delete_after ? "--delete-after" :
+               (opt.spider ? "--spider" :
+                "recursive rejection criteria")));
+      logprintf (LOG_VERBOSE,
+                 (opt.delete_after || opt.spider
+                  ? _("Removing %s.\n")
+                  : _("Removing %s since it should be rejected.\n")),
+                 file);
+      if (unlink (file))
+        logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+      logputs (LOG_VERBOSE, "\n");
+      register_delete_file (file);
     }
 
-  /* If anything is left of the queue due to a premature exit, free it
-     now.  */
-  {
-    char *d1, *d2;
-    int d3;
-    bool d4, d5;
-    struct iri *d6;
-    while (url_dequeue (queue, (struct iri **)&d6,
-                        (const char **)&d1, (const char **)&d2, &d3, &d4, &d5))
-      {
-        iri_free (d6);
-        xfree (d1);
-        xfree (d2);
-      }
-  }
-  url_queue_delete (queue);
-
-  string_set_free (blacklist);
-
-  if (opt.quota && total_downloaded_bytes > opt.quota)
-    return QUOTEXC;
-  else if (status == FWRITEERR)
-    return FWRITEERR;
-  else
-    return RETROK;
+ out:
+  xfree (url);
+  xfree (referer);
+  xfree (file);
+  iri_free (i);
+  xfree (qel);
 }
 
 /* Based on the context provided by retrieve_tree, decide whether a
@@ -566,7 +1641,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
 static reject_reason
 download_child (const struct urlpos *upos, struct url *parent, int depth,
-                  struct url *start_url_parsed, struct hash_table *blacklist,
+                  struct url *start_url_parsed, struct url_set *blacklist,
                   struct iri *iri)
 {
   struct url *u = upos->url;
@@ -794,7 +1869,7 @@ download_child (const struct urlpos *upos, struct url *parent, int depth,
 
 static reject_reason
 descend_redirect (const char *redirected, struct url *orig_parsed, int depth,
-                    struct url *start_url_parsed, struct hash_table *blacklist,
+                    struct url *start_url_parsed, struct url_set *blacklist,
                     struct iri *iri)
 {
   struct url *new_parsed;
@@ -915,4 +1990,170 @@ write_reject_log_reason (FILE *fp, reject_reason reason,
   fprintf (fp, "\n");
 }
 
+#ifdef TESTING
+
+static bool
+not_host_a (struct queue_element *qel, void *arg)
+{
+  (void) arg;
+  return strncmp (qel->url, "http://a/", 9) != 0;
+}
+
+/* Enqueue the Nth element of the test queue to QUEUE.  */
+
+static void
+test_enqueue (struct url_queue *queue, int n)
+{
+  struct iri *i = iri_new ();
+  char url[64];
+
+#ifdef ENABLE_IRI
+  i->content_encoding = n % 2 ? xstrdup ("utf-8") : NULL;
+#endif
+  snprintf (url, sizeof (url), "http://example.com/%d", n);
+  url_enqueue (queue, i, xstrdup (url),
+               n % 3 ? xstrdup ("http://example.com/") : NULL,
+               n % 7, n % 2, n % 5 == 0);
+}
+
+/* Check that QEL is the Nth element of the test queue.  */
+
+static const char *
+test_queue_element (const struct queue_element *qel, int n)
+{
+  char expected[64];
+
+  mu_assert ("test_url_queue: queue empty too early", qel != NULL);
+  snprintf (expected, sizeof (expected), "http://example.com/%d", n);
+  mu_assert ("test_url_queue: wrong URL", !strcmp (qel->url, expected));
+  mu_assert ("test_url_queue: wrong referer", !qel->referer == !(n % 3));
+  mu_assert ("test_url_queue: wrong flags",
+             qel->depth == n % 7
+             && qel->html_allowed == (n % 2)
+             && qel->css_allowed == (n % 5 == 0));
+#ifdef ENABLE_IRI
+  mu_assert ("test_url_queue: wrong IRI",
+             !qel->iri->content_encoding == !(n % 2));
+#endif
+  return NULL;
+}
+
+const char *
+test_url_queue (void)
+{
+  struct url_queue *queue = url_queue_new (), *copy;
+  const int total = QUEUE_WINDOW_SIZE + 3 * QUEUE_SEGMENT_SIZE + 100;
+  int enqueued = 0, dequeued = 0, n;
+  bool spilled = false;
+  struct queue_element *qel;
+  const char *message;
+  FILE *fp;
+
+  /* Enqueue three elements for every one dequeued, and then dequeue
+     the rest: they must come out in order, whether they were kept in
+     memory or not.  */
+  while (dequeued < total)
+    {
+      if (enqueued < total)
+        {
+          test_enqueue (queue, enqueued++);
+          spilled |= queue->first_segment != NULL;
+          if (enqueued % 3)
+            continue;
+        }
+      qel = url_dequeue (queue, NULL, NULL);
+      if ((message = test_queue_element (qel, dequeued)) != NULL)
+        return message;
+      queue_element_free (qel);
+      dequeued++;
+      mu_assert ("test_url_queue: wrong count",
+                 queue->count == enqueued - dequeued);
+    }
+  mu_assert ("test_url_queue: nothing was spilled", spilled);
+  url_queue_delete (queue);
+
+  /* A checkpoint of a spilled queue, with an element taken out of it
+     that is still being retrieved, reads back in the same order, and
+     the queue is still good afterwards.  */
+  queue = url_queue_new ();
+  for (n = 0; n < total; n++)
+    test_enqueue (queue, n);
+  mu_assert ("test_url_queue: nothing was spilled",
+             queue->first_segment != NULL && queue->spill_head != NULL);
+  qel = url_dequeue (queue, NULL, NULL);
+  qel->next = NULL;
+  fp = tmpfile ();
+  mu_assert ("test_url_queue: cannot write the queue",
+             fp && url_queue_write (queue, qel, fp));
+  queue_element_free (qel);
+  rewind (fp);
+  copy = url_queue_new ();
+  mu_assert ("test_url_queue: cannot read the queue",
+             url_queue_read (copy, fp) && copy->count == total);
+  fclose (fp);
+  for (n = 0; n < total; n++)
+    {
+      qel = url_dequeue (copy, NULL, NULL);
+      if ((message = test_queue_element (qel, n)) != NULL)
+        return message;
+      queue_element_free (qel);
+      if (n == 0)
+        continue;
+      qel = url_dequeue (queue, NULL, NULL);
+      if ((message = test_queue_element (qel, n)) != NULL)
+        return message;
+      queue_element_free (qel);
+    }
+  mu_assert ("test_url_queue: elements left",
+             copy->count == 0 && queue->count == 0);
+  url_queue_delete (copy);
+  url_queue_delete (queue);
+
+  /* A truncated checkpoint is noticed.  */
+  queue = url_queue_new ();
+  for (n = 0; n < 10; n++)
+    test_enqueue (queue, n);
+  fp = tmpfile ();
+  mu_assert ("test_url_queue: cannot write the queue",
+             fp && url_queue_write (queue, NULL, fp));
+  url_queue_delete (queue);
+  mu_assert ("test_url_queue: cannot truncate",
+             fflush (fp) == 0
+             && ftruncate (fileno (fp), ftello (fp) - 1) == 0);
+  rewind (fp);
+  queue = url_queue_new ();
+  mu_assert ("test_url_queue: truncated queue read",
+             !url_queue_read (queue, fp));
+  fclose (fp);
+  url_queue_delete (queue);
+
+  /* With a filter, the first eligible URL of the depth at the head is
+     taken, and none of the next depth.  */
+  queue = url_queue_new ();
+  url_enqueue (queue, NULL, xstrdup ("http://a/"), NULL, 0, true, false);
+  url_enqueue (queue, NULL, xstrdup ("http://b/"), NULL, 0, true, false);
+  url_enqueue (queue, NULL, xstrdup ("http://c/"), NULL, 1, true, false);
+  {
+    static const char *expected[] = { "http://b/", NULL, "http://a/",
+                                      "http://c/" };
+    unsigned n;
+
+    for (n = 0; n < countof (expected); n++)
+      {
+        struct queue_element *qel =
+          url_dequeue (queue, n == 2 ? NULL : not_host_a, NULL);
+        mu_assert ("test_url_queue: wrong eligible URL",
+                   expected[n] ? qel && !strcmp (qel->url, expected[n])
+                               : !qel);
+        if (qel)
+          queue_element_free (qel);
+      }
+    mu_assert ("test_url_queue: eligible URLs left", queue->count == 0);
+  }
+  url_queue_delete (queue);
+  return NULL;
+}
+
+#endif /* TESTING */
+
 /* vim:set sts=2 sw=2 cino+={s: */
@@ -58,6 +58,10 @@ as that of the covered work.  */
 
    * We don't recognize sole CR as the line ending.
 
+   * The `Crawl-delay' field, which is not part of either
+     specification but is widely used, is honored by retrieve_tree as
+     the minimum number of seconds between two requests to the host.
+
    * We don't implement expiry mechanism for /robots.txt specs.  I
      consider it non-necessary for a relatively short-lived
      application such as Wget.  Besides, it is highly questionable
@@ -97,6 +101,8 @@ struct robot_specs {
   int count;
   int size;
   struct path_info *paths;
+  double crawl_delay;           /* the Crawl-delay applying to Wget, or
+                                   0 if there is none */
 };
 
 /* Parsing the robot spec. */
@@ -241,6 +247,9 @@ res_parse (const char *source, int length)
      the last `user-agent' instructions.  */
   int record_count = 0;
 
+  /* the Crawl-delay of the records for "*" and for Wget.  */
+  double delay_any = 0, delay_exact = 0;
+
   struct robot_specs *specs = xnew0 (struct robot_specs);
 
   while (1)
@@ -352,6 +361,29 @@ res_parse (const char *source, int length)
             }
           ++record_count;
         }
+      else if (FIELD_IS ("crawl-delay"))
+        {
+          if (user_agent_applies)
+            {
+              char *value = strdupdelim (value_b, value_e);
+              char *end_value;
+              double delay = strtod (value, &end_value);
+              /* Ignore delays of a day or more as bogus.  */
+              if (end_value != value && *end_value == '\0'
+                  && delay > 0 && delay < 86400)
+                {
+                  if (user_agent_exact)
+                    delay_exact = delay;
+                  else
+                    delay_any = delay;
+                }
+              else
+                DEBUGP (("Ignoring malformed Crawl-delay at line %d\n",
+                         line_count));
+              xfree (value);
+            }
+          ++record_count;
+        }
       else
         {
           DEBUGP (("Ignoring unknown field at line %d\n", line_count));
@@ -377,6 +409,7 @@ res_parse (const char *source, int length)
                                specs->count * sizeof (struct path_info));
       specs->size = specs->count;
     }
+  specs->crawl_delay = found_exact ? delay_exact : delay_any;
 
   return specs;
 }
@@ -475,6 +508,15 @@ res_match_path (const struct robot_specs *specs, const char *path)
   return true;
 }
 
+/* Return the number of seconds to wait between two requests to the
+   host SPECS are for, as requested by its Crawl-delay, or 0.  */
+
+double
+res_crawl_delay (const struct robot_specs *specs)
+{
+  return specs->crawl_delay;
+}
+
 /* Registering the specs. */
 
 static struct hash_table *registered_specs;
@@ -638,6 +680,38 @@ test_is_robots_txt_url(void)
   return NULL;
 }
 
+const char *
+test_crawl_delay (void)
+{
+  unsigned i;
+  static const struct {
+    const char *robots;
+    double expected_delay;
+  } test_array[] = {
+    { "User-agent: *\nDisallow: /cgi-bin/\n", 0 },
+    { "User-agent: *\nCrawl-delay: 2\n", 2 },
+    { "User-agent: *\nCrawl-delay: 0.5 # comment\nDisallow:\n", 0.5 },
+    { "User-agent: *\nCrawl-delay: 2\n\n"
+      "User-agent: Wget\nCrawl-delay: 10\n", 10 },
+    { "User-agent: *\nCrawl-delay: 2\n\n"
+      "User-agent: Wget\nDisallow: /tmp/\n", 0 },
+    { "User-agent: googlebot\nCrawl-delay: 7\n", 0 },
+    { "User-agent: *\nCrawl-delay: soon\n", 0 },
+    { "User-agent: *\nCrawl-delay: -1\n", 0 },
+  };
+
+  for (i = 0; i < countof(test_array); ++i)
+    {
+      struct robot_specs *specs =
+        res_parse (test_array[i].robots, strlen (test_array[i].robots));
+      mu_assert ("test_crawl_delay: wrong delay",
+                 res_crawl_delay (specs) == test_array[i].expected_delay);
+      free_specs (specs);
+    }
+
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
@@ -40,9 +40,6 @@ as that of the covered work.  */
 # include <unixio.h>            /* For delete(). */
 #endif
 
-#ifdef HAVE_LIBZ
-# include <zlib.h>
-#endif
 
 #include "exits.h"
 #include "utils.h"
@@ -60,6 +57,11 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "iri.h"
 #include "hsts.h"
+#include "decoder.h"
+
+#ifdef TESTING
+#include "../tests/unit-tests.h"
+#endif
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 SUM_SIZE_INT total_downloaded_bytes;
@@ -67,6 +69,11 @@ SUM_SIZE_INT total_downloaded_bytes;
 /* Total download time in seconds. */
 double total_download_time;
 
+/* Set by the callers of retrieve_url that have already made sure the
+   request is not made too soon after the previous ones to the same
+   host, so that the wait before its first attempt is left out.  */
+bool wait_scheduled;
+
 /* If non-NULL, the stream to which output should be written.  This
    stream is initialized when `-O' is used.  */
 FILE *output_stream;
@@ -87,22 +94,6 @@ limit_bandwidth_reset (void)
   xzero (limit_data);
 }
 
-#ifdef HAVE_LIBZ
-static voidpf
-zalloc (voidpf opaque, unsigned int items, unsigned int size)
-{
-  (void) opaque;
-  return (voidpf) xcalloc (items, size);
-}
-
-static void
-zfree (voidpf opaque, voidpf address)
-{
-  (void) opaque;
-  xfree (address);
-}
-#endif
-
 /* Limit the bandwidth by pausing the download for an amount of time.
    BYTES is the number of bytes received from the network, and TIMER
    is the timer that started at the beginning of download.  */
@@ -195,25 +186,7 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
   if (written)
     *written += bufsize;
 
-  /* Immediately flush the downloaded data.  This should not hinder
-     performance: fast downloads will arrive in large 16K chunks
-     (which stdio would write out immediately anyway), and slow
-     downloads wouldn't be limited by disk speed.  */
-
-  /* 2005-04-20 SMS.
-     Perhaps it shouldn't hinder performance, but it sure does, at least
-     on VMS (more than 2X).  Rather than speculate on what it should or
-     shouldn't do, it might make more sense to test it.  Even better, it
-     might be nice to explain what possible benefit it could offer, as
-     it appears to be a clear invitation to poor performance with no
-     actual justification.  (Also, why 16K?  Anyone test other values?)
-  */
-#ifndef __VMS
-  if (out)
-    fflush (out);
-  if (out2)
-    fflush (out2);
-#endif /* ndef __VMS */
+  /* fd_read_body flushes OUT and OUT2; see body_writer_flush_p.  */
 
   if (out && ferror (out))
     return -2;
@@ -223,9 +196,367 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
   return 0;
 }
 
+#ifdef HAVE_CONTENT_DECODING
+/* Where decode_sink writes the data decoded by fd_read_body.  */
+struct decode_target {
+  FILE *out;
+  wgint *skip;
+  wgint *written;
+  const char *file;             /* for html_stream_feed, if HTML */
+  wgint startpos;
+};
+
+static int
+decode_sink (void *arg, const char *buf, int len)
+{
+  struct decode_target *target = arg;
+  wgint written = *target->written;
+  int res = write_data (target->out, NULL, buf, len, target->skip,
+                        target->written);
+  if (res == 0 && target->file)
+    html_stream_feed (target->file, target->startpos + written,
+                      buf + len - (*target->written - written),
+                      *target->written - written);
+  return res < 0 ? res : 0;
+}
+#endif
+
+/* Downloaded data is written out to disk once this much of it has
+   accumulated, or once it has waited for WRITE_FLUSH_INTERVAL seconds,
+   whichever comes first.  Flushing after every read would cost a
+   write system call per 8K for no benefit to fast downloads; the
+   interval keeps slow downloads showing up on disk promptly, for -c
+   after an interruption or for someone watching the file.  */
+#define WRITE_FLUSH_SIZE (256 * 1024)
+#define WRITE_FLUSH_INTERVAL 1.0
+
+/* How fd_read_body writes the body to its output file.
+
+   When the body is stored as it arrives, with nothing to decompress,
+   skip, or copy to a WARC file, it is collected in BUF and written
+   straight to the file descriptor of OUT, bypassing stdio.  The data
+   is read from the network right into BUF, so it isn't copied around,
+   and it is written out in large pieces.  Otherwise it goes through
+   write_data and stdio, and OUT and OUT2 are flushed according to the
+   same policy.  */
+struct body_writer {
+  FILE *out, *out2;
+  bool direct;                  /* whether the direct path is used */
+  int fd;                       /* descriptor of OUT for the direct path */
+  char *buf;                    /* data not yet written by the direct path */
+  int len;
+  wgint unflushed;              /* data not yet flushed, either path */
+  double flush_tm;              /* time of the last flush */
+};
+
+static void
+body_writer_init (struct body_writer *bw, FILE *out, FILE *out2, int flags)
+{
+  xzero (*bw);
+  bw->out = out;
+  bw->out2 = out2;
+  bw->fd = -1;
+
+#ifndef __VMS
+  /* VMS files may have record structure that write() doesn't know
+     about; leave them to stdio.  */
+  if (out && !out2 && !(flags & (rb_skip_startpos | rb_compressed))
+      /* Write out what has been written to OUT so far (such as saved
+         headers), so the descriptor is positioned after it.  */
+      && fflush (out) == 0)
+    {
+      bw->direct = true;
+      bw->fd = fileno (out);
+      bw->buf = xmalloc (WRITE_FLUSH_SIZE);
+    }
+#endif /* ndef __VMS */
+}
+
+/* Whether it's time to write out the data collected in BW, NOW being
+   the current download time, or -1 if unknown.  */
+
+static bool
+body_writer_flush_p (const struct body_writer *bw, double now)
+{
+  if (!bw->unflushed)
+    return false;
+  return (bw->unflushed >= WRITE_FLUSH_SIZE
+          || (now >= 0 && now - bw->flush_tm >= WRITE_FLUSH_INTERVAL));
+}
+
+/* Write out the data collected in BW.  Returns 0 on success, -2 on an
+   error writing to OUT, and -3 on an error writing to OUT2, as
+   write_data does.  */
+
+static int
+body_writer_flush (struct body_writer *bw, double now)
+{
+  int res = 0;
+
+  if (bw->direct)
+    {
+      if (bw->len && !write_all (bw->fd, bw->buf, bw->len))
+        res = -2;
+      bw->len = 0;
+    }
+  else
+    {
+      if (bw->out && fflush (bw->out) != 0)
+        res = -2;
+      else if (bw->out2 && fflush (bw->out2) != 0)
+        res = -3;
+    }
+  bw->unflushed = 0;
+  if (now >= 0)
+    bw->flush_tm = now;
+  return res;
+}
+
+/* Account for BUFSIZE bytes the direct path has read into BW->buf
+   after BW->len.  */
+
+static void
+body_writer_commit (struct body_writer *bw, int bufsize, wgint *written)
+{
+  bw->len += bufsize;
+  bw->unflushed += bufsize;
+  if (written)
+    *written += bufsize;
+}
+
+/* Write out whatever is left in BW and free it.  After the direct
+   path, OUT is positioned at the end of what was written, so the
+   caller can keep using it.  Returns 0, -2 or -3 as
+   body_writer_flush.  */
+
+static int
+body_writer_finish (struct body_writer *bw)
+{
+  int res = body_writer_flush (bw, -1);
+
+  if (bw->direct)
+    {
+      off_t pos = lseek (bw->fd, 0, SEEK_CUR);
+      if (pos >= 0)
+        fseeko (bw->out, pos, SEEK_SET);
+      xfree (bw->buf);
+    }
+  return res;
+}
+
+/* fd_read_body reads up to DLBUF_MAX bytes at a time.  It starts out
+   with reads of DLBUF_MIN bytes and doubles their size after
+   DLBUF_GROW reads in a row have filled the buffer; when a read brings
+   in less than a quarter of it, as on slow connections, the size is
+   halved again.  Fast downloads thus take few read calls and progress
+   updates per megabyte, without slow ones waiting on a large buffer.
+   --limit-rate caps the size, see fd_read_body.  */
+#define DLBUF_MIN (MAX (BUFSIZ, 8 * 1024))
+#define DLBUF_MAX (256 * 1024)
+#define DLBUF_GROW 2
+
+/* Return the new read size of fd_read_body after a read of GOT bytes
+   when SIZE were asked for, with the size at most LIMIT.  *FULL counts
+   the reads in a row that filled the buffer.  */
+
+static int
+adapt_read_size (int size, int got, int limit, int *full)
+{
+  if (got >= size)
+    {
+      if (++*full >= DLBUF_GROW && size < limit)
+        {
+          *full = 0;
+          return MIN (size * 2, limit);
+        }
+    }
+  else
+    {
+      *full = 0;
+      if (got < size / 4)
+        return MAX (size / 2, MIN (DLBUF_MIN, limit));
+    }
+  return size;
+}
+
+/* Decoding of the chunked transfer coding (RFC 7230, section 4.1).
+
+   The decoder is a state machine that is fed the body as it arrives,
+   so chunk sizes are parsed right out of the read buffer: unlike
+   reading every size line with fd_read_line, this needs no peeking
+   and no allocation per chunk.  Lines may end in LF as well as CRLF,
+   and chunk extensions and trailers are skipped.  */
+
+void
+chunk_decoder_init (struct chunk_decoder *cd)
+{
+  xzero (*cd);
+  cd->state = CHUNK_SIZE;
+}
+
+/* Decode LEN bytes of a chunked body at IN, storing the chunk data
+   they contain to OUT and its length to *OUTLEN.  OUT may be the same
+   as IN, or NULL to drop the data.  Decoding stops at the end of the
+   body, when CD->state becomes CHUNK_DONE.
+
+   Returns the number of bytes of IN that were used, which is less
+   than LEN only if the body ended before, or -1 if the body is
+   malformed.  */
+
+int
+chunk_decode (struct chunk_decoder *cd, const char *in, int len,
+              char *out, int *outlen)
+{
+  int i = 0, o = 0;
+
+  while (i < len && cd->state != CHUNK_DONE)
+    {
+      char c = in[i];
+
+      switch (cd->state)
+        {
+        case CHUNK_SIZE:
+          if (c_isxdigit (c))
+            {
+              if (cd->remaining > (WGINT_MAX >> 4))
+                return -1;
+              cd->remaining = (cd->remaining << 4) + XDIGIT_TO_NUM (c);
+              ++cd->digits;
+            }
+          else if (!cd->digits && (c == ' ' || c == '\t'))
+            ;
+          else if (!cd->digits)
+            return -1;
+          else
+            {
+              /* Let CHUNK_EXT look at C.  */
+              cd->state = CHUNK_EXT;
+              continue;
+            }
+          break;
+        case CHUNK_EXT:
+          if (c == '\n')
+            {
+              if (cd->remaining)
+                cd->state = CHUNK_DATA;
+              else
+                {
+                  cd->state = CHUNK_TRAILER;
+                  cd->line_len = 0;
+                }
+            }
+          break;
+        case CHUNK_DATA:
+          {
+            int n = MIN (cd->remaining, len - i);
+            if (out && out + o != in + i)
+              memmove (out + o, in + i, n);
+            o += n;
+            i += n;
+            cd->remaining -= n;
+            if (!cd->remaining)
+              cd->state = CHUNK_DATA_END;
+          }
+          continue;
+        case CHUNK_DATA_END:
+          if (c == '\n')
+            {
+              cd->state = CHUNK_SIZE;
+              cd->digits = 0;
+            }
+          else if (c != '\r')
+            return -1;
+          break;
+        case CHUNK_TRAILER:
+          if (c == '\n')
+            {
+              if (!cd->line_len)
+                cd->state = CHUNK_DONE;
+              cd->line_len = 0;
+            }
+          else if (c != '\r')
+            ++cd->line_len;
+          break;
+        case CHUNK_DONE:
+          break;
+        }
+      ++i;
+    }
+
+  if (outlen)
+    *outlen = o;
+  return i;
+}
+
+/* Return the number of bytes that are certain to follow in a chunked
+   body decoded up to the state CD: the least it can take to end the
+   chunk being read and the body, with "0\n\n".  Reading that much
+   never reads past the end of the body.  */
+
+static wgint
+chunk_decoder_minimum (const struct chunk_decoder *cd)
+{
+  switch (cd->state)
+    {
+    case CHUNK_SIZE:
+      if (!cd->digits)
+        return 3;
+      /* fallthrough */
+    case CHUNK_EXT:
+      /* The end of this line, the data, the line end after it, and
+         "0\n\n"; or, for the last chunk, the end of this line and of
+         the trailer.  */
+      if (cd->remaining)
+        return MIN (cd->remaining, WGINT_MAX - 5) + 5;
+      return 2;
+    case CHUNK_DATA:
+      return MIN (cd->remaining, WGINT_MAX - 4) + 4;
+    case CHUNK_DATA_END:
+      return 4;
+    case CHUNK_TRAILER:
+      return cd->line_len ? 2 : 1;
+    case CHUNK_DONE:
+      break;
+    }
+  return 0;
+}
+
+/* Read up to BUFSIZE bytes of a chunked body from FD into BUF, like
+   fd_read, but never beyond the end of the body, so that a persistent
+   connection can go on with the next response.  CD is the state of
+   decoding the data read so far.
+
+   In the middle of a large chunk this is a plain read.  Near the end
+   of a chunk, the available data is peeked at to find out how much of
+   it belongs to the body, which takes one peek for all the small
+   chunks that have arrived rather than one per chunk.  */
+
+int
+fd_read_chunked (int fd, const struct chunk_decoder *cd, char *buf,
+                 int bufsize, double timeout)
+{
+  if (chunk_decoder_minimum (cd) < bufsize)
+    {
+      struct chunk_decoder scan = *cd;
+      int ret = fd_peek (fd, buf, bufsize, timeout);
+      if (ret <= 0)
+        return ret;
+      bufsize = chunk_decode (&scan, buf, ret, NULL, NULL);
+      if (bufsize < 0)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      /* The data is there; don't wait for it again.  */
+      timeout = 0;
+    }
+  return fd_read (fd, buf, bufsize, timeout);
+}
+
 /* Read the contents of file descriptor FD until it the connection
    terminates or a read error occurs.  The data is read in portions of
-   up to 16K and written to OUT as it arrives.  If opt.verbose is set,
+   up to DLBUF_MAX and written to OUT as it arrives, flushed according to
+   WRITE_FLUSH_SIZE and WRITE_FLUSH_INTERVAL.  If opt.verbose is set,
    the progress is shown.
 
    TOREAD is the amount of data expected to arrive, normally only used
@@ -255,10 +586,14 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
               FILE *out2)
 {
   int ret = 0;
-#undef max
-#define max(a,b) ((a) > (b) ? (a) : (b))
-  int dlbufsize = max (BUFSIZ, 8 * 1024);
-  char *dlbuf = xmalloc (dlbufsize);
+  int dlbufsize = DLBUF_MIN;
+  int dlbufalloc = dlbufsize;
+  char *dlbuf = xmalloc (dlbufalloc);
+
+  /* The largest read size, and the number of reads in a row that have
+     filled the buffer (see adapt_read_size).  */
+  int dlbufmax = DLBUF_MAX;
+  int full_reads = 0;
 
   struct ptimer *timer = NULL;
   double last_successful_read_tm = 0;
@@ -281,49 +616,47 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   /* How much data we've read/written.  */
   wgint sum_read = 0;
   wgint sum_written = 0;
-  wgint remaining_chunk_size = 0;
+  struct chunk_decoder cd;
+
+  /* OUT2 gets a copy of the body as it arrives; when it is chunked,
+     that's done before decoding it, not by write_data.  */
+  FILE *body_out2 = chunked ? NULL : out2;
+
+  struct body_writer bw;
+  int write_res;
+  double now = -1;
+
+#ifdef HAVE_CONTENT_DECODING
+  /* The decoder of a compressed body, and where it writes to.  */
+  struct decoder *decoder = NULL;
+  struct decode_target target;
+#endif
 
-#ifdef HAVE_LIBZ
-  /* try to minimize the number of calls to inflate() and write_data() per
-     call to fd_read() */
-  unsigned int gzbufsize = dlbufsize * 4;
-  char *gzbuf = NULL;
-  z_stream gzstream;
+  body_writer_init (&bw, out, out2, flags);
 
-  if (flags & rb_compressed_gzip)
+#ifdef HAVE_CONTENT_DECODING
+  if (flags & rb_compressed)
     {
-      gzbuf = xmalloc (gzbufsize);
-      if (gzbuf != NULL)
+      decoder = decoder_new (flags & rb_compressed);
+      if (!decoder)
         {
-          gzstream.zalloc = zalloc;
-          gzstream.zfree = zfree;
-          gzstream.opaque = Z_NULL;
-          gzstream.next_in = Z_NULL;
-          gzstream.avail_in = 0;
-
-          #define GZIP_DETECT 32 /* gzip format detection */
-          #define GZIP_WINDOW 15 /* logarithmic window size (default: 15) */
-          ret = inflateInit2 (&gzstream, GZIP_DETECT | GZIP_WINDOW);
-          if (ret != Z_OK)
-            {
-              xfree (gzbuf);
-              errno = (ret == Z_MEM_ERROR) ? ENOMEM : EINVAL;
-              ret = -1;
-              goto out;
-            }
-        }
-      else
-        {
-          errno = ENOMEM;
           ret = -1;
           goto out;
         }
+      target.out = out;
+      target.skip = &skip;
+      target.written = &sum_written;
+      target.file = (flags & rb_html) ? downloaded_filename : NULL;
+      target.startpos = startpos;
     }
 #endif
 
   if (flags & rb_skip_startpos)
     skip = startpos;
 
+  if (chunked)
+    chunk_decoder_init (&cd);
+
   if (opt.show_progress)
     {
       const char *filename_progress;
@@ -342,10 +675,10 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   if (opt.limit_rate)
     limit_bandwidth_reset ();
 
-  /* A timer is needed for tracking progress, for throttling, and for
-     tracking elapsed time.  If either of these are requested, start
-     the timer.  */
-  if (progress || opt.limit_rate || elapsed)
+  /* A timer is needed for tracking progress, for throttling, for
+     tracking elapsed time, and for deciding when to flush the output.
+     If either of these are requested, start the timer.  */
+  if (progress || opt.limit_rate || elapsed || out || out2)
     {
       timer = ptimer_new ();
       last_successful_read_tm = 0;
@@ -357,6 +690,8 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
      we never have to sleep for more than one second.  */
   if (opt.limit_rate && opt.limit_rate < dlbufsize)
     dlbufsize = opt.limit_rate;
+  if (opt.limit_rate && opt.limit_rate < dlbufmax)
+    dlbufmax = MAX (opt.limit_rate, dlbufsize);
 
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
@@ -364,52 +699,17 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
      should be read.  */
   while (!exact || (sum_read < toread))
     {
-      int rdsize;
+      int rdsize, got;
+      char *rdbuf = dlbuf;
       double tmout = opt.read_timeout;
 
-      if (chunked)
-        {
-          if (remaining_chunk_size == 0)
-            {
-              char *line = fd_read_line (fd);
-              char *endl;
-              if (line == NULL)
-                {
-                  ret = -1;
-                  break;
-                }
-              else if (out2 != NULL)
-                fwrite (line, 1, strlen (line), out2);
-
-              remaining_chunk_size = strtol (line, &endl, 16);
-              xfree (line);
-
-              if (remaining_chunk_size < 0)
-                {
-                  ret = -1;
-                  break;
-                }
+      rdsize = exact ? MIN (toread - sum_read, dlbufsize) : dlbufsize;
 
-              if (remaining_chunk_size == 0)
-                {
-                  ret = 0;
-                  line = fd_read_line (fd);
-                  if (line == NULL)
-                    ret = -1;
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
-                  break;
-                }
-            }
-
-          rdsize = MIN (remaining_chunk_size, dlbufsize);
+      if (bw.direct)
+        {
+          rdbuf = bw.buf + bw.len;
+          rdsize = MIN (rdsize, WRITE_FLUSH_SIZE - bw.len);
         }
-      else
-        rdsize = exact ? MIN (toread - sum_read, dlbufsize) : dlbufsize;
 
       if (progress_interactive)
         {
@@ -434,71 +734,83 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                 }
             }
         }
-      ret = fd_read (fd, dlbuf, rdsize, tmout);
+      if (chunked)
+        ret = fd_read_chunked (fd, &cd, rdbuf, rdsize, tmout);
+      else
+        ret = fd_read (fd, rdbuf, rdsize, tmout);
 
       if (progress_interactive && ret < 0 && errno == ETIMEDOUT)
         ret = 0;                /* interactive timeout, handled above */
+      else if (ret == 0 && chunked)
+        {
+          /* EOF before the last chunk.  */
+          ret = -1;
+          errno = 0;
+          break;
+        }
       else if (ret <= 0)
         break;                  /* EOF or read error */
+      got = ret;
 
-      if (progress || opt.limit_rate || elapsed)
+      if (timer)
         {
-          ptimer_measure (timer);
+          now = ptimer_measure (timer);
           if (ret > 0)
-            last_successful_read_tm = ptimer_read (timer);
+            last_successful_read_tm = now;
         }
 
-      if (ret > 0)
+      if (ret > 0 && chunked)
         {
-          int write_res;
+          /* The WARC record gets the body as it was sent, the
+             output only the data, which is moved to the start of
+             RDBUF.  */
+          write_res = write_data (NULL, out2, rdbuf, ret, NULL, NULL);
+          if (write_res < 0)
+            {
+              ret = write_res;
+              goto out;
+            }
+          if (chunk_decode (&cd, rdbuf, ret, rdbuf, &ret) < 0)
+            {
+              errno = EINVAL;
+              ret = -1;
+              break;
+            }
+        }
 
+      if (ret > 0)
+        {
           sum_read += ret;
 
-#ifdef HAVE_LIBZ
-          if (gzbuf != NULL)
+#ifdef HAVE_CONTENT_DECODING
+          if (decoder)
             {
-              int err;
-              int towrite;
-
               /* Write original data to WARC file */
-              write_res = write_data (NULL, out2, dlbuf, ret, NULL, NULL);
+              write_res = write_data (NULL, body_out2, dlbuf, ret, NULL, NULL);
               if (write_res < 0)
                 {
                   ret = write_res;
                   goto out;
                 }
 
-              gzstream.avail_in = ret;
-              gzstream.next_in = (unsigned char *) dlbuf;
-
-              do
+              write_res = decoder_decode (decoder, dlbuf, ret, decode_sink,
+                                          &target);
+              if (write_res < 0)
                 {
-                  gzstream.avail_out = gzbufsize;
-                  gzstream.next_out = (unsigned char *) gzbuf;
-
-                  err = inflate (&gzstream, Z_NO_FLUSH);
-
-                  switch (err)
-                    {
-                    case Z_MEM_ERROR:
-                      errno = ENOMEM;
-                      ret = -1;
-                      goto out;
-                    case Z_NEED_DICT:
-                    case Z_DATA_ERROR:
-                      errno = EINVAL;
-                      ret = -1;
-                      goto out;
-                    case Z_STREAM_END:
-                      if (exact && sum_read != toread)
-                        {
-                          DEBUGP(("zlib stream ended unexpectedly after "
-                                  "%ld/%ld bytes\n", sum_read, toread));
-                        }
-                    }
+                  ret = write_res;
+                  goto out;
+                }
+            }
+          else
+#endif
+            {
+              wgint written = sum_written;
 
-                  towrite = gzbufsize - gzstream.avail_out;
-                  write_res = write_data (out, NULL, gzbuf, towrite, &skip,
+              if (bw.direct)
+                body_writer_commit (&bw, ret, &sum_written);
+              else
+                {
+                  write_res = write_data (out, body_out2, dlbuf, ret, &skip,
                                           &sum_written);
                   if (write_res < 0)
                     {
@@ -506,38 +818,38 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                       goto out;
                     }
                 }
-              while (gzstream.avail_out == 0);
+
+              /* Whatever was skipped came first.  */
+              if (flags & rb_html)
+                html_stream_feed (downloaded_filename, startpos + written,
+                                  rdbuf + ret - (sum_written - written),
+                                  sum_written - written);
             }
-          else
-#endif
+
+          if (!bw.direct)
+            bw.unflushed += ret;
+
+          /* Only a read that could have filled the buffer says
+             something about the connection.  */
+          if (rdsize == dlbufsize)
             {
-              write_res = write_data (out, out2, dlbuf, ret, &skip,
-                                      &sum_written);
-              if (write_res < 0)
+              dlbufsize = adapt_read_size (dlbufsize, got, dlbufmax,
+                                           &full_reads);
+              if (dlbufsize > dlbufalloc && !bw.direct)
                 {
-                  ret = write_res;
-                  goto out;
+                  dlbufalloc = dlbufsize;
+                  dlbuf = xrealloc (dlbuf, dlbufalloc);
                 }
             }
+        }
 
-          if (chunked)
+      if (body_writer_flush_p (&bw, now))
+        {
+          write_res = body_writer_flush (&bw, now);
+          if (write_res < 0)
             {
-              remaining_chunk_size -= ret;
-              if (remaining_chunk_size == 0)
-                {
-                  char *line = fd_read_line (fd);
-                  if (line == NULL)
-                    {
-                      ret = -1;
-                      break;
-                    }
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
-                }
+              ret = write_res;
+              goto out;
             }
         }
 
@@ -551,11 +863,22 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
         ws_percenttitle (100.0 *
                          (startpos + sum_read) / (startpos + toread));
 #endif
+
+      if (chunked && cd.state == CHUNK_DONE)
+        {
+          ret = 0;
+          break;
+        }
     }
   if (ret < -1)
     ret = -1;
 
  out:
+  /* Whatever happened, keep the data that did arrive.  */
+  write_res = body_writer_finish (&bw);
+  if (write_res < 0 && ret >= 0)
+    ret = write_res;
+
   if (progress)
     progress_finish (progress, ptimer_read (timer));
 
@@ -564,28 +887,16 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   if (timer)
     ptimer_destroy (timer);
 
-#ifdef HAVE_LIBZ
-  if (gzbuf != NULL)
+#ifdef HAVE_CONTENT_DECODING
+  if (decoder)
     {
-      int err = inflateEnd (&gzstream);
+      /* with compression enabled, ret must be 0 if successful */
       if (ret >= 0)
-        {
-          /* with compression enabled, ret must be 0 if successful */
-          if (err == Z_OK)
-            ret = 0;
-          else
-            {
-              errno = EINVAL;
-              ret = -1;
-            }
-        }
-      xfree (gzbuf);
-
-      if (gzstream.total_in != sum_read)
-        {
-          DEBUGP(("zlib read size differs from raw read size (%lu/%lu)\n",
-                  gzstream.total_in, sum_read));
-        }
+        ret = 0;
+      if (!decoder_finished_p (decoder))
+        DEBUGP (("Compressed data ended unexpectedly after %s bytes.\n",
+                 number_to_static_string (sum_read)));
+      decoder_free (decoder);
     }
 #endif
 
@@ -1134,19 +1445,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           DEBUGP (("[Couldn't fallback to non-utf8 for %s\n", quote (url)));
     }
 
-  if (local_file && u && (*dt & RETROKF || opt.content_on_error))
-    {
-      register_download (u->url, local_file);
-
-      if (!opt.spider && redirection_count && 0 != strcmp (origurl, u->url))
-        register_redirection (origurl, u->url);
-
-      if (*dt & TEXTHTML)
-        register_html (local_file);
-
-      if (*dt & TEXTCSS)
-        register_css (local_file);
-    }
+  if (u)
+    register_retrieval (origurl, redirection_count ? u->url : NULL,
+                        u->url, local_file, *dt);
 
   if (file)
     *file = local_file ? local_file : NULL;
@@ -1181,6 +1482,36 @@ bail:
   return result;
 }
 
+/* Register the outcome of a retrieval with the link conversion code.
+   ORIGURL is the URL that was requested, REDIRECTED the URL it was
+   redirected to (or NULL if there was no redirection), and FINALURL
+   the URL that was finally downloaded to FILE.  DT holds the flags
+   returned by retrieve_url.  */
+
+void
+register_retrieval (const char *origurl, const char *redirected,
+                    const char *finalurl, const char *file, int dt)
+{
+  if (!file || !(dt & RETROKF || opt.content_on_error))
+    return;
+
+  /* With --url-fingerprints, the URLs and names of the downloaded
+     files are kept only when they are needed to convert links.  */
+  if (opt.url_fingerprints && !opt.convert_links && !opt.convert_file_only)
+    return;
+
+  register_download (finalurl, file);
+
+  if (!opt.spider && redirected && 0 != strcmp (origurl, redirected))
+    register_redirection (origurl, redirected);
+
+  if (dt & TEXTHTML)
+    register_html (file);
+
+  if (dt & TEXTCSS)
+    register_css (file);
+}
+
 /* Find the URLs in the file and call retrieve_url() for each of them.
    If HTML is true, treat the file as HTML, and construct the URLs
    accordingly.
@@ -1343,7 +1674,10 @@ void
 sleep_between_retrievals (int count)
 {
   static bool first_retrieval = true;
+  bool scheduled = wait_scheduled;
 
+  /* Redirections and retries are waited for as usual.  */
+  wait_scheduled = false;
   if (first_retrieval)
     {
       /* Don't sleep before the very first retrieval. */
@@ -1351,6 +1685,9 @@ sleep_between_retrievals (int count)
       return;
     }
 
+  if (scheduled && count == 1)
+    return;
+
   if (opt.waitretry && count > 1)
     {
       /* If opt.waitretry is specified and this is a retry, wait for
@@ -1389,7 +1726,6 @@ free_urlpos (struct urlpos *l)
       struct urlpos *next = l->next;
       if (l->url)
         url_free (l->url);
-      xfree (l->local_name);
       xfree (l);
       l = next;
     }
@@ -1546,3 +1882,70 @@ input_file_url (const char *input_file)
   else
     return false;
 }
+
+#ifdef TESTING
+
+const char *
+test_chunk_decode (void)
+{
+  unsigned i;
+  static const struct {
+    const char *body;           /* the chunked body */
+    const char *data;           /* the data in it, or NULL if malformed */
+    int used;                   /* bytes of BODY belonging to it */
+  } test_array[] = {
+    { "5\r\nhello\r\n0\r\n\r\n", "hello", 15 },
+    { "5\nhello\n6\n world\n0\n\nnext", "hello world", 20 },
+    { "A;ext=1\r\n0123456789\r\n0\r\nExpires: never\r\n\r\n",
+      "0123456789", 42 },
+    { "0\r\n\r\nHTTP/1.1 200 OK", "", 5 },
+    { "3\r\nabcd\r\n", NULL, 0 },
+    { "x\r\n", NULL, 0 },
+  };
+
+  for (i = 0; i < countof (test_array); ++i)
+    {
+      const char *body = test_array[i].body;
+      int len = strlen (body);
+      int step;
+
+      /* Feed the body at once, and byte by byte.  */
+      for (step = len; step > 0; step = step == 1 ? 0 : 1)
+        {
+          struct chunk_decoder cd;
+          char buf[64];
+          int used = 0, datalen = 0, res = 0;
+
+          chunk_decoder_init (&cd);
+          while (used < len && cd.state != CHUNK_DONE)
+            {
+              int n = MIN (step, len - used), got;
+              memcpy (buf, body + used, n);
+              res = chunk_decode (&cd, buf, n, buf, &got);
+              if (res < 0)
+                break;
+              if (test_array[i].data)
+                {
+                  const char *data = test_array[i].data;
+                  mu_assert ("test_chunk_decode: data too long",
+                             datalen + got <= (int) strlen (data));
+                  mu_assert ("test_chunk_decode: wrong data",
+                             !memcmp (data + datalen, buf, got));
+                }
+              datalen += got;
+              used += res;
+            }
+
+          if (!test_array[i].data)
+            mu_assert ("test_chunk_decode: malformed body accepted", res < 0);
+          else
+            mu_assert ("test_chunk_decode: wrong result",
+                       cd.state == CHUNK_DONE && used == test_array[i].used
+                       && datalen == (int) strlen (test_array[i].data));
+        }
+    }
+
+  return NULL;
+}
+
+#endif /* TESTING */
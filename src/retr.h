@@ -38,6 +38,7 @@ extern int numurls;
    functions! */
 extern SUM_SIZE_INT total_downloaded_bytes;
 extern double total_download_time;
+extern bool wait_scheduled;
 extern FILE *output_stream;
 extern bool output_stream_regular;
 
@@ -49,11 +50,41 @@ enum {
   /* Used by HTTP/HTTPS*/
   rb_chunked_transfer_encoding = 4,
 
-  rb_compressed_gzip = 8
+  rb_compressed_gzip = 8,
+  rb_compressed_deflate = 16,
+  rb_compressed_brotli = 32,
+  rb_compressed_zstd = 64,
+
+  /* Any of the above.  */
+  rb_compressed = (rb_compressed_gzip | rb_compressed_deflate
+                   | rb_compressed_brotli | rb_compressed_zstd),
+
+  /* The body is an HTML page; its links are looked for as it arrives,
+     see html_stream_feed.  */
+  rb_html = 128
 };
 
 int fd_read_body (const char *, int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
 
+/* State of the decoder of a chunked body, see chunk_decode.  */
+struct chunk_decoder {
+  enum {
+    CHUNK_SIZE,                 /* reading the chunk size */
+    CHUNK_EXT,                  /* skipping the rest of the size line */
+    CHUNK_DATA,                 /* inside the chunk data */
+    CHUNK_DATA_END,             /* at the line end after the data */
+    CHUNK_TRAILER,              /* reading the trailer lines */
+    CHUNK_DONE                  /* the body has ended */
+  } state;
+  wgint remaining;              /* chunk size, or data left of it */
+  int digits;                   /* digits of the chunk size seen */
+  int line_len;                 /* length of the trailer line so far */
+};
+
+void chunk_decoder_init (struct chunk_decoder *);
+int chunk_decode (struct chunk_decoder *, const char *, int, char *, int *);
+int fd_read_chunked (int, const struct chunk_decoder *, char *, int, double);
+
 typedef const char *(*hunk_terminator_t) (const char *, const char *, int);
 
 char *fd_read_hunk (int, hunk_terminator_t, long, long);
@@ -62,6 +93,8 @@ char *fd_read_line (int);
 uerr_t retrieve_url (struct url *, const char *, char **, char **,
                      const char *, int *, bool, struct iri *, bool);
 uerr_t retrieve_from_file (const char *, bool, int *);
+void register_retrieval (const char *, const char *, const char *,
+                         const char *, int);
 
 const char *retr_rate (wgint, double);
 double calc_rate (wgint, double, int *);
@@ -0,0 +1,771 @@
+/* Segmented retrieval of a single document over several connections.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --segments, a large document whose server accepts byte ranges
+   is split into pieces that are retrieved concurrently by forked
+   worker processes, each over its own connection.  The output file is
+   created at its full size up front, and every worker writes the
+   pieces it fetches at their own offsets through its own file
+   descriptor.  The pieces may be fetched from several sources, such
+   as the mirrors listed in a Metalink file, and checked as they
+   arrive.
+
+   The progress is recorded in a state file next to the output file,
+   rewritten whenever a piece has been dealt with.  It lists the URL,
+   the length of the document and, for each piece, its first and last
+   byte and how many bytes of it are on disk.  When a download is
+   interrupted, a later `wget -c' reads the state file and only
+   requests what is missing.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <sys/wait.h>
+#endif
+
+#include "utils.h"
+#include "segments.h"
+#include "http.h"
+#include "progress.h"
+#include "ptimer.h"
+
+/* Pieces are made so that each connection gets about this many of
+   them, within the limits below.  Smaller pieces balance the load
+   better between fast and slow connections, larger ones waste less
+   on requests.  */
+#define PIECES_PER_CONNECTION 4
+#define MIN_PIECE_SIZE (1024 * 1024)
+#define MAX_PIECE_SIZE (16 * 1024 * 1024)
+
+/* How many times a piece is tried before the download is given up
+   for this round.  With several sources, each of them gets a chance.  */
+#define PIECE_TRIES 3
+
+/* A source that failed this many times in a row is not used any
+   more.  */
+#define SOURCE_FAILURES 3
+
+struct piece {
+  wgint start;                  /* first byte */
+  wgint end;                    /* last byte */
+  wgint got;                    /* bytes on disk, counted from START */
+  int tries;                    /* failed attempts in this round */
+  int source;                   /* source of the last attempt, or -1 */
+  bool busy;                    /* being fetched by a worker */
+};
+
+struct segment_state {
+  char *url;
+  wgint length;
+  struct piece *pieces;
+  int count;
+};
+
+static char *
+state_file_name (const char *file)
+{
+  return aprintf ("%s.wget-segments", file);
+}
+
+static void
+state_free (struct segment_state *st)
+{
+  xfree (st->url);
+  xfree (st->pieces);
+}
+
+/* Read the state file of FILE into ST.  Returns false if there is no
+   state file or it cannot be parsed.  */
+
+static bool
+state_load (const char *file, struct segment_state *st)
+{
+  char *name = state_file_name (file);
+  FILE *fp = fopen (name, "r");
+  char *line = NULL;
+  size_t bufsize = 0;
+  int size = 0;
+  bool ok = true;
+
+  xfree (name);
+  xzero (*st);
+  st->length = -1;
+  if (!fp)
+    return false;
+
+  while (ok && getline (&line, &bufsize, fp) > 0)
+    {
+      char *p = line, *end;
+
+      p[strcspn (p, "\r\n")] = '\0';
+      if (!strncmp (p, "url ", 4))
+        {
+          xfree (st->url);
+          st->url = xstrdup (p + 4);
+        }
+      else if (!strncmp (p, "length ", 7))
+        {
+          st->length = str_to_wgint (p + 7, &end, 10);
+          ok = *end == '\0' && st->length > 0;
+        }
+      else if (!strncmp (p, "piece ", 6))
+        {
+          struct piece pc;
+
+          xzero (pc);
+          pc.source = -1;
+          pc.start = str_to_wgint (p + 6, &end, 10);
+          pc.end = str_to_wgint (end, &end, 10);
+          pc.got = str_to_wgint (end, &end, 10);
+          ok = *end == '\0' && pc.start >= 0 && pc.end >= pc.start
+            && pc.got >= 0 && pc.got <= pc.end - pc.start + 1;
+          if (ok)
+            {
+              DO_REALLOC (st->pieces, size, st->count + 1, struct piece);
+              st->pieces[st->count++] = pc;
+            }
+        }
+      else if (*p)
+        ok = false;
+    }
+  xfree (line);
+  fclose (fp);
+
+  if (ok && (!st->url || st->length < 0 || !st->count
+             || st->pieces[st->count - 1].end != st->length - 1))
+    ok = false;
+  if (!ok)
+    {
+      DEBUGP (("Ignoring malformed segment state of %s.\n", file));
+      state_free (st);
+    }
+  return ok;
+}
+
+/* Write ST to the state file of FILE.  The file is replaced
+   atomically, so that an interrupted write doesn't lose track of the
+   pieces already retrieved.  */
+
+static bool
+state_save (const char *file, const struct segment_state *st)
+{
+  char *name = state_file_name (file);
+  char *tmp = aprintf ("%s.tmp", name);
+  FILE *fp = fopen (tmp, "w");
+  bool ok = false;
+  int i;
+
+  if (fp)
+    {
+      fprintf (fp, "url %s\n", st->url);
+      fprintf (fp, "length %s\n", number_to_static_string (st->length));
+      for (i = 0; i < st->count; i++)
+        {
+          const struct piece *pc = &st->pieces[i];
+          fprintf (fp, "piece %s %s %s\n", number_to_static_string (pc->start),
+                   number_to_static_string (pc->end),
+                   number_to_static_string (pc->got));
+        }
+      ok = !ferror (fp);
+      if (fclose (fp) != 0)
+        ok = false;
+      if (ok && rename (tmp, name) != 0)
+        ok = false;
+      if (!ok)
+        unlink (tmp);
+    }
+  if (!ok)
+    logprintf (LOG_NOTQUIET, _("Cannot write segment state to %s: %s\n"),
+               quote (name), strerror (errno));
+  xfree (tmp);
+  xfree (name);
+  return ok;
+}
+
+static void
+state_remove (const char *file)
+{
+  char *name = state_file_name (file);
+  if (unlink (name) < 0 && errno != ENOENT)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", name, strerror (errno));
+  xfree (name);
+}
+
+/* Split a document of LENGTH bytes into pieces of SIZE bytes, or, if
+   SIZE is 0, of a size suitable for CONNECTIONS connections.  */
+
+static void
+state_init (struct segment_state *st, const char *url, wgint length,
+            int connections, wgint size)
+{
+  wgint pos;
+  int i;
+
+  if (!size)
+    {
+      size = length / ((wgint) connections * PIECES_PER_CONNECTION);
+      size = MAX (size, MIN_PIECE_SIZE);
+      size = MIN (size, MAX_PIECE_SIZE);
+    }
+
+  xzero (*st);
+  st->url = xstrdup (url);
+  st->length = length;
+  st->count = (length + size - 1) / size;
+  st->pieces = xnew_array (struct piece, st->count);
+  for (i = 0, pos = 0; i < st->count; i++, pos += size)
+    {
+      xzero (st->pieces[i]);
+      st->pieces[i].source = -1;
+      st->pieces[i].start = pos;
+      st->pieces[i].end = MIN (pos + size, length) - 1;
+    }
+}
+
+/* Return the number of bytes retrieved in total, and store the number
+   of bytes retrieved at the start of the document without a gap to
+   *PREFIX, unless it is NULL.  */
+
+static wgint
+state_done (const struct segment_state *st, wgint *prefix)
+{
+  wgint done = 0;
+  bool contiguous = true;
+  int i;
+
+  if (prefix)
+    *prefix = 0;
+  for (i = 0; i < st->count; i++)
+    {
+      const struct piece *pc = &st->pieces[i];
+      done += pc->got;
+      if (contiguous && prefix)
+        *prefix += pc->got;
+      if (pc->got < pc->end - pc->start + 1)
+        contiguous = false;
+    }
+  return done;
+}
+
+/* Return true if FILE is the unfinished segmented download of URL,
+   LENGTH bytes long, and can be resumed.  */
+
+bool
+segments_resume_p (const char *file, const char *url, wgint length)
+{
+  struct segment_state st;
+  bool resume;
+
+  if (!state_load (file, &st))
+    return false;
+  resume = !strcmp (st.url, url) && st.length == length
+    && file_size (file) == length;
+  state_free (&st);
+  return resume;
+}
+
+/* Return true if FILE has a segment state file, i.e. if it is the
+   output of an unfinished segmented download.  */
+
+bool
+segments_state_p (const char *file)
+{
+  char *name = state_file_name (file);
+  bool exists = file_exists_p (name, NULL);
+  xfree (name);
+  return exists;
+}
+
+/* Turn the unfinished segmented download in FILE into an ordinary
+   partial download: truncate FILE after the part retrieved without a
+   gap, and remove the state file.  After that, -c continues FILE the
+   usual way.  */
+
+void
+segments_abandon (const char *file)
+{
+  struct segment_state st;
+  wgint prefix;
+
+  if (state_load (file, &st))
+    {
+      state_done (&st, &prefix);
+      DEBUGP (("Truncating %s to %s bytes.\n", file,
+               number_to_static_string (prefix)));
+      if (truncate (file, prefix) < 0 && errno != ENOENT)
+        logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      state_free (&st);
+    }
+  state_remove (file);
+}
+
+#if !defined(WINDOWS) && !defined(MSDOS)
+
+/* A piece, or what remains of it, to be fetched by a worker.  */
+struct segment_job {
+  int piece;
+  int source;
+  wgint piece_start;            /* first byte of the piece */
+  wgint start;                  /* first byte to fetch */
+  wgint end;
+};
+
+struct segment_result {
+  int piece;
+  uerr_t status;
+  wgint written;
+  bool corrupt;                 /* the piece failed verification */
+};
+
+struct segment_worker {
+  pid_t pid;
+  int job_fd;                   /* parent writes jobs here */
+  int result_fd;                /* parent reads results here */
+  int piece;                    /* piece in progress, or -1 */
+  int source;                   /* source of that piece */
+  bool dead;
+};
+
+/* The body of a worker process: open FILE for writing in place, and
+   fetch the pieces sent over JOB_FD into it, reporting back over
+   RESULT_FD.  Never returns.  */
+
+_Noreturn static void
+segment_worker_main (int job_fd, int result_fd, const char *file,
+                     const struct segment_params *sp)
+{
+  struct segment_job job;
+  struct segment_result res;
+  FILE *fp;
+
+  /* The parent shows the progress of the whole document.  */
+  opt.verbose = false;
+  opt.show_progress = false;
+  http_forget_connections ();
+
+  fp = fopen (file, "r+b");
+  if (!fp)
+    logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+
+  while (read_all (job_fd, (char *) &job, sizeof job))
+    {
+      xzero (res);
+      res.piece = job.piece;
+      if (!fp)
+        res.status = FOPENERR;
+      else if (fseeko (fp, job.start, SEEK_SET) < 0)
+        res.status = FWRITEERR;
+      else
+        {
+          res.status = sp->fetch (sp->closure, job.source, fp,
+                                  job.start, job.end, &res.written);
+          /* Only what has reached the file counts as retrieved.  */
+          if (fflush (fp) != 0)
+            {
+              res.status = FWRITEERR;
+              res.written = 0;
+            }
+          else if (sp->verify && res.status == RETRFINISHED
+                   && res.written == job.end - job.start + 1
+                   && !sp->verify (sp->closure, job.piece, fp,
+                                   job.piece_start, job.end))
+            res.corrupt = true;
+        }
+      logflush ();
+      if (!write_all (result_fd, (char *) &res, sizeof res))
+        break;
+    }
+
+  if (fp)
+    fclose (fp);
+  logflush ();
+  _exit (0);
+}
+
+static bool
+segment_worker_start (struct segment_worker *workers, int n,
+                      struct segment_worker *w, const char *file,
+                      const struct segment_params *sp)
+{
+  int job_pipe[2], result_pipe[2];
+  int i;
+
+  if (pipe (job_pipe) < 0)
+    return false;
+  if (pipe (result_pipe) < 0)
+    {
+      close (job_pipe[0]);
+      close (job_pipe[1]);
+      return false;
+    }
+
+  logflush ();
+  fflush (NULL);
+
+  w->pid = fork ();
+  if (w->pid < 0)
+    {
+      close (job_pipe[0]);
+      close (job_pipe[1]);
+      close (result_pipe[0]);
+      close (result_pipe[1]);
+      return false;
+    }
+
+  if (w->pid == 0)
+    {
+      for (i = 0; i < n; i++)
+        if (&workers[i] != w && !workers[i].dead)
+          {
+            close (workers[i].job_fd);
+            close (workers[i].result_fd);
+          }
+      close (job_pipe[1]);
+      close (result_pipe[0]);
+      segment_worker_main (job_pipe[0], result_pipe[1], file, sp);
+    }
+
+  close (job_pipe[0]);
+  close (result_pipe[1]);
+  w->job_fd = job_pipe[1];
+  w->result_fd = result_pipe[0];
+  w->piece = -1;
+  w->dead = false;
+  DEBUGP (("Started segment worker %d.\n", (int) w->pid));
+  return true;
+}
+
+static void
+segment_worker_stop (struct segment_worker *w)
+{
+  if (w->dead)
+    return;
+  close (w->job_fd);
+  close (w->result_fd);
+  while (waitpid (w->pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+  w->dead = true;
+}
+
+/* Return the index of the first piece that still needs fetching, or
+   -1 if there is none.  */
+
+static int
+next_piece (const struct segment_state *st, int tries)
+{
+  int i;
+  for (i = 0; i < st->count; i++)
+    {
+      const struct piece *pc = &st->pieces[i];
+      if (!pc->busy && pc->tries < tries
+          && pc->got < pc->end - pc->start + 1)
+        return i;
+    }
+  return -1;
+}
+
+/* Choose the source to fetch piece PC from.  Workers start out on
+   different sources, given by PREFERRED, and a piece that failed is
+   tried from the next source.  Returns -1 if all sources have
+   failed too often.  */
+
+static int
+choose_source (const struct piece *pc, int preferred, const int *failures,
+               int sources)
+{
+  int s = pc->source < 0 ? preferred : (pc->source + 1) % sources;
+  int i;
+
+  for (i = 0; i < sources; i++, s = (s + 1) % sources)
+    if (failures[s] < SOURCE_FAILURES)
+      return s;
+  return -1;
+}
+
+/* Return true if the pieces in ST are of SIZE bytes, as needed for
+   verifying them.  */
+
+static bool
+state_piece_size_p (const struct segment_state *st, wgint size)
+{
+  int i;
+  for (i = 0; i < st->count; i++)
+    {
+      const struct piece *pc = &st->pieces[i];
+      if (pc->start != (wgint) i * size
+          || (i < st->count - 1 && pc->end != pc->start + size - 1))
+        return false;
+    }
+  return true;
+}
+
+/* Retrieve the document described by SP into FILE.  FILE must exist;
+   if it has a state file matching SP->id and SP->length, only the
+   missing parts are retrieved, otherwise FILE must already have been
+   created at its full size.  The pieces are handed out to
+   SP->connections worker processes, which fetch them with SP->fetch
+   and, if SP->verify is set, check them; a piece that fails to arrive
+   or to verify is fetched again, from another source if there is one.
+
+   Returns RETRFINISHED with *LEN set to the number of bytes of the
+   document on disk, which is short of SP->length if some pieces could
+   not be retrieved; the state file is left behind in that case and
+   removed otherwise.  Fatal errors are returned as such.  *RD_SIZE is
+   set to the amount of data retrieved by this call and *DLTIME to the
+   time it took.  */
+
+uerr_t
+segmented_download (const char *file, const struct segment_params *sp,
+                    wgint *rd_size, wgint *len, double *dltime)
+{
+  struct segment_state st;
+  struct segment_worker *workers;
+  struct ptimer *timer = ptimer_new ();
+  void *progress = NULL;
+  uerr_t fatal = RETROK;
+  wgint done, fetched = 0;
+  int *failures = xnew0_array (int, sp->sources);
+  int tries = MAX (PIECE_TRIES, sp->sources);
+  int n, i, pending = 0;
+
+  if (!state_load (file, &st) || strcmp (st.url, sp->id)
+      || st.length != sp->length
+      || (sp->piece_size && !state_piece_size_p (&st, sp->piece_size)))
+    {
+      if (st.url)
+        state_free (&st);
+      state_init (&st, sp->id, sp->length, sp->connections, sp->piece_size);
+    }
+  for (i = 0; i < st.count; i++)
+    if (st.pieces[i].got < st.pieces[i].end - st.pieces[i].start + 1)
+      ++pending;
+  done = state_done (&st, NULL);
+  if (!state_save (file, &st))
+    {
+      state_free (&st);
+      xfree (failures);
+      ptimer_destroy (timer);
+      return FWRITEERR;
+    }
+
+  n = MIN (sp->connections, pending);
+  logprintf (LOG_VERBOSE,
+             _("Retrieving %d of %d pieces over %d connections.\n"),
+             pending, st.count, n);
+
+  workers = xnew0_array (struct segment_worker, n);
+  for (i = 0; i < n; i++)
+    if (!segment_worker_start (workers, i, &workers[i], file, sp))
+      {
+        logprintf (LOG_NOTQUIET, _("Cannot start worker process: %s\n"),
+                   strerror (errno));
+        break;
+      }
+  n = i;
+
+  if (opt.show_progress)
+    progress = progress_create (file, done, sp->length);
+
+  for (;;)
+    {
+      struct segment_result res;
+      struct timeval tv;
+      fd_set fds;
+      int maxfd = -1, busy = 0, ready;
+
+      /* Hand out pieces to the idle workers.  */
+      for (i = 0; i < n; i++)
+        {
+          struct segment_worker *w = &workers[i];
+          struct segment_job job;
+          struct piece *pc;
+          int next, source;
+
+          if (w->dead || w->piece >= 0 || fatal != RETROK
+              || (next = next_piece (&st, tries)) < 0)
+            continue;
+          pc = &st.pieces[next];
+          source = choose_source (pc, i % sp->sources, failures, sp->sources);
+          if (source < 0)
+            continue;
+          job.piece = next;
+          job.source = source;
+          job.piece_start = pc->start;
+          job.start = pc->start + pc->got;
+          job.end = pc->end;
+          if (!write_all (w->job_fd, (char *) &job, sizeof job))
+            {
+              segment_worker_stop (w);
+              continue;
+            }
+          DEBUGP (("Worker %d fetches bytes %s-%s from source %d.\n",
+                   (int) w->pid, number_to_static_string (job.start),
+                   number_to_static_string (job.end), source));
+          pc->busy = true;
+          pc->source = source;
+          w->piece = next;
+          w->source = source;
+        }
+
+      FD_ZERO (&fds);
+      for (i = 0; i < n; i++)
+        if (!workers[i].dead && workers[i].piece >= 0)
+          {
+            FD_SET (workers[i].result_fd, &fds);
+            maxfd = MAX (maxfd, workers[i].result_fd);
+            ++busy;
+          }
+      if (!busy)
+        break;
+
+      /* Wake up now and then to keep the progress display going.  */
+      tv.tv_sec = 1;
+      tv.tv_usec = 0;
+      ready = select (maxfd + 1, &fds, NULL, NULL, &tv);
+      if (ready < 0 && errno != EINTR)
+        {
+          logprintf (LOG_NOTQUIET, "select: %s\n", strerror (errno));
+          break;
+        }
+      if (ready <= 0)
+        {
+          if (progress)
+            progress_update (progress, 0, ptimer_measure (timer));
+          continue;
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          struct segment_worker *w = &workers[i];
+          struct piece *pc;
+
+          if (w->dead || w->piece < 0 || !FD_ISSET (w->result_fd, &fds))
+            continue;
+          pc = &st.pieces[w->piece];
+          pc->busy = false;
+          w->piece = -1;
+
+          if (!read_all (w->result_fd, (char *) &res, sizeof res))
+            {
+              logprintf (LOG_NOTQUIET,
+                         _("Worker process %d exited unexpectedly.\n"),
+                         (int) w->pid);
+              segment_worker_stop (w);
+              ++pc->tries;
+              continue;
+            }
+
+          res.written = MIN (res.written, pc->end - pc->start + 1 - pc->got);
+          fetched += res.written;
+
+          if (res.corrupt)
+            {
+              /* Discard the whole piece; it can't be told which part
+                 of it is bad.  */
+              logprintf (LOG_NOTQUIET,
+                         _("Piece %d of %s failed verification.\n"),
+                         res.piece, quote (file));
+              done -= pc->got;
+              pc->got = 0;
+              ++pc->tries;
+              ++failures[w->source];
+            }
+          else
+            {
+              pc->got += res.written;
+              done += res.written;
+              /* The progress display counts only what is kept, so
+                 that it can't run past the end.  */
+              if (progress && res.written)
+                progress_update (progress, res.written,
+                                 ptimer_measure (timer));
+              if (res.status == RETRFINISHED
+                  && pc->got == pc->end - pc->start + 1)
+                failures[w->source] = 0;
+              else if (res.status == FWRITEERR || res.status == FOPENERR
+                       || res.status == RANGEERR)
+                fatal = res.status;
+              else
+                {
+                  ++pc->tries;
+                  ++failures[w->source];
+                }
+            }
+
+          state_save (file, &st);
+        }
+    }
+
+  if (progress)
+    progress_finish (progress, ptimer_measure (timer));
+
+  for (i = 0; i < n; i++)
+    segment_worker_stop (&workers[i]);
+  xfree (workers);
+  xfree (failures);
+
+  *rd_size = fetched;
+  *len = done;
+  *dltime = ptimer_read (timer);
+  ptimer_destroy (timer);
+
+  if (done == sp->length)
+    state_remove (file);
+  else
+    DEBUGP (("Segmented download of %s stopped at %s of %s bytes.\n", file,
+             number_to_static_string (done),
+             number_to_static_string (sp->length)));
+  state_free (&st);
+
+  return fatal != RETROK ? fatal : RETRFINISHED;
+}
+
+#else /* WINDOWS || MSDOS */
+
+/* No fork() here; segmented downloads are never started.  */
+
+uerr_t
+segmented_download (const char *file, const struct segment_params *sp,
+                    wgint *rd_size, wgint *len, double *dltime)
+{
+  (void) file; (void) sp;
+  *rd_size = *len = 0;
+  *dltime = 0;
+  return RANGEERR;
+}
+
+#endif /* WINDOWS || MSDOS */
@@ -0,0 +1,68 @@
+/* Declarations for segments.c.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+/* Documents shorter than this are not worth splitting up.  */
+#define SEGMENTS_MIN_LENGTH (2 * 1024 * 1024)
+
+/* Retrieve bytes START through END (inclusive) of the document from
+   source SOURCE into FP, which is positioned at START.  The number of
+   bytes written is stored to *WRITTEN.  Called in the worker
+   processes.  */
+typedef uerr_t (*segment_fetch_fn) (void *closure, int source, FILE *fp,
+                                    wgint start, wgint end, wgint *written);
+
+/* Return true if bytes START through END of FP, piece number PIECE of
+   the document, have the expected contents.  Called in the worker
+   processes once a piece is complete.  */
+typedef bool (*segment_verify_fn) (void *closure, int piece, FILE *fp,
+                                   wgint start, wgint end);
+
+/* Describes the document to be retrieved by segmented_download.  */
+struct segment_params {
+  const char *id;               /* identifies the document in the state
+                                   file, normally its URL */
+  wgint length;                 /* length of the document */
+  int connections;              /* number of concurrent connections */
+  wgint piece_size;             /* size of the pieces, or 0 to choose */
+  int sources;                  /* number of sources FETCH can use */
+  segment_fetch_fn fetch;
+  segment_verify_fn verify;     /* or NULL */
+  void *closure;                /* passed to FETCH and VERIFY */
+};
+
+bool segments_resume_p (const char *, const char *, wgint);
+bool segments_state_p (const char *);
+void segments_abandon (const char *);
+uerr_t segmented_download (const char *, const struct segment_params *,
+                           wgint *, wgint *, double *);
+
+#endif /* SEGMENTS_H */
@@ -38,6 +38,7 @@ as that of the covered work.  */
 #include "url.h"
 #include "utils.h"
 #include "hash.h"
+#include "intern.h"
 #include "res.h"
 
 
@@ -49,7 +50,7 @@ void
 spider_cleanup (void)
 {
   if (nonexisting_urls_set)
-    string_set_free (nonexisting_urls_set);
+    hash_table_destroy (nonexisting_urls_set);
 }
 
 /* Remembers broken links.  */
@@ -61,7 +62,7 @@ nonexisting_url (const char *url)
     return;
   if (!nonexisting_urls_set)
     nonexisting_urls_set = make_string_hash_table (0);
-  string_set_add (nonexisting_urls_set, url);
+  hash_table_put (nonexisting_urls_set, intern_string (url), "1");
 }
 
 void
@@ -0,0 +1,300 @@
+/* Cache of TLS sessions, for resuming them on new connections.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* The SSL backends store the session state they get from servers
+   here, serialized, under the host and port it is valid for, and look
+   it up when connecting to the same host and port again, so that
+   later connections do an abbreviated handshake.  The cache can be
+   kept in a file across runs with --tls-session-file.  Since session
+   state holds the keys of the sessions, that file must only be
+   accessible by its owner.  */
+
+#include "wget.h"
+
+#ifdef HAVE_SSL
+#include "ssl.h"
+#include "utils.h"
+#include "hash.h"
+#include "c-ctype.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+
+struct ssl_session_entry {
+  time_t expires;
+  size_t size;
+  unsigned char *data;
+};
+
+/* Mapping between "host:port" and struct ssl_session_entry.  */
+static struct hash_table *session_map;
+
+/* Return the key under which the sessions with HOST and PORT are
+   stored.  The caller frees it.  */
+
+char *
+ssl_session_key (const char *host, int port)
+{
+  return aprintf ("%s:%d", host, port);
+}
+
+static void
+session_remove (const char *key)
+{
+  char *old_key;
+  struct ssl_session_entry *old;
+
+  if (hash_table_get_pair (session_map, key, &old_key, &old))
+    {
+      hash_table_remove (session_map, key);
+      xfree (old_key);
+      xfree (old->data);
+      xfree (old);
+    }
+}
+
+/* Store SIZE bytes of DATA, a serialized session good until EXPIRES,
+   as the session to resume with KEY, replacing the one stored
+   before.  */
+
+void
+ssl_session_store (const char *key, const void *data, size_t size,
+                   time_t expires)
+{
+  struct ssl_session_entry *entry;
+
+  if (!session_map)
+    session_map = make_nocase_string_hash_table (0);
+  session_remove (key);
+  if (!size || expires <= time (NULL))
+    return;
+
+  entry = xnew (struct ssl_session_entry);
+  entry->expires = expires;
+  entry->size = size;
+  entry->data = xmemdup (data, size);
+  hash_table_put (session_map, xstrdup (key), entry);
+  DEBUGP (("Stored TLS session for %s.\n", key));
+}
+
+/* Return the serialized session to resume with KEY, and store its
+   size to *SIZE, or return NULL if there is none.  The data remains
+   valid until the next call to ssl_session_store.  */
+
+const void *
+ssl_session_lookup (const char *key, size_t *size)
+{
+  struct ssl_session_entry *entry;
+
+  if (!session_map)
+    return NULL;
+  entry = hash_table_get (session_map, key);
+  if (!entry)
+    return NULL;
+  if (entry->expires <= time (NULL))
+    {
+      session_remove (key);
+      return NULL;
+    }
+  *size = entry->size;
+  return entry->data;
+}
+
+/* Read the sessions in FP into the cache.  If MERGE is true, the
+   sessions already in the cache take precedence.  */
+
+static void
+sessions_read (FILE *fp, bool merge)
+{
+  char *line = NULL;
+  size_t len = 0;
+  time_t now = time (NULL);
+
+  if (!session_map)
+    session_map = make_nocase_string_hash_table (0);
+
+  while (getline (&line, &len, fp) > 0)
+    {
+      char key[300];
+      unsigned long expires;
+      unsigned char *data;
+      ssize_t size;
+      char *p;
+      int n;
+
+      for (p = line; c_isspace (*p); p++)
+        ;
+      if (*p == '#' || sscanf (p, "%299s %lu%n", key, &expires, &n) != 2)
+        continue;
+      if ((time_t) expires <= now
+          || (merge && hash_table_contains (session_map, key)))
+        continue;
+
+      for (p += n; c_isspace (*p); p++)
+        ;
+      data = xmalloc (strlen (p) / 4 * 3 + 3);
+      size = wget_base64_decode (p, data, strlen (p) / 4 * 3 + 3);
+      if (size > 0)
+        ssl_session_store (key, data, size, (time_t) expires);
+      xfree (data);
+    }
+  xfree (line);
+}
+
+/* Write the sessions in the cache that haven't expired to FP.  */
+
+static bool
+sessions_dump (FILE *fp)
+{
+  hash_table_iterator iter;
+  time_t now = time (NULL);
+
+  fputs ("# TLS session cache of GNU Wget.  Keep it private.\n", fp);
+  fputs ("# <host>:<port>\t<expires>\t<session data in base64>\n", fp);
+
+  for (hash_table_iterate (session_map, &iter); hash_table_iter_next (&iter); )
+    {
+      const char *key = iter.key;
+      struct ssl_session_entry *entry = iter.value;
+      char *base64;
+
+      if (entry->expires <= now)
+        continue;
+      base64 = xmalloc (BASE64_LENGTH (entry->size) + 1);
+      wget_base64_encode (entry->data, entry->size, base64);
+      fprintf (fp, "%s\t%lu\t%s\n", key, (unsigned long) entry->expires,
+               base64);
+      xfree (base64);
+    }
+  return !ferror (fp);
+}
+
+/* Return true if FILE can be trusted with the sessions: it is a
+   regular file, and only its owner can read or write it.  */
+
+static bool
+sessions_file_access_valid (const char *file)
+{
+  struct stat st;
+
+  if (stat (file, &st) == -1)
+    return false;
+  return
+#ifndef WINDOWS
+    !(st.st_mode & (S_IRWXG | S_IRWXO)) &&
+#endif
+    S_ISREG (st.st_mode);
+}
+
+/* The modification time of the session file when it was loaded.  */
+static time_t sessions_file_mtime;
+
+/* Load the sessions stored in FILE, if it exists.  */
+
+void
+ssl_sessions_load (const char *file)
+{
+  struct stat st;
+  FILE *fp;
+
+  if (!file_exists_p (file, NULL))
+    return;
+  if (!sessions_file_access_valid (file))
+    {
+      logprintf (LOG_NOTQUIET, _("Not using the TLS session file %s, which "
+                                 "must be a regular file accessible only by "
+                                 "its owner.\n"), quote (file));
+      return;
+    }
+  fp = fopen (file, "r");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      return;
+    }
+  sessions_read (fp, false);
+  if (fstat (fileno (fp), &st) == 0)
+    sessions_file_mtime = st.st_mtime;
+  fclose (fp);
+}
+
+/* Save the cached sessions to FILE, merging in what other Wget
+   processes have saved there since it was loaded.  */
+
+void
+ssl_sessions_save (const char *file)
+{
+  struct stat st;
+  FILE *fp;
+  int fd;
+
+  if (!session_map)
+    return;
+  if (file_exists_p (file, NULL) && !sessions_file_access_valid (file))
+    return;
+
+  fd = open (file, O_RDWR | O_CREAT, 0600);
+  if (fd < 0 || !(fp = fdopen (fd, "r+")))
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return;
+    }
+
+  /* Lock the file, so that concurrent runs don't overwrite each
+     other's sessions.  */
+  flock (fd, LOCK_EX);
+
+  if (fstat (fd, &st) == 0 && st.st_mtime != sessions_file_mtime)
+    {
+      fseeko (fp, 0, SEEK_SET);
+      sessions_read (fp, true);
+    }
+
+  fseeko (fp, 0, SEEK_SET);
+  if (ftruncate (fd, 0) < 0 || !sessions_dump (fp))
+    logprintf (LOG_NOTQUIET, _("Could not write the TLS session file %s: %s\n"),
+               quote (file), strerror (errno));
+
+  /* fclose is expected to unlock the file for us */
+  if (fclose (fp) == EOF)
+    logprintf (LOG_NOTQUIET, _("Could not write the TLS session file %s: %s\n"),
+               quote (file), strerror (errno));
+}
+
+#endif /* HAVE_SSL */
@@ -32,7 +32,14 @@ as that of the covered work.  */
 #define GEN_SSLFUNC_H
 
 bool ssl_init (void);
-bool ssl_connect_wget (int, const char *, int *);
+bool ssl_connect_wget (int, const char *, int, int *);
 bool ssl_check_certificate (int, const char *);
 
+/* Defined in ssl-cache.c.  */
+char *ssl_session_key (const char *, int);
+void ssl_session_store (const char *, const void *, size_t, time_t);
+const void *ssl_session_lookup (const char *, size_t *);
+void ssl_sessions_load (const char *);
+void ssl_sessions_save (const char *);
+
 #endif /* GEN_SSLFUNC_H */
@@ -0,0 +1,328 @@
+/* Sets of URLs, optionally stored as fingerprints.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* Recursive retrieval remembers every URL it has decided about, so
+   that it doesn't enqueue or examine it twice.  Stored as strings,
+   these URLs take a hundred bytes or more each, which adds up to many
+   gigabytes in crawls of tens of millions of URLs.
+
+   A compact set stores only a 64-bit fingerprint of each URL, the
+   first half of its MD5 digest, in an open-addressed table kept at
+   most three quarters full, which comes to 11 to 21 bytes per URL.
+   The price is that two different URLs may have the same fingerprint,
+   and then the second one is taken to be in the set already.  With N
+   URLs in the set, the chance of this happening at all is below
+   N^2 / 2^65: about one in 15,000 for 50 million URLs, and one in 1.5
+   million for 5 million.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "intern.h"
+#include "md5.h"
+#include "url-set.h"
+
+#ifdef TESTING
+#include <unistd.h> /* For ftruncate.  */
+#include "../tests/unit-tests.h"
+#endif
+
+struct url_set {
+  struct hash_table *strings;   /* the URLs, interned, unless the set is
+                                   compact */
+  uint64_t *fingerprints;       /* the table of fingerprints, with 0
+                                   marking free slots */
+  size_t size;                  /* number of slots, a power of two */
+  size_t count;                 /* number of fingerprints stored */
+};
+
+#define URL_SET_INITIAL_SIZE 1024
+
+/* Return a new, empty set of URLs.  If COMPACT is true, the URLs are
+   stored as fingerprints.  */
+
+struct url_set *
+url_set_new (bool compact)
+{
+  struct url_set *set = xnew0 (struct url_set);
+
+  if (compact)
+    {
+      set->size = URL_SET_INITIAL_SIZE;
+      set->fingerprints = xnew0_array (uint64_t, set->size);
+    }
+  else
+    set->strings = make_string_hash_table (0);
+  return set;
+}
+
+static uint64_t
+url_fingerprint (const char *url)
+{
+  unsigned char digest[MD5_DIGEST_SIZE];
+  uint64_t fp;
+
+  md5_buffer (url, strlen (url), digest);
+  memcpy (&fp, digest, sizeof (fp));
+
+  /* 0 marks free slots.  */
+  return fp ? fp : 1;
+}
+
+/* Return the slot of FP in SET, or the free slot where it belongs.  */
+
+static size_t
+fingerprint_slot (const struct url_set *set, uint64_t fp)
+{
+  size_t mask = set->size - 1;
+  size_t i;
+
+  for (i = fp & mask; set->fingerprints[i] && set->fingerprints[i] != fp;
+       i = (i + 1) & mask)
+    ;
+  return i;
+}
+
+static void
+fingerprints_grow (struct url_set *set)
+{
+  uint64_t *old = set->fingerprints;
+  size_t old_size = set->size, i;
+
+  set->size *= 2;
+  set->fingerprints = xnew0_array (uint64_t, set->size);
+  for (i = 0; i < old_size; i++)
+    if (old[i])
+      set->fingerprints[fingerprint_slot (set, old[i])] = old[i];
+  xfree (old);
+}
+
+/* Add URL to SET.  */
+
+void
+url_set_add (struct url_set *set, const char *url)
+{
+  uint64_t fp;
+  size_t i;
+
+  if (set->strings)
+    {
+      hash_table_put (set->strings, intern_string (url), "1");
+      return;
+    }
+
+  fp = url_fingerprint (url);
+  i = fingerprint_slot (set, fp);
+  if (set->fingerprints[i])
+    return;
+  if ((set->count + 1) * 4 > set->size * 3)
+    {
+      fingerprints_grow (set);
+      i = fingerprint_slot (set, fp);
+    }
+  set->fingerprints[i] = fp;
+  set->count++;
+}
+
+/* Return true if URL is in SET, or, if SET is compact, a URL with the
+   same fingerprint.  */
+
+bool
+url_set_contains (const struct url_set *set, const char *url)
+{
+  if (set->strings)
+    return string_set_contains (set->strings, url);
+  return set->fingerprints[fingerprint_slot (set, url_fingerprint (url))] != 0;
+}
+
+/* Write SET to FP, so that url_set_read can read it back.  A compact
+   set is written as its table of fingerprints, which then needs no
+   rehashing when read.  */
+
+void
+url_set_write (const struct url_set *set, FILE *fp)
+{
+  unsigned char compact = !set->strings;
+
+  fwrite (&compact, 1, 1, fp);
+  if (compact)
+    {
+      uint64_t size = set->size, count = set->count;
+
+      fwrite (&size, sizeof size, 1, fp);
+      fwrite (&count, sizeof count, 1, fp);
+      fwrite (set->fingerprints, sizeof (uint64_t), set->size, fp);
+    }
+  else
+    {
+      hash_table_iterator iter;
+      int count = hash_table_count (set->strings);
+
+      fwrite (&count, sizeof count, 1, fp);
+      for (hash_table_iterate (set->strings, &iter);
+           hash_table_iter_next (&iter); )
+        write_counted_string (fp, iter.key);
+    }
+}
+
+/* Read a set written by url_set_write from FP.  Return NULL if it
+   cannot be read.  */
+
+struct url_set *
+url_set_read (FILE *fp)
+{
+  struct url_set *set;
+  unsigned char compact;
+
+  if (fread (&compact, 1, 1, fp) != 1)
+    return NULL;
+
+  if (compact)
+    {
+      uint64_t size, count;
+
+      if (fread (&size, sizeof size, 1, fp) != 1
+          || fread (&count, sizeof count, 1, fp) != 1
+          || size < URL_SET_INITIAL_SIZE || (size & (size - 1)) != 0
+          || size > SIZE_MAX / sizeof (uint64_t) || count * 4 > size * 3)
+        return NULL;
+      set = xnew0 (struct url_set);
+      set->size = size;
+      set->count = count;
+      set->fingerprints = xnew_array (uint64_t, set->size);
+      if (fread (set->fingerprints, sizeof (uint64_t), set->size, fp)
+          != set->size)
+        {
+          url_set_free (set);
+          return NULL;
+        }
+    }
+  else
+    {
+      int count;
+
+      if (fread (&count, sizeof count, 1, fp) != 1 || count < 0)
+        return NULL;
+      set = url_set_new (false);
+      while (count--)
+        {
+          char *url;
+          if (!read_counted_string (fp, &url) || !url)
+            {
+              url_set_free (set);
+              return NULL;
+            }
+          hash_table_put (set->strings, intern_string (url), "1");
+          xfree (url);
+        }
+    }
+  return set;
+}
+
+void
+url_set_free (struct url_set *set)
+{
+  if (set->strings)
+    hash_table_destroy (set->strings);
+  xfree (set->fingerprints);
+  xfree (set);
+}
+
+#ifdef TESTING
+
+const char *
+test_url_set (void)
+{
+  int compact;
+
+  for (compact = 0; compact < 2; compact++)
+    {
+      struct url_set *set = url_set_new (compact);
+      char url[64];
+      off_t size;
+      FILE *fp;
+      int i;
+
+      /* Enough URLs for the table of fingerprints to grow.  */
+      for (i = 0; i < 5000; i++)
+        {
+          snprintf (url, sizeof (url), "http://example.com/%d.html", i);
+          url_set_add (set, url);
+          url_set_add (set, url);
+        }
+      if (compact)
+        mu_assert ("test_url_set: wrong count", set->count == 5000);
+
+      for (i = 0; i < 10000; i++)
+        {
+          snprintf (url, sizeof (url), "http://example.com/%d.html", i);
+          mu_assert ("test_url_set: wrong membership",
+                     url_set_contains (set, url) == (i < 5000));
+        }
+
+      /* It reads back the same from a checkpoint, and a truncated one
+         is noticed.  */
+      fp = tmpfile ();
+      mu_assert ("test_url_set: cannot write the set", fp != NULL);
+      url_set_write (set, fp);
+      url_set_free (set);
+      mu_assert ("test_url_set: cannot write the set", fflush (fp) == 0);
+      size = ftello (fp);
+      rewind (fp);
+      set = url_set_read (fp);
+      mu_assert ("test_url_set: cannot read the set", set != NULL);
+      mu_assert ("test_url_set: wrong mode", (set->strings == NULL) == compact);
+      if (compact)
+        mu_assert ("test_url_set: wrong count", set->count == 5000);
+      for (i = 0; i < 10000; i++)
+        {
+          snprintf (url, sizeof (url), "http://example.com/%d.html", i);
+          mu_assert ("test_url_set: wrong membership after reading",
+                     url_set_contains (set, url) == (i < 5000));
+        }
+      url_set_free (set);
+
+      mu_assert ("test_url_set: cannot truncate",
+                 ftruncate (fileno (fp), size - 1) == 0);
+      rewind (fp);
+      set = url_set_read (fp);
+      fclose (fp);
+      mu_assert ("test_url_set: truncated set read", set == NULL);
+    }
+
+  return NULL;
+}
+
+#endif /* TESTING */
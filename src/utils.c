@@ -641,6 +641,44 @@ file_size (const char *filename)
 #endif
 }
 
+/* Write the whole of BUF to FD, retrying on short writes and on
+   interrupted system calls.  */
+
+bool
+write_all (int fd, const char *buf, int len)
+{
+  while (len > 0)
+    {
+      int res = write (fd, buf, len);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+      buf += res;
+      len -= res;
+    }
+  return true;
+}
+
+/* Read exactly LEN bytes from FD into BUF.  Returns false on EOF or
+   error.  */
+
+bool
+read_all (int fd, char *buf, int len)
+{
+  while (len > 0)
+    {
+      int res = read (fd, buf, len);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+      buf += res;
+      len -= res;
+    }
+  return true;
+}
+
 /* 2005-02-19 SMS.
    If no UNIQ_SEP is defined (as on VMS), have unique_name() return the
    original name.  With the VMS file systems' versioning, everything
@@ -1404,6 +1442,43 @@ wget_read_file_free (struct file_memory *fm)
   xfree (fm);
 }
 
+/* Write S, which may be NULL, to FP, preceded by its length in the
+   byte order of the machine, so that read_counted_string can read it
+   back.  */
+
+void
+write_counted_string (FILE *fp, const char *s)
+{
+  int len = s ? (int) strlen (s) : -1;
+
+  fwrite (&len, sizeof len, 1, fp);
+  if (s)
+    fwrite (s, 1, len, fp);
+}
+
+/* Read a string written by write_counted_string from FP to *S.
+   Return false if it cannot be read.  */
+
+bool
+read_counted_string (FILE *fp, char **s)
+{
+  int len;
+
+  *s = NULL;
+  if (fread (&len, sizeof len, 1, fp) != 1)
+    return false;
+  if (len < 0)
+    return true;
+  *s = xmalloc (len + 1);
+  if (fread (*s, 1, len, fp) != (size_t) len)
+    {
+      xfree (*s);
+      return false;
+    }
+  (*s)[len] = '\0';
+  return true;
+}
+
 /* Free the pointers in a NULL-terminated vector of pointers, then
    free the pointer itself.  */
 void
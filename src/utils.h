@@ -88,6 +88,8 @@ int remove_link (const char *);
 bool file_exists_p (const char *, file_stats_t *);
 bool file_non_directory_p (const char *);
 wgint file_size (const char *);
+bool write_all (int, const char *, int);
+bool read_all (int, char *, int);
 int make_directory (const char *);
 char *unique_name (const char *, bool);
 FILE *unique_create (const char *, bool, char **);
@@ -109,6 +111,9 @@ bool has_html_suffix_p (const char *);
 struct file_memory *wget_read_file (const char *);
 void wget_read_file_free (struct file_memory *);
 
+void write_counted_string (FILE *, const char *);
+bool read_counted_string (FILE *, char **);
+
 void free_vec (char **);
 char **merge_vecs (char **, char **);
 char **vec_append (char **, const char *);
@@ -57,6 +57,11 @@ as that of the covered work.  */
 # define HAVE_HSTS /* There's no sense in enabling HSTS without SSL */
 #endif
 
+/* Can compressed HTTP responses be decoded?  See decoder.c.  */
+#if defined HAVE_LIBZ || defined HAVE_BROTLIDEC || defined HAVE_ZSTD
+# define HAVE_CONTENT_DECODING
+#endif
+
 /* `gettext (FOO)' is long to write, so we use `_(FOO)'.  If NLS is
    unavailable, _(STRING) simply returns STRING.  */
 #include "gettext.h"
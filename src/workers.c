@@ -0,0 +1,661 @@
+/* Pool of worker processes for concurrent retrievals.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* The recursive retriever normally downloads one URL at a time.  With
+   --max-parallel, the downloads themselves are handed to a fixed set
+   of forked worker processes, each of which keeps its own persistent
+   connection.  The parent keeps sole ownership of the URL queue, the
+   blacklist and the download maps, so all decisions about what to
+   download are made exactly as in the serial case; a worker only
+   calls retrieve_url and reports back what it got.
+
+   Jobs and results travel over a pair of pipes per worker, using a
+   trivial length-prefixed encoding.  Both ends run the same binary,
+   so numbers are sent in native representation.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <sys/wait.h>
+# include <signal.h>
+#endif
+
+#include "utils.h"
+#include "workers.h"
+#include "retr.h"
+#include "http.h"
+#include "url.h"
+#include "exits.h"
+#include "xmemdup0.h"
+
+#if !defined(WINDOWS) && !defined(MSDOS)
+
+struct worker {
+  pid_t pid;
+  int job_fd;                   /* parent writes jobs here */
+  int result_fd;                /* parent reads results here */
+  void *cookie;                 /* cookie of the job in progress */
+  bool busy;
+  bool dead;
+};
+
+struct worker_pool {
+  struct worker *workers;
+  int count;                    /* number of live workers */
+  int size;                     /* number of allocated workers */
+  int busy;                     /* number of workers with a job */
+};
+
+/* Growable message buffer. */
+
+struct msgbuf {
+  char *data;
+  int size;
+  int len;                      /* bytes stored */
+  int pos;                      /* read position */
+};
+
+static void
+msg_put (struct msgbuf *m, const void *p, int len)
+{
+  DO_REALLOC (m->data, m->size, m->len + len, char);
+  memcpy (m->data + m->len, p, len);
+  m->len += len;
+}
+
+static void
+msg_put_int (struct msgbuf *m, int v)
+{
+  msg_put (m, &v, sizeof v);
+}
+
+/* Store string S, which may be NULL. */
+
+static void
+msg_put_string (struct msgbuf *m, const char *s)
+{
+  int len = s ? (int) strlen (s) : -1;
+  msg_put_int (m, len);
+  if (s)
+    msg_put (m, s, len);
+}
+
+static bool
+msg_get (struct msgbuf *m, void *p, int len)
+{
+  if (m->pos + len > m->len)
+    return false;
+  memcpy (p, m->data + m->pos, len);
+  m->pos += len;
+  return true;
+}
+
+static bool
+msg_get_int (struct msgbuf *m, int *v)
+{
+  return msg_get (m, v, sizeof *v);
+}
+
+static bool
+msg_get_string (struct msgbuf *m, char **s)
+{
+  int len;
+  *s = NULL;
+  if (!msg_get_int (m, &len))
+    return false;
+  if (len < 0)
+    return true;
+  if (m->pos + len > m->len)
+    return false;
+  *s = xmemdup0 (m->data + m->pos, len);
+  m->pos += len;
+  return true;
+}
+
+static void
+msg_put_iri (struct msgbuf *m, const struct iri *i)
+{
+#ifdef ENABLE_IRI
+  msg_put_string (m, i->uri_encoding);
+  msg_put_string (m, i->content_encoding);
+  msg_put_string (m, i->orig_url);
+  msg_put_int (m, i->utf8_encode);
+#else
+  (void) m; (void) i;
+#endif
+}
+
+static bool
+msg_get_iri (struct msgbuf *m, struct iri **ip)
+{
+  struct iri *i = iri_new ();
+#ifdef ENABLE_IRI
+  int utf8_encode;
+  xfree (i->uri_encoding);
+  if (!msg_get_string (m, &i->uri_encoding)
+      || !msg_get_string (m, &i->content_encoding)
+      || !msg_get_string (m, &i->orig_url)
+      || !msg_get_int (m, &utf8_encode))
+    {
+      iri_free (i);
+      return false;
+    }
+  i->utf8_encode = utf8_encode;
+#else
+  (void) m;
+#endif
+  *ip = i;
+  return true;
+}
+
+/* Send message M over FD, prefixed with its length.  */
+
+static bool
+msg_send (int fd, struct msgbuf *m)
+{
+  return write_all (fd, (char *) &m->len, sizeof m->len)
+    && write_all (fd, m->data, m->len);
+}
+
+/* Receive a message from FD into M.  Returns false on EOF or error. */
+
+static bool
+msg_receive (int fd, struct msgbuf *m)
+{
+  int len;
+  if (!read_all (fd, (char *) &len, sizeof len) || len < 0)
+    return false;
+  m->len = m->pos = 0;
+  DO_REALLOC (m->data, m->size, len, char);
+  if (!read_all (fd, m->data, len))
+    return false;
+  m->len = len;
+  return true;
+}
+
+/* The body of a worker process: read jobs from JOB_FD, retrieve them,
+   and write the results to RESULT_FD, until the parent closes the job
+   pipe.  Never returns.  */
+
+_Noreturn static void
+worker_main (int job_fd, int result_fd)
+{
+  struct msgbuf in, out;
+
+  xzero (in);
+  xzero (out);
+
+  /* Connections opened by the parent must not be shared.  */
+  http_forget_connections ();
+
+  while (msg_receive (job_fd, &in))
+    {
+      char *url, *referer;
+      char *file = NULL, *redirected = NULL;
+      struct iri *i;
+      struct url *u;
+      int dt = 0, url_err;
+      uerr_t status;
+      int numurls_before = numurls;
+      SUM_SIZE_INT bytes_before = total_downloaded_bytes;
+      double time_before = total_download_time;
+      SUM_SIZE_INT bytes_delta;
+      double time_delta;
+
+      if (!msg_get_string (&in, &url) || !url
+          || !msg_get_string (&in, &referer)
+          || !msg_get_iri (&in, &i))
+        break;
+
+      u = url_parse (url, &url_err, i, true);
+      if (u)
+        {
+          /* retrieve_tree has taken care of --wait.  */
+          wait_scheduled = true;
+          status = retrieve_url (u, url, &file, &redirected, referer, &dt,
+                                 false, i, true);
+          wait_scheduled = false;
+          url_free (u);
+        }
+      else
+        status = URLERROR;
+
+      bytes_delta = total_downloaded_bytes - bytes_before;
+      time_delta = total_download_time - time_before;
+
+      out.len = 0;
+      msg_put_int (&out, status);
+      msg_put_int (&out, dt);
+      msg_put_string (&out, file);
+      msg_put_string (&out, redirected);
+      msg_put_iri (&out, i);
+      msg_put_int (&out, numurls - numurls_before);
+      msg_put (&out, &bytes_delta, sizeof bytes_delta);
+      msg_put (&out, &time_delta, sizeof time_delta);
+
+      logflush ();
+      if (!msg_send (result_fd, &out))
+        break;
+
+      xfree (url);
+      xfree (referer);
+      xfree (file);
+      xfree (redirected);
+      iri_free (i);
+    }
+
+  logflush ();
+  fflush (NULL);
+  _exit (WGET_EXIT_SUCCESS);
+}
+
+/* Start a worker in slot W.  Returns false if it could not be
+   started.  */
+
+static bool
+worker_start (struct worker_pool *pool, struct worker *w)
+{
+  int job_pipe[2], result_pipe[2];
+  int i;
+
+  if (pipe (job_pipe) < 0)
+    return false;
+  if (pipe (result_pipe) < 0)
+    {
+      close (job_pipe[0]);
+      close (job_pipe[1]);
+      return false;
+    }
+
+  /* Anything still sitting in stdio buffers would otherwise be
+     written out by both processes.  */
+  logflush ();
+  fflush (NULL);
+
+  w->pid = fork ();
+  if (w->pid < 0)
+    {
+      close (job_pipe[0]);
+      close (job_pipe[1]);
+      close (result_pipe[0]);
+      close (result_pipe[1]);
+      return false;
+    }
+
+  if (w->pid == 0)
+    {
+      /* Child: drop the parent's ends of the pipes, including those
+         of previously started workers, so that their EOF is not held
+         up by us.  */
+      for (i = 0; i < pool->size; i++)
+        if (&pool->workers[i] != w && !pool->workers[i].dead)
+          {
+            close (pool->workers[i].job_fd);
+            close (pool->workers[i].result_fd);
+          }
+      close (job_pipe[1]);
+      close (result_pipe[0]);
+      worker_main (job_pipe[0], result_pipe[1]);
+    }
+
+  close (job_pipe[0]);
+  close (result_pipe[1]);
+  w->job_fd = job_pipe[1];
+  w->result_fd = result_pipe[0];
+  w->busy = false;
+  w->dead = false;
+  w->cookie = NULL;
+  DEBUGP (("Started worker process %d.\n", (int) w->pid));
+  return true;
+}
+
+/* Shut down worker W and reap it.  */
+
+static void
+worker_stop (struct worker_pool *pool, struct worker *w)
+{
+  if (w->dead)
+    return;
+  close (w->job_fd);
+  close (w->result_fd);
+  while (waitpid (w->pid, NULL, 0) < 0 && errno == EINTR)
+    ;
+  if (w->busy)
+    --pool->busy;
+  w->busy = false;
+  w->dead = true;
+  --pool->count;
+}
+
+/* Create a pool of COUNT worker processes.  Returns NULL if not even
+   one could be started, in which case the caller should fall back to
+   retrieving serially.  */
+
+struct worker_pool *
+worker_pool_new (int count)
+{
+  struct worker_pool *pool = xnew0 (struct worker_pool);
+  int i;
+
+  pool->workers = xnew_array (struct worker, count);
+  for (i = 0; i < count; i++)
+    {
+      pool->workers[i].dead = true;
+      pool->size = i + 1;
+      if (!worker_start (pool, &pool->workers[i]))
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot start worker process: %s\n"),
+                     strerror (errno));
+          pool->size = i;
+          break;
+        }
+      ++pool->count;
+    }
+
+  if (!pool->count)
+    {
+      xfree (pool->workers);
+      xfree (pool);
+      return NULL;
+    }
+  return pool;
+}
+
+/* Return the number of workers still running.  */
+
+int
+worker_pool_size (const struct worker_pool *pool)
+{
+  return pool->count;
+}
+
+/* Return the number of workers available for a new job.  */
+
+int
+worker_pool_idle (const struct worker_pool *pool)
+{
+  return pool->count - pool->busy;
+}
+
+/* Return the number of jobs in progress.  */
+
+int
+worker_pool_busy (const struct worker_pool *pool)
+{
+  return pool->busy;
+}
+
+/* Hand the retrieval of URL, referred to by REFERER, to an idle
+   worker.  COOKIE is returned with the result.  Returns false if no
+   worker could take the job.  */
+
+bool
+worker_pool_submit (struct worker_pool *pool, const char *url,
+                    const char *referer, struct iri *iri, void *cookie)
+{
+  struct msgbuf m;
+  int i;
+  bool ok;
+
+  for (i = 0; i < pool->size; i++)
+    if (!pool->workers[i].dead && !pool->workers[i].busy)
+      break;
+  if (i == pool->size)
+    return false;
+
+  xzero (m);
+  msg_put_string (&m, url);
+  msg_put_string (&m, referer);
+  msg_put_iri (&m, iri);
+  ok = msg_send (pool->workers[i].job_fd, &m);
+  xfree (m.data);
+
+  if (!ok)
+    {
+      worker_stop (pool, &pool->workers[i]);
+      return false;
+    }
+
+  pool->workers[i].busy = true;
+  pool->workers[i].cookie = cookie;
+  ++pool->busy;
+  return true;
+}
+
+/* Wait for up to TIMEOUT seconds, or indefinitely if TIMEOUT is
+   negative, for one of the busy workers of POOL to report back, and
+   mark those that did in FDS.  Returns the number of such workers.  */
+
+static int
+workers_select (struct worker_pool *pool, fd_set *fds, double timeout)
+{
+  struct timeval tv, *tvp = NULL;
+  int i, n, maxfd = -1;
+
+  if (timeout >= 0)
+    {
+      tv.tv_sec = (long) timeout;
+      tv.tv_usec = 1000000 * (timeout - (long) timeout);
+      tvp = &tv;
+    }
+
+  do
+    {
+      FD_ZERO (fds);
+      for (i = 0; i < pool->size; i++)
+        if (pool->workers[i].busy)
+          {
+            FD_SET (pool->workers[i].result_fd, fds);
+            maxfd = MAX (maxfd, pool->workers[i].result_fd);
+          }
+      n = select (maxfd + 1, fds, NULL, NULL, tvp);
+    }
+  while (n < 0 && errno == EINTR);
+  return n;
+}
+
+/* Wait for up to TIMEOUT seconds for a worker to finish its job.
+   Returns true if one has, in which case worker_pool_collect won't
+   block.  */
+
+bool
+worker_pool_wait (struct worker_pool *pool, double timeout)
+{
+  fd_set fds;
+
+  if (!pool->busy)
+    return false;
+  return workers_select (pool, &fds, timeout) > 0;
+}
+
+/* Wait for a worker to finish its job and store the outcome to RES.
+   Returns false if no job is in progress.  If a worker dies in the
+   middle of a job, or can't be waited for, the worker is retired and
+   the job is reported as lost, so that the caller can retrieve it
+   again.  */
+
+bool
+worker_pool_collect (struct worker_pool *pool, struct worker_result *res)
+{
+  struct worker *w = NULL;
+  struct msgbuf m;
+  int i, n;
+  fd_set fds;
+
+  if (!pool->busy)
+    return false;
+
+  n = workers_select (pool, &fds, -1);
+  for (i = 0; i < pool->size; i++)
+    if (pool->workers[i].busy
+        && (n <= 0 || FD_ISSET (pool->workers[i].result_fd, &fds)))
+      {
+        w = &pool->workers[i];
+        break;
+      }
+  assert (w != NULL);
+
+  xzero (*res);
+  res->cookie = w->cookie;
+  w->busy = false;
+  --pool->busy;
+
+  if (n <= 0)
+    {
+      /* Without select there is no telling which worker is done, so
+         give up on them one by one.  */
+      logprintf (LOG_NOTQUIET, _("Cannot wait for worker process %d: %s\n"),
+                 (int) w->pid, strerror (errno));
+      kill (w->pid, SIGTERM);
+      worker_stop (pool, w);
+      res->lost = true;
+      return true;
+    }
+
+  xzero (m);
+  if (msg_receive (w->result_fd, &m))
+    {
+      int status, numurls_delta;
+      SUM_SIZE_INT bytes_delta;
+      double time_delta;
+
+      if (msg_get_int (&m, &status)
+          && msg_get_int (&m, &res->dt)
+          && msg_get_string (&m, &res->file)
+          && msg_get_string (&m, &res->redirected)
+          && msg_get_iri (&m, &res->iri)
+          && msg_get_int (&m, &numurls_delta)
+          && msg_get (&m, &bytes_delta, sizeof bytes_delta)
+          && msg_get (&m, &time_delta, sizeof time_delta))
+        {
+          res->status = status;
+          numurls += numurls_delta;
+          total_downloaded_bytes += bytes_delta;
+          total_download_time += time_delta;
+          xfree (m.data);
+          return true;
+        }
+    }
+  xfree (m.data);
+
+  /* The worker went away or sent garbage; retire it.  */
+  logprintf (LOG_NOTQUIET, _("Worker process %d exited unexpectedly.\n"),
+             (int) w->pid);
+  worker_stop (pool, w);
+  xfree (res->file);
+  xfree (res->redirected);
+  iri_free (res->iri);
+  res->iri = NULL;
+  res->dt = 0;
+  res->lost = true;
+  return true;
+}
+
+/* Stop all workers and free POOL.  */
+
+void
+worker_pool_delete (struct worker_pool *pool)
+{
+  int i;
+  for (i = 0; i < pool->size; i++)
+    worker_stop (pool, &pool->workers[i]);
+  xfree (pool->workers);
+  xfree (pool);
+}
+
+#else /* WINDOWS || MSDOS */
+
+/* No fork() here; callers fall back to serial retrieval.  */
+
+struct worker_pool *
+worker_pool_new (int count)
+{
+  (void) count;
+  return NULL;
+}
+
+int
+worker_pool_size (const struct worker_pool *pool)
+{
+  (void) pool;
+  return 0;
+}
+
+int
+worker_pool_idle (const struct worker_pool *pool)
+{
+  (void) pool;
+  return 0;
+}
+
+int
+worker_pool_busy (const struct worker_pool *pool)
+{
+  (void) pool;
+  return 0;
+}
+
+bool
+worker_pool_submit (struct worker_pool *pool, const char *url,
+                    const char *referer, struct iri *iri, void *cookie)
+{
+  (void) pool; (void) url; (void) referer; (void) iri; (void) cookie;
+  return false;
+}
+
+bool
+worker_pool_wait (struct worker_pool *pool, double timeout)
+{
+  (void) pool; (void) timeout;
+  return false;
+}
+
+bool
+worker_pool_collect (struct worker_pool *pool, struct worker_result *res)
+{
+  (void) pool; (void) res;
+  return false;
+}
+
+void
+worker_pool_delete (struct worker_pool *pool)
+{
+  (void) pool;
+}
+
+#endif /* WINDOWS || MSDOS */
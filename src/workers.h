@@ -0,0 +1,58 @@
+/* Declarations for workers.c.
+   Copyright (C) 2018 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+struct worker_pool;
+
+/* The outcome of a retrieval performed by a worker, as reported back
+   to the process that submitted it.  */
+struct worker_result {
+  void *cookie;                 /* opaque value passed to worker_pool_submit */
+  uerr_t status;                /* what retrieve_url returned */
+  int dt;                       /* the DT flags set by retrieve_url */
+  char *file;                   /* local file name, or NULL */
+  char *redirected;             /* final URL if redirected, or NULL */
+  struct iri *iri;              /* IRI, updated by the retrieval */
+  bool lost;                    /* the worker went away before it was
+                                   done; nothing else is set */
+};
+
+struct worker_pool *worker_pool_new (int);
+int worker_pool_size (const struct worker_pool *);
+int worker_pool_idle (const struct worker_pool *);
+int worker_pool_busy (const struct worker_pool *);
+bool worker_pool_submit (struct worker_pool *, const char *, const char *,
+                         struct iri *, void *);
+bool worker_pool_wait (struct worker_pool *, double);
+bool worker_pool_collect (struct worker_pool *, struct worker_result *);
+void worker_pool_delete (struct worker_pool *);
+
+#endif /* WORKERS_H */
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from test.base_test import HTTP, HTTPS
+from misc.wget_file import WgetFile
+
+"""
+    Test that --http-pipelining goes on after an error page too large to be
+    skipped in the middle of a batch of pipelined requests.  Wget closes the
+    connection and sends the requests it loses again on a new one, which
+    is no reason to stop pipelining to the server.
+"""
+############# File Definitions ###############################################
+Count = 12
+Index = "<html><body>\n" + \
+        "".join ("<a href=\"/File%d.txt\">text</a>\n" % (i + 1)
+                 for i in range (Count)) + \
+        "</body></html>"
+Error_Page = "Not here. " * 500
+
+Error_Rules = {
+    "Response" : 404
+}
+# By the time File6.txt is requested, the connection Wget opened after the
+# error page is persistent, so the request for File7.txt must follow it
+# without waiting for the response.
+Pipelined_Rules = {
+    "ExpectPipelining" : 2
+}
+
+Index_File = WgetFile ("index.html", Index)
+Text_Files = [WgetFile ("File%d.txt" % (i + 1),
+                        "Contents of file %d\n" % (i + 1))
+              for i in range (Count)]
+Text_Files[2] = WgetFile ("File3.txt", Error_Page, rules=Error_Rules)
+Text_Files[5] = WgetFile ("File6.txt", "Contents of file 6\n",
+                          rules=Pipelined_Rules)
+
+WGET_OPTIONS = "--recursive --no-host-directories --http-pipelining"
+WGET_URLS = [["index.html"]]
+
+Servers = [HTTP]
+
+Files = [[Index_File] + Text_Files]
+Existing_Files = []
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [Index_File] + Text_Files[:2] + Text_Files[3:]
+Request_List = [["GET /index.html",
+                 "GET /robots.txt"] +
+                ["GET /File%d.txt" % (i + 1) for i in range (Count)]]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test,
+                protocols=Servers
+).begin ()
+
+exit (err)
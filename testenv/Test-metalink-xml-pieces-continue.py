@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+from sys import exit
+from misc.metalinkv3_xml import Metalinkv3_XML
+
+"""
+    This is to test that with --segments and --continue, Wget resumes the
+    retrieval of a Metalink/XML file in pieces where an earlier run left it,
+    and gives up on it, keeping the pieces for a later run, when a piece
+    stays corrupt on every mirror.
+
+    The first piece is already there, so only the second one is requested:
+    from each mirror in turn, until it has been tried three times.  Wget
+    doesn't fall back to retrieving the whole file from one mirror after
+    another.
+"""
+
+############# File Definitions ###############################################
+File1 = "".join ("Line %04d of the Tea menu.\n" % i for i in range (70))
+File1_corrupt = File1[:1500] + "X" + File1[1501:]
+File1_partial = File1[:1024] + "-" * (len (File1) - 1024)
+
+State = "url File1\n" + \
+        "length %d\n" % len (File1) + \
+        "piece 0 1023 1024\n" + \
+        "piece 1024 %d 0\n" % (len (File1) - 1)
+
+############# Metalink/XML ###################################################
+Meta = Metalinkv3_XML()
+
+XmlName = "test.metalink"
+
+Meta.PieceLength = 1024
+
+Meta.add_LocalFiles (
+    ["File1", File1_partial],
+    ["File1.wget-segments", State],
+)
+
+Meta.xml (
+    # Metalink/XML file name
+    XmlName,
+    # file_name, save_name, content, size, hash_sha256
+    ["File1", None, File1, True, True,
+     # srv_file, srv_content, utype, location, preference
+     ["File1", File1_corrupt, "http", None, 50],
+     ["File1_mirror", File1_corrupt, "http", None, 40]],
+)
+
+# The pieces that arrived are kept, even the corrupt one.
+Meta.add_ExpectedFiles (
+    ["File1", File1_corrupt],
+    ["File1.wget-segments", State],
+)
+
+Meta.RangesRequested = [
+    "GET /File1 bytes=1024-%d" % (len (File1) - 1),
+    "GET /File1_mirror bytes=1024-%d" % (len (File1) - 1),
+    "GET /File1 bytes=1024-%d" % (len (File1) - 1),
+]
+
+Meta.print_meta ()
+
+err = Meta.http_test (
+    "--trust-server-names --segments=2 --no-http-keep-alive --continue " + \
+    "--input-metalink " + XmlName, 1
+)
+
+exit (err)
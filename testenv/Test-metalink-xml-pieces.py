@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+
+from sys import exit
+from misc.metalinkv3_xml import Metalinkv3_XML
+
+"""
+    This is to test that with --segments, Wget retrieves a Metalink/XML
+    file in pieces from two mirrors, checks each piece against its piece
+    hash, and fetches a corrupt piece again from the other mirror.
+
+    Of the two pieces, the first is requested from the preferred mirror and
+    the second from the other one, which corrupts it.  Only the second piece
+    may be requested again, from the preferred mirror.  The test server
+    handles one connection at a time, so keep-alive is turned off to let the
+    connections take turns.
+"""
+
+############# File Definitions ###############################################
+File1 = "".join ("Line %04d of the Tea menu.\n" % i for i in range (70))
+File1_corrupt = File1[:1500] + "X" + File1[1501:]
+
+############# Metalink/XML ###################################################
+Meta = Metalinkv3_XML()
+
+XmlName = "test.metalink"
+
+Meta.PieceLength = 1024
+
+Meta.xml (
+    # Metalink/XML file name
+    XmlName,
+    # file_name, save_name, content, size, hash_sha256
+    ["File1", "File1", File1, True, True,
+     # srv_file, srv_content, utype, location, preference
+     ["File1", File1, "http", None, 50],
+     ["File1_corrupt", File1_corrupt, "http", None, 40]],
+)
+
+Meta.RangesRequested = [
+    "GET /File1 bytes=0-1023",
+    "GET /File1_corrupt bytes=1024-%d" % (len (File1) - 1),
+    "GET /File1 bytes=1024-%d" % (len (File1) - 1),
+]
+
+Meta.print_meta ()
+
+err = Meta.http_test (
+    "--trust-server-names --segments=2 --no-http-keep-alive " + \
+    "--input-metalink " + XmlName, 0
+)
+
+exit (err)
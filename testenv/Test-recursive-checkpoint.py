@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+from sys import exit
+import os
+import shutil
+import tempfile
+from test.http_test import HTTPTest
+from test.base_test import HTTP, HTTPS
+from misc.wget_file import WgetFile
+from server.http.http_server import HTTPd
+
+"""
+    Test --checkpoint and --resume-crawl.  The first run is stopped by
+    --quota after the first page, leaving a checkpoint with the links of
+    that page queued.  Resuming from it retrieves the rest of the pages
+    without requesting the first one again, and resuming once more, from
+    the checkpoint of the completed retrieval, requests nothing at all.
+
+    The checkpoint is kept outside of the test directory, which is made
+    anew for every run, and the server listens on the same port every
+    time, so that the start URL stays the same.
+"""
+############# File Definitions ###############################################
+Index = """<html><body>
+<a href=\"/File1.html\">text</a>
+<a href=\"/File2.html\">text</a>
+</body></html>"""
+File1 = """<html><body>
+<a href=\"/File3.txt\">text</a>
+<a href=\"/index.html\">text</a>
+</body></html>"""
+File2 = "With lemon or cream?"
+File3 = "Surely you're joking Mr. Feynman"
+
+Index_File = WgetFile ("index.html", Index)
+File1_File = WgetFile ("File1.html", File1)
+File2_File = WgetFile ("File2.html", File2)
+File3_File = WgetFile ("File3.txt", File3)
+
+Files = [[Index_File, File1_File, File2_File, File3_File]]
+
+Checkpoint_Dir = tempfile.mkdtemp ()
+Checkpoint = os.path.join (Checkpoint_Dir, "crawl.checkpoint")
+
+WGET_OPTIONS = "--recursive --no-host-directories --checkpoint=" + Checkpoint
+WGET_URLS = [["index.html"]]
+
+Servers = [HTTP]
+
+class CheckpointTest (HTTPTest):
+    """ An HTTPTest whose server listens on the port of the first run. """
+
+    address = None
+
+    def instantiate_server_by (self, protocol):
+        server = HTTPd (CheckpointTest.address)
+        CheckpointTest.address = server.server_address
+        server.start ()
+        return server
+
+    def stop_server (self):
+        super (CheckpointTest, self).stop_server ()
+        for server in self.servers:
+            server.server_inst.server_close ()
+
+def run (options, local_files, expected_files, request_list, retcode):
+    pre_test = {
+        "ServerFiles"       : Files,
+        "LocalFiles"        : local_files
+    }
+    test_options = {
+        "WgetCommands"      : WGET_OPTIONS + options,
+        "Urls"              : WGET_URLS
+    }
+    post_test = {
+        "ExpectedFiles"     : expected_files,
+        "ExpectedRetcode"   : retcode,
+        "FilesCrawled"      : request_list
+    }
+    return CheckpointTest (
+                    pre_hook=pre_test,
+                    test_params=test_options,
+                    post_hook=post_test,
+                    protocols=Servers
+    ).begin ()
+
+All_Files = [Index_File, File1_File, File2_File, File3_File]
+
+# A failed run raises an exception, which ends the test.
+try:
+    # Stop after the first page.
+    run (" --quota=1", [], [Index_File],
+         [["GET /index.html", "GET /robots.txt"]], 0)
+
+    # Continue with its links, which are in the checkpoint.  The robots.txt
+    # isn't part of it.
+    run (" --resume-crawl", [Index_File], All_Files,
+         [["GET /File1.html",
+           "GET /robots.txt",
+           "GET /File2.html",
+           "GET /File3.txt"]], 0)
+
+    # The retrieval is complete.
+    err = run (" --resume-crawl", All_Files, All_Files, [[]], 0)
+finally:
+    shutil.rmtree (Checkpoint_Dir)
+
+exit (err)
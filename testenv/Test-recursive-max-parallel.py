@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from test.base_test import HTTP, HTTPS
+from misc.wget_file import WgetFile
+
+"""
+    Test that --recursive with --max-parallel retrieves the same files as
+    a serial run, and converts their links the same way with -k.  The test
+    server handles one connection at a time, so keep-alive is turned off
+    to let the workers take turns.
+"""
+############# File Definitions ###############################################
+Index = """<html><body>
+<a href=\"/a/File1.html\">text</a>
+<a href=\"/a/File2.html\">text</a>
+<a href=\"/b/File3.html\">text</a>
+<a href=\"/b/File4.html\">text</a>
+</body></html>"""
+File1 = """<html><body>
+<a href=\"/a/File2.html\">text</a>
+<a href=\"/c/File5.html\">text</a>
+<img src=\"/c/image.png\">
+</body></html>"""
+File2 = """<html><body>
+<a href=\"/c/File6.html\">text</a>
+<a href=\"/index.html\">text</a>
+</body></html>"""
+File3 = "With lemon or cream?"
+File4 = """<html><body>
+<a href=\"/c/File5.html\">text</a>
+<a href=\"/c/File7.html\">text</a>
+</body></html>"""
+File5 = "Surely you're joking Mr. Feynman"
+File6 = "What do you care what other people think?"
+File7 = "The pleasure of finding things out"
+Image = "not really a PNG"
+
+Index_Converted = """<html><body>
+<a href="a/File1.html">text</a>
+<a href="a/File2.html">text</a>
+<a href="b/File3.html">text</a>
+<a href="b/File4.html">text</a>
+</body></html>"""
+File1_Converted = """<html><body>
+<a href="File2.html">text</a>
+<a href="../c/File5.html">text</a>
+<img src="../c/image.png">
+</body></html>"""
+File2_Converted = """<html><body>
+<a href="../c/File6.html">text</a>
+<a href="../index.html">text</a>
+</body></html>"""
+File4_Converted = """<html><body>
+<a href="../c/File5.html">text</a>
+<a href="../c/File7.html">text</a>
+</body></html>"""
+
+Index_File = WgetFile ("index.html", Index)
+File1_File = WgetFile ("a/File1.html", File1)
+File2_File = WgetFile ("a/File2.html", File2)
+File3_File = WgetFile ("b/File3.html", File3)
+File4_File = WgetFile ("b/File4.html", File4)
+File5_File = WgetFile ("c/File5.html", File5)
+File6_File = WgetFile ("c/File6.html", File6)
+File7_File = WgetFile ("c/File7.html", File7)
+Image_File = WgetFile ("c/image.png", Image)
+
+WGET_OPTIONS = "--recursive --level=2 --no-host-directories --convert-links " \
+               "--max-parallel=3 --no-http-keep-alive"
+WGET_URLS = [["index.html"]]
+
+Servers = [HTTP]
+
+Files = [[Index_File, File1_File, File2_File, File3_File, File4_File,
+          File5_File, File6_File, File7_File, Image_File]]
+Existing_Files = []
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [WgetFile ("index.html", Index_Converted),
+                           WgetFile ("a/File1.html", File1_Converted),
+                           WgetFile ("a/File2.html", File2_Converted),
+                           File3_File,
+                           WgetFile ("b/File4.html", File4_Converted),
+                           File5_File, File6_File, File7_File, Image_File]
+# The order of the requests is up to the workers.
+Request_List = [["GET /index.html",
+                 "GET /robots.txt",
+                 "GET /a/File1.html",
+                 "GET /a/File2.html",
+                 "GET /b/File3.html",
+                 "GET /b/File4.html",
+                 "GET /c/File5.html",
+                 "GET /c/File6.html",
+                 "GET /c/File7.html",
+                 "GET /c/image.png"]]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test,
+                protocols=Servers
+).begin ()
+
+exit (err)
@@ -0,0 +1,14 @@
+from conf import rule
+
+""" Rule: ExpectPipelining
+This rule makes the server check that, by the time it responds to a request
+for the file to which the rule was applied, the client has already sent the
+next request on the same connection. The value is the number of seconds to
+wait for that request.
+"""
+
+
+@rule()
+class ExpectPipelining:
+    def __init__(self, timeout):
+        self.timeout = timeout
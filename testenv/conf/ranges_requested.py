@@ -0,0 +1,23 @@
+from misc.colour_terminal import print_red
+from conf import hook
+from exc.test_failed import TestFailed
+
+""" Post-Test Hook: RangesRequested
+This is a post test hook for tests of segmented and Metalink downloads. It
+expects a list of the Range requests that the server must receive, each as the
+request line followed by the value of the Range header. The order is
+unimportant, but a range requested twice must be listed twice.
+"""
+
+
+@hook()
+class RangesRequested:
+    def __init__(self, ranges):
+        self.ranges = ranges
+
+    def __call__(self, test_obj):
+        for ranges, received in zip(self.ranges,
+                                    test_obj.ranges_requested()):
+            if sorted(ranges) != sorted(received):
+                print_red(str(sorted(received)))
+                raise TestFailed('Not the expected ranges were requested.')
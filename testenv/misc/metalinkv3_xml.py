@@ -21,6 +21,8 @@ class Metalinkv3_XML:
         self.Xml = ''               # Metalink/XML content
         self.XmlName = ''           # Metalink/XML file name
         self.XmlFile = None         # Metalink/XML WgetFile object
+        self.PieceLength = None     # length of the pieces with a sha1 hash
+        self.RangesRequested = None # ranges the server must be asked for
         self.Xml_Header = '<?xml version="1.0" encoding="utf-8"?>\n' + \
                           '<metalink version="3.0" xmlns="http://www.metalinker.org/">\n' + \
                           '  <publisher>\n' + \
@@ -96,6 +98,9 @@ class Metalinkv3_XML:
             "ExpectedRetcode" : expected_retcode,   # Wget return status code
         }
 
+        if self.RangesRequested is not None:
+            post_test["RangesRequested"] = [self.RangesRequested]
+
         http_test = HTTPTest (
             pre_hook=pre_test,
             test_params=test_options,
@@ -230,7 +235,8 @@ class Metalinkv3_XML:
 
         return Tag
 
-    # Create the verification tag.
+    # Create the verification tag, with the piece hashes of the content if
+    # PieceLength is set.
     #
     # hash_sha256:
     #   False    no <verification></verification>
@@ -250,13 +256,35 @@ class Metalinkv3_XML:
             if content is not None and hash_sha256 is True:
                 hash_sha256 = hashlib.sha256 (content.encode ('UTF-8')).hexdigest ()
 
-            if hash_sha256 is None:
-                Tag = '      <verification>\n' + \
-                      '      </verification>'
-            else:
-                Tag = '      <verification>\n' + \
-                      '        <hash type="sha256">' + str (hash_sha256) + '</hash>\n' + \
-                      '      </verification>'
+            Tag = '      <verification>\n'
+
+            if hash_sha256 is not None:
+                Tag += '        <hash type="sha256">' + str (hash_sha256) + '</hash>\n'
+
+            if content is not None and self.PieceLength is not None:
+                Tag += self.pieces_tag (content) + '\n'
+
+            Tag += '      </verification>'
+
+        return Tag
+
+    # Create the pieces tag: the sha1 hashes of the content, PieceLength
+    # bytes at a time.
+    #
+    # ARGUMENTS:
+    #
+    # "content"
+    def pieces_tag (self, content):
+
+        data = content.encode ('UTF-8')
+
+        Tag = '        <pieces type="sha1" length="' + str (self.PieceLength) + '">\n'
+
+        for piece, start in enumerate (range (0, len (data), self.PieceLength)):
+            piece_hash = hashlib.sha1 (data[start:start + self.PieceLength]).hexdigest ()
+            Tag += '          <hash piece="' + str (piece) + '">' + piece_hash + '</hash>\n'
+
+        Tag += '        </pieces>'
 
         return Tag
 
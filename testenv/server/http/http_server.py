@@ -6,6 +6,7 @@ from base64 import b64encode
 from random import random
 from hashlib import md5
 import threading
+import select
 import socket
 import os
 
@@ -18,6 +19,7 @@ class StoppableHTTPServer(HTTPServer):
     method. """
 
     request_headers = list()
+    request_ranges = list()
 
     """ Define methods for configuring the Server. """
 
@@ -25,10 +27,17 @@ class StoppableHTTPServer(HTTPServer):
         """ Set Server Rules and File System for this instance. """
         self.server_configs = conf_dict
         self.fileSys = filelist
+        # Log the requests of this instance only, for the tests that run
+        # Wget more than once.
+        self.request_headers = list()
+        self.request_ranges = list()
 
     def get_req_headers(self):
         return self.request_headers
 
+    def get_req_ranges(self):
+        return self.request_ranges
+
 
 class HTTPSServer(StoppableHTTPServer):
     """ The HTTPSServer class extends the StoppableHTTPServer class with
@@ -81,14 +90,16 @@ class _Handler(BaseHTTPRequestHandler):
         """ Process HTTP GET requests. This is the same as processing HEAD
         requests and then actually transmitting the data to the client. If
         send_head() does not specify any "start" offset, we send the complete
-        data, else transmit only partial data. """
+        data, else transmit only partial data, up to self.range_stop if the
+        range requested had an end. """
 
+        self.range_stop = None
         content, start = self.send_head("GET")
         if content:
             if start is None:
                 self.wfile.write(content.encode('utf-8'))
             else:
-                self.wfile.write(content.encode('utf-8')[start:])
+                self.wfile.write(content.encode('utf-8')[start:self.range_stop])
 
     def do_POST(self):
         """ According to RFC 7231 sec 4.3.3, if the resource requested in a POST
@@ -139,17 +150,25 @@ class _Handler(BaseHTTPRequestHandler):
     """ Helper functions for the Handlers. """
 
     def parse_range_header(self, header_line, length):
+        """ Return the first byte of the range requested by header_line, and
+        the byte after its last one, or None if the range is open-ended. """
         import re
         if header_line is None:
-            return None
-        if not header_line.startswith("bytes="):
+            return None, None
+        regex = re.match(r"^bytes=(\d+)\-(\d*)$", header_line)
+        if regex is None:
             raise ServerError("Cannot parse header Range: %s" %
                               (header_line))
-        regex = re.match(r"^bytes=(\d*)\-$", header_line)
         range_start = int(regex.group(1))
         if range_start >= length:
             raise ServerError("Range Overflow")
-        return range_start
+        if not regex.group(2):
+            return range_start, None
+        range_end = int(regex.group(2))
+        if range_end < range_start:
+            raise ServerError("Cannot parse header Range: %s" %
+                              (header_line))
+        return range_start, min(range_end + 1, length)
 
     def get_body_data(self):
         cLength_header = self.headers.get("Content-Length")
@@ -370,9 +389,26 @@ class _Handler(BaseHTTPRequestHandler):
                                 header_line)
                 raise ServerError("Header " + header_line + ' received')
 
+    def ExpectPipelining(self, pipe_obj):
+        # The next request may have been read into our buffer already.
+        self.connection.setblocking(False)
+        try:
+            pending = self.rfile.peek(1)
+        finally:
+            self.connection.setblocking(True)
+        if not pending:
+            pending, _, _ = select.select([self.connection], [], [],
+                                          pipe_obj.timeout)
+        if not pending:
+            self.send_error(400, "Expected a pipelined request")
+            raise ServerError("No request was pipelined after " + self.path)
+
     def __log_request(self, method):
         req = method + " " + self.path
         self.server.request_headers.append(req)
+        if self.headers.get("Range") is not None:
+            self.server.request_ranges.append(req + " " +
+                                              self.headers.get("Range"))
 
     def send_head(self, method):
         """ Common code for GET and HEAD Commands.
@@ -419,7 +455,7 @@ class _Handler(BaseHTTPRequestHandler):
                     return(content, None)
 
             try:
-                self.range_begin = self.parse_range_header(
+                self.range_begin, self.range_stop = self.parse_range_header(
                     self.headers.get("Range"), content_length)
             except ServerError as ae:
                 # self.log_error("%s", ae.err_message)
@@ -442,11 +478,12 @@ class _Handler(BaseHTTPRequestHandler):
             else:
                 self.send_response(206)
                 self.add_header("Accept-Ranges", "bytes")
+                range_stop = self.range_stop or content_length
                 self.add_header("Content-Range",
                                 "bytes %d-%d/%d" % (self.range_begin,
-                                                    content_length - 1,
+                                                    range_stop - 1,
                                                     content_length))
-                content_length -= self.range_begin
+                content_length = range_stop - self.range_begin
             cont_type = self.guess_type(path)
             self.add_header("Content-Type", cont_type)
             self.add_header("Content-Length", content_length)
@@ -55,6 +55,10 @@ class HTTPTest(BaseTest):
         return [s.server_inst.get_req_headers()
                 for s in self.servers]
 
+    def ranges_requested(self):
+        return [s.server_inst.get_req_ranges()
+                for s in self.servers]
+
     def stop_server(self):
         for server in self.servers:
             server.server_inst.shutdown()
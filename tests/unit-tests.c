@@ -50,6 +50,7 @@ all_tests(void)
 #endif
   mu_run_test (test_parse_content_disposition);
   mu_run_test (test_parse_range_header);
+  mu_run_test (test_chunk_decode);
   mu_run_test (test_subdir_p);
   mu_run_test (test_dir_matches_p);
   mu_run_test (test_commands_sorted);
@@ -58,6 +59,13 @@ all_tests(void)
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
   mu_run_test (test_is_robots_txt_url);
+  mu_run_test (test_crawl_delay);
+  mu_run_test (test_dns_negative_cache);
+  mu_run_test (test_hash_table);
+  mu_run_test (test_reactor);
+  mu_run_test (test_known_names);
+  mu_run_test (test_url_set);
+  mu_run_test (test_url_queue);
 #ifdef HAVE_HSTS
   mu_run_test (test_hsts_new_entry);
   mu_run_test (test_hsts_url_rewrite_superdomain);
@@ -48,14 +48,22 @@ const char *test_find_key_value (void);
 const char *test_find_key_values (void);
 const char *test_parse_content_disposition(void);
 const char *test_parse_range_header(void);
+const char *test_chunk_decode(void);
 const char *test_commands_sorted(void);
 const char *test_cmd_spec_restrict_file_names(void);
 const char *test_is_robots_txt_url(void);
+const char *test_crawl_delay(void);
 const char *test_path_simplify (void);
 const char *test_append_uri_pathel(void);
 const char *test_are_urls_equal(void);
 const char *test_subdir_p(void);
 const char *test_dir_matches_p(void);
+const char *test_dns_negative_cache(void);
+const char *test_hash_table(void);
+const char *test_reactor(void);
+const char *test_known_names(void);
+const char *test_url_set(void);
+const char *test_url_queue(void);
 const char *test_hsts_new_entry(void);
 const char *test_hsts_url_rewrite_superdomain(void);
 const char *test_hsts_url_rewrite_congruent(void);
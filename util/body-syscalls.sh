@@ -0,0 +1,69 @@
+#!/bin/sh
+# body-syscalls.sh: Count the read and write system calls Wget makes per
+# megabyte of downloaded data.
+#
+# Copyright (C) 2018 Free Software Foundation, Inc.
+#
+# Copying and distribution of this file, with or without modification,
+# are permitted in any medium without royalty provided the copyright
+# notice and this notice are preserved.
+#
+# Usage: body-syscalls.sh [-n runs] wget-binary url [wget-options...]
+#
+# The document is retrieved RUNS times (default 3) into a scratch
+# directory and the average counts are printed.  Use a large document
+# on a fast local server, so that the body dominates the counts, and
+# run the script against two builds to compare them.  Linux only: the
+# counts are taken from /proc/PID/io, which includes reaped children.
+
+runs=3
+if [ "$1" = "-n" ]; then
+  runs=$2
+  shift 2
+fi
+if [ $# -lt 2 ]; then
+  echo "usage: $0 [-n runs] wget-binary url [wget-options...]" >&2
+  exit 2
+fi
+wget=$1
+shift
+
+if [ ! -r /proc/$$/io ]; then
+  echo "$0: /proc/$$/io is not available" >&2
+  exit 1
+fi
+
+# Set SYSCR and SYSCW from this shell's counters, using builtins only
+# so that the measurement itself doesn't add up.
+counters ()
+{
+  while read key value; do
+    case $key in
+      syscr:) syscr=$value ;;
+      syscw:) syscw=$value ;;
+    esac
+  done < /proc/$$/io
+}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+reads=0 writes=0 bytes=0 i=0
+while [ $i -lt $runs ]; do
+  rm -f "$dir"/*
+  counters
+  r0=$syscr w0=$syscw
+  "$wget" -q -O "$dir/body" "$@" || { echo "$0: $wget failed" >&2; exit 1; }
+  counters
+  reads=$((reads + syscr - r0))
+  writes=$((writes + syscw - w0))
+  bytes=$((bytes + $(wc -c < "$dir/body")))
+  i=$((i + 1))
+done
+
+awk -v r=$reads -v w=$writes -v b=$bytes -v n=$runs 'BEGIN {
+  mb = b / 1048576;
+  printf "%.1f MB per run, %d runs\n", mb / n, n;
+  printf "read:  %8.0f per run, %8.1f per MB\n", r / n, r / mb;
+  printf "write: %8.0f per run, %8.1f per MB\n", w / n, w / mb;
+}'